@@ -120,6 +120,182 @@ struct att_data_list *att_data_list_alloc(uint16_t num, uint16_t len)
 	return list;
 }
 
+uint16_t att_iter_init(struct att_iter *iter, const uint8_t *pdu, size_t len)
+{
+	uint16_t elen, offset = 2;
+
+	if (pdu == NULL || len < 2)
+		return 0;
+
+	switch (pdu[0]) {
+	case ATT_OP_READ_BY_TYPE_RESP:
+		elen = pdu[1];
+		/* Handle followed by the attribute value */
+		if (elen < 2)
+			return 0;
+		break;
+	case ATT_OP_READ_BY_GROUP_RESP:
+		elen = pdu[1];
+		/* Handle and end group handle followed by the value */
+		if (elen < 4)
+			return 0;
+		break;
+	case ATT_OP_FIND_INFO_RESP:
+		if (pdu[1] == ATT_FIND_INFO_RESP_FMT_16BIT)
+			elen = 4;
+		else if (pdu[1] == ATT_FIND_INFO_RESP_FMT_128BIT)
+			elen = 18;
+		else
+			return 0;
+		break;
+	case ATT_OP_FIND_BY_TYPE_RESP:
+		elen = 4;
+		offset = 1;
+		break;
+	default:
+		return 0;
+	}
+
+	/* Trailing bytes not forming a complete entry are ignored */
+	iter->ptr = &pdu[offset];
+	iter->end = iter->ptr + (len - offset) / elen * elen;
+	iter->len = elen;
+
+	return elen;
+}
+
+const uint8_t *att_iter_next(struct att_iter *iter)
+{
+	const uint8_t *entry;
+
+	if (iter->end - iter->ptr < iter->len)
+		return NULL;
+
+	entry = iter->ptr;
+	iter->ptr += iter->len;
+
+	return entry;
+}
+
+void att_list_init(struct att_list *list, uint8_t opcode, uint8_t *pdu,
+								size_t len)
+{
+	list->pdu = pdu;
+	list->size = pdu ? len : 0;
+	list->len = 0;
+
+	if (opcode == ATT_OP_FIND_BY_TYPE_RESP)
+		list->offset = 1;
+	else
+		list->offset = 2;
+
+	if (list->size > 0)
+		pdu[0] = opcode;
+}
+
+uint8_t *att_list_append(struct att_list *list, uint16_t len)
+{
+	uint8_t *entry;
+	uint8_t header;
+
+	if (len == 0)
+		return NULL;
+
+	if (list->len != 0 && list->len != len)
+		return NULL;
+
+	if (list->offset + len > list->size)
+		return NULL;
+
+	if (list->len == 0) {
+		switch (list->pdu[0]) {
+		case ATT_OP_READ_BY_TYPE_RESP:
+		case ATT_OP_READ_BY_GROUP_RESP:
+			if (len > UINT8_MAX)
+				return NULL;
+			header = len;
+			break;
+		case ATT_OP_FIND_INFO_RESP:
+			if (len == 4)
+				header = ATT_FIND_INFO_RESP_FMT_16BIT;
+			else if (len == 18)
+				header = ATT_FIND_INFO_RESP_FMT_128BIT;
+			else
+				return NULL;
+			break;
+		case ATT_OP_FIND_BY_TYPE_RESP:
+			if (len != 4)
+				return NULL;
+			header = 0;
+			break;
+		default:
+			return NULL;
+		}
+
+		if (list->offset == 2)
+			list->pdu[1] = header;
+
+		list->len = len;
+	}
+
+	entry = &list->pdu[list->offset];
+	list->offset += len;
+
+	return entry;
+}
+
+uint16_t att_list_finish(struct att_list *list)
+{
+	if (list->len == 0)
+		return 0;
+
+	return list->offset;
+}
+
+static struct att_data_list *dec_list(uint8_t opcode, const uint8_t *pdu,
+								size_t len)
+{
+	struct att_data_list *list;
+	struct att_iter iter;
+	const uint8_t *entry;
+	int i;
+
+	if (att_iter_init(&iter, pdu, len) == 0 || pdu[0] != opcode)
+		return NULL;
+
+	list = att_data_list_alloc((iter.end - iter.ptr) / iter.len, iter.len);
+	if (list == NULL)
+		return NULL;
+
+	for (i = 0; (entry = att_iter_next(&iter)) != NULL; i++)
+		memcpy(list->data[i], entry, list->len);
+
+	return list;
+}
+
+static uint16_t enc_list(uint8_t opcode, struct att_data_list *list,
+					uint16_t elen, uint8_t *pdu, size_t len)
+{
+	struct att_list out;
+	uint8_t *entry;
+	int i;
+
+	if (pdu == NULL || list == NULL)
+		return 0;
+
+	att_list_init(&out, opcode, pdu, len);
+
+	for (i = 0; i < list->num; i++) {
+		entry = att_list_append(&out, elen);
+		if (entry == NULL)
+			break;
+
+		memcpy(entry, list->data[i], elen);
+	}
+
+	return att_list_finish(&out);
+}
+
 uint16_t enc_read_by_grp_req(uint16_t start, uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, size_t len)
 {
@@ -178,54 +354,15 @@ uint16_t dec_read_by_grp_req(const uint8_t *pdu, size_t len, uint16_t *start,
 uint16_t enc_read_by_grp_resp(struct att_data_list *list, uint8_t *pdu,
 								size_t len)
 {
-	int i;
-	uint16_t w;
-	uint8_t *ptr;
-
 	if (list == NULL)
 		return 0;
 
-	if (len < list->len + sizeof(uint8_t) * 2)
-		return 0;
-
-	pdu[0] = ATT_OP_READ_BY_GROUP_RESP;
-	pdu[1] = list->len;
-
-	ptr = &pdu[2];
-
-	for (i = 0, w = 2; i < list->num && w + list->len <= len; i++) {
-		memcpy(ptr, list->data[i], list->len);
-		ptr += list->len;
-		w += list->len;
-	}
-
-	return w;
+	return enc_list(ATT_OP_READ_BY_GROUP_RESP, list, list->len, pdu, len);
 }
 
 struct att_data_list *dec_read_by_grp_resp(const uint8_t *pdu, size_t len)
 {
-	struct att_data_list *list;
-	const uint8_t *ptr;
-	uint16_t elen, num;
-	int i;
-
-	if (pdu[0] != ATT_OP_READ_BY_GROUP_RESP)
-		return NULL;
-
-	elen = pdu[1];
-	num = (len - 2) / elen;
-	list = att_data_list_alloc(num, elen);
-	if (list == NULL)
-		return NULL;
-
-	ptr = &pdu[2];
-
-	for (i = 0; i < num; i++) {
-		memcpy(list->data[i], ptr, list->len);
-		ptr += list->len;
-	}
-
-	return list;
+	return dec_list(ATT_OP_READ_BY_GROUP_RESP, pdu, len);
 }
 
 uint16_t enc_find_by_type_req(uint16_t start, uint16_t end, bt_uuid_t *uuid,
@@ -306,44 +443,44 @@ uint16_t dec_find_by_type_req(const uint8_t *pdu, size_t len, uint16_t *start,
 
 uint16_t enc_find_by_type_resp(GSList *matches, uint8_t *pdu, size_t len)
 {
+	struct att_list list;
+	uint8_t *entry;
 	GSList *l;
-	uint16_t offset;
 
 	if (pdu == NULL || len < 5)
 		return 0;
 
-	pdu[0] = ATT_OP_FIND_BY_TYPE_RESP;
+	att_list_init(&list, ATT_OP_FIND_BY_TYPE_RESP, pdu, len);
 
-	for (l = matches, offset = 1;
-				l && len >= (offset + sizeof(uint16_t) * 2);
-				l = l->next, offset += sizeof(uint16_t) * 2) {
+	for (l = matches; l; l = l->next) {
 		struct att_range *range = l->data;
 
-		att_put_u16(range->start, &pdu[offset]);
-		att_put_u16(range->end, &pdu[offset + 2]);
+		entry = att_list_append(&list, sizeof(uint16_t) * 2);
+		if (entry == NULL)
+			break;
+
+		att_put_u16(range->start, entry);
+		att_put_u16(range->end, &entry[2]);
 	}
 
-	return offset;
+	return att_list_finish(&list);
 }
 
 GSList *dec_find_by_type_resp(const uint8_t *pdu, size_t len)
 {
 	struct att_range *range;
-	GSList *matches;
-	off_t offset;
-
-	if (pdu == NULL || len < 5)
-		return NULL;
+	struct att_iter iter;
+	const uint8_t *entry;
+	GSList *matches = NULL;
 
-	if (pdu[0] != ATT_OP_FIND_BY_TYPE_RESP)
+	if (att_iter_init(&iter, pdu, len) == 0 ||
+				pdu[0] != ATT_OP_FIND_BY_TYPE_RESP)
 		return NULL;
 
-	for (offset = 1, matches = NULL;
-				len >= (offset + sizeof(uint16_t) * 2);
-				offset += sizeof(uint16_t) * 2) {
+	while ((entry = att_iter_next(&iter)) != NULL) {
 		range = g_new0(struct att_range, 1);
-		range->start = att_get_u16(&pdu[offset]);
-		range->end = att_get_u16(&pdu[offset + 2]);
+		range->start = att_get_u16(entry);
+		range->end = att_get_u16(&entry[2]);
 
 		matches = g_slist_append(matches, range);
 	}
@@ -410,54 +547,16 @@ uint16_t dec_read_by_type_req(const uint8_t *pdu, size_t len, uint16_t *start,
 uint16_t enc_read_by_type_resp(struct att_data_list *list, uint8_t *pdu,
 								size_t len)
 {
-	uint8_t *ptr;
-	size_t i, w, l;
-
-	if (list == NULL)
+	if (list == NULL || len < 2)
 		return 0;
 
-	if (pdu == NULL)
-		return 0;
-
-	l = MIN(len - 2, list->len);
-
-	pdu[0] = ATT_OP_READ_BY_TYPE_RESP;
-	pdu[1] = l;
-	ptr = &pdu[2];
-
-	for (i = 0, w = 2; i < list->num && w + l <= len; i++) {
-		memcpy(ptr, list->data[i], l);
-		ptr += l;
-		w += l;
-	}
-
-	return w;
+	return enc_list(ATT_OP_READ_BY_TYPE_RESP, list, MIN(len - 2, list->len),
+								pdu, len);
 }
 
 struct att_data_list *dec_read_by_type_resp(const uint8_t *pdu, size_t len)
 {
-	struct att_data_list *list;
-	const uint8_t *ptr;
-	uint16_t elen, num;
-	int i;
-
-	if (pdu[0] != ATT_OP_READ_BY_TYPE_RESP)
-		return NULL;
-
-	elen = pdu[1];
-	num = (len - 2) / elen;
-	list = att_data_list_alloc(num, elen);
-	if (list == NULL)
-		return NULL;
-
-	ptr = &pdu[2];
-
-	for (i = 0; i < num; i++) {
-		memcpy(list->data[i], ptr, list->len);
-		ptr += list->len;
-	}
-
-	return list;
+	return dec_list(ATT_OP_READ_BY_TYPE_RESP, pdu, len);
 }
 
 uint16_t enc_write_cmd(uint16_t handle, const uint8_t *value, size_t vlen,
@@ -779,67 +878,31 @@ uint16_t dec_find_info_req(const uint8_t *pdu, size_t len, uint16_t *start,
 uint16_t enc_find_info_resp(uint8_t format, struct att_data_list *list,
 							uint8_t *pdu, size_t len)
 {
-	uint8_t *ptr;
-	size_t i, w;
-
-	if (pdu == NULL)
-		return 0;
-
 	if (list == NULL)
 		return 0;
 
-	if (len < list->len + sizeof(uint8_t) * 2)
+	if (format == ATT_FIND_INFO_RESP_FMT_16BIT && list->len != 4)
 		return 0;
 
-	pdu[0] = ATT_OP_FIND_INFO_RESP;
-	pdu[1] = format;
-	ptr = (void *) &pdu[2];
-
-	for (i = 0, w = 2; i < list->num && w + list->len <= len; i++) {
-		memcpy(ptr, list->data[i], list->len);
-		ptr += list->len;
-		w += list->len;
-	}
+	if (format == ATT_FIND_INFO_RESP_FMT_128BIT && list->len != 18)
+		return 0;
 
-	return w;
+	return enc_list(ATT_OP_FIND_INFO_RESP, list, list->len, pdu, len);
 }
 
 struct att_data_list *dec_find_info_resp(const uint8_t *pdu, size_t len,
 							uint8_t *format)
 {
 	struct att_data_list *list;
-	uint8_t *ptr;
-	uint16_t elen, num;
-	int i;
-
-	if (pdu == NULL)
-		return 0;
 
 	if (format == NULL)
-		return 0;
-
-	if (pdu[0] != ATT_OP_FIND_INFO_RESP)
-		return 0;
-
-	*format = pdu[1];
-	elen = sizeof(pdu[0]) + sizeof(*format);
-	if (*format == 0x01)
-		elen += 2;
-	else if (*format == 0x02)
-		elen += 16;
-
-	num = (len - 2) / elen;
-
-	ptr = (void *) &pdu[2];
+		return NULL;
 
-	list = att_data_list_alloc(num, elen);
+	list = dec_list(ATT_OP_FIND_INFO_RESP, pdu, len);
 	if (list == NULL)
 		return NULL;
 
-	for (i = 0; i < num; i++) {
-		memcpy(list->data[i], ptr, list->len);
-		ptr += list->len;
-	}
+	*format = pdu[1];
 
 	return list;
 }
@@ -1036,7 +1099,7 @@ uint16_t dec_prep_write_resp(const uint8_t *pdu, size_t len, uint16_t *handle,
 	if (len < min_len)
 		return 0;
 
-	if (pdu[0] != ATT_OP_PREP_WRITE_REQ)
+	if (pdu[0] != ATT_OP_PREP_WRITE_RESP)
 		return 0;
 
 	*handle = att_get_u16(&pdu[1]);
@@ -111,6 +111,27 @@ struct att_range {
 	uint16_t end;
 };
 
+/*
+ * Walks the entries of a Read By Type, Read By Group Type, Find
+ * Information or Find By Type Value response in place.
+ */
+struct att_iter {
+	const uint8_t *ptr;
+	const uint8_t *end;
+	uint16_t len;
+};
+
+/*
+ * Writes the entries of one of the responses above directly into the
+ * output PDU. All entries must have the same length.
+ */
+struct att_list {
+	uint8_t *pdu;
+	size_t size;
+	uint16_t offset;
+	uint16_t len;
+};
+
 /* These functions do byte conversion */
 static inline uint8_t att_get_u8(const void *ptr)
 {
@@ -203,6 +224,14 @@ static inline bt_uuid_t att_get_uuid128(const void *ptr)
 struct att_data_list *att_data_list_alloc(uint16_t num, uint16_t len);
 void att_data_list_free(struct att_data_list *list);
 
+uint16_t att_iter_init(struct att_iter *iter, const uint8_t *pdu, size_t len);
+const uint8_t *att_iter_next(struct att_iter *iter);
+
+void att_list_init(struct att_list *list, uint8_t opcode, uint8_t *pdu,
+								size_t len);
+uint8_t *att_list_append(struct att_list *list, uint16_t len);
+uint16_t att_list_finish(struct att_list *list);
+
 const char *att_ecode2str(uint8_t status);
 uint16_t enc_read_by_grp_req(uint16_t start, uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, size_t len);
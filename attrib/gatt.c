@@ -70,6 +70,15 @@ struct discover_char {
 	void *user_data;
 };
 
+struct discover_desc {
+	GAttrib *attrib;
+	bt_uuid_t *uuid;
+	uint16_t end;
+	GSList *descriptors;
+	gatt_cb_t cb;
+	void *user_data;
+};
+
 static void discover_primary_free(struct discover_primary *dp)
 {
 	g_slist_free(dp->primaries);
@@ -107,6 +116,14 @@ static void discover_char_free(struct discover_char *dc)
 	g_free(dc);
 }
 
+static void discover_desc_free(struct discover_desc *dd)
+{
+	g_slist_free_full(dd->descriptors, g_free);
+	g_attrib_unref(dd->attrib);
+	g_free(dd->uuid);
+	g_free(dd);
+}
+
 static guint16 encode_discover_primary(uint16_t start, uint16_t end,
 				bt_uuid_t *uuid, uint8_t *pdu, size_t len)
 {
@@ -191,33 +208,33 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 							gpointer user_data)
 {
 	struct discover_primary *dp = user_data;
-	struct att_data_list *list;
-	unsigned int i, err;
-	uint16_t start, end;
+	struct att_iter iter;
+	const uint8_t *data;
+	unsigned int err;
+	uint16_t start, end = 0;
 
 	if (status) {
 		err = status == ATT_ECODE_ATTR_NOT_FOUND ? 0 : status;
 		goto done;
 	}
 
-	list = dec_read_by_grp_resp(ipdu, iplen);
-	if (list == NULL) {
+	if (att_iter_init(&iter, ipdu, iplen) == 0 ||
+				ipdu[0] != ATT_OP_READ_BY_GROUP_RESP) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
 
-	for (i = 0, end = 0; i < list->num; i++) {
-		const uint8_t *data = list->data[i];
+	while ((data = att_iter_next(&iter)) != NULL) {
 		struct gatt_primary *primary;
 		bt_uuid_t uuid;
 
 		start = att_get_u16(&data[0]);
 		end = att_get_u16(&data[2]);
 
-		if (list->len == 6) {
+		if (iter.len == 6) {
 			bt_uuid_t uuid16 = att_get_uuid16(&data[4]);
 			bt_uuid_to_uuid128(&uuid16, &uuid);
-		} else if (list->len == 20) {
+		} else if (iter.len == 20) {
 			uuid = att_get_uuid128(&data[4]);
 		} else {
 			/* Skipping invalid data */
@@ -226,7 +243,6 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 
 		primary = g_try_new0(struct gatt_primary, 1);
 		if (!primary) {
-			att_data_list_free(list);
 			err = ATT_ECODE_INSUFF_RESOURCES;
 			goto done;
 		}
@@ -236,7 +252,6 @@ static void primary_all_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 		dp->primaries = g_slist_append(dp->primaries, primary);
 	}
 
-	att_data_list_free(list);
 	err = 0;
 
 	if (end != 0xffff) {
@@ -381,8 +396,8 @@ static void find_included_cb(uint8_t status, const uint8_t *pdu, uint16_t len,
 	struct included_discovery *isd = user_data;
 	uint16_t last_handle = isd->end_handle;
 	unsigned int err = status;
-	struct att_data_list *list;
-	int i;
+	struct att_iter iter;
+	const uint8_t *data;
 
 	if (err == ATT_ECODE_ATTR_NOT_FOUND)
 		err = 0;
@@ -390,26 +405,25 @@ static void find_included_cb(uint8_t status, const uint8_t *pdu, uint16_t len,
 	if (status)
 		goto done;
 
-	list = dec_read_by_type_resp(pdu, len);
-	if (list == NULL) {
+	if (att_iter_init(&iter, pdu, len) == 0 ||
+				pdu[0] != ATT_OP_READ_BY_TYPE_RESP) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
 
-	if (list->len != 6 && list->len != 8) {
+	if (iter.len != 6 && iter.len != 8) {
 		err = ATT_ECODE_IO;
-		att_data_list_free(list);
 		goto done;
 	}
 
-	for (i = 0; i < list->num; i++) {
+	while ((data = att_iter_next(&iter)) != NULL) {
 		struct gatt_included *incl;
 
-		incl = included_from_buf(list->data[i], list->len);
+		incl = included_from_buf(data, iter.len);
 		last_handle = incl->handle;
 
 		/* 128 bit UUID, needs resolving */
-		if (list->len == 6) {
+		if (iter.len == 6) {
 			resolve_included_uuid(isd, incl);
 			continue;
 		}
@@ -417,8 +431,6 @@ static void find_included_cb(uint8_t status, const uint8_t *pdu, uint16_t len,
 		isd->includes = g_slist_append(isd->includes, incl);
 	}
 
-	att_data_list_free(list);
-
 	if (last_handle < isd->end_handle)
 		find_included(isd, last_handle + 1);
 
@@ -445,8 +457,9 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 							gpointer user_data)
 {
 	struct discover_char *dc = user_data;
-	struct att_data_list *list;
-	unsigned int i, err = ATT_ECODE_ATTR_NOT_FOUND;
+	struct att_iter iter;
+	const uint8_t *value;
+	unsigned int err = ATT_ECODE_ATTR_NOT_FOUND;
 	size_t buflen;
 	uint8_t *buf;
 	guint16 oplen;
@@ -458,20 +471,21 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 		goto done;
 	}
 
-	list = dec_read_by_type_resp(ipdu, iplen);
-	if (list == NULL) {
+	/* Handle, properties, value handle and UUID */
+	if (att_iter_init(&iter, ipdu, iplen) == 0 ||
+				ipdu[0] != ATT_OP_READ_BY_TYPE_RESP ||
+				(iter.len != 7 && iter.len != 21)) {
 		err = ATT_ECODE_IO;
 		goto done;
 	}
 
-	for (i = 0; i < list->num; i++) {
-		uint8_t *value = list->data[i];
+	while ((value = att_iter_next(&iter)) != NULL) {
 		struct gatt_char *chars;
 		bt_uuid_t uuid;
 
 		last = att_get_u16(value);
 
-		if (list->len == 7) {
+		if (iter.len == 7) {
 			bt_uuid_t uuid16 = att_get_uuid16(&value[5]);
 			bt_uuid_to_uuid128(&uuid16, &uuid);
 		} else
@@ -494,8 +508,6 @@ static void char_discovered_cb(guint8 status, const guint8 *ipdu, guint16 iplen,
 									chars);
 	}
 
-	att_data_list_free(list);
-
 	if (last != 0 && (last + 1 < dc->end)) {
 		buf = g_attrib_get_buffer(dc->attrib, &buflen);
 
@@ -550,6 +562,116 @@ guint gatt_discover_char(GAttrib *attrib, uint16_t start, uint16_t end,
 								dc, NULL);
 }
 
+static void desc_discovered_cb(guint8 status, const guint8 *ipdu,
+					guint16 iplen, gpointer user_data)
+{
+	struct discover_desc *dd = user_data;
+	struct att_iter iter;
+	const uint8_t *value;
+	unsigned int err = ATT_ECODE_ATTR_NOT_FOUND;
+	size_t buflen;
+	uint8_t *buf;
+	guint16 oplen;
+	uint16_t last = 0xffff;
+
+	/* Attribute Not Found is how the server ends the sweep */
+	if (status) {
+		err = status;
+		goto done;
+	}
+
+	if (att_iter_init(&iter, ipdu, iplen) == 0 ||
+				ipdu[0] != ATT_OP_FIND_INFO_RESP) {
+		err = ATT_ECODE_IO;
+		goto done;
+	}
+
+	while ((value = att_iter_next(&iter)) != NULL) {
+		struct gatt_desc *desc;
+		bt_uuid_t uuid128;
+		uint16_t uuid16 = 0;
+
+		last = att_get_u16(value);
+
+		if (iter.len == 4) {
+			bt_uuid_t uuid = att_get_uuid16(&value[2]);
+
+			uuid16 = uuid.value.u16;
+			bt_uuid_to_uuid128(&uuid, &uuid128);
+		} else
+			uuid128 = att_get_uuid128(&value[2]);
+
+		if (dd->uuid && bt_uuid_cmp(dd->uuid, &uuid128))
+			continue;
+
+		desc = g_try_new0(struct gatt_desc, 1);
+		if (!desc) {
+			err = ATT_ECODE_INSUFF_RESOURCES;
+			goto done;
+		}
+
+		desc->handle = last;
+		desc->uuid16 = uuid16;
+		bt_uuid_to_string(&uuid128, desc->uuid, sizeof(desc->uuid));
+		dd->descriptors = g_slist_append(dd->descriptors, desc);
+	}
+
+	if (last < dd->end) {
+		buf = g_attrib_get_buffer(dd->attrib, &buflen);
+		oplen = enc_find_info_req(last + 1, dd->end, buf, buflen);
+		if (oplen == 0) {
+			err = ATT_ECODE_IO;
+			goto done;
+		}
+
+		if (g_attrib_send(dd->attrib, 0, buf, oplen,
+					desc_discovered_cb, dd, NULL) == 0) {
+			err = ATT_ECODE_IO;
+			goto done;
+		}
+
+		return;
+	}
+
+done:
+	/*
+	 * Only the end of the range completes the sweep, any other error
+	 * leaves the list incomplete so it is not handed to the caller.
+	 */
+	if (err == ATT_ECODE_ATTR_NOT_FOUND && dd->descriptors)
+		err = 0;
+
+	dd->cb(err ? NULL : dd->descriptors, err, dd->user_data);
+	discover_desc_free(dd);
+}
+
+guint gatt_discover_desc(GAttrib *attrib, uint16_t start, uint16_t end,
+						bt_uuid_t *uuid, gatt_cb_t func,
+						gpointer user_data)
+{
+	size_t buflen;
+	uint8_t *buf = g_attrib_get_buffer(attrib, &buflen);
+	struct discover_desc *dd;
+	guint16 plen;
+
+	plen = enc_find_info_req(start, end, buf, buflen);
+	if (plen == 0)
+		return 0;
+
+	dd = g_try_new0(struct discover_desc, 1);
+	if (dd == NULL)
+		return 0;
+
+	dd->attrib = g_attrib_ref(attrib);
+	dd->cb = func;
+	dd->user_data = user_data;
+	dd->end = end;
+	dd->uuid = g_memdup(uuid, sizeof(bt_uuid_t));
+
+	return g_attrib_send(attrib, 0, buf, plen, desc_discovered_cb,
+								dd, NULL);
+}
+
 guint gatt_read_char_by_uuid(GAttrib *attrib, uint16_t start, uint16_t end,
 					bt_uuid_t *uuid, GAttribResultFunc func,
 					gpointer user_data)
@@ -820,6 +942,443 @@ guint gatt_write_char(GAttrib *attrib, uint16_t handle, uint8_t *value,
 							func, long_write);
 }
 
+/*
+ * Long value engine: reads and writes whose value does not fit in a single
+ * ATT PDU. The MTU is optionally negotiated first so that every Read Blob or
+ * Prepare Write carries as much payload as the link allows. Prepare Write
+ * requests are all queued at once so GAttrib can send the next one as soon
+ * as the previous response arrives, without a round through the caller.
+ */
+struct long_op {
+	guint id;
+	guint req_id;
+	int ref;
+	GAttrib *attrib;
+	uint16_t handle;
+	uint16_t mtu;
+	gboolean write;
+	gboolean done;
+	uint8_t *value;
+	size_t vlen;
+	size_t size;
+	guint *pending;
+	unsigned int npending;
+	unsigned int acked;
+	gint64 start;
+	struct gatt_long_stats stats;
+	gatt_long_cb_t func;
+	gpointer user_data;
+};
+
+static GSList *long_ops = NULL;
+static guint next_long_id = 1;
+
+static struct long_op *long_op_ref(struct long_op *op)
+{
+	__sync_fetch_and_add(&op->ref, 1);
+
+	return op;
+}
+
+static void long_op_unref(gpointer user_data)
+{
+	struct long_op *op = user_data;
+
+	if (__sync_sub_and_fetch(&op->ref, 1) > 0)
+		return;
+
+	g_attrib_unref(op->attrib);
+	g_free(op->pending);
+	g_free(op->value);
+	g_free(op);
+}
+
+static void long_op_complete(struct long_op *op, guint8 status)
+{
+	if (op->done)
+		return;
+
+	op->done = TRUE;
+	op->stats.elapsed = g_get_monotonic_time() - op->start;
+
+	long_ops = g_slist_remove(long_ops, op);
+
+	if (op->func)
+		op->func(status, op->write ? NULL : op->value, op->size,
+						&op->stats, op->user_data);
+
+	long_op_unref(op);
+}
+
+static void long_op_cancel_pending(struct long_op *op)
+{
+	unsigned int i;
+
+	for (i = 0; i < op->npending; i++) {
+		if (op->pending[i] > 0)
+			g_attrib_cancel(op->attrib, op->pending[i]);
+	}
+
+	op->npending = 0;
+}
+
+static guint long_op_send(struct long_op *op, guint id, const uint8_t *pdu,
+				guint16 plen, GAttribResultFunc func)
+{
+	id = g_attrib_send(op->attrib, id, pdu, plen, func, long_op_ref(op),
+								long_op_unref);
+	if (id == 0) {
+		long_op_unref(op);
+		return 0;
+	}
+
+	op->stats.pdus++;
+
+	return id;
+}
+
+static gboolean long_op_grow(struct long_op *op, size_t needed)
+{
+	size_t vlen = op->vlen ? op->vlen : op->mtu;
+	uint8_t *tmp;
+
+	if (needed <= op->vlen)
+		return TRUE;
+
+	while (vlen < needed)
+		vlen *= 2;
+
+	tmp = g_try_realloc(op->value, vlen);
+	if (tmp == NULL)
+		return FALSE;
+
+	op->value = tmp;
+	op->vlen = vlen;
+
+	return TRUE;
+}
+
+static void read_long_cb(guint8 status, const guint8 *rpdu, guint16 rlen,
+							gpointer user_data)
+{
+	struct long_op *op = user_data;
+	size_t buflen;
+	uint8_t *buf;
+	guint16 plen;
+
+	if (op->done)
+		return;
+
+	op->npending = 0;
+
+	/* Reading exactly at the end of the value is reported this way */
+	if ((status == ATT_ECODE_INVALID_OFFSET ||
+				status == ATT_ECODE_ATTR_NOT_LONG) &&
+				op->size > 0)
+		status = 0;
+
+	if (status != 0 || rlen <= 1)
+		goto done;
+
+	if (!long_op_grow(op, op->size + rlen - 1)) {
+		status = ATT_ECODE_INSUFF_RESOURCES;
+		goto done;
+	}
+
+	memcpy(&op->value[op->size], &rpdu[1], rlen - 1);
+	op->size += rlen - 1;
+	op->stats.bytes = op->size;
+
+	/* A response shorter than the MTU carries the last chunk */
+	buf = g_attrib_get_buffer(op->attrib, &buflen);
+	if (rlen < buflen || op->size > UINT16_MAX)
+		goto done;
+
+	plen = enc_read_blob_req(op->handle, op->size, buf, buflen);
+
+	/* Reuse the ID so the request jumps ahead of unrelated ones */
+	op->pending[0] = long_op_send(op, op->req_id, buf, plen,
+								read_long_cb);
+	if (op->pending[0] != 0) {
+		op->npending = 1;
+		return;
+	}
+
+	status = ATT_ECODE_IO;
+
+done:
+	long_op_complete(op, status);
+}
+
+static void exec_write_long_cb(guint8 status, const guint8 *rpdu,
+					guint16 rlen, gpointer user_data)
+{
+	struct long_op *op = user_data;
+
+	if (status == 0 && !dec_exec_write_resp(rpdu, rlen))
+		status = ATT_ECODE_IO;
+
+	op->npending = 0;
+
+	long_op_complete(op, status);
+}
+
+static void exec_write_cancel(struct long_op *op)
+{
+	size_t buflen;
+	uint8_t *buf = g_attrib_get_buffer(op->attrib, &buflen);
+	guint16 plen;
+
+	/* Drop whatever the server already queued for us */
+	plen = enc_exec_write_req(ATT_CANCEL_ALL_PREP_WRITES, buf, buflen);
+	if (plen > 0)
+		g_attrib_send(op->attrib, 0, buf, plen, NULL, NULL, NULL);
+}
+
+static void prep_write_long_cb(guint8 status, const guint8 *rpdu,
+					guint16 rlen, gpointer user_data)
+{
+	struct long_op *op = user_data;
+	uint8_t value[ATT_MAX_VALUE_LEN];
+	uint16_t handle, offset;
+	size_t vlen;
+
+	if (op->done)
+		return;
+
+	if (status != 0)
+		goto failed;
+
+	if (!dec_prep_write_resp(rpdu, rlen, &handle, &offset, value, &vlen)) {
+		status = ATT_ECODE_IO;
+		goto failed;
+	}
+
+	/* The server has to echo back exactly what we sent */
+	if (handle != op->handle || offset != op->stats.bytes ||
+				offset + vlen > op->size ||
+				memcmp(&op->value[offset], value, vlen) != 0) {
+		status = ATT_ECODE_IO;
+		goto failed;
+	}
+
+	op->pending[op->acked++] = 0;
+	op->stats.bytes += vlen;
+
+	return;
+
+failed:
+	op->pending[op->acked] = 0;
+	long_op_cancel_pending(op);
+	exec_write_cancel(op);
+	long_op_complete(op, status);
+}
+
+static gboolean write_long_queue(struct long_op *op)
+{
+	size_t buflen, chunk, offset;
+	uint8_t *buf = g_attrib_get_buffer(op->attrib, &buflen);
+	unsigned int i, count;
+	guint16 plen;
+
+	/* Prepare Write Request header: opcode, handle and offset */
+	chunk = buflen - 5;
+	count = (op->size + chunk - 1) / chunk;
+
+	op->pending = g_try_new0(guint, count + 1);
+	if (op->pending == NULL)
+		return FALSE;
+
+	for (i = 0, offset = 0; i < count; i++, offset += chunk) {
+		plen = enc_prep_write_req(op->handle, offset,
+					&op->value[offset],
+					MIN(chunk, op->size - offset),
+					buf, buflen);
+		if (plen == 0)
+			goto failed;
+
+		op->pending[i] = long_op_send(op, 0, buf, plen,
+							prep_write_long_cb);
+		if (op->pending[i] == 0)
+			goto failed;
+
+		op->npending = i + 1;
+	}
+
+	plen = enc_exec_write_req(ATT_WRITE_ALL_PREP_WRITES, buf, buflen);
+	op->pending[count] = long_op_send(op, 0, buf, plen,
+							exec_write_long_cb);
+	if (op->pending[count] == 0)
+		goto failed;
+
+	op->npending = count + 1;
+
+	return TRUE;
+
+failed:
+	long_op_cancel_pending(op);
+
+	return FALSE;
+}
+
+static gboolean read_long_start(struct long_op *op)
+{
+	size_t buflen;
+	uint8_t *buf = g_attrib_get_buffer(op->attrib, &buflen);
+	guint16 plen;
+
+	op->pending = g_try_new0(guint, 1);
+	if (op->pending == NULL)
+		return FALSE;
+
+	plen = enc_read_req(op->handle, buf, buflen);
+	op->pending[0] = long_op_send(op, 0, buf, plen, read_long_cb);
+	if (op->pending[0] == 0)
+		return FALSE;
+
+	op->npending = 1;
+	op->req_id = op->pending[0];
+
+	return TRUE;
+}
+
+static gboolean long_op_start(struct long_op *op)
+{
+	size_t buflen;
+
+	g_attrib_get_buffer(op->attrib, &buflen);
+	op->mtu = buflen;
+	op->start = g_get_monotonic_time();
+
+	if (op->write)
+		return write_long_queue(op);
+
+	return read_long_start(op);
+}
+
+static void long_mtu_cb(guint8 status, const guint8 *rpdu, guint16 rlen,
+							gpointer user_data)
+{
+	struct long_op *op = user_data;
+	uint16_t mtu;
+
+	if (op->done)
+		return;
+
+	op->npending = 0;
+
+	/* Servers are allowed to refuse, keep going with the current MTU */
+	if (status == 0 && dec_mtu_resp(rpdu, rlen, &mtu))
+		g_attrib_set_mtu(op->attrib, MIN(mtu, op->mtu));
+
+	g_free(op->pending);
+	op->pending = NULL;
+
+	if (!long_op_start(op))
+		long_op_complete(op, ATT_ECODE_IO);
+}
+
+static guint long_op_new(GAttrib *attrib, uint16_t handle, uint16_t mtu,
+			const uint8_t *value, size_t vlen,
+			gatt_long_cb_t func, gpointer user_data)
+{
+	struct long_op *op;
+	size_t buflen;
+	uint8_t *buf = g_attrib_get_buffer(attrib, &buflen);
+	gboolean started;
+
+	op = g_try_new0(struct long_op, 1);
+	if (op == NULL)
+		return 0;
+
+	op->ref = 1;
+	op->attrib = g_attrib_ref(attrib);
+	op->handle = handle;
+	op->func = func;
+	op->user_data = user_data;
+
+	if (value) {
+		op->write = TRUE;
+		op->value = g_memdup(value, vlen);
+		op->size = vlen;
+		op->vlen = vlen;
+	}
+
+	if (mtu > buflen) {
+		guint16 plen = enc_mtu_req(mtu, buf, buflen);
+
+		op->mtu = mtu;
+		op->start = g_get_monotonic_time();
+		op->pending = g_try_new0(guint, 1);
+		started = op->pending != NULL;
+		if (started) {
+			op->pending[0] = long_op_send(op, 0, buf, plen,
+								long_mtu_cb);
+			started = op->pending[0] != 0;
+			op->npending = started ? 1 : 0;
+		}
+	} else
+		started = long_op_start(op);
+
+	if (!started) {
+		long_op_cancel_pending(op);
+		long_op_unref(op);
+		return 0;
+	}
+
+	op->id = next_long_id++;
+
+	long_ops = g_slist_prepend(long_ops, op);
+
+	return op->id;
+}
+
+guint gatt_read_long(GAttrib *attrib, uint16_t handle, uint16_t mtu,
+				gatt_long_cb_t func, gpointer user_data)
+{
+	return long_op_new(attrib, handle, mtu, NULL, 0, func, user_data);
+}
+
+guint gatt_write_long(GAttrib *attrib, uint16_t handle, uint16_t mtu,
+				const uint8_t *value, size_t vlen,
+				gatt_long_cb_t func, gpointer user_data)
+{
+	if (value == NULL || vlen == 0 || vlen > UINT16_MAX)
+		return 0;
+
+	return long_op_new(attrib, handle, mtu, value, vlen, func, user_data);
+}
+
+static int long_op_cmp_by_id(gconstpointer a, gconstpointer b)
+{
+	const struct long_op *op = a;
+	guint id = GPOINTER_TO_UINT(b);
+
+	return op->id - id;
+}
+
+gboolean gatt_long_cancel(guint id)
+{
+	struct long_op *op;
+	GSList *l;
+
+	l = g_slist_find_custom(long_ops, GUINT_TO_POINTER(id),
+							long_op_cmp_by_id);
+	if (l == NULL)
+		return FALSE;
+
+	op = l->data;
+
+	long_op_cancel_pending(op);
+
+	if (op->write)
+		exec_write_cancel(op);
+
+	long_op_complete(op, ATT_ECODE_ABORTED);
+
+	return TRUE;
+}
+
 guint gatt_exchange_mtu(GAttrib *attrib, uint16_t mtu, GAttribResultFunc func,
 							gpointer user_data)
 {
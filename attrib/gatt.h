@@ -55,6 +55,16 @@
 
 typedef void (*gatt_cb_t) (GSList *l, guint8 status, gpointer user_data);
 
+struct gatt_long_stats {
+	size_t bytes;
+	unsigned int pdus;
+	gint64 elapsed;		/* microseconds */
+};
+
+typedef void (*gatt_long_cb_t) (guint8 status, const guint8 *value,
+				size_t vlen, const struct gatt_long_stats *stats,
+				gpointer user_data);
+
 struct gatt_primary {
 	char uuid[MAX_LEN_UUID_STR + 1];
 	gboolean changed;
@@ -74,6 +84,12 @@ struct gatt_char {
 	uint16_t value_handle;
 };
 
+struct gatt_desc {
+	char uuid[MAX_LEN_UUID_STR + 1];
+	uint16_t handle;
+	uint16_t uuid16;
+};
+
 guint gatt_discover_primary(GAttrib *attrib, bt_uuid_t *uuid, gatt_cb_t func,
 							gpointer user_data);
 
@@ -84,6 +100,10 @@ guint gatt_discover_char(GAttrib *attrib, uint16_t start, uint16_t end,
 					bt_uuid_t *uuid, gatt_cb_t func,
 					gpointer user_data);
 
+guint gatt_discover_desc(GAttrib *attrib, uint16_t start, uint16_t end,
+					bt_uuid_t *uuid, gatt_cb_t func,
+					gpointer user_data);
+
 guint gatt_read_char(GAttrib *attrib, uint16_t handle, GAttribResultFunc func,
 							gpointer user_data);
 
@@ -101,6 +121,15 @@ guint gatt_read_char_by_uuid(GAttrib *attrib, uint16_t start, uint16_t end,
 				bt_uuid_t *uuid, GAttribResultFunc func,
 				gpointer user_data);
 
+guint gatt_read_long(GAttrib *attrib, uint16_t handle, uint16_t mtu,
+				gatt_long_cb_t func, gpointer user_data);
+
+guint gatt_write_long(GAttrib *attrib, uint16_t handle, uint16_t mtu,
+				const uint8_t *value, size_t vlen,
+				gatt_long_cb_t func, gpointer user_data);
+
+gboolean gatt_long_cancel(guint id);
+
 guint gatt_exchange_mtu(GAttrib *attrib, uint16_t mtu, GAttribResultFunc func,
 							gpointer user_data);
 
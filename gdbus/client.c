@@ -51,7 +51,12 @@ struct GDBusClient {
 	GDBusProxyFunction proxy_removed;
 	GDBusPropertyFunction property_changed;
 	void *user_data;
+	GDBusPropertiesFunction properties_changed;
+	void *properties_data;
 	GList *proxy_list;
+	GHashTable *proxy_hash;
+	GQueue *changed_queue;
+	guint changed_id;
 };
 
 struct GDBusProxy {
@@ -65,6 +70,7 @@ struct GDBusProxy {
 	void *prop_data;
 	GDBusProxyFunction removed_func;
 	void *removed_data;
+	GPtrArray *changed_props;
 };
 
 struct prop_entry {
@@ -208,6 +214,78 @@ static void prop_entry_free(gpointer data)
 	g_free(prop);
 }
 
+static void proxy_changed_free(GDBusProxy *proxy)
+{
+	if (proxy->changed_props == NULL)
+		return;
+
+	g_ptr_array_free(proxy->changed_props, TRUE);
+	proxy->changed_props = NULL;
+}
+
+static gboolean flush_changed(gpointer user_data)
+{
+	GDBusClient *client = user_data;
+	GDBusProxy *proxy;
+
+	client->changed_id = 0;
+
+	g_dbus_client_ref(client);
+
+	while ((proxy = g_queue_pop_head(client->changed_queue))) {
+		GPtrArray *props = proxy->changed_props;
+
+		proxy->changed_props = NULL;
+
+		/* Removed proxies already dropped their pending changes */
+		if (props == NULL) {
+			g_dbus_proxy_unref(proxy);
+			continue;
+		}
+
+		if (client->properties_changed) {
+			g_ptr_array_add(props, NULL);
+			client->properties_changed(proxy,
+					(const char **) props->pdata,
+					client->properties_data);
+		}
+
+		g_ptr_array_free(props, TRUE);
+		g_dbus_proxy_unref(proxy);
+	}
+
+	g_dbus_client_unref(client);
+
+	return FALSE;
+}
+
+static void queue_changed(GDBusProxy *proxy, const char *name)
+{
+	GDBusClient *client = proxy->client;
+	unsigned int i;
+
+	if (client == NULL || client->properties_changed == NULL)
+		return;
+
+	if (proxy->changed_props == NULL) {
+		proxy->changed_props = g_ptr_array_new_with_free_func(g_free);
+		g_queue_push_tail(client->changed_queue,
+						g_dbus_proxy_ref(proxy));
+	}
+
+	/* Repeated changes within one iteration are reported once */
+	for (i = 0; i < proxy->changed_props->len; i++) {
+		if (g_str_equal(g_ptr_array_index(proxy->changed_props, i),
+								name) == TRUE)
+			return;
+	}
+
+	g_ptr_array_add(proxy->changed_props, g_strdup(name));
+
+	if (client->changed_id == 0)
+		client->changed_id = g_idle_add(flush_changed, client);
+}
+
 static void add_property(GDBusProxy *proxy, const char *name,
 				DBusMessageIter *iter, gboolean send_changed)
 {
@@ -239,6 +317,9 @@ done:
 	if (client == NULL || send_changed == FALSE)
 		return;
 
+	/* The callback below may release the client and its proxies */
+	queue_changed(proxy, name);
+
 	if (client->property_changed)
 		client->property_changed(proxy, name, &value,
 							client->user_data);
@@ -272,6 +353,49 @@ static void update_properties(GDBusProxy *proxy, DBusMessageIter *iter,
 	}
 }
 
+static guint proxy_hash(gconstpointer key)
+{
+	const GDBusProxy *proxy = key;
+
+	return g_str_hash(proxy->obj_path) * 31 + g_str_hash(proxy->interface);
+}
+
+static gboolean proxy_equal(gconstpointer a, gconstpointer b)
+{
+	const GDBusProxy *proxy1 = a;
+	const GDBusProxy *proxy2 = b;
+
+	return g_str_equal(proxy1->obj_path, proxy2->obj_path) &&
+			g_str_equal(proxy1->interface, proxy2->interface);
+}
+
+static GDBusProxy *proxy_lookup(GDBusClient *client, const char *path,
+						const char *interface)
+{
+	GDBusProxy key;
+
+	key.obj_path = (char *) path;
+	key.interface = (char *) interface;
+
+	return g_hash_table_lookup(client->proxy_hash, &key);
+}
+
+static void proxy_add(GDBusClient *client, GDBusProxy *proxy)
+{
+	client->proxy_list = g_list_prepend(client->proxy_list, proxy);
+	g_hash_table_replace(client->proxy_hash, proxy, proxy);
+}
+
+static void proxy_free(gpointer data);
+
+static void proxy_remove_all(GDBusClient *client)
+{
+	g_hash_table_remove_all(client->proxy_hash);
+
+	g_list_free_full(client->proxy_list, proxy_free);
+	client->proxy_list = NULL;
+}
+
 static void get_all_properties_reply(DBusPendingCall *call, void *user_data)
 {
 	GDBusProxy *proxy = user_data;
@@ -292,11 +416,11 @@ static void get_all_properties_reply(DBusPendingCall *call, void *user_data)
 	update_properties(proxy, &iter, FALSE);
 
 done:
-	if (g_list_find(client->proxy_list, proxy) == NULL) {
+	if (g_hash_table_lookup(client->proxy_hash, proxy) == NULL) {
 		if (client->proxy_added)
 			client->proxy_added(proxy, client->user_data);
 
-		client->proxy_list = g_list_append(client->proxy_list, proxy);
+		proxy_add(client, proxy);
 	}
 
 	dbus_message_unref(reply);
@@ -334,23 +458,6 @@ static void get_all_properties(GDBusProxy *proxy)
 	dbus_message_unref(msg);
 }
 
-static GDBusProxy *proxy_lookup(GDBusClient *client, const char *path,
-						const char *interface)
-{
-	GList *list;
-
-	for (list = g_list_first(client->proxy_list); list;
-						list = g_list_next(list)) {
-		GDBusProxy *proxy = list->data;
-
-		if (g_str_equal(proxy->interface, interface) == TRUE &&
-				g_str_equal(proxy->obj_path, path) == TRUE)
-			return proxy;
-        }
-
-	return NULL;
-}
-
 static GDBusProxy *proxy_new(GDBusClient *client, const char *path,
 						const char *interface)
 {
@@ -396,6 +503,8 @@ static void proxy_free(gpointer data)
 
 		g_hash_table_remove_all(proxy->prop_list);
 
+		proxy_changed_free(proxy);
+
 		proxy->client = NULL;
 	}
 
@@ -408,20 +517,16 @@ static void proxy_free(gpointer data)
 static void proxy_remove(GDBusClient *client, const char *path,
 						const char *interface)
 {
-	GList *list;
+	GDBusProxy *proxy;
 
-	for (list = g_list_first(client->proxy_list); list;
-						list = g_list_next(list)) {
-		GDBusProxy *proxy = list->data;
+	proxy = proxy_lookup(client, path, interface);
+	if (proxy == NULL)
+		return;
 
-		if (g_str_equal(proxy->interface, interface) == TRUE &&
-				g_str_equal(proxy->obj_path, path) == TRUE) {
-			client->proxy_list =
-				g_list_delete_link(client->proxy_list, list);
-			proxy_free(proxy);
-			break;
-		}
-	}
+	g_hash_table_remove(client->proxy_hash, proxy);
+	client->proxy_list = g_list_remove(client->proxy_list, proxy);
+
+	proxy_free(proxy);
 }
 
 GDBusProxy *g_dbus_proxy_new(GDBusClient *client, const char *path,
@@ -465,6 +570,8 @@ void g_dbus_proxy_unref(GDBusProxy *proxy)
 
 	g_hash_table_destroy(proxy->prop_list);
 
+	proxy_changed_free(proxy);
+
 	g_free(proxy->obj_path);
 	g_free(proxy->interface);
 
@@ -796,10 +903,9 @@ static void refresh_properties(GDBusClient *client)
 static void properties_changed(GDBusClient *client, const char *path,
 							DBusMessage *msg)
 {
-	GDBusProxy *proxy = NULL;
+	GDBusProxy *proxy;
 	DBusMessageIter iter, entry;
 	const char *interface;
-	GList *list;
 
 	if (dbus_message_iter_init(msg, &iter) == FALSE)
 		return;
@@ -810,17 +916,7 @@ static void properties_changed(GDBusClient *client, const char *path,
 	dbus_message_iter_get_basic(&iter, &interface);
 	dbus_message_iter_next(&iter);
 
-	for (list = g_list_first(client->proxy_list); list;
-						list = g_list_next(list)) {
-		GDBusProxy *data = list->data;
-
-		if (g_str_equal(data->interface, interface) == TRUE &&
-				g_str_equal(data->obj_path, path) == TRUE) {
-			proxy = data;
-			break;
-		}
-	}
-
+	proxy = proxy_lookup(client, path, interface);
 	if (proxy == NULL)
 		return;
 
@@ -843,6 +939,8 @@ static void properties_changed(GDBusClient *client, const char *path,
 		if (proxy->prop_func)
 			proxy->prop_func(proxy, name, NULL, proxy->prop_data);
 
+		queue_changed(proxy, name);
+
 		if (client->property_changed)
 			client->property_changed(proxy, name, NULL,
 							client->user_data);
@@ -877,7 +975,7 @@ static void parse_properties(GDBusClient *client, const char *path,
 	if (client->proxy_added)
 		client->proxy_added(proxy, client->user_data);
 
-	client->proxy_list = g_list_append(client->proxy_list, proxy);
+	proxy_add(client, proxy);
 }
 
 static void parse_interfaces(GDBusClient *client, const char *path,
@@ -1154,8 +1252,7 @@ static DBusHandlerResult message_filter(DBusConnection *connection,
 		if (*new == '\0' && client->unique_name != NULL &&
 				g_str_equal(old, client->unique_name) == TRUE) {
 
-			g_list_free_full(client->proxy_list, proxy_free);
-			client->proxy_list = NULL;
+			proxy_remove_all(client);
 
 			if (client->disconn_func)
 				client->disconn_func(client->dbus_conn,
@@ -1244,6 +1341,8 @@ GDBusClient *g_dbus_client_new(DBusConnection *connection,
 	client->dbus_conn = dbus_connection_ref(connection);
 	client->service_name = g_strdup(service);
 	client->base_path = g_strdup(path);
+	client->proxy_hash = g_hash_table_new(proxy_hash, proxy_equal);
+	client->changed_queue = g_queue_new();
 
 	get_name_owner(client, client->service_name);
 
@@ -1317,7 +1416,14 @@ void g_dbus_client_unref(GDBusClient *client)
 	dbus_connection_remove_filter(client->dbus_conn,
 						message_filter, client);
 
-	g_list_free_full(client->proxy_list, proxy_free);
+	if (client->changed_id > 0)
+		g_source_remove(client->changed_id);
+
+	g_queue_free_full(client->changed_queue,
+				(GDestroyNotify) g_dbus_proxy_unref);
+
+	proxy_remove_all(client);
+	g_hash_table_destroy(client->proxy_hash);
 
 	if (client->disconn_func)
 		client->disconn_func(client->dbus_conn, client->disconn_data);
@@ -1385,3 +1491,15 @@ gboolean g_dbus_client_set_proxy_handlers(GDBusClient *client,
 
 	return TRUE;
 }
+
+gboolean g_dbus_client_set_properties_watch(GDBusClient *client,
+				GDBusPropertiesFunction function, void *user_data)
+{
+	if (client == NULL)
+		return FALSE;
+
+	client->properties_changed = function;
+	client->properties_data = user_data;
+
+	return TRUE;
+}
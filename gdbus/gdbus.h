@@ -363,6 +363,12 @@ gboolean g_dbus_client_set_proxy_handlers(GDBusClient *client,
 					GDBusPropertyFunction property_changed,
 					void *user_data);
 
+typedef void (* GDBusPropertiesFunction) (GDBusProxy *proxy,
+					const char **names, void *user_data);
+
+gboolean g_dbus_client_set_properties_watch(GDBusClient *client,
+				GDBusPropertiesFunction function, void *user_data);
+
 #ifdef __cplusplus
 }
 #endif
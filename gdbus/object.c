@@ -38,6 +38,7 @@
 #define debug(fmt...)
 
 #define DBUS_INTERFACE_OBJECT_MANAGER "org.freedesktop.DBus.ObjectManager"
+#define DBUS_INTERFACE_OBJECT_FILTER "org.bluez.ObjectFilter1"
 
 #ifndef DBUS_ERROR_UNKNOWN_PROPERTY
 #define DBUS_ERROR_UNKNOWN_PROPERTY "org.freedesktop.DBus.Error.UnknownProperty"
@@ -58,12 +59,36 @@ struct generic_data {
 	guint process_id;
 	gboolean pending_prop;
 	char *introspect;
+	GHashTable *children;
 	struct generic_data *parent;
 };
 
+struct method_entry {
+	const GDBusMethodTable *method;
+	char *signature;
+	struct method_entry *next;
+};
+
+struct method_index {
+	unsigned int refcount;
+	const GDBusMethodTable *methods;
+	GHashTable *names;
+};
+
+struct interface_xml {
+	unsigned int refcount;
+	char *name;
+	const GDBusMethodTable *methods;
+	const GDBusSignalTable *signals;
+	const GDBusPropertyTable *properties;
+	char *xml;
+};
+
 struct interface_data {
 	char *name;
 	const GDBusMethodTable *methods;
+	struct method_index *method_index;
+	struct interface_xml *xml;
 	const GDBusSignalTable *signals;
 	const GDBusPropertyTable *properties;
 	GSList *pending_prop;
@@ -84,8 +109,18 @@ struct property_data {
 	DBusMessage *message;
 };
 
+struct subscriber {
+	DBusConnection *conn;
+	char *name;
+	char **interfaces;
+	guint watch;
+};
+
 static int global_flags = 0;
 static struct generic_data *root;
+static GHashTable *method_indexes = NULL;
+static GHashTable *interface_xmls = NULL;
+static GSList *subscribers = NULL;
 
 static gboolean process_changes(gpointer user_data);
 static void process_properties_from_interface(struct generic_data *data,
@@ -189,41 +224,122 @@ static void generate_interface_xml(GString *gstr, struct interface_data *iface)
 	}
 }
 
-static void generate_introspection_xml(DBusConnection *conn,
-				struct generic_data *data, const char *path)
+static guint interface_xml_hash(gconstpointer key)
 {
-	GSList *list;
-	GString *gstr;
-	char **children;
-	int i;
+	const struct interface_xml *xml = key;
 
-	g_free(data->introspect);
+	return g_str_hash(xml->name) ^ g_direct_hash(xml->methods) ^
+				g_direct_hash(xml->signals) ^
+				g_direct_hash(xml->properties);
+}
 
-	gstr = g_string_new(DBUS_INTROSPECT_1_0_XML_DOCTYPE_DECL_NODE);
+static gboolean interface_xml_equal(gconstpointer a, gconstpointer b)
+{
+	const struct interface_xml *xml1 = a;
+	const struct interface_xml *xml2 = b;
 
-	g_string_append_printf(gstr, "<node>");
+	return xml1->methods == xml2->methods &&
+				xml1->signals == xml2->signals &&
+				xml1->properties == xml2->properties &&
+				g_str_equal(xml1->name, xml2->name);
+}
 
-	for (list = data->interfaces; list; list = list->next) {
-		struct interface_data *iface = list->data;
+/*
+ * Interfaces registered with the same name and tables share a single XML
+ * fragment, rendered on the first introspection of any of those objects.
+ */
+static struct interface_xml *interface_xml_ref(struct interface_data *iface)
+{
+	struct interface_xml key, *xml;
 
-		g_string_append_printf(gstr, "<interface name=\"%s\">",
-								iface->name);
+	if (interface_xmls == NULL)
+		interface_xmls = g_hash_table_new(interface_xml_hash,
+							interface_xml_equal);
 
-		generate_interface_xml(gstr, iface);
+	key.name = iface->name;
+	key.methods = iface->methods;
+	key.signals = iface->signals;
+	key.properties = iface->properties;
 
-		g_string_append_printf(gstr, "</interface>");
+	xml = g_hash_table_lookup(interface_xmls, &key);
+	if (xml != NULL) {
+		xml->refcount++;
+		return xml;
 	}
 
-	if (!dbus_connection_list_registered(conn, path, &children))
-		goto done;
+	xml = g_new0(struct interface_xml, 1);
+	xml->refcount = 1;
+	xml->name = g_strdup(iface->name);
+	xml->methods = iface->methods;
+	xml->signals = iface->signals;
+	xml->properties = iface->properties;
 
-	for (i = 0; children[i]; i++)
-		g_string_append_printf(gstr, "<node name=\"%s\"/>",
-								children[i]);
+	g_hash_table_insert(interface_xmls, xml, xml);
 
-	dbus_free_string_array(children);
+	return xml;
+}
+
+static void interface_xml_unref(struct interface_xml *xml)
+{
+	if (--xml->refcount > 0)
+		return;
+
+	g_hash_table_remove(interface_xmls, xml);
+
+	if (g_hash_table_size(interface_xmls) == 0) {
+		g_hash_table_destroy(interface_xmls);
+		interface_xmls = NULL;
+	}
+
+	g_free(xml->xml);
+	g_free(xml->name);
+	g_free(xml);
+}
+
+static const char *interface_xml_get(struct interface_data *iface)
+{
+	struct interface_xml *xml = iface->xml;
+	GString *gstr;
+
+	if (xml->xml != NULL)
+		return xml->xml;
+
+	gstr = g_string_new(NULL);
+
+	g_string_append_printf(gstr, "<interface name=\"%s\">", iface->name);
+
+	generate_interface_xml(gstr, iface);
+
+	g_string_append_printf(gstr, "</interface>");
+
+	xml->xml = g_string_free(gstr, FALSE);
+
+	return xml->xml;
+}
+
+static void generate_introspection_xml(struct generic_data *data)
+{
+	GSList *list;
+	GString *gstr;
+	GList *names, *l;
+
+	g_free(data->introspect);
+
+	gstr = g_string_new(DBUS_INTROSPECT_1_0_XML_DOCTYPE_DECL_NODE);
+
+	g_string_append_printf(gstr, "<node>");
+
+	for (list = data->interfaces; list; list = list->next)
+		g_string_append(gstr, interface_xml_get(list->data));
+
+	/* Sorted so the output does not depend on the hash table order */
+	names = g_list_sort(g_hash_table_get_keys(data->children),
+						(GCompareFunc) strcmp);
+	for (l = names; l; l = l->next)
+		g_string_append_printf(gstr, "<node name=\"%s\"/>",
+							(const char *) l->data);
+	g_list_free(names);
 
-done:
 	g_string_append_printf(gstr, "</node>");
 
 	data->introspect = g_string_free(gstr, FALSE);
@@ -236,8 +352,7 @@ static DBusMessage *introspect(DBusConnection *connection,
 	DBusMessage *reply;
 
 	if (data->introspect == NULL)
-		generate_introspection_xml(connection, data,
-						dbus_message_get_path(message));
+		generate_introspection_xml(data);
 
 	reply = dbus_message_new_method_return(message);
 	if (reply == NULL)
@@ -565,19 +680,62 @@ static void append_interface(gpointer data, gpointer user_data)
 	dbus_message_iter_close_container(array, &entry);
 }
 
-static void emit_interfaces_added(struct generic_data *data)
+static gboolean match_interfaces(char **interfaces, const char *name)
+{
+	int i;
+
+	if (interfaces == NULL || interfaces[0] == NULL)
+		return TRUE;
+
+	for (i = 0; interfaces[i]; i++) {
+		if (g_str_equal(interfaces[i], name))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Subscribers get their own copy of the signals of the interfaces they
+ * subscribed to, in addition to the broadcast, see subscribe().
+ */
+static void send_to_subscribers(DBusConnection *conn, const char *interface,
+							DBusMessage *signal)
+{
+	GSList *l;
+
+	for (l = subscribers; l != NULL; l = l->next) {
+		struct subscriber *sub = l->data;
+		DBusMessage *copy;
+
+		if (sub->conn != conn)
+			continue;
+
+		if (!match_interfaces(sub->interfaces, interface))
+			continue;
+
+		copy = dbus_message_copy(signal);
+		if (copy == NULL)
+			continue;
+
+		dbus_message_set_destination(copy, sub->name);
+		g_dbus_send_message(conn, copy);
+	}
+}
+
+static DBusMessage *interfaces_added_new(struct generic_data *data,
+						struct subscriber *sub)
 {
 	DBusMessage *signal;
 	DBusMessageIter iter, array;
-
-	if (root == NULL || data == root)
-		return;
+	GSList *l;
+	int count = 0;
 
 	signal = dbus_message_new_signal(root->path,
 					DBUS_INTERFACE_OBJECT_MANAGER,
 					"InterfacesAdded");
 	if (signal == NULL)
-		return;
+		return NULL;
 
 	dbus_message_iter_init_append(signal, &iter);
 	dbus_message_iter_append_basic(&iter, DBUS_TYPE_OBJECT_PATH,
@@ -593,13 +751,55 @@ static void emit_interfaces_added(struct generic_data *data)
 				DBUS_DICT_ENTRY_END_CHAR_AS_STRING
 				DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &array);
 
-	g_slist_foreach(data->added, append_interface, &array);
-	g_slist_free(data->added);
-	data->added = NULL;
+	for (l = data->added; l != NULL; l = l->next) {
+		struct interface_data *iface = l->data;
+
+		if (sub != NULL && !match_interfaces(sub->interfaces,
+								iface->name))
+			continue;
+
+		append_interface(iface, &array);
+		count++;
+	}
 
 	dbus_message_iter_close_container(&iter, &array);
 
-	g_dbus_send_message(data->conn, signal);
+	if (count == 0) {
+		dbus_message_unref(signal);
+		return NULL;
+	}
+
+	if (sub != NULL)
+		dbus_message_set_destination(signal, sub->name);
+
+	return signal;
+}
+
+static void emit_interfaces_added(struct generic_data *data)
+{
+	DBusMessage *signal;
+	GSList *l;
+
+	if (root == NULL || data == root)
+		return;
+
+	signal = interfaces_added_new(data, NULL);
+	if (signal != NULL)
+		g_dbus_send_message(data->conn, signal);
+
+	for (l = subscribers; l != NULL; l = l->next) {
+		struct subscriber *sub = l->data;
+
+		if (sub->conn != data->conn)
+			continue;
+
+		signal = interfaces_added_new(data, sub);
+		if (signal != NULL)
+			g_dbus_send_message(data->conn, signal);
+	}
+
+	g_slist_free(data->added);
+	data->added = NULL;
 }
 
 static struct interface_data *find_interface(GSList *interfaces,
@@ -619,6 +819,102 @@ static struct interface_data *find_interface(GSList *interfaces,
 	return NULL;
 }
 
+static char *args_signature(const GDBusArgInfo *args)
+{
+	GString *signature = g_string_new(NULL);
+
+	for (; args && args->signature; args++)
+		g_string_append(signature, args->signature);
+
+	return g_string_free(signature, FALSE);
+}
+
+static void method_entry_free(gpointer data)
+{
+	struct method_entry *entry = data;
+
+	while (entry) {
+		struct method_entry *next = entry->next;
+
+		g_free(entry->signature);
+		g_free(entry);
+		entry = next;
+	}
+}
+
+/*
+ * Method tables are static and shared by every object implementing the
+ * same interface, so the name lookup table and the expected signatures
+ * are built once per table and reference counted.
+ */
+static struct method_index *method_index_ref(const GDBusMethodTable *methods)
+{
+	struct method_index *index;
+	const GDBusMethodTable *method;
+
+	if (methods == NULL)
+		return NULL;
+
+	if (method_indexes == NULL)
+		method_indexes = g_hash_table_new(NULL, NULL);
+
+	index = g_hash_table_lookup(method_indexes, methods);
+	if (index != NULL) {
+		index->refcount++;
+		return index;
+	}
+
+	index = g_new0(struct method_index, 1);
+	index->refcount = 1;
+	index->methods = methods;
+	index->names = g_hash_table_new_full(g_str_hash, g_str_equal,
+						NULL, method_entry_free);
+
+	for (method = methods; method->name && method->function; method++) {
+		struct method_entry *entry, *last;
+
+		entry = g_new0(struct method_entry, 1);
+		entry->method = method;
+		entry->signature = args_signature(method->in_args);
+
+		/* Keep the table order for overloaded method names */
+		last = g_hash_table_lookup(index->names, method->name);
+		if (last == NULL) {
+			g_hash_table_insert(index->names,
+						(gpointer) method->name, entry);
+			continue;
+		}
+
+		while (last->next)
+			last = last->next;
+
+		last->next = entry;
+	}
+
+	g_hash_table_insert(method_indexes, (gpointer) methods, index);
+
+	return index;
+}
+
+static void method_index_unref(struct method_index *index)
+{
+	if (index == NULL)
+		return;
+
+	if (--index->refcount > 0)
+		return;
+
+	g_hash_table_remove(method_indexes, index->methods);
+
+	if (g_hash_table_size(method_indexes) == 0) {
+		g_hash_table_destroy(method_indexes);
+		method_indexes = NULL;
+	}
+
+	g_hash_table_destroy(index->names);
+	g_free(index);
+}
+
 static gboolean g_dbus_args_have_signature(const GDBusArgInfo *args,
 							DBusMessage *message)
 {
@@ -657,6 +953,9 @@ static gboolean remove_interface(struct generic_data *data, const char *name)
 		iface->user_data = NULL;
 	}
 
+	method_index_unref(iface->method_index);
+	interface_xml_unref(iface->xml);
+
 	/*
 	 * Interface being removed was just added, on the same mainloop
 	 * iteration? Don't send any signal
@@ -717,9 +1016,6 @@ static struct generic_data *invalidate_parent_data(DBusConnection *conn,
 			goto done;
 	}
 
-	g_free(data->introspect);
-	data->introspect = NULL;
-
 	if (!dbus_connection_get_object_path_data(conn, child_path,
 							(void *) &child))
 		goto done;
@@ -950,19 +1246,19 @@ static void append_name(gpointer data, gpointer user_data)
 	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &name);
 }
 
-static void emit_interfaces_removed(struct generic_data *data)
+static DBusMessage *interfaces_removed_new(struct generic_data *data,
+						struct subscriber *sub)
 {
 	DBusMessage *signal;
 	DBusMessageIter iter, array;
-
-	if (root == NULL || data == root)
-		return;
+	GSList *l;
+	int count = 0;
 
 	signal = dbus_message_new_signal(root->path,
 					DBUS_INTERFACE_OBJECT_MANAGER,
 					"InterfacesRemoved");
 	if (signal == NULL)
-		return;
+		return NULL;
 
 	dbus_message_iter_init_append(signal, &iter);
 	dbus_message_iter_append_basic(&iter, DBUS_TYPE_OBJECT_PATH,
@@ -970,13 +1266,52 @@ static void emit_interfaces_removed(struct generic_data *data)
 	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
 					DBUS_TYPE_STRING_AS_STRING, &array);
 
-	g_slist_foreach(data->removed, append_name, &array);
-	g_slist_free_full(data->removed, g_free);
-	data->removed = NULL;
+	for (l = data->removed; l != NULL; l = l->next) {
+		if (sub != NULL && !match_interfaces(sub->interfaces, l->data))
+			continue;
+
+		append_name(l->data, &array);
+		count++;
+	}
 
 	dbus_message_iter_close_container(&iter, &array);
 
-	g_dbus_send_message(data->conn, signal);
+	if (count == 0) {
+		dbus_message_unref(signal);
+		return NULL;
+	}
+
+	if (sub != NULL)
+		dbus_message_set_destination(signal, sub->name);
+
+	return signal;
+}
+
+static void emit_interfaces_removed(struct generic_data *data)
+{
+	DBusMessage *signal;
+	GSList *l;
+
+	if (root == NULL || data == root)
+		return;
+
+	signal = interfaces_removed_new(data, NULL);
+	if (signal != NULL)
+		g_dbus_send_message(data->conn, signal);
+
+	for (l = subscribers; l != NULL; l = l->next) {
+		struct subscriber *sub = l->data;
+
+		if (sub->conn != data->conn)
+			continue;
+
+		signal = interfaces_removed_new(data, sub);
+		if (signal != NULL)
+			g_dbus_send_message(data->conn, signal);
+	}
+
+	g_slist_free_full(data->removed, g_free);
+	data->removed = NULL;
 }
 
 static gboolean process_changes(gpointer user_data)
@@ -1015,6 +1350,7 @@ static void generic_unregister(DBusConnection *connection, void *user_data)
 	g_slist_free(data->objects);
 
 	dbus_connection_unref(data->conn);
+	g_hash_table_destroy(data->children);
 	g_free(data->introspect);
 	g_free(data->path);
 	g_free(data);
@@ -1025,28 +1361,33 @@ static DBusHandlerResult generic_message(DBusConnection *connection,
 {
 	struct generic_data *data = user_data;
 	struct interface_data *iface;
-	const GDBusMethodTable *method;
-	const char *interface;
+	struct method_entry *entry;
+	const char *interface, *member, *signature;
+
+	if (dbus_message_get_type(message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
 	interface = dbus_message_get_interface(message);
 
 	iface = find_interface(data->interfaces, interface);
-	if (iface == NULL)
+	if (iface == NULL || iface->method_index == NULL)
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-	for (method = iface->methods; method &&
-			method->name && method->function; method++) {
+	member = dbus_message_get_member(message);
+	if (member == NULL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-		if (dbus_message_is_method_call(message, iface->name,
-							method->name) == FALSE)
-			continue;
+	entry = g_hash_table_lookup(iface->method_index->names, member);
+	signature = dbus_message_get_signature(message);
+
+	for (; entry; entry = entry->next) {
+		const GDBusMethodTable *method = entry->method;
 
 		if (check_experimental(method->flags,
 					G_DBUS_METHOD_FLAG_EXPERIMENTAL))
 			return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-		if (g_dbus_args_have_signature(method->in_args,
-							message) == FALSE)
+		if (strcmp(entry->signature, signature) != 0)
 			continue;
 
 		if (check_privilege(connection, message, method,
@@ -1148,12 +1489,384 @@ static DBusMessage *get_objects(DBusConnection *connection,
 	return reply;
 }
 
+struct object_filter {
+	const char *path;
+	char **interfaces;
+	const char *after;
+	dbus_uint32_t count;
+	GPtrArray *objects;
+};
+
+static gboolean filter_path(const char *prefix, const char *path)
+{
+	size_t len = strlen(prefix);
+
+	if (g_str_equal(prefix, "/"))
+		return TRUE;
+
+	if (strncmp(prefix, path, len) != 0)
+		return FALSE;
+
+	return path[len] == '\0' || path[len] == '/';
+}
+
+static gboolean filter_object(struct generic_data *data,
+						struct object_filter *filter)
+{
+	GSList *l;
+
+	if (!filter_path(filter->path, data->path))
+		return FALSE;
+
+	if (filter->interfaces == NULL || filter->interfaces[0] == NULL)
+		return TRUE;
+
+	for (l = data->interfaces; l != NULL; l = l->next) {
+		struct interface_data *iface = l->data;
+
+		if (g_slist_find(data->added, iface))
+			continue;
+
+		if (match_interfaces(filter->interfaces, iface->name))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void collect_filtered_objects(struct generic_data *data,
+						struct object_filter *filter)
+{
+	GSList *l;
+
+	if (filter_object(data, filter) && (filter->after == NULL ||
+					strcmp(data->path, filter->after) > 0))
+		g_ptr_array_add(filter->objects, data);
+
+	/* Only descend into subtrees that can contain the prefix */
+	for (l = data->objects; l != NULL; l = l->next) {
+		struct generic_data *child = l->data;
+
+		if (!filter_path(filter->path, child->path) &&
+				!filter_path(child->path, filter->path))
+			continue;
+
+		collect_filtered_objects(child, filter);
+	}
+}
+
+static int object_path_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct generic_data *data1 = *(const struct generic_data **) a;
+	const struct generic_data *data2 = *(const struct generic_data **) b;
+
+	return strcmp(data1->path, data2->path);
+}
+
+static void append_filtered_object(struct generic_data *data,
+						struct object_filter *filter,
+						DBusMessageIter *dict)
+{
+	DBusMessageIter entry, array;
+	GSList *l;
+
+	dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY,
+							NULL, &entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_OBJECT_PATH,
+								&data->path);
+	dbus_message_iter_open_container(&entry, DBUS_TYPE_ARRAY,
+				DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+				DBUS_TYPE_STRING_AS_STRING
+				DBUS_TYPE_ARRAY_AS_STRING
+				DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+				DBUS_TYPE_STRING_AS_STRING
+				DBUS_TYPE_VARIANT_AS_STRING
+				DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+				DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &array);
+
+	for (l = data->interfaces; l != NULL; l = l->next) {
+		struct interface_data *iface = l->data;
+
+		if (g_slist_find(data->added, iface))
+			continue;
+
+		if (!match_interfaces(filter->interfaces, iface->name))
+			continue;
+
+		append_interface(iface, &array);
+	}
+
+	dbus_message_iter_close_container(&entry, &array);
+	dbus_message_iter_close_container(dict, &entry);
+}
+
+static gboolean parse_object_filter(DBusMessageIter *iter,
+						struct object_filter *filter)
+{
+	DBusMessageIter dict;
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return FALSE;
+
+	dbus_message_iter_recurse(iter, &dict);
+
+	while (dbus_message_iter_get_arg_type(&dict) == DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter entry, value;
+		const char *key;
+		int type;
+
+		dbus_message_iter_recurse(&dict, &entry);
+		dbus_message_iter_get_basic(&entry, &key);
+		dbus_message_iter_next(&entry);
+		dbus_message_iter_recurse(&entry, &value);
+
+		type = dbus_message_iter_get_arg_type(&value);
+
+		if (g_str_equal(key, "Path")) {
+			if (type != DBUS_TYPE_OBJECT_PATH)
+				return FALSE;
+			dbus_message_iter_get_basic(&value, &filter->path);
+		} else if (g_str_equal(key, "Interfaces")) {
+			DBusMessageIter array;
+			GPtrArray *names;
+
+			if (type != DBUS_TYPE_ARRAY || filter->interfaces)
+				return FALSE;
+
+			names = g_ptr_array_new();
+
+			dbus_message_iter_recurse(&value, &array);
+			while (dbus_message_iter_get_arg_type(&array) ==
+							DBUS_TYPE_STRING) {
+				const char *name;
+
+				dbus_message_iter_get_basic(&array, &name);
+				g_ptr_array_add(names, g_strdup(name));
+				dbus_message_iter_next(&array);
+			}
+
+			g_ptr_array_add(names, NULL);
+			filter->interfaces = (char **) g_ptr_array_free(names,
+									FALSE);
+		} else if (g_str_equal(key, "After")) {
+			if (type != DBUS_TYPE_OBJECT_PATH)
+				return FALSE;
+			dbus_message_iter_get_basic(&value, &filter->after);
+		} else if (g_str_equal(key, "Count")) {
+			if (type != DBUS_TYPE_UINT32)
+				return FALSE;
+			dbus_message_iter_get_basic(&value, &filter->count);
+		} else
+			return FALSE;
+
+		dbus_message_iter_next(&dict);
+	}
+
+	return TRUE;
+}
+
+static DBusMessage *get_filtered_objects(DBusConnection *connection,
+				DBusMessage *message, void *user_data)
+{
+	struct generic_data *data = user_data;
+	struct object_filter filter;
+	DBusMessage *reply;
+	DBusMessageIter iter, array;
+	const char *next = "/";
+	unsigned int i, count;
+	GSList *l;
+
+	memset(&filter, 0, sizeof(filter));
+	filter.path = "/";
+
+	dbus_message_iter_init(message, &iter);
+
+	if (!parse_object_filter(&iter, &filter)) {
+		g_strfreev(filter.interfaces);
+		return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS,
+							"Invalid filter");
+	}
+
+	reply = dbus_message_new_method_return(message);
+	if (reply == NULL) {
+		g_strfreev(filter.interfaces);
+		return NULL;
+	}
+
+	dbus_message_iter_init_append(reply, &iter);
+
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_OBJECT_PATH_AS_STRING
+					DBUS_TYPE_ARRAY_AS_STRING
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_ARRAY_AS_STRING
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&array);
+
+	/*
+	 * Pages are sorted by path and continue after the last path of the
+	 * previous one, so objects added or removed in between do not shift
+	 * the remaining ones.
+	 */
+	filter.objects = g_ptr_array_new();
+
+	for (l = data->objects; l != NULL; l = l->next)
+		collect_filtered_objects(l->data, &filter);
+
+	g_ptr_array_sort(filter.objects, object_path_cmp);
+
+	count = filter.objects->len;
+	if (filter.count > 0 && filter.count < count)
+		count = filter.count;
+
+	for (i = 0; i < count; i++)
+		append_filtered_object(g_ptr_array_index(filter.objects, i),
+							&filter, &array);
+
+	dbus_message_iter_close_container(&iter, &array);
+
+	/* The root object is never listed, it means there is nothing left */
+	if (count < filter.objects->len) {
+		struct generic_data *last;
+
+		last = g_ptr_array_index(filter.objects, count - 1);
+		next = last->path;
+	}
+
+	dbus_message_iter_append_basic(&iter, DBUS_TYPE_OBJECT_PATH, &next);
+
+	g_ptr_array_free(filter.objects, TRUE);
+	g_strfreev(filter.interfaces);
+
+	return reply;
+}
+
+static void subscriber_free(gpointer user_data)
+{
+	struct subscriber *sub = user_data;
+
+	g_free(sub->name);
+	g_strfreev(sub->interfaces);
+	g_free(sub);
+}
+
+static struct subscriber *find_subscriber(DBusConnection *conn,
+							const char *name)
+{
+	GSList *l;
+
+	for (l = subscribers; l != NULL; l = l->next) {
+		struct subscriber *sub = l->data;
+
+		if (sub->conn == conn && g_str_equal(sub->name, name))
+			return sub;
+	}
+
+	return NULL;
+}
+
+static void remove_subscriber(struct subscriber *sub)
+{
+	subscribers = g_slist_remove(subscribers, sub);
+	g_dbus_remove_watch(sub->conn, sub->watch);
+}
+
+static void subscriber_disconnect(DBusConnection *conn, void *user_data)
+{
+	struct subscriber *sub = user_data;
+
+	subscribers = g_slist_remove(subscribers, sub);
+	sub->watch = 0;
+}
+
+/*
+ * Signals are always broadcast so clients that do not subscribe keep
+ * working. A subscriber additionally receives InterfacesAdded,
+ * InterfacesRemoved and PropertiesChanged of the interfaces it asked for
+ * as unicast signals, limited to those interfaces, and is expected to
+ * drop its broadcast match rules for them.
+ */
+static DBusMessage *subscribe(DBusConnection *connection,
+				DBusMessage *message, void *user_data)
+{
+	const char *sender = dbus_message_get_sender(message);
+	struct subscriber *sub;
+	char **interfaces;
+	int len;
+
+	if (!dbus_message_get_args(message, NULL, DBUS_TYPE_ARRAY,
+					DBUS_TYPE_STRING, &interfaces, &len,
+					DBUS_TYPE_INVALID))
+		return g_dbus_create_error(message, DBUS_ERROR_INVALID_ARGS,
+							"Invalid arguments");
+
+	sub = find_subscriber(connection, sender);
+	if (sub != NULL) {
+		g_strfreev(sub->interfaces);
+		sub->interfaces = g_strdupv(interfaces);
+		dbus_free_string_array(interfaces);
+		return dbus_message_new_method_return(message);
+	}
+
+	sub = g_new0(struct subscriber, 1);
+	sub->conn = connection;
+	sub->name = g_strdup(sender);
+	sub->interfaces = g_strdupv(interfaces);
+	dbus_free_string_array(interfaces);
+
+	sub->watch = g_dbus_add_disconnect_watch(connection, sender,
+						subscriber_disconnect, sub,
+						subscriber_free);
+	if (sub->watch == 0) {
+		subscriber_free(sub);
+		return g_dbus_create_error(message, DBUS_ERROR_FAILED,
+							"Unable to watch");
+	}
+
+	subscribers = g_slist_prepend(subscribers, sub);
+
+	return dbus_message_new_method_return(message);
+}
+
+static DBusMessage *unsubscribe(DBusConnection *connection,
+				DBusMessage *message, void *user_data)
+{
+	struct subscriber *sub;
+
+	sub = find_subscriber(connection, dbus_message_get_sender(message));
+	if (sub == NULL)
+		return g_dbus_create_error(message, DBUS_ERROR_FAILED,
+							"Not subscribed");
+
+	remove_subscriber(sub);
+
+	return dbus_message_new_method_return(message);
+}
+
 static const GDBusMethodTable manager_methods[] = {
 	{ GDBUS_METHOD("GetManagedObjects", NULL,
 		GDBUS_ARGS({ "objects", "a{oa{sa{sv}}}" }), get_objects) },
 	{ }
 };
 
+static const GDBusMethodTable filter_methods[] = {
+	{ GDBUS_METHOD("GetFilteredObjects",
+		GDBUS_ARGS({ "filter", "a{sv}" }),
+		GDBUS_ARGS({ "objects", "a{oa{sa{sv}}}" }, { "next", "o" }),
+		get_filtered_objects) },
+	{ GDBUS_METHOD("Subscribe",
+		GDBUS_ARGS({ "interfaces", "as" }), NULL, subscribe) },
+	{ GDBUS_METHOD("Unsubscribe", NULL, NULL, unsubscribe) },
+	{ }
+};
+
 static const GDBusSignalTable manager_signals[] = {
 	{ GDBUS_SIGNAL("InterfacesAdded",
 		GDBUS_ARGS({ "object", "o" },
@@ -1201,8 +1914,10 @@ done:
 	iface = g_new0(struct interface_data, 1);
 	iface->name = g_strdup(name);
 	iface->methods = methods;
+	iface->method_index = method_index_ref(methods);
 	iface->signals = signals;
 	iface->properties = properties;
+	iface->xml = interface_xml_ref(iface);
 	iface->user_data = user_data;
 	iface->destroy = destroy;
 
@@ -1219,6 +1934,108 @@ done:
 	return TRUE;
 }
 
+static void update_children(DBusConnection *conn, const char *path, int delta)
+{
+	struct generic_data *data;
+	char *parent, *slash, *name;
+	int old, count;
+
+	parent = g_strdup(path);
+
+	/* Every registered ancestor lists the first component below it */
+	while ((slash = strrchr(parent, '/')) != NULL && slash[1] != '\0') {
+		name = g_strdup(slash + 1);
+
+		if (slash == parent)
+			parent[1] = '\0';
+		else
+			*slash = '\0';
+
+		data = NULL;
+		if (dbus_connection_get_object_path_data(conn, parent,
+						(void *) &data) && data) {
+			old = GPOINTER_TO_INT(g_hash_table_lookup(
+						data->children, name));
+			count = old + delta;
+			if (count > 0)
+				g_hash_table_insert(data->children,
+						g_strdup(name),
+						GINT_TO_POINTER(count));
+			else
+				g_hash_table_remove(data->children, name);
+
+			/* Only a new or removed name changes the XML */
+			if ((old > 0) != (count > 0)) {
+				g_free(data->introspect);
+				data->introspect = NULL;
+			}
+		}
+
+		g_free(name);
+	}
+
+	g_free(parent);
+}
+
+static unsigned int count_registered(DBusConnection *conn, const char *path)
+{
+	struct generic_data *data = NULL;
+	unsigned int count = 0;
+	char **children;
+	int i;
+
+	if (dbus_connection_get_object_path_data(conn, path,
+						(void *) &data) && data)
+		count++;
+
+	if (!dbus_connection_list_registered(conn, path, &children))
+		return count;
+
+	for (i = 0; children[i]; i++) {
+		char *child;
+
+		child = g_strconcat(path, path[1] ? "/" : "", children[i],
+									NULL);
+		count += count_registered(conn, child);
+		g_free(child);
+	}
+
+	dbus_free_string_array(children);
+
+	return count;
+}
+
+/*
+ * Objects are normally registered before their children, this only finds
+ * anything when a parent is registered after some of its descendants.
+ */
+static void seed_children(struct generic_data *data)
+{
+	char **children;
+	int i;
+
+	if (!dbus_connection_list_registered(data->conn, data->path,
+								&children))
+		return;
+
+	for (i = 0; children[i]; i++) {
+		unsigned int count;
+		char *child;
+
+		child = g_strconcat(data->path, data->path[1] ? "/" : "",
+							children[i], NULL);
+		count = count_registered(data->conn, child);
+		g_free(child);
+
+		if (count > 0)
+			g_hash_table_insert(data->children,
+						g_strdup(children[i]),
+						GINT_TO_POINTER(count));
+	}
+
+	dbus_free_string_array(children);
+}
+
 static struct generic_data *object_path_ref(DBusConnection *connection,
 							const char *path)
 {
@@ -1238,15 +2055,21 @@ static struct generic_data *object_path_ref(DBusConnection *connection,
 	data->refcount = 1;
 
 	data->introspect = g_strdup(DBUS_INTROSPECT_1_0_XML_DOCTYPE_DECL_NODE "<node></node>");
+	data->children = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
 
 	if (!dbus_connection_register_object_path(connection, path,
 						&generic_table, data)) {
+		g_hash_table_destroy(data->children);
 		g_free(data->introspect);
 		g_free(data);
 		return NULL;
 	}
 
+	seed_children(data);
+
 	invalidate_parent_data(connection, path);
+	update_children(connection, path, 1);
 
 	add_interface(data, DBUS_INTERFACE_INTROSPECTABLE, introspect_methods,
 						NULL, NULL, data, NULL);
@@ -1274,6 +2097,7 @@ static void object_path_unref(DBusConnection *connection, const char *path)
 	remove_interface(data, DBUS_INTERFACE_PROPERTIES);
 
 	invalidate_parent_data(data->conn, data->path);
+	update_children(data->conn, data->path, -1);
 
 	dbus_connection_unregister_object_path(data->conn, data->path);
 }
@@ -1664,6 +2488,7 @@ static void process_properties_from_interface(struct generic_data *data,
 	g_slist_free(invalidated);
 	dbus_message_iter_close_container(&iter, &array);
 
+	send_to_subscribers(data->conn, iface->name, signal);
 	g_dbus_send_message(data->conn, signal);
 
 	g_slist_free(iface->pending_prop);
@@ -1751,6 +2576,34 @@ gboolean g_dbus_get_properties(DBusConnection *connection, const char *path,
 	return TRUE;
 }
 
+/* The filter extension is only available with experimental support */
+static void update_object_filter(void)
+{
+	gboolean registered;
+
+	if (root == NULL)
+		return;
+
+	registered = find_interface(root->interfaces,
+					DBUS_INTERFACE_OBJECT_FILTER) != NULL;
+
+	if (global_flags & G_DBUS_FLAG_ENABLE_EXPERIMENTAL) {
+		if (!registered)
+			g_dbus_register_interface(root->conn, "/",
+						DBUS_INTERFACE_OBJECT_FILTER,
+						filter_methods, NULL, NULL,
+						root, NULL);
+		return;
+	}
+
+	while (subscribers != NULL)
+		remove_subscriber(subscribers->data);
+
+	if (registered)
+		g_dbus_unregister_interface(root->conn, "/",
+						DBUS_INTERFACE_OBJECT_FILTER);
+}
+
 gboolean g_dbus_attach_object_manager(DBusConnection *connection)
 {
 	struct generic_data *data;
@@ -1764,11 +2617,21 @@ gboolean g_dbus_attach_object_manager(DBusConnection *connection)
 					NULL, data, NULL);
 	root = data;
 
+	update_object_filter();
+
 	return TRUE;
 }
 
 gboolean g_dbus_detach_object_manager(DBusConnection *connection)
 {
+	while (subscribers != NULL)
+		remove_subscriber(subscribers->data);
+
+	if (root != NULL && find_interface(root->interfaces,
+					DBUS_INTERFACE_OBJECT_FILTER) != NULL)
+		g_dbus_unregister_interface(connection, "/",
+						DBUS_INTERFACE_OBJECT_FILTER);
+
 	if (!g_dbus_unregister_interface(connection, "/",
 					DBUS_INTERFACE_OBJECT_MANAGER))
 		return FALSE;
@@ -1778,7 +2641,22 @@ gboolean g_dbus_detach_object_manager(DBusConnection *connection)
 	return TRUE;
 }
 
+static void reset_interface_xml(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct interface_xml *xml = value;
+
+	g_free(xml->xml);
+	xml->xml = NULL;
+}
+
 void g_dbus_set_flags(int flags)
 {
 	global_flags = flags;
+
+	/* Experimental members may need to be shown or hidden now */
+	if (interface_xmls != NULL)
+		g_hash_table_foreach(interface_xmls, reset_interface_xml, NULL);
+
+	update_object_filter();
 }
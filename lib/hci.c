@@ -33,6 +33,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <sys/param.h>
 #include <sys/uio.h>
@@ -1080,150 +1081,526 @@ int hci_send_cmd(int dd, uint16_t ogf, uint16_t ocf, uint8_t plen, void *param)
 	return 0;
 }
 
-int hci_send_req(int dd, struct hci_request *r, int to)
+/* HCI command queue */
+
+struct hci_cmd {
+	unsigned int id;
+	uint16_t opcode;
+	int event;
+	uint8_t plen;
+	uint8_t param[HCI_MAX_EVENT_SIZE];
+	int status_seen;
+	uint64_t deadline;
+	hci_cmd_func_t func;
+	void *user_data;
+	struct hci_cmd *next;
+};
+
+struct hci_queue {
+	int dd;
+	struct hci_filter of;
+	struct hci_filter nf;
+	int credits;
+	unsigned int next_id;
+	struct hci_cmd *queued;
+	struct hci_cmd *sent;
+	int in_callback;
+	int destroyed;
+};
+
+static uint64_t hci_queue_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void hci_cmd_append(struct hci_cmd **list, struct hci_cmd *cmd)
+{
+	while (*list)
+		list = &(*list)->next;
+
+	cmd->next = NULL;
+	*list = cmd;
+}
+
+static struct hci_cmd *hci_cmd_unlink(struct hci_cmd **list,
+							struct hci_cmd *cmd)
 {
-	unsigned char buf[HCI_MAX_EVENT_SIZE], *ptr;
-	uint16_t opcode = htobs(cmd_opcode_pack(r->ogf, r->ocf));
-	struct hci_filter nf, of;
+	for (; *list; list = &(*list)->next) {
+		if (*list != cmd)
+			continue;
+
+		*list = cmd->next;
+		cmd->next = NULL;
+		return cmd;
+	}
+
+	return NULL;
+}
+
+static void hci_cmd_complete(struct hci_queue *q, struct hci_cmd *cmd,
+				int err, const void *param, uint8_t plen)
+{
+	hci_cmd_unlink(&q->sent, cmd);
+
+	if (cmd->func) {
+		q->in_callback++;
+		cmd->func(err, param, plen, cmd->user_data);
+		q->in_callback--;
+	}
+
+	free(cmd);
+}
+
+struct hci_queue *hci_queue_new(int dd)
+{
+	struct hci_queue *q;
 	socklen_t olen;
-	hci_event_hdr *hdr;
-	int err, try;
 
-	olen = sizeof(of);
-	if (getsockopt(dd, SOL_HCI, HCI_FILTER, &of, &olen) < 0)
-		return -1;
+	q = malloc(sizeof(*q));
+	if (!q)
+		return NULL;
 
-	hci_filter_clear(&nf);
-	hci_filter_set_ptype(HCI_EVENT_PKT,  &nf);
-	hci_filter_set_event(EVT_CMD_STATUS, &nf);
-	hci_filter_set_event(EVT_CMD_COMPLETE, &nf);
-	hci_filter_set_event(EVT_LE_META_EVENT, &nf);
-	hci_filter_set_event(r->event, &nf);
-	hci_filter_set_opcode(opcode, &nf);
-	if (setsockopt(dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0)
-		return -1;
+	memset(q, 0, sizeof(*q));
+	q->dd = dd;
+
+	/* Until the controller reports its credits assume just one */
+	q->credits = 1;
 
-	if (hci_send_cmd(dd, r->ogf, r->ocf, r->clen, r->cparam) < 0)
+	olen = sizeof(q->of);
+	if (getsockopt(dd, SOL_HCI, HCI_FILTER, &q->of, &olen) < 0)
 		goto failed;
 
-	try = 10;
-	while (try--) {
-		evt_cmd_complete *cc;
-		evt_cmd_status *cs;
-		evt_remote_name_req_complete *rn;
-		evt_le_meta_event *me;
-		remote_name_req_cp *cp;
-		int len;
-
-		if (to) {
-			struct pollfd p;
-			int n;
-
-			p.fd = dd; p.events = POLLIN;
-			while ((n = poll(&p, 1, to)) < 0) {
-				if (errno == EAGAIN || errno == EINTR)
-					continue;
-				goto failed;
-			}
+	hci_filter_clear(&q->nf);
+	hci_filter_set_ptype(HCI_EVENT_PKT, &q->nf);
+	hci_filter_set_event(EVT_CMD_STATUS, &q->nf);
+	hci_filter_set_event(EVT_CMD_COMPLETE, &q->nf);
+	hci_filter_set_event(EVT_LE_META_EVENT, &q->nf);
+	if (setsockopt(dd, SOL_HCI, HCI_FILTER, &q->nf, sizeof(q->nf)) < 0)
+		goto failed;
+
+	return q;
+
+failed:
+	free(q);
+	return NULL;
+}
+
+static void hci_queue_destroy(struct hci_queue *q)
+{
+	struct hci_cmd *cmd;
+	int err = errno;
+
+	while ((cmd = q->queued)) {
+		q->queued = cmd->next;
+		free(cmd);
+	}
+
+	while ((cmd = q->sent)) {
+		q->sent = cmd->next;
+		free(cmd);
+	}
+
+	setsockopt(q->dd, SOL_HCI, HCI_FILTER, &q->of, sizeof(q->of));
+	free(q);
+
+	errno = err;
+}
+
+void hci_queue_free(struct hci_queue *q)
+{
+	/* Freed from a completion callback, finish once it returns */
+	if (q->in_callback) {
+		q->destroyed = 1;
+		return;
+	}
 
-			if (!n) {
-				errno = ETIMEDOUT;
-				goto failed;
+	hci_queue_destroy(q);
+}
+
+int hci_queue_fd(struct hci_queue *q)
+{
+	return q->dd;
+}
+
+static void hci_queue_flush(struct hci_queue *q)
+{
+	struct hci_cmd *cmd;
+	uint16_t opcode;
+
+	while (q->credits > 0 && (cmd = q->queued)) {
+		q->queued = cmd->next;
+		cmd->next = NULL;
+
+		opcode = btohs(cmd->opcode);
+		if (hci_send_cmd(q->dd, cmd_opcode_ogf(opcode),
+					cmd_opcode_ocf(opcode), cmd->plen,
+					cmd->param) < 0) {
+			if (cmd->func) {
+				q->in_callback++;
+				cmd->func(-errno, NULL, 0, cmd->user_data);
+				q->in_callback--;
 			}
+			free(cmd);
 
-			to -= 10;
-			if (to < 0)
-				to = 0;
+			if (q->destroyed)
+				return;
 
+			continue;
 		}
 
-		while ((len = read(dd, buf, sizeof(buf))) < 0) {
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
-			goto failed;
+		q->credits--;
+
+		if (cmd->deadline)
+			cmd->deadline += hci_queue_now();
+
+		hci_cmd_append(&q->sent, cmd);
+	}
+}
+
+int hci_queue_send(struct hci_queue *q, uint16_t ogf, uint16_t ocf, int event,
+				void *param, uint8_t plen, int to,
+				hci_cmd_func_t func, void *user_data)
+{
+	struct hci_cmd *cmd;
+	unsigned int id;
+
+	cmd = malloc(sizeof(*cmd));
+	if (!cmd)
+		return -1;
+
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->opcode = htobs(cmd_opcode_pack(ogf, ocf));
+	cmd->event = event;
+	cmd->plen = plen;
+	if (plen)
+		memcpy(cmd->param, param, plen);
+	cmd->deadline = to > 0 ? to : 0;
+	cmd->func = func;
+	cmd->user_data = user_data;
+
+	if (++q->next_id == 0)
+		q->next_id = 1;
+	cmd->id = id = q->next_id;
+
+	if (!hci_filter_test_event(event, &q->nf)) {
+		hci_filter_set_event(event, &q->nf);
+		if (setsockopt(q->dd, SOL_HCI, HCI_FILTER, &q->nf,
+						sizeof(q->nf)) < 0) {
+			free(cmd);
+			return -1;
 		}
+	}
 
-		hdr = (void *) (buf + 1);
-		ptr = buf + (1 + HCI_EVENT_HDR_SIZE);
-		len -= (1 + HCI_EVENT_HDR_SIZE);
+	hci_cmd_append(&q->queued, cmd);
 
-		switch (hdr->evt) {
-		case EVT_CMD_STATUS:
-			cs = (void *) ptr;
+	/* A failed send completes at once, its callback may free the queue */
+	q->in_callback++;
+	hci_queue_flush(q);
+	q->in_callback--;
 
-			if (cs->opcode != opcode)
-				continue;
+	if (q->destroyed && !q->in_callback)
+		hci_queue_destroy(q);
 
-			if (r->event != EVT_CMD_STATUS) {
-				if (cs->status) {
-					errno = EIO;
-					goto failed;
-				}
-				break;
-			}
+	return id;
+}
 
-			r->rlen = MIN(len, r->rlen);
-			memcpy(r->rparam, ptr, r->rlen);
-			goto done;
+int hci_queue_cancel(struct hci_queue *q, unsigned int id)
+{
+	struct hci_cmd *cmd;
 
-		case EVT_CMD_COMPLETE:
-			cc = (void *) ptr;
+	for (cmd = q->queued; cmd; cmd = cmd->next) {
+		if (cmd->id != id)
+			continue;
 
-			if (cc->opcode != opcode)
-				continue;
+		hci_cmd_unlink(&q->queued, cmd);
+		free(cmd);
+		return 0;
+	}
 
-			ptr += EVT_CMD_COMPLETE_SIZE;
-			len -= EVT_CMD_COMPLETE_SIZE;
+	/* Already sent, its credit comes back with the completion */
+	for (cmd = q->sent; cmd; cmd = cmd->next) {
+		if (cmd->id != id)
+			continue;
 
-			r->rlen = MIN(len, r->rlen);
-			memcpy(r->rparam, ptr, r->rlen);
-			goto done;
+		cmd->func = NULL;
+		return 0;
+	}
 
-		case EVT_REMOTE_NAME_REQ_COMPLETE:
-			if (hdr->evt != r->event)
-				break;
+	errno = ENOENT;
+	return -1;
+}
 
-			rn = (void *) ptr;
-			cp = r->cparam;
+int hci_queue_pending(struct hci_queue *q)
+{
+	struct hci_cmd *cmd;
+	int count = 0;
+
+	for (cmd = q->queued; cmd; cmd = cmd->next)
+		count++;
+
+	for (cmd = q->sent; cmd; cmd = cmd->next)
+		count++;
+
+	return count;
+}
+
+int hci_queue_timeout(struct hci_queue *q)
+{
+	struct hci_cmd *cmd;
+	uint64_t now, next = 0;
+
+	for (cmd = q->sent; cmd; cmd = cmd->next) {
+		if (!cmd->deadline)
+			continue;
+
+		if (!next || cmd->deadline < next)
+			next = cmd->deadline;
+	}
+
+	if (!next)
+		return -1;
+
+	now = hci_queue_now();
+
+	return next > now ? next - now : 0;
+}
+
+static struct hci_cmd *hci_queue_find(struct hci_queue *q, uint16_t opcode)
+{
+	struct hci_cmd *cmd;
+
+	for (cmd = q->sent; cmd; cmd = cmd->next) {
+		if (cmd->opcode == opcode)
+			return cmd;
+	}
+
+	return NULL;
+}
+
+static struct hci_cmd *hci_queue_find_event(struct hci_queue *q, int event,
+							int le, const void *ptr)
+{
+	struct hci_cmd *cmd;
+
+	for (cmd = q->sent; cmd; cmd = cmd->next) {
+		uint16_t ogf = cmd_opcode_ogf(btohs(cmd->opcode));
+
+		/* Only commands the controller accepted wait for events */
+		if (!cmd->status_seen || cmd->event != event)
+			continue;
+
+		/* LE subevent codes overlap with the regular event codes */
+		if (le != (ogf == OGF_LE_CTL))
+			continue;
+
+		if (event == EVT_REMOTE_NAME_REQ_COMPLETE) {
+			const evt_remote_name_req_complete *rn = ptr;
+			const remote_name_req_cp *cp = (void *) cmd->param;
 
 			if (bacmp(&rn->bdaddr, &cp->bdaddr))
 				continue;
+		}
 
-			r->rlen = MIN(len, r->rlen);
-			memcpy(r->rparam, ptr, r->rlen);
-			goto done;
+		return cmd;
+	}
+
+	return NULL;
+}
+
+static void hci_queue_event(struct hci_queue *q, unsigned char *buf, int len)
+{
+	hci_event_hdr *hdr = (void *) (buf + 1);
+	unsigned char *ptr = buf + (1 + HCI_EVENT_HDR_SIZE);
+	evt_cmd_complete *cc;
+	evt_cmd_status *cs;
+	evt_le_meta_event *me;
+	struct hci_cmd *cmd;
+
+	len -= (1 + HCI_EVENT_HDR_SIZE);
+	if (buf[0] != HCI_EVENT_PKT || len < 0)
+		return;
+
+	switch (hdr->evt) {
+	case EVT_CMD_STATUS:
+		if (len < EVT_CMD_STATUS_SIZE)
+			return;
+
+		cs = (void *) ptr;
+		q->credits = cs->ncmd;
+
+		cmd = hci_queue_find(q, cs->opcode);
+		if (!cmd)
+			return;
+
+		if (cmd->event == EVT_CMD_STATUS)
+			hci_cmd_complete(q, cmd, 0, ptr, len);
+		else if (cs->status)
+			hci_cmd_complete(q, cmd, -EIO, ptr, len);
+		else
+			cmd->status_seen = 1;
+
+		return;
+
+	case EVT_CMD_COMPLETE:
+		if (len < EVT_CMD_COMPLETE_SIZE)
+			return;
+
+		cc = (void *) ptr;
+		q->credits = cc->ncmd;
+
+		cmd = hci_queue_find(q, cc->opcode);
+		if (!cmd)
+			return;
+
+		hci_cmd_complete(q, cmd, 0, ptr + EVT_CMD_COMPLETE_SIZE,
+						len - EVT_CMD_COMPLETE_SIZE);
+		return;
+
+	case EVT_LE_META_EVENT:
+		if (len < 1)
+			return;
+
+		me = (void *) ptr;
+
+		cmd = hci_queue_find_event(q, me->subevent, 1, me->data);
+		if (cmd)
+			hci_cmd_complete(q, cmd, 0, me->data, len - 1);
+
+		return;
+
+	default:
+		cmd = hci_queue_find_event(q, hdr->evt, 0, ptr);
+		if (cmd)
+			hci_cmd_complete(q, cmd, 0, ptr, len);
+
+		return;
+	}
+}
 
-		case EVT_LE_META_EVENT:
-			me = (void *) ptr;
+int hci_queue_process(struct hci_queue *q)
+{
+	unsigned char buf[HCI_MAX_EVENT_SIZE];
+	struct hci_cmd *cmd, *next;
+	uint64_t now;
+	int len, err = 0;
+
+	q->in_callback++;
 
-			if (me->subevent != r->event)
+	while (1) {
+		len = recv(q->dd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
 				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			err = -1;
+			goto done;
+		}
 
-			len -= 1;
-			r->rlen = MIN(len, r->rlen);
-			memcpy(r->rparam, me->data, r->rlen);
+		hci_queue_event(q, buf, len);
+		if (q->destroyed)
 			goto done;
+	}
 
-		default:
-			if (hdr->evt != r->event)
-				break;
+	now = hci_queue_now();
 
-			r->rlen = MIN(len, r->rlen);
-			memcpy(r->rparam, ptr, r->rlen);
+	for (cmd = q->sent; cmd; cmd = next) {
+		next = cmd->next;
+
+		if (!cmd->deadline || cmd->deadline > now)
+			continue;
+
+		/*
+		 * The controller never answered, so it won't return the
+		 * credit either. Assume one is available again, like the
+		 * kernel does on command timeouts.
+		 */
+		if (q->credits < 1)
+			q->credits = 1;
+
+		hci_cmd_complete(q, cmd, -ETIMEDOUT, NULL, 0);
+		if (q->destroyed)
 			goto done;
-		}
 	}
-	errno = ETIMEDOUT;
 
-failed:
-	err = errno;
-	setsockopt(dd, SOL_HCI, HCI_FILTER, &of, sizeof(of));
-	errno = err;
-	return -1;
+	hci_queue_flush(q);
 
 done:
-	setsockopt(dd, SOL_HCI, HCI_FILTER, &of, sizeof(of));
+	q->in_callback--;
+
+	if (q->destroyed && !q->in_callback)
+		hci_queue_destroy(q);
+
+	return err;
+}
+
+struct hci_send_req_data {
+	struct hci_request *r;
+	int done;
+	int err;
+};
+
+static void hci_send_req_complete(int err, const void *param, uint8_t plen,
+							void *user_data)
+{
+	struct hci_send_req_data *data = user_data;
+
+	data->done = 1;
+	data->err = err;
+
+	if (err < 0)
+		return;
+
+	data->r->rlen = MIN(plen, data->r->rlen);
+	memcpy(data->r->rparam, param, data->r->rlen);
+}
+
+int hci_send_req(int dd, struct hci_request *r, int to)
+{
+	struct hci_send_req_data data;
+	struct hci_queue *q;
+	struct pollfd p;
+	int n;
+
+	q = hci_queue_new(dd);
+	if (!q)
+		return -1;
+
+	memset(&data, 0, sizeof(data));
+	data.r = r;
+
+	if (hci_queue_send(q, r->ogf, r->ocf, r->event, r->cparam, r->clen,
+				to, hci_send_req_complete, &data) < 0)
+		goto failed;
+
+	while (!data.done) {
+		p.fd = dd; p.events = POLLIN;
+		n = poll(&p, 1, hci_queue_timeout(q));
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			goto failed;
+		}
+
+		if (hci_queue_process(q) < 0)
+			goto failed;
+	}
+
+	if (data.err < 0) {
+		errno = -data.err;
+		goto failed;
+	}
+
+	hci_queue_free(q);
 	return 0;
+
+failed:
+	hci_queue_free(q);
+	return -1;
 }
 
 int hci_create_connection(int dd, const bdaddr_t *bdaddr, uint16_t ptype,
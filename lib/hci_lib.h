@@ -53,6 +53,22 @@ int hci_close_dev(int dd);
 int hci_send_cmd(int dd, uint16_t ogf, uint16_t ocf, uint8_t plen, void *param);
 int hci_send_req(int dd, struct hci_request *req, int timeout);
 
+struct hci_queue;
+
+typedef void (*hci_cmd_func_t)(int err, const void *param, uint8_t plen,
+							void *user_data);
+
+struct hci_queue *hci_queue_new(int dd);
+void hci_queue_free(struct hci_queue *q);
+int hci_queue_fd(struct hci_queue *q);
+int hci_queue_send(struct hci_queue *q, uint16_t ogf, uint16_t ocf, int event,
+				void *param, uint8_t plen, int to,
+				hci_cmd_func_t func, void *user_data);
+int hci_queue_cancel(struct hci_queue *q, unsigned int id);
+int hci_queue_pending(struct hci_queue *q);
+int hci_queue_timeout(struct hci_queue *q);
+int hci_queue_process(struct hci_queue *q);
+
 int hci_create_connection(int dd, const bdaddr_t *bdaddr, uint16_t ptype, uint16_t clkoffset, uint8_t rswitch, uint16_t *handle, int to);
 int hci_disconnect(int dd, uint16_t handle, uint8_t reason, int to);
 
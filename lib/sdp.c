@@ -70,7 +70,7 @@ static uint128_t bluetooth_base_uuid = {
 static sdp_data_t *sdp_copy_seq(sdp_data_t *data);
 static int sdp_attr_add_new_with_length(sdp_record_t *rec,
 	uint16_t attr, uint8_t dtd, const void *value, uint32_t len);
-static int sdp_gen_buffer(sdp_buf_t *buf, sdp_data_t *d);
+static uint32_t sdp_gen_size(sdp_data_t *d);
 
 /* Message structure. */
 struct tupla {
@@ -672,22 +672,18 @@ void sdp_set_attrid(sdp_buf_t *buf, uint16_t attr)
 	buf->data_size += sizeof(uint16_t);
 }
 
-static int get_data_size(sdp_buf_t *buf, sdp_data_t *sdpdata)
+static uint32_t get_data_size(sdp_data_t *sdpdata)
 {
 	sdp_data_t *d;
-	int n = 0;
+	uint32_t n = 0;
 
-	for (d = sdpdata->val.dataseq; d; d = d->next) {
-		if (buf->data)
-			n += sdp_gen_pdu(buf, d);
-		else
-			n += sdp_gen_buffer(buf, d);
-	}
+	for (d = sdpdata->val.dataseq; d; d = d->next)
+		n += sdp_gen_size(d);
 
 	return n;
 }
 
-static int sdp_get_data_size(sdp_buf_t *buf, sdp_data_t *d)
+static uint32_t sdp_get_data_size(sdp_data_t *d)
 {
 	uint32_t data_size = 0;
 	uint8_t dtd = d->dtd;
@@ -737,12 +733,12 @@ static int sdp_get_data_size(sdp_buf_t *buf, sdp_data_t *d)
 	case SDP_SEQ8:
 	case SDP_SEQ16:
 	case SDP_SEQ32:
-		data_size = get_data_size(buf, d);
+		data_size = get_data_size(d);
 		break;
 	case SDP_ALT8:
 	case SDP_ALT16:
 	case SDP_ALT32:
-		data_size = get_data_size(buf, d);
+		data_size = get_data_size(d);
 		break;
 	case SDP_UUID16:
 		data_size = sizeof(uint16_t);
@@ -760,28 +756,18 @@ static int sdp_get_data_size(sdp_buf_t *buf, sdp_data_t *d)
 	return data_size;
 }
 
-static int sdp_gen_buffer(sdp_buf_t *buf, sdp_data_t *d)
+/*
+ * Exact encoded size of a data element including its header, taking into
+ * account the promotion of oversized SEQ8 done by sdp_gen_pdu().
+ */
+static uint32_t sdp_gen_size(sdp_data_t *d)
 {
-	int orig = buf->buf_size;
-
-	if (buf->buf_size == 0 && d->dtd == 0) {
-		/* create initial sequence */
-		buf->buf_size += sizeof(uint8_t);
-
-		/* reserve space for sequence size */
-		buf->buf_size += sizeof(uint8_t);
-	}
-
-	/* attribute length */
-	buf->buf_size += sizeof(uint8_t) + sizeof(uint16_t);
+	uint32_t data_size = sdp_get_data_size(d);
 
-	buf->buf_size += sdp_get_data_type_size(d->dtd);
-	buf->buf_size += sdp_get_data_size(buf, d);
+	if (data_size > UCHAR_MAX && d->dtd == SDP_SEQ8)
+		return sdp_get_data_type_size(SDP_SEQ16) + data_size;
 
-	if (buf->buf_size > UCHAR_MAX && d->dtd == SDP_SEQ8)
-		buf->buf_size += sizeof(uint8_t);
-
-	return buf->buf_size - orig;
+	return sdp_get_data_type_size(d->dtd) + data_size;
 }
 
 int sdp_gen_pdu(sdp_buf_t *buf, sdp_data_t *d)
@@ -793,18 +779,27 @@ int sdp_gen_pdu(sdp_buf_t *buf, sdp_data_t *d)
 	uint64_t u64;
 	uint128_t u128;
 	uint8_t *seqp = buf->data + buf->data_size;
-	uint32_t orig_data_size = buf->data_size;
+	sdp_data_t *child;
 
-recalculate:
 	pdu_size = sdp_get_data_type_size(d->dtd);
 	buf->data_size += pdu_size;
 
-	data_size = sdp_get_data_size(buf, d);
-	if (data_size > UCHAR_MAX && d->dtd == SDP_SEQ8) {
-		buf->data_size = orig_data_size;
-		d->dtd = SDP_SEQ16;
-		goto recalculate;
-	}
+	if (d->dtd >= SDP_SEQ8 && d->dtd <= SDP_ALT32) {
+		/* Children are encoded in place right after the header */
+		data_size = 0;
+		for (child = d->val.dataseq; child; child = child->next)
+			data_size += sdp_gen_pdu(buf, child);
+
+		if (data_size > UCHAR_MAX && d->dtd == SDP_SEQ8) {
+			memmove(seqp + sdp_get_data_type_size(SDP_SEQ16),
+						seqp + pdu_size, data_size);
+			d->dtd = SDP_SEQ16;
+			pdu_size = sdp_get_data_type_size(SDP_SEQ16);
+			buf->data_size = seqp - buf->data + pdu_size +
+								data_size;
+		}
+	} else
+		data_size = sdp_get_data_size(d);
 
 	*seqp = d->dtd;
 
@@ -900,20 +895,26 @@ recalculate:
 	return pdu_size;
 }
 
-static void sdp_attr_pdu(void *value, void *udata)
-{
-	sdp_append_to_pdu((sdp_buf_t *)udata, (sdp_data_t *)value);
-}
-
-static void sdp_attr_size(void *value, void *udata)
-{
-	sdp_gen_buffer((sdp_buf_t *)udata, (sdp_data_t *)value);
-}
-
 int sdp_gen_record_pdu(const sdp_record_t *rec, sdp_buf_t *buf)
 {
+	sdp_list_t *l;
+	uint32_t size = 0;
+	int hdr_size;
+
 	memset(buf, 0, sizeof(sdp_buf_t));
-	sdp_list_foreach(rec->attrlist, sdp_attr_size, buf);
+
+	for (l = rec->attrlist; l; l = l->next)
+		size += sizeof(uint8_t) + sizeof(uint16_t) +
+						sdp_gen_size(l->data);
+
+	/* Same header selection as sdp_append_to_buf() */
+	if (size + sdp_get_data_type_size(SDP_SEQ8) > UCHAR_MAX)
+		hdr_size = sdp_get_data_type_size(SDP_SEQ16);
+	else
+		hdr_size = sdp_get_data_type_size(SDP_SEQ8);
+
+	if (size > 0)
+		buf->buf_size = hdr_size + size;
 
 	buf->data = malloc(buf->buf_size);
 	if (!buf->data)
@@ -921,7 +922,25 @@ int sdp_gen_record_pdu(const sdp_record_t *rec, sdp_buf_t *buf)
 	buf->data_size = 0;
 	memset(buf->data, 0, buf->buf_size);
 
-	sdp_list_foreach(rec->attrlist, sdp_attr_pdu, buf);
+	if (size == 0)
+		return 0;
+
+	buf->data_size = hdr_size;
+
+	for (l = rec->attrlist; l; l = l->next) {
+		sdp_data_t *d = l->data;
+		uint8_t *p = buf->data + buf->data_size;
+
+		*p++ = SDP_UINT16;
+		bt_put_be16(d->attrId, p);
+		buf->data_size += sizeof(uint8_t) + sizeof(uint16_t);
+
+		sdp_gen_pdu(buf, d);
+	}
+
+	buf->data[0] = hdr_size == sdp_get_data_type_size(SDP_SEQ8) ?
+							SDP_SEQ8 : SDP_SEQ16;
+	sdp_set_seq_len(buf->data, buf->data_size - hdr_size);
 
 	return 0;
 }
@@ -1397,6 +1416,7 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 	uint8_t dtd;
 	uint16_t attr;
 	sdp_record_t *rec = sdp_record_alloc();
+	sdp_list_t *tail = NULL;
 	const uint8_t *p = buf;
 
 	*scanned = sdp_extract_seqtype(buf, bufsize, &dtd, &seqlen);
@@ -1441,7 +1461,34 @@ sdp_record_t *sdp_extract_pdu(const uint8_t *buf, int bufsize, int *scanned)
 		extracted += n;
 		p += n;
 		bufsize -= n;
-		sdp_attr_replace(rec, attr, data);
+
+		/*
+		 * Attributes are sent in ascending order, so they can be
+		 * appended without searching the list for the right place.
+		 */
+		if (!tail || attr > ((sdp_data_t *) tail->data)->attrId) {
+			sdp_list_t *l = malloc(sizeof(sdp_list_t));
+
+			if (!l) {
+				sdp_data_free(data);
+				break;
+			}
+
+			data->attrId = attr;
+			l->data = data;
+			l->next = NULL;
+
+			if (tail)
+				tail->next = l;
+			else
+				rec->attrlist = l;
+			tail = l;
+		} else {
+			sdp_attr_replace(rec, attr, data);
+
+			for (tail = rec->attrlist; tail->next;
+							tail = tail->next);
+		}
 
 		SDPDBG("Extract PDU, seqLength: %d localExtractedLength: %d",
 							seqlen, extracted);
@@ -2864,7 +2911,7 @@ void sdp_append_to_pdu(sdp_buf_t *pdu, sdp_data_t *d)
 	sdp_buf_t append;
 
 	memset(&append, 0, sizeof(sdp_buf_t));
-	sdp_gen_buffer(&append, d);
+	append.buf_size = sizeof(uint8_t) + sizeof(uint16_t) + sdp_gen_size(d);
 	append.data = malloc(append.buf_size);
 	if (!append.data)
 		return;
@@ -3211,15 +3258,54 @@ void sdp_record_free(sdp_record_t *rec)
 
 void sdp_pattern_add_uuid(sdp_record_t *rec, uuid_t *uuid)
 {
-	uuid_t *uuid128 = sdp_uuid_to_uuid128(uuid);
+	sdp_list_t *p, *q, *n;
+	uuid_t uuid128;
+	int cmp;
+
+	memset(&uuid128, 0, sizeof(uuid_t));
+	switch (uuid->type) {
+	case SDP_UUID128:
+		uuid128 = *uuid;
+		break;
+	case SDP_UUID32:
+		sdp_uuid32_to_uuid128(&uuid128, uuid);
+		break;
+	case SDP_UUID16:
+		sdp_uuid16_to_uuid128(&uuid128, uuid);
+		break;
+	}
 
 	SDPDBG("Elements in target pattern : %d", sdp_list_len(rec->pattern));
-	SDPDBG("Trying to add : 0x%lx", (unsigned long) uuid128);
 
-	if (sdp_list_find(rec->pattern, uuid128, sdp_uuid128_cmp) == NULL)
-		rec->pattern = sdp_list_insert_sorted(rec->pattern, uuid128, sdp_uuid128_cmp);
+	/*
+	 * The pattern is sorted, so a single walk both detects duplicates
+	 * and finds the insertion point. Only new entries get allocated.
+	 */
+	for (q = NULL, p = rec->pattern; p; q = p, p = p->next) {
+		cmp = sdp_uuid128_cmp(p->data, &uuid128);
+		if (cmp == 0)
+			return;
+		if (cmp > 0)
+			break;
+	}
+
+	n = malloc(sizeof(sdp_list_t));
+	if (!n)
+		return;
+
+	n->data = bt_malloc(sizeof(uuid_t));
+	if (!n->data) {
+		free(n);
+		return;
+	}
+
+	memcpy(n->data, &uuid128, sizeof(uuid_t));
+	n->next = p;
+
+	if (q)
+		q->next = n;
 	else
-		bt_free(uuid128);
+		rec->pattern = n;
 
 	SDPDBG("Elements in target pattern : %d", sdp_list_len(rec->pattern));
 }
@@ -3304,7 +3390,7 @@ static int gen_dataseq_pdu(uint8_t *dst, const sdp_list_t *seq, uint8_t dtd)
 	}
 
 	memset(&buf, 0, sizeof(sdp_buf_t));
-	sdp_gen_buffer(&buf, dataseq);
+	buf.buf_size = sdp_gen_size(dataseq);
 	buf.data = malloc(buf.buf_size);
 
 	if (!buf.data) {
@@ -0,0 +1,1015 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "bt.h"
+#include "packet.h"
+#include "analyze.h"
+
+#define HASH_TABLE_MIN		16
+#define MAX_PENDING_CMDS	8
+#define CREDIT_RING_SIZE	64
+
+#define LINK_TYPE_BREDR		0x00
+#define LINK_TYPE_LE		0x01
+#define LINK_TYPE_UNKNOWN	0xff
+
+/*
+ * Minimal chained hash table keyed by 64-bit integers. Entries embed
+ * struct hash_entry as their first member and are allocated on lookup.
+ */
+struct hash_entry {
+	struct hash_entry *next;
+	uint64_t key;
+};
+
+struct hash_table {
+	struct hash_entry **buckets;
+	unsigned int size;
+	unsigned int count;
+	size_t entry_size;
+};
+
+struct latency {
+	unsigned int count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+};
+
+struct chan_stats {
+	struct chan_stats *next;
+	uint16_t cid;
+	unsigned int frames[2];
+	uint64_t bytes[2];
+};
+
+struct conn_stats {
+	struct hash_entry entry;
+	struct conn_stats *closed_next;
+	uint16_t index;
+	uint16_t handle;
+	uint8_t type;
+	uint8_t addr_type;
+	uint8_t addr[6];
+	bool has_addr;
+	uint64_t start;
+	uint64_t end;
+	unsigned int packets[2];
+	uint64_t bytes[2];
+	uint64_t first_data;
+	uint64_t last_data;
+	struct chan_stats *chans;
+	struct chan_stats *cur_chan[2];
+	unsigned int in_flight;
+	unsigned int max_in_flight;
+	uint64_t sent[CREDIT_RING_SIZE];
+	unsigned int sent_head;
+	unsigned int sent_count;
+	struct latency completion;
+};
+
+struct cmd_stats {
+	struct hash_entry entry;
+	uint16_t opcode;
+	unsigned int count;
+	unsigned int failed;
+	struct latency latency;
+};
+
+struct adv_stats {
+	struct hash_entry entry;
+	uint16_t index;
+	uint8_t addr_type;
+	uint8_t addr[6];
+	unsigned int count;
+	uint64_t first;
+	uint64_t last;
+	int64_t rssi_total;
+	int8_t rssi_min;
+	int8_t rssi_max;
+};
+
+struct pending_cmd {
+	uint16_t opcode;
+	uint64_t time;
+};
+
+struct buffer_pool {
+	unsigned int max_pkt;
+	unsigned int in_flight;
+	uint64_t stall_start;
+	unsigned int stalls;
+	uint64_t stall_time;
+};
+
+struct index_stats {
+	bool seen;
+	unsigned int commands;
+	unsigned int events;
+	unsigned int acl[2];
+	struct pending_cmd cmds[MAX_PENDING_CMDS];
+	unsigned int num_cmds;
+	struct buffer_pool acl_pool;
+	struct buffer_pool le_pool;
+};
+
+static struct hash_table conn_table = { .entry_size = sizeof(struct conn_stats) };
+static struct hash_table cmd_table = { .entry_size = sizeof(struct cmd_stats) };
+static struct hash_table adv_table = { .entry_size = sizeof(struct adv_stats) };
+
+static struct conn_stats *closed_conns;
+
+static struct index_stats *index_list;
+static unsigned int index_count;
+
+static uint64_t first_time;
+static uint64_t last_time;
+static unsigned long long total_frames;
+
+static unsigned int hash_bucket(uint64_t key, unsigned int size)
+{
+	return ((key * 0x9e3779b97f4a7c15ull) >> 32) & (size - 1);
+}
+
+static void hash_grow(struct hash_table *table)
+{
+	struct hash_entry **buckets;
+	unsigned int i, size;
+
+	size = table->size ? table->size * 2 : HASH_TABLE_MIN;
+
+	buckets = calloc(size, sizeof(*buckets));
+	if (!buckets)
+		return;
+
+	for (i = 0; i < table->size; i++) {
+		struct hash_entry *entry = table->buckets[i];
+
+		while (entry) {
+			struct hash_entry *next = entry->next;
+			unsigned int n = hash_bucket(entry->key, size);
+
+			entry->next = buckets[n];
+			buckets[n] = entry;
+			entry = next;
+		}
+	}
+
+	free(table->buckets);
+	table->buckets = buckets;
+	table->size = size;
+}
+
+static void *hash_lookup(struct hash_table *table, uint64_t key, bool create)
+{
+	struct hash_entry *entry;
+	unsigned int n;
+
+	if (table->size) {
+		n = hash_bucket(key, table->size);
+
+		for (entry = table->buckets[n]; entry; entry = entry->next) {
+			if (entry->key == key)
+				return entry;
+		}
+	}
+
+	if (!create)
+		return NULL;
+
+	if (table->count >= table->size)
+		hash_grow(table);
+
+	if (!table->size)
+		return NULL;
+
+	entry = calloc(1, table->entry_size);
+	if (!entry)
+		return NULL;
+
+	entry->key = key;
+
+	n = hash_bucket(key, table->size);
+	entry->next = table->buckets[n];
+	table->buckets[n] = entry;
+	table->count++;
+
+	return entry;
+}
+
+static void *hash_remove(struct hash_table *table, uint64_t key)
+{
+	struct hash_entry **p, *entry;
+
+	if (!table->size)
+		return NULL;
+
+	for (p = &table->buckets[hash_bucket(key, table->size)]; *p;
+							p = &(*p)->next) {
+		entry = *p;
+
+		if (entry->key == key) {
+			*p = entry->next;
+			table->count--;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/* Returns a newly allocated array with all entries of the table */
+static void **hash_entries(struct hash_table *table, unsigned int extra)
+{
+	struct hash_entry *entry;
+	void **entries;
+	unsigned int i, n = 0;
+
+	entries = calloc(table->count + extra + 1, sizeof(void *));
+	if (!entries)
+		return NULL;
+
+	for (i = 0; i < table->size; i++) {
+		for (entry = table->buckets[i]; entry; entry = entry->next)
+			entries[n++] = entry;
+	}
+
+	return entries;
+}
+
+static void latency_add(struct latency *latency, uint64_t value)
+{
+	if (!latency->count || value < latency->min)
+		latency->min = value;
+
+	if (value > latency->max)
+		latency->max = value;
+
+	latency->count++;
+	latency->total += value;
+}
+
+static struct index_stats *get_index(uint16_t index)
+{
+	struct index_stats *list;
+	unsigned int count;
+
+	if (index < index_count)
+		return &index_list[index];
+
+	count = index + 1;
+
+	list = realloc(index_list, count * sizeof(*list));
+	if (!list)
+		return NULL;
+
+	memset(list + index_count, 0,
+			(count - index_count) * sizeof(*list));
+
+	index_list = list;
+	index_count = count;
+
+	return &index_list[index];
+}
+
+static uint64_t conn_key(uint16_t index, uint16_t handle)
+{
+	return ((uint64_t) index << 16) | handle;
+}
+
+/*
+ * The address takes 48 bits and the LE address type 2 bits, leaving 14
+ * bits for the controller index. Higher indexes are never used in
+ * practice, mask them so they cannot spill into the other fields.
+ */
+static uint64_t adv_key(uint16_t index, uint8_t addr_type,
+							const uint8_t *addr)
+{
+	return ((uint64_t) (index & 0x3fff) << 50) |
+			((uint64_t) (addr_type & 0x03) << 48) |
+			((uint64_t) bt_get_le16(addr + 4) << 32) |
+			bt_get_le32(addr);
+}
+
+static struct conn_stats *get_conn(uint16_t index, uint16_t handle,
+							uint64_t now)
+{
+	struct conn_stats *conn;
+
+	conn = hash_lookup(&conn_table, conn_key(index, handle), true);
+	if (!conn)
+		return NULL;
+
+	if (!conn->start) {
+		conn->index = index;
+		conn->handle = handle;
+		conn->type = LINK_TYPE_UNKNOWN;
+		conn->start = now;
+	}
+
+	return conn;
+}
+
+static struct buffer_pool *get_pool(struct index_stats *stats,
+						struct conn_stats *conn)
+{
+	/* LE links share the ACL buffers unless the controller has its own */
+	if (conn->type == LINK_TYPE_LE && stats->le_pool.max_pkt)
+		return &stats->le_pool;
+
+	return &stats->acl_pool;
+}
+
+static void pool_release(struct buffer_pool *pool, unsigned int count,
+							uint64_t now)
+{
+	pool->in_flight -= count < pool->in_flight ? count : pool->in_flight;
+
+	if (pool->stall_start && pool->in_flight < pool->max_pkt) {
+		pool->stall_time += now - pool->stall_start;
+		pool->stall_start = 0;
+	}
+}
+
+static void conn_closed(struct index_stats *stats, uint16_t index,
+					uint16_t handle, uint64_t now)
+{
+	struct conn_stats *conn;
+
+	conn = hash_remove(&conn_table, conn_key(index, handle));
+	if (!conn)
+		return;
+
+	/* Packets still queued are flushed by the controller */
+	pool_release(get_pool(stats, conn), conn->in_flight, now);
+
+	conn->end = now;
+	conn->closed_next = closed_conns;
+	closed_conns = conn;
+}
+
+static void conn_opened(uint16_t index, uint16_t handle, uint8_t type,
+				uint8_t addr_type, const uint8_t *addr,
+				uint64_t now)
+{
+	struct index_stats *stats = get_index(index);
+	struct conn_stats *conn;
+
+	/* A handle being reused means the disconnection was missed */
+	if (stats)
+		conn_closed(stats, index, handle, now);
+
+	conn = get_conn(index, handle, now);
+	if (!conn)
+		return;
+
+	conn->type = type;
+	conn->addr_type = addr_type;
+	memcpy(conn->addr, addr, 6);
+	conn->has_addr = true;
+}
+
+static void acl_frame(struct index_stats *stats, uint16_t index, bool in,
+				const void *data, uint16_t size, uint64_t now)
+{
+	const struct bt_hci_acl_hdr *hdr = data;
+	struct conn_stats *conn;
+	struct chan_stats *chan;
+	struct buffer_pool *pool;
+	uint16_t handle, cid;
+	uint8_t flags;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	handle = btohs(hdr->handle) & 0x0fff;
+	flags = btohs(hdr->handle) >> 12;
+
+	data += sizeof(*hdr);
+	size -= sizeof(*hdr);
+
+	stats->acl[in]++;
+
+	conn = get_conn(index, handle, now);
+	if (!conn)
+		return;
+
+	if (!conn->first_data)
+		conn->first_data = now;
+	conn->last_data = now;
+
+	conn->packets[in]++;
+	conn->bytes[in] += size;
+
+	/* Start fragments carry the L2CAP header with the channel id */
+	if ((flags & 0x03) != 0x01) {
+		if (size < 4) {
+			conn->cur_chan[in] = NULL;
+			goto credits;
+		}
+
+		cid = bt_get_le16(data + 2);
+
+		for (chan = conn->chans; chan; chan = chan->next) {
+			if (chan->cid == cid)
+				break;
+		}
+
+		if (!chan) {
+			chan = calloc(1, sizeof(*chan));
+			if (chan) {
+				chan->cid = cid;
+				chan->next = conn->chans;
+				conn->chans = chan;
+			}
+		}
+
+		conn->cur_chan[in] = chan;
+
+		if (chan)
+			chan->frames[in]++;
+	}
+
+	if (conn->cur_chan[in])
+		conn->cur_chan[in]->bytes[in] += size;
+
+credits:
+	if (in)
+		return;
+
+	conn->in_flight++;
+	if (conn->in_flight > conn->max_in_flight)
+		conn->max_in_flight = conn->in_flight;
+
+	if (conn->sent_count == CREDIT_RING_SIZE) {
+		conn->sent_head = (conn->sent_head + 1) % CREDIT_RING_SIZE;
+		conn->sent_count--;
+	}
+
+	conn->sent[(conn->sent_head + conn->sent_count) %
+						CREDIT_RING_SIZE] = now;
+	conn->sent_count++;
+
+	pool = get_pool(stats, conn);
+	pool->in_flight++;
+
+	if (pool->max_pkt && pool->in_flight >= pool->max_pkt &&
+							!pool->stall_start) {
+		pool->stall_start = now;
+		pool->stalls++;
+	}
+}
+
+static void command_pkt(struct index_stats *stats, const void *data,
+					uint16_t size, uint64_t now)
+{
+	const struct bt_hci_cmd_hdr *hdr = data;
+	struct pending_cmd *cmd;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	stats->commands++;
+
+	/* Forget the oldest command if the controller never answered it */
+	if (stats->num_cmds == MAX_PENDING_CMDS) {
+		memmove(stats->cmds, stats->cmds + 1,
+				(MAX_PENDING_CMDS - 1) * sizeof(*cmd));
+		stats->num_cmds--;
+	}
+
+	cmd = &stats->cmds[stats->num_cmds++];
+	cmd->opcode = btohs(hdr->opcode);
+	cmd->time = now;
+}
+
+static void command_done(struct index_stats *stats, uint16_t opcode,
+					uint8_t status, uint64_t now)
+{
+	struct cmd_stats *cmd;
+	unsigned int i;
+
+	for (i = 0; i < stats->num_cmds; i++) {
+		if (stats->cmds[i].opcode == opcode)
+			break;
+	}
+
+	if (i == stats->num_cmds)
+		return;
+
+	cmd = hash_lookup(&cmd_table, opcode, true);
+	if (cmd) {
+		cmd->opcode = opcode;
+		cmd->count++;
+		if (status)
+			cmd->failed++;
+		latency_add(&cmd->latency, now - stats->cmds[i].time);
+	}
+
+	stats->num_cmds--;
+	memmove(stats->cmds + i, stats->cmds + i + 1,
+			(stats->num_cmds - i) * sizeof(stats->cmds[0]));
+}
+
+static void cmd_complete_evt(struct index_stats *stats, const void *data,
+					uint8_t size, uint64_t now)
+{
+	const struct bt_hci_evt_cmd_complete *evt = data;
+	uint16_t opcode;
+	uint8_t status = 0;
+
+	if (size < sizeof(*evt))
+		return;
+
+	opcode = btohs(evt->opcode);
+	data += sizeof(*evt);
+	size -= sizeof(*evt);
+
+	if (size > 0)
+		status = *((const uint8_t *) data);
+
+	if (opcode == BT_HCI_CMD_READ_BUFFER_SIZE &&
+			size >= sizeof(struct bt_hci_rsp_read_buffer_size)) {
+		const struct bt_hci_rsp_read_buffer_size *rsp = data;
+
+		if (!rsp->status)
+			stats->acl_pool.max_pkt = btohs(rsp->acl_max_pkt);
+	}
+
+	if (opcode == BT_HCI_CMD_LE_READ_BUFFER_SIZE &&
+			size >= sizeof(struct bt_hci_rsp_le_read_buffer_size)) {
+		const struct bt_hci_rsp_le_read_buffer_size *rsp = data;
+
+		if (!rsp->status)
+			stats->le_pool.max_pkt = rsp->le_max_pkt;
+	}
+
+	command_done(stats, opcode, status, now);
+}
+
+static void num_completed_packets_evt(struct index_stats *stats,
+					uint16_t index, const void *data,
+					uint8_t size, uint64_t now)
+{
+	const uint8_t *ptr = data;
+	uint8_t num_handles;
+	int i;
+
+	if (size < 1)
+		return;
+
+	num_handles = *ptr++;
+	size--;
+
+	for (i = 0; i < num_handles && size >= 4; i++, ptr += 4, size -= 4) {
+		uint16_t handle = bt_get_le16(ptr) & 0x0fff;
+		uint16_t count = bt_get_le16(ptr + 2);
+		struct conn_stats *conn;
+
+		conn = hash_lookup(&conn_table, conn_key(index, handle), false);
+		if (!conn) {
+			pool_release(&stats->acl_pool, count, now);
+			continue;
+		}
+
+		pool_release(get_pool(stats, conn), count, now);
+
+		conn->in_flight -= count < conn->in_flight ?
+						count : conn->in_flight;
+
+		while (count-- > 0 && conn->sent_count > 0) {
+			latency_add(&conn->completion,
+					now - conn->sent[conn->sent_head]);
+			conn->sent_head = (conn->sent_head + 1) %
+							CREDIT_RING_SIZE;
+			conn->sent_count--;
+		}
+	}
+}
+
+static void adv_report_evt(uint16_t index, const void *data, uint8_t size,
+								uint64_t now)
+{
+	const uint8_t *ptr = data;
+	uint8_t num_reports;
+	int i;
+
+	if (size < 1)
+		return;
+
+	num_reports = *ptr++;
+	size--;
+
+	for (i = 0; i < num_reports; i++) {
+		const uint8_t *addr = ptr + 2;
+		struct adv_stats *adv;
+		uint8_t data_len;
+		int8_t rssi;
+
+		/* Event type, address type, address and data length */
+		if (size < 9)
+			return;
+
+		data_len = ptr[8];
+		if (size < 9 + data_len + 1)
+			return;
+
+		rssi = (int8_t) ptr[9 + data_len];
+
+		adv = hash_lookup(&adv_table, adv_key(index, ptr[1], addr),
+									true);
+		if (adv) {
+			if (!adv->count) {
+				adv->index = index;
+				adv->addr_type = ptr[1];
+				memcpy(adv->addr, addr, 6);
+				adv->first = now;
+				adv->rssi_min = rssi;
+				adv->rssi_max = rssi;
+			}
+
+			adv->count++;
+			adv->last = now;
+			adv->rssi_total += rssi;
+
+			if (rssi < adv->rssi_min)
+				adv->rssi_min = rssi;
+			if (rssi > adv->rssi_max)
+				adv->rssi_max = rssi;
+		}
+
+		ptr += 9 + data_len + 1;
+		size -= 9 + data_len + 1;
+	}
+}
+
+static void event_pkt(struct index_stats *stats, uint16_t index,
+				const void *data, uint16_t size, uint64_t now)
+{
+	const struct bt_hci_evt_hdr *hdr = data;
+
+	if (size < sizeof(*hdr))
+		return;
+
+	stats->events++;
+
+	data += sizeof(*hdr);
+	size -= sizeof(*hdr);
+
+	if (hdr->plen > size)
+		return;
+
+	switch (hdr->evt) {
+	case BT_HCI_EVT_CONN_COMPLETE:
+		if (hdr->plen >= sizeof(struct bt_hci_evt_conn_complete)) {
+			const struct bt_hci_evt_conn_complete *evt = data;
+
+			if (!evt->status && evt->link_type == 0x01)
+				conn_opened(index, btohs(evt->handle),
+						LINK_TYPE_BREDR, 0x00,
+						evt->bdaddr, now);
+		}
+		break;
+	case BT_HCI_EVT_DISCONNECT_COMPLETE:
+		if (hdr->plen >=
+			sizeof(struct bt_hci_evt_disconnect_complete)) {
+			const struct bt_hci_evt_disconnect_complete *evt = data;
+
+			if (!evt->status)
+				conn_closed(stats, index, btohs(evt->handle),
+									now);
+		}
+		break;
+	case BT_HCI_EVT_CMD_COMPLETE:
+		cmd_complete_evt(stats, data, hdr->plen, now);
+		break;
+	case BT_HCI_EVT_CMD_STATUS:
+		if (hdr->plen >= sizeof(struct bt_hci_evt_cmd_status)) {
+			const struct bt_hci_evt_cmd_status *evt = data;
+
+			command_done(stats, btohs(evt->opcode), evt->status,
+									now);
+		}
+		break;
+	case BT_HCI_EVT_NUM_COMPLETED_PACKETS:
+		num_completed_packets_evt(stats, index, data, hdr->plen, now);
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		if (hdr->plen < 1)
+			break;
+
+		switch (*((const uint8_t *) data)) {
+		case BT_HCI_EVT_LE_CONN_COMPLETE:
+			if (hdr->plen >= 1 +
+				sizeof(struct bt_hci_evt_le_conn_complete)) {
+				const struct bt_hci_evt_le_conn_complete *evt;
+
+				evt = data + 1;
+				if (!evt->status)
+					conn_opened(index, btohs(evt->handle),
+						LINK_TYPE_LE,
+						evt->peer_addr_type,
+						evt->peer_addr, now);
+			}
+			break;
+		case BT_HCI_EVT_LE_ADV_REPORT:
+			adv_report_evt(index, data + 1, hdr->plen - 1, now);
+			break;
+		}
+		break;
+	}
+}
+
+void analyze_packet(struct timeval *tv, uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	struct index_stats *stats;
+	struct timeval ctv;
+	uint64_t now;
+
+	if (!tv) {
+		gettimeofday(&ctv, NULL);
+		tv = &ctv;
+	}
+
+	now = (uint64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+
+	if (!first_time)
+		first_time = now;
+	last_time = now;
+
+	total_frames++;
+
+	stats = get_index(index);
+	if (!stats)
+		return;
+
+	stats->seen = true;
+
+	switch (opcode) {
+	case MONITOR_COMMAND_PKT:
+		command_pkt(stats, data, size, now);
+		break;
+	case MONITOR_EVENT_PKT:
+		event_pkt(stats, index, data, size, now);
+		break;
+	case MONITOR_ACL_TX_PKT:
+		acl_frame(stats, index, false, data, size, now);
+		break;
+	case MONITOR_ACL_RX_PKT:
+		acl_frame(stats, index, true, data, size, now);
+		break;
+	}
+}
+
+static void print_addr(const uint8_t *addr)
+{
+	printf("%2.2X:%2.2X:%2.2X:%2.2X:%2.2X:%2.2X",
+			addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+}
+
+static void print_latency(const char *label, const struct latency *latency)
+{
+	printf("%s min %" PRIu64 ".%3.3" PRIu64 " avg %" PRIu64 ".%3.3" PRIu64
+			" max %" PRIu64 ".%3.3" PRIu64 " msec", label,
+			latency->min / 1000, latency->min % 1000,
+			latency->total / latency->count / 1000,
+			latency->total / latency->count % 1000,
+			latency->max / 1000, latency->max % 1000);
+}
+
+/* Bits per millisecond equals kbit/s */
+static unsigned long long rate(uint64_t bytes, uint64_t usec)
+{
+	return usec ? bytes * 8 * 1000 / usec : 0;
+}
+
+static int conn_cmp(const void *a, const void *b)
+{
+	const struct conn_stats *c1 = *(const struct conn_stats **) a;
+	const struct conn_stats *c2 = *(const struct conn_stats **) b;
+
+	if (c1->index != c2->index)
+		return c1->index - c2->index;
+
+	if (c1->start != c2->start)
+		return c1->start < c2->start ? -1 : 1;
+
+	return c1->handle - c2->handle;
+}
+
+static int cmd_cmp(const void *a, const void *b)
+{
+	const struct cmd_stats *c1 = *(const struct cmd_stats **) a;
+	const struct cmd_stats *c2 = *(const struct cmd_stats **) b;
+
+	if (c1->count != c2->count)
+		return c1->count > c2->count ? -1 : 1;
+
+	return c1->opcode - c2->opcode;
+}
+
+static int adv_cmp(const void *a, const void *b)
+{
+	const struct adv_stats *a1 = *(const struct adv_stats **) a;
+	const struct adv_stats *a2 = *(const struct adv_stats **) b;
+
+	if (a1->count != a2->count)
+		return a1->count > a2->count ? -1 : 1;
+
+	return memcmp(a1->addr, a2->addr, 6);
+}
+
+static void print_conn(const struct conn_stats *conn)
+{
+	const struct chan_stats *chan;
+	uint64_t duration, span;
+
+	duration = (conn->end ? conn->end : last_time) - conn->start;
+	span = conn->last_data - conn->first_data;
+
+	printf("  hci%u handle %u", conn->index, conn->handle);
+
+	switch (conn->type) {
+	case LINK_TYPE_BREDR:
+		printf(" BR/EDR ");
+		print_addr(conn->addr);
+		break;
+	case LINK_TYPE_LE:
+		printf(" LE ");
+		print_addr(conn->addr);
+		printf(" (%s)", conn->addr_type ? "random" : "public");
+		break;
+	default:
+		printf(" (connection not in trace)");
+		break;
+	}
+
+	printf("%s\n", conn->end ? "" : " still connected");
+
+	printf("    Duration: %" PRIu64 ".%3.3" PRIu64 " sec\n",
+				duration / 1000000, duration / 1000 % 1000);
+
+	printf("    TX: %u packets, %" PRIu64 " bytes, %llu kbit/s\n",
+				conn->packets[0], conn->bytes[0],
+				rate(conn->bytes[0], span));
+	printf("    RX: %u packets, %" PRIu64 " bytes, %llu kbit/s\n",
+				conn->packets[1], conn->bytes[1],
+				rate(conn->bytes[1], span));
+
+	if (conn->completion.count) {
+		printf("    Packets in flight: max %u\n", conn->max_in_flight);
+		print_latency("    Completion:", &conn->completion);
+		printf("\n");
+	}
+
+	for (chan = conn->chans; chan; chan = chan->next)
+		printf("    Channel %u: TX %u frames %" PRIu64 " bytes, "
+				"RX %u frames %" PRIu64 " bytes\n", chan->cid,
+				chan->frames[0], chan->bytes[0],
+				chan->frames[1], chan->bytes[1]);
+}
+
+static void print_pool(const char *label, const struct buffer_pool *pool)
+{
+	uint64_t stall_time = pool->stall_time;
+
+	if (!pool->max_pkt)
+		return;
+
+	if (pool->stall_start)
+		stall_time += last_time - pool->stall_start;
+
+	printf("    %s buffers: %u, credit stalls: %u (%" PRIu64 ".%3.3" PRIu64
+				" sec)\n", label, pool->max_pkt, pool->stalls,
+				stall_time / 1000000, stall_time / 1000 % 1000);
+}
+
+void analyze_report(void)
+{
+	struct conn_stats *conn;
+	void **entries;
+	unsigned int i, n;
+	uint64_t span = last_time - first_time;
+
+	printf("\nTrace summary: %llu frames in %" PRIu64 ".%3.3" PRIu64
+				" sec\n", total_frames, span / 1000000,
+				span / 1000 % 1000);
+
+	printf("\nControllers:\n");
+
+	for (i = 0; i < index_count; i++) {
+		struct index_stats *stats = &index_list[i];
+
+		if (!stats->seen)
+			continue;
+
+		printf("  hci%u: %u commands, %u events, "
+				"%u ACL TX, %u ACL RX\n", i, stats->commands,
+				stats->events, stats->acl[0], stats->acl[1]);
+
+		print_pool("ACL", &stats->acl_pool);
+		print_pool("LE", &stats->le_pool);
+	}
+
+	for (n = 0, conn = closed_conns; conn; conn = conn->closed_next)
+		n++;
+
+	entries = conn_table.count + n ? hash_entries(&conn_table, n) : NULL;
+	if (entries) {
+		n = conn_table.count;
+
+		for (conn = closed_conns; conn; conn = conn->closed_next)
+			entries[n++] = conn;
+
+		qsort(entries, n, sizeof(void *), conn_cmp);
+
+		printf("\nConnections:\n");
+
+		for (i = 0; i < n; i++)
+			print_conn(entries[i]);
+
+		free(entries);
+	}
+
+	entries = cmd_table.count ? hash_entries(&cmd_table, 0) : NULL;
+	if (entries) {
+		n = cmd_table.count;
+
+		qsort(entries, n, sizeof(void *), cmd_cmp);
+
+		printf("\nCommands:\n");
+
+		for (i = 0; i < n; i++) {
+			struct cmd_stats *cmd = entries[i];
+
+			printf("  0x%4.4x (OGF 0x%2.2x OCF 0x%4.4x): %u completed, "
+					"%u failed\n", cmd->opcode,
+					cmd->opcode >> 10, cmd->opcode & 0x03ff,
+					cmd->count, cmd->failed);
+			print_latency("    Latency:", &cmd->latency);
+			printf("\n");
+		}
+
+		free(entries);
+	}
+
+	entries = adv_table.count ? hash_entries(&adv_table, 0) : NULL;
+	if (entries) {
+		n = adv_table.count;
+
+		qsort(entries, n, sizeof(void *), adv_cmp);
+
+		printf("\nAdvertising reports:\n");
+
+		for (i = 0; i < n; i++) {
+			struct adv_stats *adv = entries[i];
+			uint64_t period = adv->last - adv->first;
+
+			printf("  hci%u ", adv->index);
+			print_addr(adv->addr);
+			printf(" (%s): %u reports, %llu.%3.3llu per sec, "
+				"RSSI min %d avg %d max %d dBm\n",
+				adv->addr_type ? "random" : "public",
+				adv->count,
+				period ? adv->count * 1000000ull / period : 0,
+				period ? adv->count * 1000000000ull / period
+								% 1000 : 0,
+				adv->rssi_min,
+				(int) (adv->rssi_total / adv->count),
+				adv->rssi_max);
+		}
+
+		free(entries);
+	}
+}
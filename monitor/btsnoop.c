@@ -77,6 +77,45 @@ static uint32_t btsnoop_type = 0;
 static int btsnoop_fd = -1;
 static uint16_t btsnoop_index = 0xffff;
 
+/* Read side buffering to avoid three system calls per packet */
+static uint8_t read_buf[65536];
+static size_t read_pos = 0;
+static size_t read_len = 0;
+
+static ssize_t buffered_read(void *data, size_t size)
+{
+	uint8_t *ptr = data;
+	size_t copied = 0;
+
+	while (copied < size) {
+		size_t count;
+
+		if (read_pos == read_len) {
+			ssize_t len;
+
+			len = read(btsnoop_fd, read_buf, sizeof(read_buf));
+			if (len < 0)
+				return copied ? (ssize_t) copied : len;
+
+			if (len == 0)
+				break;
+
+			read_pos = 0;
+			read_len = len;
+		}
+
+		count = read_len - read_pos;
+		if (count > size - copied)
+			count = size - copied;
+
+		memcpy(ptr + copied, read_buf + read_pos, count);
+		read_pos += count;
+		copied += count;
+	}
+
+	return copied;
+}
+
 void btsnoop_create(const char *path)
 {
 	struct btsnoop_hdr hdr;
@@ -174,7 +213,10 @@ int btsnoop_open(const char *path)
 		return -1;
 	}
 
-	len = read(btsnoop_fd, &hdr, BTSNOOP_HDR_SIZE);
+	read_pos = 0;
+	read_len = 0;
+
+	len = buffered_read(&hdr, BTSNOOP_HDR_SIZE);
 	if (len < 0 || len != BTSNOOP_HDR_SIZE) {
 		perror("Failed to read header");
 		close(btsnoop_fd);
@@ -224,7 +266,7 @@ int btsnoop_read(struct timeval *tv, uint16_t *index, uint16_t *opcode,
 	if (btsnoop_fd < 0)
 		return -1;
 
-	len = read(btsnoop_fd, &pkt, BTSNOOP_PKT_SIZE);
+	len = buffered_read(&pkt, BTSNOOP_PKT_SIZE);
 	if (len == 0)
 		return -1;
 
@@ -249,7 +291,7 @@ int btsnoop_read(struct timeval *tv, uint16_t *index, uint16_t *opcode,
 		break;
 
 	case 1002:
-		len = read(btsnoop_fd, &pkt_type, 1);
+		len = buffered_read(&pkt_type, 1);
 		if (len < 0) {
 			perror("Failed to read packet type");
 			close(btsnoop_fd);
@@ -274,7 +316,7 @@ int btsnoop_read(struct timeval *tv, uint16_t *index, uint16_t *opcode,
 		return -1;
 	}
 
-	len = read(btsnoop_fd, data, toread);
+	len = buffered_read(data, toread);
 	if (len < 0) {
 		perror("Failed to read data");
 		close(btsnoop_fd);
@@ -45,9 +45,12 @@
 #include "packet.h"
 #include "btsnoop.h"
 #include "hcidump.h"
+#include "analyze.h"
+#include "filter.h"
 #include "control.h"
 
 static bool hcidump_fallback = false;
+static bool analyze_mode = false;
 
 #define MAX_PACKET_SIZE		(1486 + 4)
 
@@ -621,10 +624,20 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 
 		switch (data->channel) {
 		case HCI_CHANNEL_CONTROL:
-			packet_control(tv, index, opcode, data->buf, pktlen);
+			if (!analyze_mode)
+				packet_control(tv, index, opcode,
+							data->buf, pktlen);
 			break;
 		case HCI_CHANNEL_MONITOR:
-			packet_monitor(tv, index, opcode, data->buf, pktlen);
+			if (!filter_packet(index, opcode, data->buf, pktlen))
+				break;
+
+			if (analyze_mode)
+				analyze_packet(tv, index, opcode,
+							data->buf, pktlen);
+			else
+				packet_monitor(tv, index, opcode,
+							data->buf, pktlen);
 			btsnoop_write(tv, index, opcode, data->buf, pktlen);
 			break;
 		}
@@ -715,7 +728,9 @@ static void client_callback(int fd, uint32_t events, void *user_data)
 			uint16_t opcode = btohs(hdr->opcode);
 			uint16_t index = btohs(hdr->index);
 
-			packet_monitor(NULL, index, opcode,
+			if (filter_packet(index, opcode,
+					data->buf + MGMT_HDR_SIZE, pktlen))
+				packet_monitor(NULL, index, opcode,
 					data->buf + MGMT_HDR_SIZE, pktlen);
 
 			data->offset -= pktlen + MGMT_HDR_SIZE;
@@ -815,20 +830,33 @@ void control_reader(const char *path)
 	if (btsnoop_open(path) < 0)
 		return;
 
-	open_pager();
+	if (!analyze_mode)
+		open_pager();
 
 	while (1) {
 		if (btsnoop_read(&tv, &index, &opcode, buf, &pktlen) < 0)
 			break;
 
-		packet_monitor(&tv, index, opcode, buf, pktlen);
+		if (!filter_packet(index, opcode, buf, pktlen))
+			continue;
+
+		if (analyze_mode)
+			analyze_packet(&tv, index, opcode, buf, pktlen);
+		else
+			packet_monitor(&tv, index, opcode, buf, pktlen);
 	}
 
-	close_pager();
+	if (!analyze_mode)
+		close_pager();
 
 	btsnoop_close();
 }
 
+void control_analyze(void)
+{
+	analyze_mode = true;
+}
+
 int control_tracing(void)
 {
 	packet_add_filter(PACKET_FILTER_SHOW_INDEX);
@@ -0,0 +1,686 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "bt.h"
+#include "packet.h"
+#include "filter.h"
+
+#define MAX_FILTER_VALUES	16
+
+struct filter_values {
+	unsigned int count;
+	uint16_t values[MAX_FILTER_VALUES];
+};
+
+struct filter_conn {
+	uint16_t index;
+	uint16_t handle;
+	bool addr_match;
+	bool cid_match[2];
+};
+
+static bool enabled = false;
+
+static struct filter_values index_filter;
+static struct filter_values opcode_filter;
+static struct filter_values event_filter;
+static struct filter_values handle_filter;
+static struct filter_values cid_filter;
+static uint8_t addr_filter[MAX_FILTER_VALUES][6];
+static unsigned int addr_count;
+static uint32_t type_mask;
+
+static struct filter_conn *conn_list;
+static unsigned int conn_count;
+
+/* Offset of the connection handle in event and command parameters */
+static const struct {
+	uint16_t code;
+	uint8_t offset;
+} event_handle_table[] = {
+	{ BT_HCI_EVT_CONN_COMPLETE,		1 },
+	{ BT_HCI_EVT_DISCONNECT_COMPLETE,	1 },
+	{ BT_HCI_EVT_AUTH_COMPLETE,		1 },
+	{ BT_HCI_EVT_ENCRYPT_CHANGE,		1 },
+	{ BT_HCI_EVT_CHANGE_CONN_LINK_KEY_COMPLETE, 1 },
+	{ BT_HCI_EVT_REMOTE_FEATURES_COMPLETE,	1 },
+	{ BT_HCI_EVT_REMOTE_VERSION_COMPLETE,	1 },
+	{ BT_HCI_EVT_MAX_SLOTS_CHANGE,		0 },
+	{ BT_HCI_EVT_REMOTE_EXT_FEATURES_COMPLETE, 1 },
+	{ BT_HCI_EVT_ENCRYPT_KEY_REFRESH_COMPLETE, 1 },
+	{ }
+}, cmd_handle_table[] = {
+	{ BT_HCI_CMD_DISCONNECT,		0 },
+	{ BT_HCI_CMD_AUTH_REQUESTED,		0 },
+	{ BT_HCI_CMD_SET_CONN_ENCRYPT,		0 },
+	{ BT_HCI_CMD_READ_REMOTE_FEATURES,	0 },
+	{ BT_HCI_CMD_READ_REMOTE_EXT_FEATURES,	0 },
+	{ BT_HCI_CMD_READ_REMOTE_VERSION,	0 },
+	{ BT_HCI_CMD_LE_CONN_UPDATE,		0 },
+	{ BT_HCI_CMD_LE_READ_REMOTE_FEATURES,	0 },
+	{ BT_HCI_CMD_LE_START_ENCRYPT,		0 },
+	{ BT_HCI_CMD_LE_LTK_REQ_REPLY,		0 },
+	{ BT_HCI_CMD_LE_LTK_REQ_NEG_REPLY,	0 },
+	{ }
+};
+
+/* Events and commands starting with the remote address */
+static const uint16_t event_addr_table[] = {
+	BT_HCI_EVT_CONN_REQUEST,
+	BT_HCI_EVT_REMOTE_NAME_REQUEST_COMPLETE,
+	BT_HCI_EVT_PIN_CODE_REQUEST,
+	BT_HCI_EVT_LINK_KEY_REQUEST,
+	BT_HCI_EVT_LINK_KEY_NOTIFY,
+	BT_HCI_EVT_IO_CAPABILITY_REQUEST,
+	BT_HCI_EVT_IO_CAPABILITY_RESPONSE,
+	BT_HCI_EVT_USER_CONFIRM_REQUEST,
+	BT_HCI_EVT_USER_PASSKEY_REQUEST,
+	BT_HCI_EVT_SIMPLE_PAIRING_COMPLETE,
+	0
+}, cmd_addr_table[] = {
+	BT_HCI_CMD_CREATE_CONN,
+	BT_HCI_CMD_CREATE_CONN_CANCEL,
+	BT_HCI_CMD_ACCEPT_CONN_REQUEST,
+	BT_HCI_CMD_REJECT_CONN_REQUEST,
+	BT_HCI_CMD_LINK_KEY_REQUEST_REPLY,
+	BT_HCI_CMD_LINK_KEY_REQUEST_NEG_REPLY,
+	BT_HCI_CMD_PIN_CODE_REQUEST_REPLY,
+	BT_HCI_CMD_PIN_CODE_REQUEST_NEG_REPLY,
+	BT_HCI_CMD_REMOTE_NAME_REQUEST,
+	BT_HCI_CMD_IO_CAPABILITY_REQUEST_REPLY,
+	BT_HCI_CMD_USER_CONFIRM_REQUEST_REPLY,
+	BT_HCI_CMD_USER_CONFIRM_REQUEST_NEG_REPLY,
+	0
+};
+
+static bool parse_number(const char *str, uint16_t *value)
+{
+	unsigned long val;
+	char *end;
+
+	if (!strncasecmp(str, "hci", 3))
+		str += 3;
+
+	val = strtoul(str, &end, 0);
+	if (end == str || *end != '\0' || val > 0xffff)
+		return false;
+
+	*value = val;
+
+	return true;
+}
+
+static bool add_value(struct filter_values *filter, const char *str)
+{
+	if (filter->count == MAX_FILTER_VALUES)
+		return false;
+
+	if (!parse_number(str, &filter->values[filter->count]))
+		return false;
+
+	filter->count++;
+
+	return true;
+}
+
+static bool add_type(const char *str)
+{
+	if (!strcasecmp(str, "cmd") || !strcasecmp(str, "command"))
+		type_mask |= 1 << MONITOR_COMMAND_PKT;
+	else if (!strcasecmp(str, "event"))
+		type_mask |= 1 << MONITOR_EVENT_PKT;
+	else if (!strcasecmp(str, "acl"))
+		type_mask |= (1 << MONITOR_ACL_TX_PKT) |
+						(1 << MONITOR_ACL_RX_PKT);
+	else if (!strcasecmp(str, "sco"))
+		type_mask |= (1 << MONITOR_SCO_TX_PKT) |
+						(1 << MONITOR_SCO_RX_PKT);
+	else
+		return false;
+
+	return true;
+}
+
+static bool add_addr(const char *str)
+{
+	bdaddr_t bdaddr;
+
+	if (addr_count == MAX_FILTER_VALUES || bachk(str) < 0)
+		return false;
+
+	str2ba(str, &bdaddr);
+	memcpy(addr_filter[addr_count++], bdaddr.b, 6);
+
+	return true;
+}
+
+static bool add_term(const char *key, const char *value)
+{
+	if (!strcmp(key, "index"))
+		return add_value(&index_filter, value);
+
+	if (!strcmp(key, "type"))
+		return add_type(value);
+
+	if (!strcmp(key, "opcode"))
+		return add_value(&opcode_filter, value);
+
+	if (!strcmp(key, "event"))
+		return add_value(&event_filter, value);
+
+	if (!strcmp(key, "handle"))
+		return add_value(&handle_filter, value);
+
+	if (!strcmp(key, "cid"))
+		return add_value(&cid_filter, value);
+
+	if (!strcmp(key, "addr"))
+		return add_addr(value);
+
+	return false;
+}
+
+/*
+ * The expression is a list of key=value terms separated by commas or
+ * spaces. Repeating a key matches any of its values, different keys
+ * all have to match.
+ */
+int filter_parse(const char *expr)
+{
+	char *str, *term, *saveptr = NULL;
+	int err = 0;
+
+	str = strdup(expr);
+	if (!str)
+		return -1;
+
+	for (term = strtok_r(str, ", ", &saveptr); term;
+				term = strtok_r(NULL, ", ", &saveptr)) {
+		char *value = strchr(term, '=');
+
+		if (!value) {
+			err = -1;
+			break;
+		}
+
+		*value++ = '\0';
+
+		if (!add_term(term, value)) {
+			err = -1;
+			break;
+		}
+	}
+
+	free(str);
+
+	if (err < 0) {
+		fprintf(stderr, "Invalid filter term: %s\n", expr);
+		return err;
+	}
+
+	enabled = true;
+
+	return 0;
+}
+
+bool filter_enabled(void)
+{
+	return enabled;
+}
+
+static bool match_value(const struct filter_values *filter, uint16_t value)
+{
+	unsigned int i;
+
+	for (i = 0; i < filter->count; i++) {
+		if (filter->values[i] == value)
+			return true;
+	}
+
+	return false;
+}
+
+static bool match_addr(const uint8_t *addr)
+{
+	unsigned int i;
+
+	for (i = 0; i < addr_count; i++) {
+		if (!memcmp(addr_filter[i], addr, 6))
+			return true;
+	}
+
+	return false;
+}
+
+static struct filter_conn *find_conn(uint16_t index, uint16_t handle,
+								bool create)
+{
+	struct filter_conn *list;
+	unsigned int i;
+
+	for (i = 0; i < conn_count; i++) {
+		if (conn_list[i].index == index &&
+					conn_list[i].handle == handle)
+			return &conn_list[i];
+	}
+
+	if (!create)
+		return NULL;
+
+	list = realloc(conn_list, (conn_count + 1) * sizeof(*list));
+	if (!list)
+		return NULL;
+
+	conn_list = list;
+
+	memset(&conn_list[conn_count], 0, sizeof(*conn_list));
+	conn_list[conn_count].index = index;
+	conn_list[conn_count].handle = handle;
+
+	return &conn_list[conn_count++];
+}
+
+static void remove_conn(uint16_t index, uint16_t handle)
+{
+	struct filter_conn *conn = find_conn(index, handle, false);
+
+	if (!conn)
+		return;
+
+	*conn = conn_list[--conn_count];
+}
+
+/*
+ * Advertising reports carry one address per report. Returns the first
+ * one matching the filter, otherwise the first one so that the packet
+ * gets rejected.
+ */
+static const uint8_t *adv_report_addr(const uint8_t *data, uint16_t size)
+{
+	const uint8_t *first = NULL;
+	uint8_t num_reports;
+	unsigned int i;
+
+	if (size < 1)
+		return NULL;
+
+	num_reports = data[0];
+	data++;
+	size--;
+
+	/* Event type, address type, address, data length, data and RSSI */
+	for (i = 0; i < num_reports; i++) {
+		if (size < 9 || size < 9 + data[8] + 1)
+			break;
+
+		if (match_addr(data + 2))
+			return data + 2;
+
+		if (!first)
+			first = data + 2;
+
+		size -= 9 + data[8] + 1;
+		data += 9 + data[8] + 1;
+	}
+
+	return first;
+}
+
+/* Returns the remote address carried by an event or command, if any */
+static const uint8_t *packet_addr(uint16_t opcode, const uint8_t *data,
+							uint16_t size)
+{
+	const uint16_t *table;
+	uint16_t code;
+	unsigned int i;
+
+	if (opcode == MONITOR_EVENT_PKT) {
+		if (size < 2)
+			return NULL;
+
+		code = data[0];
+		data += 2;
+		size -= 2;
+
+		if (code == BT_HCI_EVT_CONN_COMPLETE)
+			return size >= 9 ? data + 3 : NULL;
+
+		if (code == BT_HCI_EVT_LE_META_EVENT) {
+			if (size >= 1 + 11 &&
+					data[0] == BT_HCI_EVT_LE_CONN_COMPLETE)
+				return data + 1 + 5;
+			if (size >= 1 && data[0] == BT_HCI_EVT_LE_ADV_REPORT)
+				return adv_report_addr(data + 1, size - 1);
+			return NULL;
+		}
+
+		table = event_addr_table;
+	} else if (opcode == MONITOR_COMMAND_PKT) {
+		if (size < 3)
+			return NULL;
+
+		code = bt_get_le16(data);
+		data += 3;
+		size -= 3;
+
+		/* Scan interval and window, filter policy and address type */
+		if (code == BT_HCI_CMD_LE_CREATE_CONN)
+			return size >= 6 + 6 ? data + 6 : NULL;
+
+		table = cmd_addr_table;
+	} else
+		return NULL;
+
+	for (i = 0; table[i]; i++) {
+		if (table[i] == code)
+			return size >= 6 ? data : NULL;
+	}
+
+	return NULL;
+}
+
+/* Returns the number of connection handles stored in handles */
+static unsigned int packet_handles(uint16_t opcode, const uint8_t *data,
+					uint16_t size, uint16_t *handles)
+{
+	unsigned int i, count = 0;
+	uint16_t code;
+
+	switch (opcode) {
+	case MONITOR_ACL_TX_PKT:
+	case MONITOR_ACL_RX_PKT:
+	case MONITOR_SCO_TX_PKT:
+	case MONITOR_SCO_RX_PKT:
+		if (size < 2)
+			return 0;
+		handles[0] = bt_get_le16(data) & 0x0fff;
+		return 1;
+
+	case MONITOR_COMMAND_PKT:
+		if (size < 3)
+			return 0;
+
+		code = bt_get_le16(data);
+		data += 3;
+		size -= 3;
+
+		for (i = 0; cmd_handle_table[i].code; i++) {
+			if (cmd_handle_table[i].code != code)
+				continue;
+
+			if (size < cmd_handle_table[i].offset + 2)
+				return 0;
+
+			handles[0] = bt_get_le16(data +
+					cmd_handle_table[i].offset) & 0x0fff;
+			return 1;
+		}
+		return 0;
+
+	case MONITOR_EVENT_PKT:
+		if (size < 2)
+			return 0;
+
+		code = data[0];
+		data += 2;
+		size -= 2;
+
+		if (code == BT_HCI_EVT_NUM_COMPLETED_PACKETS) {
+			if (size < 1)
+				return 0;
+
+			for (i = 0; i < data[0] && count < MAX_FILTER_VALUES &&
+						size >= 1 + (i + 1) * 4; i++)
+				handles[count++] = bt_get_le16(data + 1 +
+							i * 4) & 0x0fff;
+			return count;
+		}
+
+		/* Subevent, status and handle */
+		if (code == BT_HCI_EVT_LE_META_EVENT) {
+			if (size < 4)
+				return 0;
+
+			switch (data[0]) {
+			case BT_HCI_EVT_LE_CONN_COMPLETE:
+			case BT_HCI_EVT_LE_CONN_UPDATE_COMPLETE:
+			case BT_HCI_EVT_LE_REMOTE_FEATURES_COMPLETE:
+				handles[0] = bt_get_le16(data + 2) & 0x0fff;
+				return 1;
+			case BT_HCI_EVT_LE_LONG_TERM_KEY_REQUEST:
+				handles[0] = bt_get_le16(data + 1) & 0x0fff;
+				return 1;
+			}
+			return 0;
+		}
+
+		for (i = 0; event_handle_table[i].code; i++) {
+			if (event_handle_table[i].code != code)
+				continue;
+
+			if (size < event_handle_table[i].offset + 2)
+				return 0;
+
+			handles[0] = bt_get_le16(data +
+					event_handle_table[i].offset) & 0x0fff;
+			return 1;
+		}
+		return 0;
+	}
+
+	return 0;
+}
+
+static bool match_opcode(uint16_t opcode, const uint8_t *data, uint16_t size)
+{
+	if (opcode == MONITOR_COMMAND_PKT)
+		return size >= 2 && match_value(&opcode_filter,
+							bt_get_le16(data));
+
+	if (opcode != MONITOR_EVENT_PKT || size < 2)
+		return false;
+
+	/* Command Complete and Command Status belong to their command */
+	if (data[0] == BT_HCI_EVT_CMD_COMPLETE && size >= 5)
+		return match_value(&opcode_filter, bt_get_le16(data + 3));
+
+	if (data[0] == BT_HCI_EVT_CMD_STATUS && size >= 6)
+		return match_value(&opcode_filter, bt_get_le16(data + 4));
+
+	return false;
+}
+
+static bool match_conn(uint16_t index, uint16_t opcode,
+					const uint8_t *data, uint16_t size)
+{
+	uint16_t handles[MAX_FILTER_VALUES];
+	const uint8_t *addr = NULL;
+	unsigned int i, count;
+
+	count = packet_handles(opcode, data, size, handles);
+
+	if (addr_count > 0) {
+		addr = packet_addr(opcode, data, size);
+		if (addr && !match_addr(addr))
+			return false;
+	}
+
+	if (!addr && addr_count > 0) {
+		for (i = 0; i < count; i++) {
+			struct filter_conn *conn;
+
+			conn = find_conn(index, handles[i], false);
+			if (conn && conn->addr_match)
+				break;
+		}
+
+		if (i == count)
+			return false;
+	}
+
+	if (handle_filter.count > 0) {
+		for (i = 0; i < count; i++) {
+			if (match_value(&handle_filter, handles[i]))
+				break;
+		}
+
+		if (i == count)
+			return false;
+	}
+
+	return true;
+}
+
+static bool match_cid(uint16_t index, uint16_t opcode,
+					const uint8_t *data, uint16_t size)
+{
+	struct filter_conn *conn;
+	uint16_t handle;
+	uint8_t flags;
+	bool in;
+
+	if (opcode != MONITOR_ACL_TX_PKT && opcode != MONITOR_ACL_RX_PKT)
+		return false;
+
+	if (size < 4)
+		return false;
+
+	handle = bt_get_le16(data);
+	flags = handle >> 12;
+	handle &= 0x0fff;
+	in = (opcode == MONITOR_ACL_RX_PKT);
+
+	conn = find_conn(index, handle, true);
+	if (!conn)
+		return false;
+
+	/* Continuation fragments follow the verdict of their start */
+	if ((flags & 0x03) == 0x01)
+		return conn->cid_match[in];
+
+	conn->cid_match[in] = size >= 8 &&
+			match_value(&cid_filter, bt_get_le16(data + 6));
+
+	return conn->cid_match[in];
+}
+
+static void track_conn(uint16_t index, uint16_t opcode,
+					const uint8_t *data, uint16_t size)
+{
+	struct filter_conn *conn;
+	const uint8_t *addr;
+	uint16_t handle;
+
+	if (opcode != MONITOR_EVENT_PKT || size < 2)
+		return;
+
+	switch (data[0]) {
+	case BT_HCI_EVT_CONN_COMPLETE:
+		if (size < 2 + 3 || data[2])
+			return;
+		handle = bt_get_le16(data + 3) & 0x0fff;
+		break;
+	case BT_HCI_EVT_LE_META_EVENT:
+		if (size < 2 + 4 || data[2] != BT_HCI_EVT_LE_CONN_COMPLETE ||
+								data[3])
+			return;
+		handle = bt_get_le16(data + 4) & 0x0fff;
+		break;
+	default:
+		return;
+	}
+
+	addr = packet_addr(opcode, data, size);
+	if (!addr || !match_addr(addr))
+		return;
+
+	conn = find_conn(index, handle, true);
+	if (conn)
+		conn->addr_match = true;
+}
+
+static void untrack_conn(uint16_t index, uint16_t opcode,
+					const uint8_t *data, uint16_t size)
+{
+	if (opcode != MONITOR_EVENT_PKT || size < 2 + 3)
+		return;
+
+	if (data[0] != BT_HCI_EVT_DISCONNECT_COMPLETE || data[2])
+		return;
+
+	remove_conn(index, bt_get_le16(data + 3) & 0x0fff);
+}
+
+bool filter_packet(uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	bool result = false;
+
+	if (!enabled)
+		return true;
+
+	if (index_filter.count > 0 && !match_value(&index_filter, index))
+		return false;
+
+	/* Controller information is needed to decode anything else */
+	if (opcode == MONITOR_NEW_INDEX || opcode == MONITOR_DEL_INDEX)
+		return true;
+
+	if (addr_count > 0)
+		track_conn(index, opcode, data, size);
+
+	if (type_mask && (opcode > 31 || !(type_mask & (1 << opcode))))
+		goto done;
+
+	if (opcode_filter.count > 0 && !match_opcode(opcode, data, size))
+		goto done;
+
+	if (event_filter.count > 0 && (opcode != MONITOR_EVENT_PKT ||
+				size < 1 || !match_value(&event_filter,
+						*((const uint8_t *) data))))
+		goto done;
+
+	if ((handle_filter.count > 0 || addr_count > 0) &&
+				!match_conn(index, opcode, data, size))
+		goto done;
+
+	if (cid_filter.count > 0 && !match_cid(index, opcode, data, size))
+		goto done;
+
+	result = true;
+
+done:
+	if (addr_count > 0 || cid_filter.count > 0)
+		untrack_conn(index, opcode, data, size);
+
+	return result;
+}
@@ -28,6 +28,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include <inttypes.h>
 
 #include <bluetooth/bluetooth.h>
@@ -39,9 +41,16 @@
 #include "uuid.h"
 #include "sdp.h"
 
-#define MAX_CHAN 64
+/*
+ * Channels and fragment reassembly state are kept per link in a hash
+ * table keyed by controller index and connection handle, so lookups do
+ * not depend on the number of active links or controllers.
+ */
 
 struct chan_data {
+	struct chan_data *next;
+	struct chan_data *amp_next;
+	uint16_t id;
 	uint16_t index;
 	uint16_t handle;
 	uint16_t scid;
@@ -51,222 +60,313 @@ struct chan_data {
 	uint8_t  mode;
 };
 
-static struct chan_data chan_list[MAX_CHAN];
+struct frag_data {
+	void *buf;
+	uint16_t pos;
+	uint16_t len;
+	uint16_t cid;
+};
 
-static void assign_scid(const struct l2cap_frame *frame,
-				uint16_t scid, uint16_t psm, uint8_t ctrlid)
+struct link_data {
+	struct link_data *next;
+	uint16_t index;
+	uint16_t handle;
+	struct chan_data *chans;
+	struct frag_data frag[2];	/* Outgoing and incoming */
+};
+
+#define LINK_TABLE_MIN 16
+
+static struct link_data **link_table;
+static unsigned int link_table_size;
+static unsigned int link_count;
+
+/* Channels moved to an AMP controller, matched on the AMP index as well */
+static struct chan_data *amp_chans;
+
+static uint16_t chan_id;
+
+static unsigned int link_hash(uint16_t index, uint16_t handle,
+							unsigned int size)
 {
-	int i, n = -1;
+	return (index * 31 + handle) & (size - 1);
+}
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (n < 0 && chan_list[i].handle == 0x0000)
-			n = i;
+static void link_table_grow(void)
+{
+	struct link_data **table;
+	unsigned int i, size;
 
-		if (chan_list[i].index != frame->index)
-			continue;
+	size = link_table_size ? link_table_size * 2 : LINK_TABLE_MIN;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	table = calloc(size, sizeof(*table));
+	if (!table)
+		return;
 
-		if (frame->in) {
-			if (chan_list[i].dcid == scid) {
-				n = i;
-				break;
-			}
-		} else {
-			if (chan_list[i].scid == scid) {
-				n = i;
-				break;
-			}
+	for (i = 0; i < link_table_size; i++) {
+		struct link_data *link = link_table[i];
+
+		while (link) {
+			struct link_data *next = link->next;
+			unsigned int n = link_hash(link->index, link->handle,
+									size);
+
+			link->next = table[n];
+			table[n] = link;
+			link = next;
 		}
 	}
 
-	if (n < 0)
-		return;
+	free(link_table);
+	link_table = table;
+	link_table_size = size;
+}
 
-	memset(&chan_list[n], 0, sizeof(chan_list[n]));
-	chan_list[n].index = frame->index;
-	chan_list[n].handle = frame->handle;
+static struct link_data *find_link(uint16_t index, uint16_t handle,
+								bool create)
+{
+	struct link_data *link;
+	unsigned int n;
 
-	if (frame->in)
-		chan_list[n].dcid = scid;
-	else
-		chan_list[n].scid = scid;
+	if (link_table_size) {
+		n = link_hash(index, handle, link_table_size);
+
+		for (link = link_table[n]; link; link = link->next) {
+			if (link->index == index && link->handle == handle)
+				return link;
+		}
+	}
+
+	if (!create)
+		return NULL;
+
+	if (link_count >= link_table_size)
+		link_table_grow();
+
+	if (!link_table_size)
+		return NULL;
 
-	chan_list[n].psm = psm;
-	chan_list[n].ctrlid = ctrlid;
-	chan_list[n].mode = 0;
+	link = calloc(1, sizeof(*link));
+	if (!link)
+		return NULL;
+
+	link->index = index;
+	link->handle = handle;
+
+	n = link_hash(index, handle, link_table_size);
+	link->next = link_table[n];
+	link_table[n] = link;
+	link_count++;
+
+	return link;
 }
 
-static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
+static void clear_fragment_buffer(struct frag_data *frag)
 {
-	int i;
+	free(frag->buf);
+	frag->buf = NULL;
+	frag->pos = 0;
+	frag->len = 0;
+}
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+static void chan_free(struct link_data *link, struct chan_data *chan)
+{
+	struct chan_data **p;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	for (p = &link->chans; *p; p = &(*p)->next) {
+		if (*p == chan) {
+			*p = chan->next;
+			break;
+		}
+	}
 
-		if (frame->in) {
-			if (chan_list[i].scid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == scid) {
-				chan_list[i].handle = 0;
-				break;
-			}
+	for (p = &amp_chans; *p; p = &(*p)->amp_next) {
+		if (*p == chan) {
+			*p = chan->amp_next;
+			break;
 		}
 	}
+
+	free(chan);
 }
 
-static void assign_dcid(const struct l2cap_frame *frame,
-					uint16_t dcid, uint16_t scid)
+void l2cap_release_link(uint16_t index, uint16_t handle)
 {
-	int i;
+	struct link_data **p, *link;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	if (!link_table_size)
+		return;
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	p = &link_table[link_hash(index, handle, link_table_size)];
 
-		if (frame->in) {
-			if (chan_list[i].scid == scid) {
-				chan_list[i].dcid = dcid;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == scid) {
-				chan_list[i].scid = dcid;
-				break;
-			}
-		}
+	for (; *p; p = &(*p)->next) {
+		if ((*p)->index == index && (*p)->handle == handle)
+			break;
 	}
+
+	link = *p;
+	if (!link)
+		return;
+
+	*p = link->next;
+	link_count--;
+
+	while (link->chans)
+		chan_free(link, link->chans);
+
+	clear_fragment_buffer(&link->frag[0]);
+	clear_fragment_buffer(&link->frag[1]);
+
+	free(link);
 }
 
-static void assign_mode(const struct l2cap_frame *frame,
-					uint8_t mode, uint16_t dcid)
+/* Find a channel of a link by its source (local) or destination CID */
+static struct chan_data *link_find_chan(struct link_data *link,
+						bool source, uint16_t cid)
 {
-	int i;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index)
-			continue;
+	for (chan = link->chans; chan; chan = chan->next) {
+		if ((source ? chan->scid : chan->dcid) == cid)
+			return chan;
+	}
 
-		if (chan_list[i].handle != frame->handle)
-			continue;
+	return NULL;
+}
 
-		if (frame->in) {
-			if (chan_list[i].scid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
-		} else {
-			if (chan_list[i].dcid == dcid) {
-				chan_list[i].mode = mode;
-				break;
-			}
-		}
-	}
+static struct chan_data *find_chan(const struct l2cap_frame *frame,
+						bool source, uint16_t cid)
+{
+	struct link_data *link;
+
+	link = find_link(frame->index, frame->handle, false);
+	if (!link)
+		return NULL;
+
+	return link_find_chan(link, source, cid);
 }
 
-static uint16_t get_psm(const struct l2cap_frame *frame)
+static void assign_scid(const struct l2cap_frame *frame,
+				uint16_t scid, uint16_t psm, uint8_t ctrlid)
 {
-	int i;
+	struct link_data *link;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	link = find_link(frame->index, frame->handle, true);
+	if (!link)
+		return;
 
-		if (chan_list[i].handle != frame->handle &&
-					chan_list[i].ctrlid != frame->index)
-			continue;
+	chan = link_find_chan(link, !frame->in, scid);
+	if (chan)
+		chan_free(link, chan);
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return chan_list[i].psm;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return chan_list[i].psm;
-		}
+	chan = calloc(1, sizeof(*chan));
+	if (!chan)
+		return;
+
+	if (++chan_id == 0)
+		chan_id = 1;
+
+	chan->id = chan_id;
+	chan->index = frame->index;
+	chan->handle = frame->handle;
+
+	if (frame->in)
+		chan->dcid = scid;
+	else
+		chan->scid = scid;
+
+	chan->psm = psm;
+	chan->ctrlid = ctrlid;
+	chan->mode = 0;
+
+	chan->next = link->chans;
+	link->chans = chan;
+
+	if (ctrlid) {
+		chan->amp_next = amp_chans;
+		amp_chans = chan;
 	}
+}
 
-	return 0;
+static void release_scid(const struct l2cap_frame *frame, uint16_t scid)
+{
+	struct link_data *link;
+	struct chan_data *chan;
+
+	link = find_link(frame->index, frame->handle, false);
+	if (!link)
+		return;
+
+	chan = link_find_chan(link, frame->in, scid);
+	if (chan)
+		chan_free(link, chan);
 }
 
-static uint8_t get_mode(const struct l2cap_frame *frame)
+static void assign_dcid(const struct l2cap_frame *frame,
+					uint16_t dcid, uint16_t scid)
 {
-	int i;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	chan = find_chan(frame, frame->in, scid);
+	if (!chan)
+		return;
 
-		if (chan_list[i].handle != frame->handle &&
-					chan_list[i].ctrlid != frame->index)
-			continue;
+	if (frame->in)
+		chan->dcid = dcid;
+	else
+		chan->scid = dcid;
+}
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return chan_list[i].mode;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return chan_list[i].mode;
-		}
-	}
+static void assign_mode(const struct l2cap_frame *frame,
+					uint8_t mode, uint16_t dcid)
+{
+	struct chan_data *chan;
 
-	return 0;
+	chan = find_chan(frame, frame->in, dcid);
+	if (chan)
+		chan->mode = mode;
 }
 
-static uint16_t get_chan(const struct l2cap_frame *frame)
+static struct chan_data *get_chan_data(const struct l2cap_frame *frame)
 {
-	int i;
+	struct chan_data *chan;
 
-	for (i = 0; i < MAX_CHAN; i++) {
-		if (chan_list[i].index != frame->index &&
-					chan_list[i].ctrlid == 0)
-			continue;
+	chan = find_chan(frame, frame->in, frame->cid);
+	if (chan)
+		return chan;
 
-		if (chan_list[i].handle != frame->handle &&
-					chan_list[i].ctrlid != frame->index)
+	for (chan = amp_chans; chan; chan = chan->amp_next) {
+		if (chan->handle != frame->handle &&
+					chan->ctrlid != frame->index)
 			continue;
 
-		if (frame->in) {
-			if (chan_list[i].scid == frame->cid)
-				return i;
-		} else {
-			if (chan_list[i].dcid == frame->cid)
-				return i;
-		}
+		if ((frame->in ? chan->scid : chan->dcid) == frame->cid)
+			return chan;
 	}
 
-	return 0;
+	return NULL;
 }
 
-#define MAX_INDEX 16
+static uint16_t get_psm(const struct l2cap_frame *frame)
+{
+	struct chan_data *chan = get_chan_data(frame);
+
+	return chan ? chan->psm : 0;
+}
 
-struct index_data {
-	void *frag_buf;
-	uint16_t frag_pos;
-	uint16_t frag_len;
-	uint16_t frag_cid;
-};
+static uint8_t get_mode(const struct l2cap_frame *frame)
+{
+	struct chan_data *chan = get_chan_data(frame);
 
-static struct index_data index_list[MAX_INDEX];
+	return chan ? chan->mode : 0;
+}
 
-static void clear_fragment_buffer(uint16_t index)
+static uint16_t get_chan(const struct l2cap_frame *frame)
 {
-	free(index_list[index].frag_buf);
-	index_list[index].frag_buf = NULL;
-	index_list[index].frag_pos = 0;
-	index_list[index].frag_len = 0;
+	struct chan_data *chan = get_chan_data(frame);
+
+	return chan ? chan->id : 0;
 }
 
 static void print_psm(uint16_t psm)
@@ -2375,21 +2475,26 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 					const void *data, uint16_t size)
 {
 	const struct bt_l2cap_hdr *hdr = data;
+	struct link_data *link;
+	struct frag_data *frag;
 	uint16_t len, cid;
 
-	if (index > MAX_INDEX - 1) {
-		print_text(COLOR_ERROR, "controller index too large");
+	link = find_link(index, handle, true);
+	if (!link) {
+		print_text(COLOR_ERROR, "failed link allocation");
 		packet_hexdump(data, size);
 		return;
 	}
 
+	frag = &link->frag[in];
+
 	switch (flags) {
 	case 0x00:	/* start of a non-automatically-flushable PDU */
 	case 0x02:	/* start of an automatically-flushable PDU */
-		if (index_list[index].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected start frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
@@ -2417,54 +2522,51 @@ void l2cap_packet(uint16_t index, bool in, uint16_t handle, uint8_t flags,
 			return;
 		}
 
-		index_list[index].frag_buf = malloc(len);
-		if (!index_list[index].frag_buf) {
+		frag->buf = malloc(len);
+		if (!frag->buf) {
 			print_text(COLOR_ERROR, "failed buffer allocation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		memcpy(index_list[index].frag_buf, data, size);
-		index_list[index].frag_pos = size;
-		index_list[index].frag_len = len - size;
-		index_list[index].frag_cid = cid;
+		memcpy(frag->buf, data, size);
+		frag->pos = size;
+		frag->len = len - size;
+		frag->cid = cid;
 		break;
 
 	case 0x01:	/* continuing fragment */
-		if (!index_list[index].frag_len) {
+		if (!frag->len) {
 			print_text(COLOR_ERROR, "unexpected continuation");
 			packet_hexdump(data, size);
 			return;
 		}
 
-		if (size > index_list[index].frag_len) {
+		if (size > frag->len) {
 			print_text(COLOR_ERROR, "fragment too long");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
-		memcpy(index_list[index].frag_buf +
-				index_list[index].frag_pos, data, size);
-		index_list[index].frag_pos += size;
-		index_list[index].frag_len -= size;
+		memcpy(frag->buf + frag->pos, data, size);
+		frag->pos += size;
+		frag->len -= size;
 
-		if (!index_list[index].frag_len) {
+		if (!frag->len) {
 			/* complete frame */
-			l2cap_frame(index, in, handle,
-					index_list[index].frag_cid,
-					index_list[index].frag_buf,
-					index_list[index].frag_pos);
-			clear_fragment_buffer(index);
+			l2cap_frame(index, in, handle, frag->cid,
+						frag->buf, frag->pos);
+			clear_fragment_buffer(frag);
 			return;
 		}
 		break;
 
 	case 0x03:	/* complete automatically-flushable PDU */
-		if (index_list[index].frag_len) {
+		if (frag->len) {
 			print_text(COLOR_ERROR, "unexpected complete frame");
 			packet_hexdump(data, size);
-			clear_fragment_buffer(index);
+			clear_fragment_buffer(frag);
 			return;
 		}
 
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include <getopt.h>
 
@@ -36,6 +37,8 @@
 #include "packet.h"
 #include "control.h"
 #include "btsnoop.h"
+#include "analyze.h"
+#include "filter.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -57,9 +60,11 @@ static void usage(void)
 		"\t-w, --write <file>     Save traces in btsnoop format\n"
 		"\t-s, --server <socket>  Start monitor server socket\n"
 		"\t-i, --index <num>      Show only specified controller\n"
+		"\t-f, --filter <expr>    Filter packets before decoding\n"
 		"\t-t, --time             Show time instead of time offset\n"
 		"\t-T, --date             Show time and date information\n"
 		"\t-S, --sco              Dump SCO traffic\n"
+		"\t-a, --analyze          Print traffic statistics summary\n"
 		"\t-h, --help             Show help options\n");
 }
 
@@ -68,9 +73,11 @@ static const struct option main_options[] = {
 	{ "write",   required_argument, NULL, 'w' },
 	{ "server",  required_argument, NULL, 's' },
 	{ "index",   required_argument, NULL, 'i' },
+	{ "filter",  required_argument, NULL, 'f' },
 	{ "time",    no_argument,       NULL, 't' },
 	{ "date",    no_argument,       NULL, 'T' },
 	{ "sco",     no_argument,	NULL, 'S' },
+	{ "analyze", no_argument,       NULL, 'a' },
 	{ "version", no_argument,       NULL, 'v' },
 	{ "help",    no_argument,       NULL, 'h' },
 	{ }
@@ -80,7 +87,9 @@ int main(int argc, char *argv[])
 {
 	unsigned long filter_mask = 0;
 	const char *str, *reader_path = NULL;
+	bool analyze = false;
 	sigset_t mask;
+	int exit_status;
 
 	mainloop_init();
 
@@ -89,7 +98,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "r:w:s:i:tTSvh",
+		opt = getopt_long(argc, argv, "r:w:s:i:f:tTSavh",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -115,6 +124,12 @@ int main(int argc, char *argv[])
 			}
 			packet_select_index(atoi(str));
 			break;
+		case 'f':
+			if (filter_parse(optarg) < 0) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
 		case 't':
 			filter_mask &= ~PACKET_FILTER_SHOW_TIME_OFFSET;
 			filter_mask |= PACKET_FILTER_SHOW_TIME;
@@ -127,6 +142,10 @@ int main(int argc, char *argv[])
 		case 'S':
 			filter_mask |= PACKET_FILTER_SHOW_SCO_DATA;
 			break;
+		case 'a':
+			analyze = true;
+			control_analyze();
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -150,11 +169,20 @@ int main(int argc, char *argv[])
 
 	if (reader_path) {
 		control_reader(reader_path);
+
+		if (analyze)
+			analyze_report();
+
 		return EXIT_SUCCESS;
 	}
 
 	if (control_tracing() < 0)
 		return EXIT_FAILURE;
 
-	return mainloop_run();
+	exit_status = mainloop_run();
+
+	if (analyze)
+		analyze_report();
+
+	return exit_status;
 }
@@ -73,36 +73,124 @@ static unsigned long filter_mask = 0;
 static bool index_filter = false;
 static uint16_t index_number = 0;
 
-#define MAX_CONN 16
+/* Controller index of the event currently being decoded */
+static uint16_t current_index;
 
 struct conn_data {
+	struct conn_data *next;
+	uint16_t index;
 	uint16_t handle;
 	uint8_t  type;
 };
 
-static struct conn_data conn_list[MAX_CONN];
+#define CONN_TABLE_MIN 16
 
-static void assign_handle(uint16_t handle, uint8_t type)
+static struct conn_data **conn_table;
+static unsigned int conn_table_size;
+static unsigned int conn_count;
+
+static unsigned int conn_hash(uint16_t index, uint16_t handle,
+							unsigned int size)
 {
-	int i;
+	return (index * 31 + handle) & (size - 1);
+}
 
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == 0x0000) {
-			conn_list[i].handle = handle;
-			conn_list[i].type = type;
-			break;
+static void conn_table_grow(void)
+{
+	struct conn_data **table;
+	unsigned int i, size;
+
+	size = conn_table_size ? conn_table_size * 2 : CONN_TABLE_MIN;
+
+	table = calloc(size, sizeof(*table));
+	if (!table)
+		return;
+
+	for (i = 0; i < conn_table_size; i++) {
+		struct conn_data *conn = conn_table[i];
+
+		while (conn) {
+			struct conn_data *next = conn->next;
+			unsigned int n = conn_hash(conn->index, conn->handle,
+									size);
+
+			conn->next = table[n];
+			table[n] = conn;
+			conn = next;
 		}
 	}
+
+	free(conn_table);
+	conn_table = table;
+	conn_table_size = size;
+}
+
+static struct conn_data *find_conn(uint16_t index, uint16_t handle)
+{
+	struct conn_data *conn;
+
+	if (!conn_table_size)
+		return NULL;
+
+	conn = conn_table[conn_hash(index, handle, conn_table_size)];
+
+	for (; conn; conn = conn->next) {
+		if (conn->index == index && conn->handle == handle)
+			return conn;
+	}
+
+	return NULL;
+}
+
+static void assign_handle(uint16_t handle, uint8_t type)
+{
+	struct conn_data *conn;
+	unsigned int n;
+
+	conn = find_conn(current_index, handle);
+	if (conn) {
+		conn->type = type;
+		return;
+	}
+
+	if (conn_count >= conn_table_size)
+		conn_table_grow();
+
+	if (!conn_table_size)
+		return;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return;
+
+	conn->index = current_index;
+	conn->handle = handle;
+	conn->type = type;
+
+	n = conn_hash(current_index, handle, conn_table_size);
+	conn->next = conn_table[n];
+	conn_table[n] = conn;
+	conn_count++;
 }
 
 static void release_handle(uint16_t handle)
 {
-	int i;
+	struct conn_data **p, *conn;
+
+	l2cap_release_link(current_index, handle);
 
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == handle) {
-			conn_list[i].handle = 0x0000;
-			conn_list[i].type = 0x00;
+	if (!conn_table_size)
+		return;
+
+	p = &conn_table[conn_hash(current_index, handle, conn_table_size)];
+
+	for (; *p; p = &(*p)->next) {
+		conn = *p;
+
+		if (conn->index == current_index && conn->handle == handle) {
+			*p = conn->next;
+			conn_count--;
+			free(conn);
 			break;
 		}
 	}
@@ -110,14 +198,9 @@ static void release_handle(uint16_t handle)
 
 static uint8_t get_type(uint16_t handle)
 {
-	int i;
-
-	for (i = 0; i < MAX_CONN; i++) {
-		if (conn_list[i].handle == handle)
-			return conn_list[i].type;
-	}
+	struct conn_data *conn = find_conn(current_index, handle);
 
-	return 0xff;
+	return conn ? conn->type : 0xff;
 }
 
 void packet_set_filter(unsigned long filter)
@@ -2192,15 +2275,6 @@ void packet_control(struct timeval *tv, uint16_t index, uint16_t opcode,
 	control_message(opcode, data, size);
 }
 
-#define MONITOR_NEW_INDEX	0
-#define MONITOR_DEL_INDEX	1
-#define MONITOR_COMMAND_PKT	2
-#define MONITOR_EVENT_PKT	3
-#define MONITOR_ACL_TX_PKT	4
-#define MONITOR_ACL_RX_PKT	5
-#define MONITOR_SCO_TX_PKT	6
-#define MONITOR_SCO_RX_PKT	7
-
 struct monitor_new_index {
 	uint8_t  type;
 	uint8_t  bus;
@@ -2212,13 +2286,39 @@ struct monitor_new_index {
 
 #define MONITOR_DEL_INDEX_SIZE 0
 
-#define MAX_INDEX 16
-
 struct index_data {
 	bdaddr_t bdaddr;
 };
 
-static struct index_data index_list[MAX_INDEX];
+/* Grown on demand, indexed directly by the controller index */
+static struct index_data *index_list;
+static unsigned int index_count;
+
+static struct index_data *get_index(uint16_t index, bool create)
+{
+	struct index_data *list;
+	unsigned int count;
+
+	if (index < index_count)
+		return &index_list[index];
+
+	if (!create)
+		return NULL;
+
+	count = index + 1;
+
+	list = realloc(index_list, count * sizeof(*list));
+	if (!list)
+		return NULL;
+
+	memset(list + index_count, 0,
+			(count - index_count) * sizeof(*list));
+
+	index_list = list;
+	index_count = count;
+
+	return &index_list[index];
+}
 
 uint32_t packet_get_flags(uint16_t opcode)
 {
@@ -2281,6 +2381,7 @@ void packet_monitor(struct timeval *tv, uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size)
 {
 	const struct monitor_new_index *ni;
+	struct index_data *data_index;
 	char str[18], extra_str[24];
 
 	if (index_filter && index_number != index)
@@ -2293,16 +2394,17 @@ void packet_monitor(struct timeval *tv, uint16_t index, uint16_t opcode,
 	case MONITOR_NEW_INDEX:
 		ni = data;
 
-		if (index < MAX_INDEX) {
-			bacpy(&index_list[index].bdaddr, &ni->bdaddr);
-		}
+		data_index = get_index(index, true);
+		if (data_index)
+			bacpy(&data_index->bdaddr, &ni->bdaddr);
 
 		ba2str(&ni->bdaddr, str);
 		packet_new_index(tv, index, str, ni->type, ni->bus, ni->name);
 		break;
 	case MONITOR_DEL_INDEX:
-		if (index < MAX_INDEX)
-			ba2str(&index_list[index].bdaddr, str);
+		data_index = get_index(index, false);
+		if (data_index)
+			ba2str(&data_index->bdaddr, str);
 		else
 			ba2str(BDADDR_ANY, str);
 
@@ -5433,6 +5535,8 @@ void packet_hci_event(struct timeval *tv, uint16_t index,
 		}
 	}
 
+	current_index = index;
+
 	event_data->func(data, hdr->plen);
 }
 
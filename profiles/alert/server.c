@@ -47,6 +47,7 @@
 #include "profile.h"
 #include "error.h"
 #include "textfile.h"
+#include "ccc.h"
 #include "attio.h"
 
 #define PHONE_ALERT_STATUS_SVC_UUID	0x180E
@@ -115,15 +116,9 @@ struct alert_adapter {
 	uint16_t hnd_value[NOTIFY_SIZE];
 };
 
-struct notify_data {
+struct notify_callback {
 	struct alert_adapter *al_adapter;
 	enum notify_type type;
-	uint8_t *value;
-	size_t len;
-};
-
-struct notify_callback {
-	struct notify_data *notify_data;
 	struct btd_device *device;
 	guint id;
 };
@@ -326,13 +321,9 @@ static gboolean is_notifiable_device(struct btd_device *device, uint16_t ccc)
 {
 	char *filename;
 	GKeyFile *key_file;
-	char handle[6];
-	char *str;
-	uint16_t val;
+	GHashTable *config;
 	gboolean result;
 
-	sprintf(handle, "%hu", ccc);
-
 	filename = btd_device_get_storage_path(device, "ccc");
 	if (!filename) {
 		warn("Unable to get ccc storage path for device");
@@ -342,21 +333,12 @@ static gboolean is_notifiable_device(struct btd_device *device, uint16_t ccc)
 	key_file = g_key_file_new();
 	g_key_file_load_from_file(key_file, filename, 0, NULL);
 
-	str = g_key_file_get_string(key_file, handle, "Value", NULL);
-	if (!str) {
-		result = FALSE;
-		goto end;
-	}
+	config = ccc_new();
+	ccc_load(config, key_file);
 
-	val = strtol(str, NULL, 16);
-	if (!(val & 0x0001)) {
-		result = FALSE;
-		goto end;
-	}
+	result = ccc_opcode(config, ccc) == ATT_OP_HANDLE_NOTIFY;
 
-	result = TRUE;
-end:
-	g_free(str);
+	g_hash_table_destroy(config);
 	g_free(filename);
 	g_key_file_free(key_file);
 
@@ -366,89 +348,72 @@ end:
 static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 {
 	struct notify_callback *cb = user_data;
-	struct notify_data *nd = cb->notify_data;
-	enum notify_type type = nd->type;
-	struct alert_adapter *al_adapter = nd->al_adapter;
-	size_t len;
-	uint8_t *pdu = g_attrib_get_buffer(attrib, &len);
-
-
-	switch (type) {
-	case NOTIFY_RINGER_SETTING:
-		len = enc_notification(al_adapter->hnd_value[type],
-				&ringer_setting, sizeof(ringer_setting),
-				pdu, len);
-		break;
-	case NOTIFY_ALERT_STATUS:
-		len = enc_notification(al_adapter->hnd_value[type],
-				&alert_status, sizeof(alert_status),
-				pdu, len);
-		break;
-	case NOTIFY_NEW_ALERT:
-	case NOTIFY_UNREAD_ALERT:
-		len = enc_notification(al_adapter->hnd_value[type],
-					nd->value, nd->len, pdu, len);
-		break;
-	default:
-		DBG("Unknown type, could not send notification");
-		goto end;
-	}
+	struct alert_adapter *al_adapter = cb->al_adapter;
+	enum notify_type type = cb->type;
 
 	DBG("Send notification for handle: 0x%04x, ccc: 0x%04x",
 					al_adapter->hnd_value[type],
 					al_adapter->hnd_ccc[type]);
 
-	g_attrib_send(attrib, 0, pdu, len, NULL, NULL, NULL);
+	/* The attribute database already holds the value to be sent */
+	if (attrib_db_notify(al_adapter->adapter, al_adapter->hnd_value[type],
+							cb->device) < 0)
+		DBG("Could not send notification");
 
-end:
 	btd_device_remove_attio_callback(cb->device, cb->id);
 	btd_device_unref(cb->device);
-	g_free(cb->notify_data->value);
-	g_free(cb->notify_data);
 	g_free(cb);
 }
 
 static void filter_devices_notify(struct btd_device *device, void *user_data)
 {
-	struct notify_data *notify_data = user_data;
-	struct alert_adapter *al_adapter = notify_data->al_adapter;
-	enum notify_type type = notify_data->type;
+	struct notify_callback *data = user_data;
+	struct alert_adapter *al_adapter = data->al_adapter;
+	enum notify_type type = data->type;
 	struct notify_callback *cb;
 
 	if (!is_notifiable_device(device, al_adapter->hnd_ccc[type]))
 		return;
 
 	cb = g_new0(struct notify_callback, 1);
-	cb->notify_data = notify_data;
+	cb->al_adapter = al_adapter;
+	cb->type = type;
 	cb->device = btd_device_ref(device);
 	cb->id = btd_device_add_attio_callback(device,
 						attio_connected_cb, NULL, cb);
 }
 
 static void notify_devices(struct alert_adapter *al_adapter,
-			enum notify_type type, uint8_t *value, size_t len)
+						enum notify_type type)
 {
-	struct notify_data *notify_data;
+	struct notify_callback data;
 
-	notify_data = g_new0(struct notify_data, 1);
-	notify_data->al_adapter = al_adapter;
-	notify_data->type = type;
-	notify_data->value = g_memdup(value, len);
-	notify_data->len = len;
+	data.al_adapter = al_adapter;
+	data.type = type;
 
 	btd_adapter_for_each_device(al_adapter->adapter, filter_devices_notify,
-					notify_data);
+									&data);
 }
 
 static void pasp_notification(enum notify_type type)
 {
 	GSList *it;
 	struct alert_adapter *al_adapter;
+	uint8_t *value;
+
+	if (type == NOTIFY_RINGER_SETTING)
+		value = &ringer_setting;
+	else
+		value = &alert_status;
 
 	for (it = alert_adapters; it; it = g_slist_next(it)) {
 		al_adapter = it->data;
 
-		notify_devices(al_adapter, type, NULL, 0);
+		attrib_db_update(al_adapter->adapter,
+					al_adapter->hnd_value[type], NULL,
+					value, sizeof(*value), NULL);
+
+		notify_devices(al_adapter, type);
 	}
 }
 
@@ -508,7 +473,7 @@ static void update_new_alert(gpointer data, gpointer user_data)
 	attrib_db_update(adapter, al_adapter->hnd_value[NOTIFY_NEW_ALERT], NULL,
 						&value[1], value[0], NULL);
 
-	notify_devices(al_adapter, NOTIFY_NEW_ALERT, &value[1], value[0]);
+	notify_devices(al_adapter, NOTIFY_NEW_ALERT);
 }
 
 static void update_phone_alerts(const char *category, const char *description)
@@ -668,7 +633,7 @@ static void update_unread_alert(gpointer data, gpointer user_data)
 			al_adapter->hnd_value[NOTIFY_UNREAD_ALERT], NULL, value,
 			2, NULL);
 
-	notify_devices(al_adapter, NOTIFY_UNREAD_ALERT, value, 2);
+	notify_devices(al_adapter, NOTIFY_UNREAD_ALERT);
 }
 
 static DBusMessage *unread_alert(DBusConnection *conn, DBusMessage *msg,
@@ -26,6 +26,8 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 #include <glib.h>
 #include <gdbus/gdbus.h>
 
@@ -41,6 +43,7 @@
 #include "attrib/att.h"
 #include "attrib/gatt.h"
 #include "attio.h"
+#include "measurement-stream.h"
 #include "log.h"
 
 /* min length for ATT indication or notification: opcode (1b) + handle (2b) */
@@ -48,6 +51,8 @@
 
 #define ATT_TIMEOUT 30
 
+#define CSC_MEASUREMENT_UUID16	0x2a5b
+
 #define CYCLINGSPEED_INTERFACE		"org.bluez.CyclingSpeed1"
 #define CYCLINGSPEED_MANAGER_INTERFACE	"org.bluez.CyclingSpeedManager1"
 #define CYCLINGSPEED_WATCHER_INTERFACE	"org.bluez.CyclingSpeedWatcher1"
@@ -86,6 +91,7 @@ struct csc_adapter {
 	struct btd_adapter	*adapter;
 	GSList			*devices;	/* list of registered devices */
 	GSList			*watchers;
+	GSList			*streams;	/* binary measurement streams */
 };
 
 struct csc {
@@ -188,6 +194,11 @@ static int cmp_device(gconstpointer a, gconstpointer b)
 	return -1;
 }
 
+static bool has_consumers(struct csc_adapter *cadapter)
+{
+	return cadapter->watchers != NULL || cadapter->streams != NULL;
+}
+
 static int cmp_watcher(gconstpointer a, gconstpointer b)
 {
 	const struct watcher *watcher = a;
@@ -251,6 +262,8 @@ static void destroy_csc_adapter(gpointer user_data)
 	struct csc_adapter *cadapter = user_data;
 
 	g_slist_free_full(cadapter->watchers, remove_watcher);
+	g_slist_free_full(cadapter->streams,
+				(GDestroyNotify) measurement_stream_free);
 
 	g_free(cadapter);
 }
@@ -418,13 +431,10 @@ static void read_location_cb(guint8 status, const guint8 *pdu,
 					CYCLINGSPEED_INTERFACE, "Location");
 }
 
-static void discover_desc_cb(guint8 status, const guint8 *pdu,
-					guint16 len, gpointer user_data)
+static void discover_desc_cb(GSList *descs, guint8 status, gpointer user_data)
 {
 	struct characteristic *ch = user_data;
-	struct att_data_list *list = NULL;
-	uint8_t format;
-	int i;
+	GSList *l;
 
 	if (status != 0) {
 		error("Discover %s descriptors failed: %s", ch->uuid,
@@ -432,30 +442,18 @@ static void discover_desc_cb(guint8 status, const guint8 *pdu,
 		goto done;
 	}
 
-	list = dec_find_info_resp(pdu, len, &format);
-	if (list == NULL)
-		goto done;
-
-	if (format != ATT_FIND_INFO_RESP_FMT_16BIT)
-		goto done;
-
-	for (i = 0; i < list->num; i++) {
-		uint8_t *value;
-		uint16_t handle, uuid;
+	for (l = descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
 		uint8_t attr_val[2];
 		char *msg;
 
-		value = list->data[i];
-		handle = att_get_u16(value);
-		uuid = att_get_u16(value + 2);
-
-		if (uuid != GATT_CLIENT_CHARAC_CFG_UUID)
+		if (desc->uuid16 != GATT_CLIENT_CHARAC_CFG_UUID)
 			continue;
 
 		if (g_strcmp0(ch->uuid, CSC_MEASUREMENT_UUID) == 0) {
-			ch->csc->measurement_ccc_handle = handle;
+			ch->csc->measurement_ccc_handle = desc->handle;
 
-			if (g_slist_length(ch->csc->cadapter->watchers) == 0) {
+			if (!has_consumers(ch->csc->cadapter)) {
 				att_put_u16(0x0000, attr_val);
 				msg = g_strdup("Disable measurement");
 			} else {
@@ -471,7 +469,7 @@ static void discover_desc_cb(guint8 status, const guint8 *pdu,
 			break;
 		}
 
-		gatt_write_char(ch->csc->attrib, handle, attr_val,
+		gatt_write_char(ch->csc->attrib, desc->handle, attr_val,
 					sizeof(attr_val), char_write_cb, msg);
 
 		/* We only want CCC, can break here */
@@ -479,8 +477,6 @@ static void discover_desc_cb(guint8 status, const guint8 *pdu,
 	}
 
 done:
-	if (list)
-		att_data_list_free(list);
 	g_free(ch);
 }
 
@@ -506,7 +502,8 @@ static void discover_desc(struct csc *csc, struct gatt_char *c,
 	ch->csc = csc;
 	memcpy(ch->uuid, c->uuid, sizeof(c->uuid));
 
-	gatt_find_info(csc->attrib, start, end, discover_desc_cb, ch);
+	btd_device_discover_desc(csc->dev, start, end, NULL,
+						discover_desc_cb, ch);
 }
 
 static void update_watcher(gpointer data, gpointer user_data)
@@ -608,7 +605,11 @@ static void measurement_notify_handler(const uint8_t *pdu, uint16_t len,
 		return;
 	}
 
-	process_measurement(csc, pdu + 3, len - 3);
+	measurement_stream_send_all(csc->cadapter->streams, csc->dev,
+					CSC_MEASUREMENT_UUID16, pdu + 3, len - 3);
+
+	if (csc->cadapter->watchers)
+		process_measurement(csc, pdu + 3, len - 3);
 }
 
 static void controlpoint_property_reply(struct controlpoint_req *req,
@@ -848,7 +849,7 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 
 	csc->attrib = g_attrib_ref(attrib);
 
-	gatt_discover_char(csc->attrib, csc->svc_range->start,
+	btd_device_discover_char(csc->dev, csc->svc_range->start,
 						csc->svc_range->end, NULL,
 						discover_char_cb, csc);
 }
@@ -883,7 +884,7 @@ static void watcher_exit_cb(DBusConnection *conn, void *user_data)
 	cadapter->watchers = g_slist_remove(cadapter->watchers, watcher);
 	g_dbus_remove_watch(conn, watcher->id);
 
-	if (g_slist_length(cadapter->watchers) == 0)
+	if (!has_consumers(cadapter))
 		g_slist_foreach(cadapter->devices, disable_measurement, 0);
 }
 
@@ -910,7 +911,7 @@ static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
 	watcher->srv = g_strdup(sender);
 	watcher->path = g_strdup(path);
 
-	if (g_slist_length(cadapter->watchers) == 0)
+	if (!has_consumers(cadapter))
 		g_slist_foreach(cadapter->devices, enable_measurement, 0);
 
 	cadapter->watchers = g_slist_prepend(cadapter->watchers, watcher);
@@ -939,7 +940,7 @@ static DBusMessage *unregister_watcher(DBusConnection *conn, DBusMessage *msg,
 	cadapter->watchers = g_slist_remove(cadapter->watchers, watcher);
 	g_dbus_remove_watch(conn, watcher->id);
 
-	if (g_slist_length(cadapter->watchers) == 0)
+	if (!has_consumers(cadapter))
 		g_slist_foreach(cadapter->devices, disable_measurement, 0);
 
 	DBG("cycling watcher [%s] unregistered", path);
@@ -947,6 +948,43 @@ static DBusMessage *unregister_watcher(DBusConnection *conn, DBusMessage *msg,
 	return dbus_message_new_method_return(msg);
 }
 
+static void stream_destroy(struct measurement_stream *stream,
+							gpointer user_data)
+{
+	struct csc_adapter *cadapter = user_data;
+
+	cadapter->streams = g_slist_remove(cadapter->streams, stream);
+
+	if (!has_consumers(cadapter))
+		g_slist_foreach(cadapter->devices, disable_measurement, 0);
+}
+
+static DBusMessage *acquire_stream(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	struct csc_adapter *cadapter = data;
+	struct measurement_stream *stream;
+	DBusMessage *reply;
+	int fd;
+
+	stream = measurement_stream_new(stream_destroy, cadapter, &fd);
+	if (stream == NULL)
+		return btd_error_failed(msg, strerror(errno));
+
+	if (!has_consumers(cadapter))
+		g_slist_foreach(cadapter->devices, enable_measurement, 0);
+
+	cadapter->streams = g_slist_prepend(cadapter->streams, stream);
+
+	reply = g_dbus_create_reply(msg, DBUS_TYPE_UNIX_FD, &fd,
+							DBUS_TYPE_INVALID);
+	close(fd);
+
+	DBG("cycling stream acquired by %s", dbus_message_get_sender(msg));
+
+	return reply;
+}
+
 static const GDBusMethodTable cyclingspeed_manager_methods[] = {
 	{ GDBUS_METHOD("RegisterWatcher",
 			GDBUS_ARGS({ "agent", "o" }), NULL,
@@ -954,6 +992,9 @@ static const GDBusMethodTable cyclingspeed_manager_methods[] = {
 	{ GDBUS_METHOD("UnregisterWatcher",
 			GDBUS_ARGS({ "agent", "o" }), NULL,
 			unregister_watcher) },
+	{ GDBUS_METHOD("AcquireStream",
+			NULL, GDBUS_ARGS({ "fd", "h" }),
+			acquire_stream) },
 	{ }
 };
 
@@ -36,9 +36,9 @@
 #include "profile.h"
 #include "service.h"
 #include "attrib/gattrib.h"
-#include "attio.h"
 #include "attrib/att.h"
 #include "attrib/gatt.h"
+#include "attio.h"
 #include "log.h"
 
 #define PNP_ID_SIZE	7
@@ -141,8 +141,9 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 
 	d->attrib = g_attrib_ref(attrib);
 
-	gatt_discover_char(d->attrib, d->svc_range->start, d->svc_range->end,
-					NULL, configure_deviceinfo_cb, d);
+	btd_device_discover_char(d->dev, d->svc_range->start,
+					d->svc_range->end, NULL,
+					configure_deviceinfo_cb, d);
 }
 
 static void attio_disconnected_cb(gpointer user_data)
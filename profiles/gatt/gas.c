@@ -32,7 +32,6 @@
 #include <errno.h>
 
 #include <glib.h>
-#include <btio/btio.h>
 
 #include "lib/uuid.h"
 #include "plugin.h"
@@ -42,8 +41,8 @@
 #include "service.h"
 #include "attrib/att.h"
 #include "attrib/gattrib.h"
-#include "attio.h"
 #include "attrib/gatt.h"
+#include "attio.h"
 #include "log.h"
 #include "textfile.h"
 
@@ -56,7 +55,6 @@ struct gas {
 	guint attioid;
 	guint changed_ind;
 	uint16_t changed_handle;
-	uint16_t mtu;
 };
 
 static GSList *devices = NULL;
@@ -235,13 +233,11 @@ static void write_ccc(GAttrib *attrib, uint16_t handle, gpointer user_data)
 								user_data);
 }
 
-static void gatt_descriptors_cb(guint8 status, const guint8 *pdu, guint16 len,
+static void gatt_descriptors_cb(GSList *descs, guint8 status,
 							gpointer user_data)
 {
 	struct gas *gas = user_data;
-	struct att_data_list *list;
-	int i;
-	uint8_t format;
+	GSList *l;
 
 	if (status) {
 		error("Discover all GATT characteristic descriptors: %s",
@@ -249,26 +245,12 @@ static void gatt_descriptors_cb(guint8 status, const guint8 *pdu, guint16 len,
 		return;
 	}
 
-	list = dec_find_info_resp(pdu, len, &format);
-	if (list == NULL)
-		return;
-
-	if (format != ATT_FIND_INFO_RESP_FMT_16BIT)
-		goto done;
-
-	for (i = 0; i < list->num; i++) {
-		uint16_t uuid16, ccc;
-		uint8_t *value;
+	for (l = descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
 
-		value = list->data[i];
-		ccc = att_get_u16(value);
-		uuid16 = att_get_u16(&value[2]);
-		DBG("CCC: 0x%04x UUID: 0x%04x", ccc, uuid16);
-		write_ccc(gas->attrib, ccc, user_data);
+		DBG("CCC: 0x%04x UUID: 0x%04x", desc->handle, desc->uuid16);
+		write_ccc(gas->attrib, desc->handle, user_data);
 	}
-
-done:
-	att_data_list_free(list);
 }
 
 static void gatt_characteristic_cb(GSList *characteristics, guint8 status,
@@ -277,6 +259,7 @@ static void gatt_characteristic_cb(GSList *characteristics, guint8 status,
 	struct gas *gas = user_data;
 	struct gatt_char *chr;
 	uint16_t start, end;
+	bt_uuid_t uuid;
 
 	if (status) {
 		error("Discover Service Changed handle: %s", att_ecode2str(status));
@@ -294,50 +277,18 @@ static void gatt_characteristic_cb(GSList *characteristics, guint8 status,
 	}
 
 	gas->changed_handle = chr->value_handle;
-	gatt_find_info(gas->attrib, start, end, gatt_descriptors_cb, gas);
-}
 
-static void exchange_mtu_cb(guint8 status, const guint8 *pdu, guint16 plen,
-							gpointer user_data)
-{
-	struct gas *gas = user_data;
-	uint16_t rmtu;
-
-	if (status) {
-		error("MTU exchange: %s", att_ecode2str(status));
-		return;
-	}
-
-	if (!dec_mtu_resp(pdu, plen, &rmtu)) {
-		error("MTU exchange: protocol error");
-		return;
-	}
-
-	gas->mtu = MIN(rmtu, gas->mtu);
-	if (g_attrib_set_mtu(gas->attrib, gas->mtu))
-		DBG("MTU exchange succeeded: %d", gas->mtu);
-	else
-		DBG("MTU exchange failed");
+	bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+	btd_device_discover_desc(gas->device, start, end, &uuid,
+						gatt_descriptors_cb, gas);
 }
 
 static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 {
 	struct gas *gas = user_data;
-	GIOChannel *io;
-	GError *gerr = NULL;
-	uint16_t cid, imtu;
 	uint16_t app;
 
 	gas->attrib = g_attrib_ref(attrib);
-	io = g_attrib_get_channel(attrib);
-
-	if (bt_io_get(io, &gerr, BT_IO_OPT_IMTU, &imtu,
-				BT_IO_OPT_CID, &cid, BT_IO_OPT_INVALID) &&
-							cid == ATT_CID) {
-		gatt_exchange_mtu(gas->attrib, imtu, exchange_mtu_cb, gas);
-		gas->mtu = imtu;
-		DBG("MTU Exchange: Requesting %d", imtu);
-	}
 
 	if (device_get_appearance(gas->device, &app) < 0) {
 		bt_uuid_t uuid;
@@ -361,8 +312,9 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 
 		bt_uuid16_create(&uuid, GATT_CHARAC_SERVICE_CHANGED);
 
-		gatt_discover_char(gas->attrib, gas->gatt.start, gas->gatt.end,
-					&uuid, gatt_characteristic_cb, gas);
+		btd_device_discover_char(gas->device, gas->gatt.start,
+					gas->gatt.end, &uuid,
+					gatt_characteristic_cb, gas);
 	}
 }
 
@@ -26,6 +26,8 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 #include <glib.h>
 #include <gdbus/gdbus.h>
 
@@ -41,6 +43,7 @@
 #include "attrib/att.h"
 #include "attrib/gatt.h"
 #include "attio.h"
+#include "measurement-stream.h"
 #include "log.h"
 
 #define HEART_RATE_INTERFACE		"org.bluez.HeartRate1"
@@ -53,10 +56,13 @@
 #define ENERGY_EXP_STATUS	0x08
 #define RR_INTERVAL		0x10
 
+#define HR_MEASUREMENT_UUID16	0x2a37
+
 struct heartrate_adapter {
 	struct btd_adapter	*adapter;
 	GSList			*devices;
 	GSList			*watchers;
+	GSList			*streams;
 };
 
 struct heartrate {
@@ -137,6 +143,11 @@ static int cmp_device(gconstpointer a, gconstpointer b)
 	return -1;
 }
 
+static bool has_consumers(struct heartrate_adapter *hradapter)
+{
+	return hradapter->watchers != NULL || hradapter->streams != NULL;
+}
+
 static int cmp_watcher(gconstpointer a, gconstpointer b)
 {
 	const struct watcher *watcher = a;
@@ -218,6 +229,8 @@ static void destroy_heartrate_adapter(gpointer user_data)
 	struct heartrate_adapter *hradapter = user_data;
 
 	g_slist_free_full(hradapter->watchers, remove_watcher);
+	g_slist_free_full(hradapter->streams,
+				(GDestroyNotify) measurement_stream_free);
 
 	g_free(hradapter);
 }
@@ -387,16 +400,17 @@ static void notify_handler(const uint8_t *pdu, uint16_t len, gpointer user_data)
 		return;
 	}
 
-	process_measurement(hr, pdu + 3, len - 3);
+	measurement_stream_send_all(hr->hradapter->streams, hr->dev,
+					HR_MEASUREMENT_UUID16, pdu + 3, len - 3);
+
+	if (hr->hradapter->watchers)
+		process_measurement(hr, pdu + 3, len - 3);
 }
 
-static void discover_ccc_cb(guint8 status, const guint8 *pdu,
-						guint16 len, gpointer user_data)
+static void discover_ccc_cb(GSList *descs, guint8 status, gpointer user_data)
 {
 	struct heartrate *hr = user_data;
-	struct att_data_list *list;
-	uint8_t format;
-	int i;
+	GSList *l;
 
 	if (status != 0) {
 		error("Discover Heart Rate Measurement descriptors failed: %s",
@@ -404,29 +418,17 @@ static void discover_ccc_cb(guint8 status, const guint8 *pdu,
 		return;
 	}
 
-	list = dec_find_info_resp(pdu, len, &format);
-	if (list == NULL)
-		return;
-
-	if (format != ATT_FIND_INFO_RESP_FMT_16BIT)
-		goto done;
-
-	for (i = 0; i < list->num; i++) {
-		uint8_t *value;
-		uint16_t handle, uuid;
+	for (l = descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
 		char *msg;
 		uint8_t attr_val[2];
 
-		value = list->data[i];
-		handle = att_get_u16(value);
-		uuid = att_get_u16(value + 2);
-
-		if (uuid != GATT_CLIENT_CHARAC_CFG_UUID)
+		if (desc->uuid16 != GATT_CLIENT_CHARAC_CFG_UUID)
 			continue;
 
-		hr->measurement_ccc_handle = handle;
+		hr->measurement_ccc_handle = desc->handle;
 
-		if (g_slist_length(hr->hradapter->watchers) == 0) {
+		if (!has_consumers(hr->hradapter)) {
 			att_put_u16(0x0000, attr_val);
 			msg = g_strdup("Disable measurement");
 		} else {
@@ -434,14 +436,11 @@ static void discover_ccc_cb(guint8 status, const guint8 *pdu,
 			msg = g_strdup("Enable measurement");
 		}
 
-		gatt_write_char(hr->attrib, handle, attr_val,
+		gatt_write_char(hr->attrib, desc->handle, attr_val,
 					sizeof(attr_val), char_write_cb, msg);
 
 		break;
 	}
-
-done:
-	att_data_list_free(list);
 }
 
 static void discover_measurement_ccc(struct heartrate *hr,
@@ -461,7 +460,8 @@ static void discover_measurement_ccc(struct heartrate *hr,
 		return;
 	}
 
-	gatt_find_info(hr->attrib, start, end, discover_ccc_cb, hr);
+	btd_device_discover_desc(hr->dev, start, end, NULL,
+						discover_ccc_cb, hr);
 }
 
 static void discover_char_cb(GSList *chars, guint8 status, gpointer user_data)
@@ -542,8 +542,9 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 
 	hr->attrib = g_attrib_ref(attrib);
 
-	gatt_discover_char(hr->attrib, hr->svc_range->start, hr->svc_range->end,
-						NULL, discover_char_cb, hr);
+	btd_device_discover_char(hr->dev, hr->svc_range->start,
+					hr->svc_range->end, NULL,
+					discover_char_cb, hr);
 }
 
 static void attio_disconnected_cb(gpointer user_data)
@@ -571,7 +572,7 @@ static void watcher_exit_cb(DBusConnection *conn, void *user_data)
 	hradapter->watchers = g_slist_remove(hradapter->watchers, watcher);
 	g_dbus_remove_watch(conn, watcher->id);
 
-	if (g_slist_length(hradapter->watchers) == 0)
+	if (!has_consumers(hradapter))
 		g_slist_foreach(hradapter->devices, disable_measurement, 0);
 }
 
@@ -598,7 +599,7 @@ static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
 	watcher->srv = g_strdup(sender);
 	watcher->path = g_strdup(path);
 
-	if (g_slist_length(hradapter->watchers) == 0)
+	if (!has_consumers(hradapter))
 		g_slist_foreach(hradapter->devices, enable_measurement, 0);
 
 	hradapter->watchers = g_slist_prepend(hradapter->watchers, watcher);
@@ -627,7 +628,7 @@ static DBusMessage *unregister_watcher(DBusConnection *conn, DBusMessage *msg,
 	hradapter->watchers = g_slist_remove(hradapter->watchers, watcher);
 	g_dbus_remove_watch(conn, watcher->id);
 
-	if (g_slist_length(hradapter->watchers) == 0)
+	if (!has_consumers(hradapter))
 		g_slist_foreach(hradapter->devices, disable_measurement, 0);
 
 	DBG("heartrate watcher [%s] unregistered", path);
@@ -635,6 +636,43 @@ static DBusMessage *unregister_watcher(DBusConnection *conn, DBusMessage *msg,
 	return dbus_message_new_method_return(msg);
 }
 
+static void stream_destroy(struct measurement_stream *stream,
+							gpointer user_data)
+{
+	struct heartrate_adapter *hradapter = user_data;
+
+	hradapter->streams = g_slist_remove(hradapter->streams, stream);
+
+	if (!has_consumers(hradapter))
+		g_slist_foreach(hradapter->devices, disable_measurement, 0);
+}
+
+static DBusMessage *acquire_stream(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	struct heartrate_adapter *hradapter = data;
+	struct measurement_stream *stream;
+	DBusMessage *reply;
+	int fd;
+
+	stream = measurement_stream_new(stream_destroy, hradapter, &fd);
+	if (stream == NULL)
+		return btd_error_failed(msg, strerror(errno));
+
+	if (!has_consumers(hradapter))
+		g_slist_foreach(hradapter->devices, enable_measurement, 0);
+
+	hradapter->streams = g_slist_prepend(hradapter->streams, stream);
+
+	reply = g_dbus_create_reply(msg, DBUS_TYPE_UNIX_FD, &fd,
+							DBUS_TYPE_INVALID);
+	close(fd);
+
+	DBG("heartrate stream acquired by %s", dbus_message_get_sender(msg));
+
+	return reply;
+}
+
 static const GDBusMethodTable heartrate_manager_methods[] = {
 	{ GDBUS_METHOD("RegisterWatcher",
 			GDBUS_ARGS({ "agent", "o" }), NULL,
@@ -642,6 +680,9 @@ static const GDBusMethodTable heartrate_manager_methods[] = {
 	{ GDBUS_METHOD("UnregisterWatcher",
 			GDBUS_ARGS({ "agent", "o" }), NULL,
 			unregister_watcher) },
+	{ GDBUS_METHOD("AcquireStream",
+			NULL, GDBUS_ARGS({ "fd", "h" }),
+			acquire_stream) },
 	{ }
 };
 
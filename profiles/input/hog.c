@@ -52,8 +52,8 @@
 #include "suspend.h"
 #include "attrib/att.h"
 #include "attrib/gattrib.h"
-#include "attio.h"
 #include "attrib/gatt.h"
+#include "attio.h"
 
 #define HOG_UUID		"00001812-0000-1000-8000-00805f9b34fb"
 
@@ -100,11 +100,6 @@ struct report {
 	struct hog_device	*hogdev;
 };
 
-struct disc_desc_cb_data {
-	uint16_t end;
-	gpointer data;
-};
-
 static gboolean suspend_supported = FALSE;
 static GSList *devices = NULL;
 
@@ -197,89 +192,54 @@ static void external_report_reference_cb(guint8 status, const guint8 *pdu,
 					guint16 plen, gpointer user_data);
 
 
-static void discover_descriptor_cb(guint8 status, const guint8 *pdu,
-					guint16 len, gpointer user_data)
+static void discover_descriptor_cb(GSList *descs, guint8 status,
+							gpointer user_data)
 {
-	struct disc_desc_cb_data *ddcb_data = user_data;
 	struct report *report;
 	struct hog_device *hogdev;
-	struct att_data_list *list = NULL;
-	GAttrib *attrib = NULL;
-	uint8_t format;
-	uint16_t handle = 0xffff;
-	uint16_t end = ddcb_data->end;
-	int i;
+	GSList *l;
 
 	if (status == ATT_ECODE_ATTR_NOT_FOUND) {
 		DBG("Discover all characteristic descriptors finished");
-		goto done;
+		return;
 	}
 
 	if (status != 0) {
 		error("Discover all characteristic descriptors failed: %s",
 							att_ecode2str(status));
-		goto done;
-	}
-
-	list = dec_find_info_resp(pdu, len, &format);
-	if (list == NULL)
 		return;
+	}
 
-	if (format != ATT_FIND_INFO_RESP_FMT_16BIT)
-		goto done;
-
-	for (i = 0; i < list->num; i++) {
-		uint16_t uuid16;
-		uint8_t *value;
-
-		value = list->data[i];
-		handle = att_get_u16(value);
-		uuid16 = att_get_u16(&value[2]);
+	for (l = descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
 
-		switch (uuid16) {
+		switch (desc->uuid16) {
 		case GATT_CLIENT_CHARAC_CFG_UUID:
-			report = ddcb_data->data;
-			attrib = report->hogdev->attrib;
-			write_ccc(handle, report);
+			report = user_data;
+			write_ccc(desc->handle, report);
 			break;
 		case GATT_REPORT_REFERENCE:
-			report = ddcb_data->data;
-			attrib = report->hogdev->attrib;
-			gatt_read_char(attrib, handle,
+			report = user_data;
+			gatt_read_char(report->hogdev->attrib, desc->handle,
 						report_reference_cb, report);
 			break;
 		case GATT_EXTERNAL_REPORT_REFERENCE:
-			hogdev = ddcb_data->data;
-			attrib = hogdev->attrib;
-			gatt_read_char(attrib, handle,
+			hogdev = user_data;
+			gatt_read_char(hogdev->attrib, desc->handle,
 					external_report_reference_cb, hogdev);
 			break;
 		}
 	}
-
-done:
-	att_data_list_free(list);
-
-	if (handle != 0xffff && handle < end)
-		gatt_find_info(attrib, handle + 1, end, discover_descriptor_cb,
-								ddcb_data);
-	else
-		g_free(ddcb_data);
 }
 
-static void discover_descriptor(GAttrib *attrib, uint16_t start, uint16_t end,
-							gpointer user_data)
+static void discover_descriptor(struct hog_device *hogdev, uint16_t start,
+					uint16_t end, gpointer user_data)
 {
-	struct disc_desc_cb_data *ddcb_data;
-
 	if (start > end)
 		return;
 
-	ddcb_data = g_new0(struct disc_desc_cb_data, 1);
-	ddcb_data->end = end;
-	ddcb_data->data = user_data;
-
-	gatt_find_info(attrib, start, end, discover_descriptor_cb, ddcb_data);
+	btd_device_discover_desc(hogdev->device, start, end, NULL,
+					discover_descriptor_cb, user_data);
 }
 
 static void external_service_char_cb(GSList *chars, guint8 status,
@@ -312,7 +272,7 @@ static void external_service_char_cb(GSList *chars, guint8 status,
 		hogdev->reports = g_slist_append(hogdev->reports, report);
 		start = chr->value_handle + 1;
 		end = (next ? next->handle - 1 : prim->range.end);
-		discover_descriptor(hogdev->attrib, start, end, report);
+		discover_descriptor(hogdev, start, end, report);
 	}
 }
 
@@ -338,7 +298,7 @@ static void external_report_reference_cb(guint8 status, const guint8 *pdu,
 	DBG("External report reference read, external report characteristic "
 						"UUID: 0x%04x", uuid16);
 	bt_uuid16_create(&uuid, uuid16);
-	gatt_discover_char(hogdev->attrib, 0x00, 0xff, &uuid,
+	btd_device_discover_char(hogdev->device, 0x00, 0xff, &uuid,
 					external_service_char_cb, hogdev);
 }
 
@@ -506,11 +466,11 @@ static void char_discovered_cb(GSList *chars, guint8 status, gpointer user_data)
 			report->decl = g_memdup(chr, sizeof(*chr));
 			hogdev->reports = g_slist_append(hogdev->reports,
 								report);
-			discover_descriptor(hogdev->attrib, start, end, report);
+			discover_descriptor(hogdev, start, end, report);
 		} else if (bt_uuid_cmp(&uuid, &report_map_uuid) == 0) {
 			gatt_read_char(hogdev->attrib, chr->value_handle,
 						report_map_read_cb, hogdev);
-			discover_descriptor(hogdev->attrib, start, end, hogdev);
+			discover_descriptor(hogdev, start, end, hogdev);
 		} else if (bt_uuid_cmp(&uuid, &info_uuid) == 0)
 			info_handle = chr->value_handle;
 		else if (bt_uuid_cmp(&uuid, &proto_mode_uuid) == 0)
@@ -650,7 +610,7 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 	hogdev->attrib = g_attrib_ref(attrib);
 
 	if (hogdev->reports == NULL) {
-		gatt_discover_char(hogdev->attrib, prim->range.start,
+		btd_device_discover_char(hogdev->device, prim->range.start,
 						prim->range.end, NULL,
 						char_discovered_cb, hogdev);
 		return;
@@ -228,8 +228,9 @@ static int write_alert_level(struct monitor *monitor)
 	bt_uuid16_create(&uuid, ALERT_LEVEL_CHR_UUID);
 
 	/* FIXME: use cache (requires service changed support) ? */
-	gatt_discover_char(monitor->attrib, linkloss->start, linkloss->end,
-					&uuid, char_discovered_cb, monitor);
+	btd_device_discover_char(monitor->device, linkloss->start,
+					linkloss->end, &uuid,
+					char_discovered_cb, monitor);
 
 	return 0;
 }
@@ -292,8 +293,9 @@ static void read_tx_power(struct monitor *monitor)
 
 	bt_uuid16_create(&uuid, POWER_LEVEL_CHR_UUID);
 
-	gatt_discover_char(monitor->attrib, txpower->start, txpower->end,
-				&uuid, tx_power_handle_cb, monitor);
+	btd_device_discover_char(monitor->device, txpower->start,
+					txpower->end, &uuid,
+					tx_power_handle_cb, monitor);
 }
 
 static gboolean immediate_timeout(gpointer user_data)
@@ -374,8 +376,9 @@ static void discover_immediate_handle(struct monitor *monitor)
 
 	bt_uuid16_create(&uuid, ALERT_LEVEL_CHR_UUID);
 
-	gatt_discover_char(monitor->attrib, immediate->start, immediate->end,
-					&uuid, immediate_handle_cb, monitor);
+	btd_device_discover_char(monitor->device, immediate->start,
+					immediate->end, &uuid,
+					immediate_handle_cb, monitor);
 }
 
 static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
@@ -103,35 +103,24 @@ static void ccc_written_cb(guint8 status, const guint8 *pdu,
 				refresh_value_cb, scan, NULL);
 }
 
-static void discover_descriptor_cb(guint8 status, const guint8 *pdu,
-					guint16 len, gpointer user_data)
+static void discover_descriptor_cb(GSList *descs, guint8 status,
+							gpointer user_data)
 {
 	struct scan *scan = user_data;
-	struct att_data_list *list;
-	uint8_t *ptr;
-	uint16_t uuid16, handle;
+	struct gatt_desc *desc;
 	uint8_t value[2];
-	uint8_t format;
 
-	list = dec_find_info_resp(pdu, len, &format);
-	if (list == NULL)
+	if (status)
 		return;
 
-	if (format != ATT_FIND_INFO_RESP_FMT_16BIT)
-		goto done;
+	desc = descs->data;
 
-	ptr = list->data[0];
-	handle = att_get_u16(ptr);
-	uuid16 = att_get_u16(&ptr[2]);
-
-	if (uuid16 != GATT_CLIENT_CHARAC_CFG_UUID)
-		goto done;
+	if (desc->uuid16 != GATT_CLIENT_CHARAC_CFG_UUID)
+		return;
 
 	att_put_u16(GATT_CLIENT_CHARAC_CFG_NOTIF_BIT, value);
-	gatt_write_char(scan->attrib, handle, value, sizeof(value),
+	gatt_write_char(scan->attrib, desc->handle, value, sizeof(value),
 						ccc_written_cb, user_data);
-done:
-	att_data_list_free(list);
 }
 
 static void refresh_discovered_cb(GSList *chars, guint8 status,
@@ -163,8 +152,8 @@ static void refresh_discovered_cb(GSList *chars, guint8 status,
 
 	scan->refresh_handle = chr->value_handle;
 
-	gatt_find_info(scan->attrib, start, end,
-				discover_descriptor_cb, user_data);
+	btd_device_discover_desc(scan->device, start, end, NULL,
+					discover_descriptor_cb, user_data);
 }
 
 static void iwin_discovered_cb(GSList *chars, guint8 status,
@@ -202,11 +191,13 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 	bt_uuid16_create(&iwin_uuid, SCAN_INTERVAL_WIN_UUID);
 	bt_uuid16_create(&refresh_uuid, SCAN_REFRESH_UUID);
 
-	gatt_discover_char(scan->attrib, scan->range.start, scan->range.end,
-					&iwin_uuid, iwin_discovered_cb, scan);
+	btd_device_discover_char(scan->device, scan->range.start,
+					scan->range.end, &iwin_uuid,
+					iwin_discovered_cb, scan);
 
-	gatt_discover_char(scan->attrib, scan->range.start, scan->range.end,
-				&refresh_uuid, refresh_discovered_cb, scan);
+	btd_device_discover_char(scan->device, scan->range.start,
+					scan->range.end, &refresh_uuid,
+					refresh_discovered_cb, scan);
 }
 
 static void attio_disconnected_cb(gpointer user_data)
@@ -26,6 +26,8 @@
 
 #include <stdbool.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <gdbus/gdbus.h>
 
@@ -39,9 +41,10 @@
 #include "error.h"
 #include "log.h"
 #include "attrib/gattrib.h"
-#include "attio.h"
 #include "attrib/att.h"
 #include "attrib/gatt.h"
+#include "attio.h"
+#include "measurement-stream.h"
 
 #define THERMOMETER_INTERFACE		"org.bluez.Thermometer1"
 #define THERMOMETER_MANAGER_INTERFACE	"org.bluez.ThermometerManager1"
@@ -58,11 +61,16 @@
 #define TEMPERATURE_TYPE_SIZE	1
 #define MEASUREMENT_INTERVAL_SIZE	2
 
+#define TEMP_MEASUREMENT_UUID16		0x2a1c
+#define INTERMEDIATE_TEMP_UUID16	0x2a1e
+
 struct thermometer_adapter {
 	struct btd_adapter	*adapter;
 	GSList			*devices;
 	GSList			*fwatchers;	/* Final measurements */
 	GSList			*iwatchers;	/* Intermediate measurements */
+	GSList			*fstreams;	/* Final measurements */
+	GSList			*istreams;	/* Intermediate measurements */
 };
 
 struct thermometer {
@@ -177,6 +185,16 @@ static void destroy_thermometer(gpointer user_data)
 	g_free(t);
 }
 
+static bool has_final_consumers(struct thermometer_adapter *tadapter)
+{
+	return tadapter->fwatchers != NULL || tadapter->fstreams != NULL;
+}
+
+static bool has_int_consumers(struct thermometer_adapter *tadapter)
+{
+	return tadapter->iwatchers != NULL || tadapter->istreams != NULL;
+}
+
 static void destroy_thermometer_adapter(gpointer user_data)
 {
 	struct thermometer_adapter *tadapter = user_data;
@@ -187,6 +205,11 @@ static void destroy_thermometer_adapter(gpointer user_data)
 	if (tadapter->fwatchers != NULL)
 		g_slist_free_full(tadapter->fwatchers, remove_watcher);
 
+	/* Intermediate streams are always on the final list as well */
+	g_slist_free(tadapter->istreams);
+	g_slist_free_full(tadapter->fstreams,
+				(GDestroyNotify) measurement_stream_free);
+
 	g_free(tadapter);
 }
 
@@ -430,7 +453,11 @@ static void measurement_ind_handler(const uint8_t *pdu, uint16_t len,
 		return;
 	}
 
-	proc_measurement(t, pdu, len, TRUE);
+	measurement_stream_send_all(t->tadapter->fstreams, t->dev,
+				TEMP_MEASUREMENT_UUID16, pdu + 3, len - 3);
+
+	if (t->tadapter->fwatchers != NULL)
+		proc_measurement(t, pdu, len, TRUE);
 
 	opdu = g_attrib_get_buffer(t->attrib, &plen);
 	olen = enc_confirmation(opdu, plen);
@@ -449,7 +476,11 @@ static void intermediate_notify_handler(const uint8_t *pdu, uint16_t len,
 		return;
 	}
 
-	proc_measurement(t, pdu, len, FALSE);
+	measurement_stream_send_all(t->tadapter->istreams, t->dev,
+				INTERMEDIATE_TEMP_UUID16, pdu + 3, len - 3);
+
+	if (t->tadapter->iwatchers != NULL)
+		proc_measurement(t, pdu, len, FALSE);
 }
 
 static void interval_ind_handler(const uint8_t *pdu, uint16_t len,
@@ -544,7 +575,7 @@ static void process_thermometer_desc(struct characteristic *ch, uint16_t uuid,
 	if (g_strcmp0(ch->uuid, TEMPERATURE_MEASUREMENT_UUID) == 0) {
 		ch->t->measurement_ccc_handle = handle;
 
-		if (g_slist_length(ch->t->tadapter->fwatchers) == 0) {
+		if (!has_final_consumers(ch->t->tadapter)) {
 			val = 0x0000;
 			msg = g_strdup("Disable Temperature Measurement ind");
 		} else {
@@ -554,7 +585,7 @@ static void process_thermometer_desc(struct characteristic *ch, uint16_t uuid,
 	} else if (g_strcmp0(ch->uuid, INTERMEDIATE_TEMPERATURE_UUID) == 0) {
 		ch->t->intermediate_ccc_handle = handle;
 
-		if (g_slist_length(ch->t->tadapter->iwatchers) == 0) {
+		if (!has_int_consumers(ch->t->tadapter)) {
 			val = 0x0000;
 			msg = g_strdup("Disable Intermediate Temperature noti");
 		} else {
@@ -573,13 +604,10 @@ static void process_thermometer_desc(struct characteristic *ch, uint16_t uuid,
 							write_ccc_cb, msg);
 }
 
-static void discover_desc_cb(guint8 status, const guint8 *pdu, guint16 len,
-							gpointer user_data)
+static void discover_desc_cb(GSList *descs, guint8 status, gpointer user_data)
 {
 	struct characteristic *ch = user_data;
-	struct att_data_list *list = NULL;
-	uint8_t format;
-	int i;
+	GSList *l;
 
 	if (status != 0) {
 		error("Discover all characteristic descriptors failed [%s]: %s",
@@ -587,27 +615,16 @@ static void discover_desc_cb(guint8 status, const guint8 *pdu, guint16 len,
 		goto done;
 	}
 
-	list = dec_find_info_resp(pdu, len, &format);
-	if (list == NULL)
-		goto done;
-
-	if (format != ATT_FIND_INFO_RESP_FMT_16BIT)
-		goto done;
-
-	for (i = 0; i < list->num; i++) {
-		uint8_t *value;
-		uint16_t handle, uuid;
+	for (l = descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
 
-		value = list->data[i];
-		handle = att_get_u16(value);
-		uuid = att_get_u16(value + 2);
+		if (desc->uuid16 == 0)
+			continue;
 
-		process_thermometer_desc(ch, uuid, handle);
+		process_thermometer_desc(ch, desc->uuid16, desc->handle);
 	}
 
 done:
-	if (list != NULL)
-		att_data_list_free(list);
 	g_free(ch);
 }
 
@@ -633,7 +650,8 @@ static void discover_desc(struct thermometer *t, struct gatt_char *c,
 	ch->t = t;
 	memcpy(ch->uuid, c->uuid, sizeof(c->uuid));
 
-	gatt_find_info(t->attrib, start, end, discover_desc_cb, ch);
+	btd_device_discover_desc(t->dev, start, end, NULL,
+						discover_desc_cb, ch);
 }
 
 static void read_temp_type_cb(guint8 status, const guint8 *pdu, guint16 len,
@@ -855,7 +873,7 @@ static void remove_int_watcher(struct thermometer_adapter *tadapter,
 
 	tadapter->iwatchers = g_slist_remove(tadapter->iwatchers, w);
 
-	if (g_slist_length(tadapter->iwatchers) == 0)
+	if (!has_int_consumers(tadapter))
 		g_slist_foreach(tadapter->devices,
 					disable_intermediate_measurement, 0);
 }
@@ -872,7 +890,7 @@ static void watcher_exit(DBusConnection *conn, void *user_data)
 	tadapter->fwatchers = g_slist_remove(tadapter->fwatchers, watcher);
 	g_dbus_remove_watch(btd_get_dbus_connection(), watcher->id);
 
-	if (g_slist_length(tadapter->fwatchers) == 0)
+	if (!has_final_consumers(tadapter))
 		g_slist_foreach(tadapter->devices,
 					disable_final_measurement, 0);
 }
@@ -921,7 +939,7 @@ static DBusMessage *register_watcher(DBusConnection *conn, DBusMessage *msg,
 	watcher->id = g_dbus_add_disconnect_watch(conn, sender, watcher_exit,
 						watcher, destroy_watcher);
 
-	if (g_slist_length(tadapter->fwatchers) == 0)
+	if (!has_final_consumers(tadapter))
 		g_slist_foreach(tadapter->devices, enable_final_measurement, 0);
 
 	tadapter->fwatchers = g_slist_prepend(tadapter->fwatchers, watcher);
@@ -952,7 +970,7 @@ static DBusMessage *unregister_watcher(DBusConnection *conn, DBusMessage *msg,
 	tadapter->fwatchers = g_slist_remove(tadapter->fwatchers, watcher);
 	g_dbus_remove_watch(btd_get_dbus_connection(), watcher->id);
 
-	if (g_slist_length(tadapter->fwatchers) == 0)
+	if (!has_final_consumers(tadapter))
 		g_slist_foreach(tadapter->devices,
 					disable_final_measurement, 0);
 
@@ -980,7 +998,7 @@ static DBusMessage *enable_intermediate(DBusConnection *conn, DBusMessage *msg,
 
 	DBG("Intermediate measurement watcher %s registered", path);
 
-	if (g_slist_length(ta->iwatchers) == 0)
+	if (!has_int_consumers(ta))
 		g_slist_foreach(ta->devices,
 					enable_intermediate_measurement, 0);
 
@@ -1012,6 +1030,64 @@ static DBusMessage *disable_intermediate(DBusConnection *conn, DBusMessage *msg,
 	return dbus_message_new_method_return(msg);
 }
 
+static void stream_destroy(struct measurement_stream *stream,
+							gpointer user_data)
+{
+	struct thermometer_adapter *ta = user_data;
+
+	if (g_slist_find(ta->istreams, stream)) {
+		ta->istreams = g_slist_remove(ta->istreams, stream);
+
+		if (!has_int_consumers(ta))
+			g_slist_foreach(ta->devices,
+					disable_intermediate_measurement, 0);
+	}
+
+	ta->fstreams = g_slist_remove(ta->fstreams, stream);
+
+	if (!has_final_consumers(ta))
+		g_slist_foreach(ta->devices, disable_final_measurement, 0);
+}
+
+static DBusMessage *acquire_stream(DBusConnection *conn, DBusMessage *msg,
+								void *data)
+{
+	struct thermometer_adapter *ta = data;
+	struct measurement_stream *stream;
+	DBusMessage *reply;
+	dbus_bool_t intermediate;
+	int fd;
+
+	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_BOOLEAN, &intermediate,
+							DBUS_TYPE_INVALID))
+		return btd_error_invalid_args(msg);
+
+	stream = measurement_stream_new(stream_destroy, ta, &fd);
+	if (stream == NULL)
+		return btd_error_failed(msg, strerror(errno));
+
+	if (!has_final_consumers(ta))
+		g_slist_foreach(ta->devices, enable_final_measurement, 0);
+
+	ta->fstreams = g_slist_prepend(ta->fstreams, stream);
+
+	if (intermediate) {
+		if (!has_int_consumers(ta))
+			g_slist_foreach(ta->devices,
+					enable_intermediate_measurement, 0);
+
+		ta->istreams = g_slist_prepend(ta->istreams, stream);
+	}
+
+	reply = g_dbus_create_reply(msg, DBUS_TYPE_UNIX_FD, &fd,
+							DBUS_TYPE_INVALID);
+	close(fd);
+
+	DBG("Thermometer stream acquired by %s", dbus_message_get_sender(msg));
+
+	return reply;
+}
+
 static gboolean property_get_intermediate(const GDBusPropertyTable *property,
 					DBusMessageIter *iter, void *data)
 {
@@ -1132,8 +1208,9 @@ static void attio_connected_cb(GAttrib *attrib, gpointer user_data)
 
 	t->attrib = g_attrib_ref(attrib);
 
-	gatt_discover_char(t->attrib, t->svc_range->start, t->svc_range->end,
-					NULL, configure_thermometer_cb, t);
+	btd_device_discover_char(t->dev, t->svc_range->start,
+					t->svc_range->end, NULL,
+					configure_thermometer_cb, t);
 }
 
 static void attio_disconnected_cb(gpointer user_data)
@@ -1239,6 +1316,10 @@ static const GDBusMethodTable thermometer_manager_methods[] = {
 	{ GDBUS_METHOD("DisableIntermediateMeasurement",
 			GDBUS_ARGS({ "agent", "o" }), NULL,
 			disable_intermediate) },
+	{ GDBUS_METHOD("AcquireStream",
+			GDBUS_ARGS({ "intermediate", "b" }),
+			GDBUS_ARGS({ "fd", "h" }),
+			acquire_stream) },
 	{ }
 };
 
@@ -31,9 +31,11 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <inttypes.h>
 #include <sys/ioctl.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <dirent.h>
 
 #include <bluetooth/bluetooth.h>
@@ -50,6 +52,7 @@
 
 #include "lib/uuid.h"
 #include "lib/mgmt.h"
+#include "src/shared/util.h"
 #include "src/shared/mgmt.h"
 
 #include "hcid.h"
@@ -119,6 +122,7 @@ struct service_auth {
 	struct btd_device *device;
 	struct btd_adapter *adapter;
 	struct agent *agent;		/* NULL for queued auths */
+	gint64 queued;			/* Enqueue time in microseconds */
 };
 
 struct btd_adapter_pin_cb_iter {
@@ -127,6 +131,40 @@ struct btd_adapter_pin_cb_iter {
 	/* When the iterator reaches the end, it is NULL and attempt is 0 */
 };
 
+/* Commands for different controllers that may be in flight at once */
+#define MGMT_MAX_PENDING	4
+
+#define SNAPSHOT_MAGIC		"btsnap01"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_DELAY		10
+
+#define STORED_BLOCKED		0x01
+#define STORED_TRUSTED		0x02
+#define STORED_LINK_KEY		0x04
+#define STORED_LTK		0x08
+
+/* Boot time state of a stored device, also the snapshot record format */
+struct stored_device {
+	bdaddr_t bdaddr;
+	uint8_t bdaddr_type;
+	uint8_t flags;
+	uint8_t key[16];
+	uint8_t key_type;
+	uint8_t pin_len;
+	uint8_t ltk[16];
+	uint8_t rand[8];
+	uint16_t ediv;
+	uint8_t enc_size;
+	uint8_t authenticated;
+	uint8_t master;
+} __attribute__ ((packed));
+
+struct snapshot_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+} __attribute__ ((packed));
+
 struct btd_adapter {
 	int ref_count;
 
@@ -165,9 +203,18 @@ struct btd_adapter {
 	guint pairable_timeout_id;	/* pairable timeout id */
 	guint auth_idle_id;		/* Pending authorization dequeue */
 	GQueue *auths;			/* Ongoing and pending auths */
+	unsigned int auth_count;	/* Completed authorizations */
+	unsigned int auth_depth_max;	/* Highest number of queued auths */
+	gint64 auth_wait_total;		/* Sum of auth wait times in us */
+	gint64 auth_wait_max;		/* Longest auth wait time in us */
 	bool pincode_requested;		/* PIN requested during last bonding */
 	GSList *connections;		/* Connected devices */
 	GSList *devices;		/* Devices structure pointers */
+	GHashTable *stored_devices;	/* Stored devices not loaded yet */
+	GHashTable *stored_records;	/* Snapshot records of all devices */
+	GQueue *stored_queue;		/* Stored devices in load order */
+	guint load_devices_id;		/* Background device loading */
+	guint snapshot_timeout;		/* Delayed storage snapshot write */
 	GSList *connect_list;		/* Devices to connect when found */
 	struct btd_device *connect_le;	/* LE device waiting to be connected */
 	sdp_list_t *services;		/* Services associated to adapter */
@@ -181,8 +228,10 @@ struct btd_adapter {
 
 	struct oob_handler *oob_handler;
 
+	gint64 load_link_keys_start;
+
 	unsigned int load_ltks_id;
-	guint load_ltks_timeout;
+	gint64 load_ltks_start;
 
 	unsigned int confirm_name_id;
 	guint confirm_name_timeout;
@@ -193,6 +242,12 @@ struct btd_adapter {
 	bool is_default;		/* true if adapter is default one */
 };
 
+static struct btd_device *load_stored_device(struct btd_adapter *adapter,
+					struct stored_device *stored);
+static struct btd_device *find_stored_device_by_path(
+						struct btd_adapter *adapter,
+						const char *path);
+
 static struct btd_adapter *btd_adapter_lookup(uint16_t index)
 {
 	GList *list;
@@ -694,6 +749,7 @@ int adapter_set_name(struct btd_adapter *adapter, const char *name)
 struct btd_device *adapter_find_device(struct btd_adapter *adapter,
 							const bdaddr_t *dst)
 {
+	struct stored_device *stored;
 	struct btd_device *device;
 	char addr[18];
 	GSList *list;
@@ -704,10 +760,17 @@ struct btd_device *adapter_find_device(struct btd_adapter *adapter,
 	ba2str(dst, addr);
 
 	list = g_slist_find_custom(adapter->devices, addr, device_address_cmp);
-	if (!list)
+	if (list)
+		return list->data;
+
+	if (!adapter->stored_devices)
+		return NULL;
+
+	stored = g_hash_table_lookup(adapter->stored_devices, dst);
+	if (!stored)
 		return NULL;
 
-	device = list->data;
+	device = load_stored_device(adapter, stored);
 
 	return device;
 }
@@ -1048,6 +1111,11 @@ static void adapter_remove_device(struct btd_adapter *adapter,
 		g_queue_delete_link(adapter->auths, l);
 		l = next;
 
+		/* Let the next request use the agent */
+		if (auth->agent && !adapter->auth_idle_id)
+			adapter->auth_idle_id = g_idle_add(process_auth_queue,
+								adapter);
+
 		service_auth_cancel(auth);
 	}
 
@@ -2129,14 +2197,17 @@ static DBusMessage *remove_device(DBusConnection *conn,
 		return btd_error_invalid_args(msg);
 
 	list = g_slist_find_custom(adapter->devices, path, device_path_cmp);
-	if (!list)
+	if (list)
+		device = list->data;
+	else
+		device = find_stored_device_by_path(adapter, path);
+
+	if (!device)
 		return btd_error_does_not_exist(msg);
 
 	if (!(adapter->current_settings & MGMT_SETTING_POWERED))
 		return btd_error_not_ready(msg);
 
-	device = list->data;
-
 	device_set_temporary(device, TRUE);
 
 	if (!device_is_connected(device)) {
@@ -2177,11 +2248,6 @@ static const GDBusPropertyTable adapter_properties[] = {
 	{ }
 };
 
-struct adapter_keys {
-	struct btd_adapter *adapter;
-	GSList *keys;
-};
-
 static int str2buf(const char *str, uint8_t *buf, size_t blen)
 {
 	int i, dlen;
@@ -2274,6 +2340,16 @@ failed:
 	return ltk;
 }
 
+/*
+ * The kernel replaces its whole key list with every load command, so
+ * all keys have to go into a single command whose parameters are
+ * limited by the 16-bit mgmt length field.
+ */
+#define MAX_LINK_KEYS ((UINT16_MAX - sizeof(struct mgmt_cp_load_link_keys)) / \
+					sizeof(struct mgmt_link_key_info))
+#define MAX_LTKS ((UINT16_MAX - sizeof(struct mgmt_cp_load_long_term_keys)) / \
+					sizeof(struct mgmt_ltk_info))
+
 static void load_link_keys_complete(uint8_t status, uint16_t length,
 					const void *param, void *user_data)
 {
@@ -2285,17 +2361,19 @@ static void load_link_keys_complete(uint8_t status, uint16_t length,
 		return;
 	}
 
-	DBG("link keys loaded for hci%u", adapter->dev_id);
+	DBG("link keys loaded for hci%u in %" G_GINT64_FORMAT " ms",
+				adapter->dev_id,
+				(g_get_monotonic_time() -
+					adapter->load_link_keys_start) / 1000);
 }
 
-static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
-							bool debug_keys)
+static void load_link_keys(struct btd_adapter *adapter, bool debug_keys)
 {
 	struct mgmt_cp_load_link_keys *cp;
 	struct mgmt_link_key_info *key;
 	size_t key_count, cp_size;
 	unsigned int id;
-	GSList *l;
+	GList *l;
 
 	/*
 	 * If the controller does not support BR/EDR operation,
@@ -2307,11 +2385,24 @@ static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
 	if (!(adapter->supported_settings & MGMT_SETTING_BREDR))
 		return;
 
-	key_count = g_slist_length(keys);
+	key_count = 0;
+	for (l = adapter->stored_queue->head; l; l = l->next) {
+		struct stored_device *stored = l->data;
+
+		if (stored->flags & STORED_LINK_KEY)
+			key_count++;
+	}
 
 	DBG("hci%u keys %zu debug_keys %d", adapter->dev_id, key_count,
 								debug_keys);
 
+	if (key_count > MAX_LINK_KEYS) {
+		error("Too many link keys for hci%u, ignoring %zu of %zu",
+					adapter->dev_id,
+					key_count - MAX_LINK_KEYS, key_count);
+		key_count = MAX_LINK_KEYS;
+	}
+
 	cp_size = sizeof(*cp) + (key_count * sizeof(*key));
 
 	cp = g_try_malloc0(cp_size);
@@ -2331,17 +2422,25 @@ static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
 	cp->debug_keys = debug_keys;
 	cp->key_count = htobs(key_count);
 
-	for (l = keys, key = cp->keys; l != NULL; l = g_slist_next(l), key++) {
-		struct link_key_info *info = l->data;
+	/* Keys are copied straight from the stored device records */
+	for (l = adapter->stored_queue->head, key = cp->keys;
+				l && key < cp->keys + key_count; l = l->next) {
+		struct stored_device *stored = l->data;
 
-		bacpy(&key->addr.bdaddr, &info->bdaddr);
+		if (!(stored->flags & STORED_LINK_KEY))
+			continue;
+
+		bacpy(&key->addr.bdaddr, &stored->bdaddr);
 		key->addr.type = BDADDR_BREDR;
-		key->type = info->type;
-		memcpy(key->val, info->key, 16);
-		key->pin_len = info->pin_len;
+		key->type = stored->key_type;
+		memcpy(key->val, stored->key, 16);
+		key->pin_len = stored->pin_len;
+		key++;
 	}
 
-	id = mgmt_send(adapter->mgmt, MGMT_OP_LOAD_LINK_KEYS,
+	adapter->load_link_keys_start = g_get_monotonic_time();
+
+	id = mgmt_send_bulk(adapter->mgmt, MGMT_OP_LOAD_LINK_KEYS,
 				adapter->dev_id, cp_size, cp,
 				load_link_keys_complete, adapter, NULL);
 
@@ -2351,44 +2450,35 @@ static void load_link_keys(struct btd_adapter *adapter, GSList *keys,
 		error("Failed to load link keys for hci%u", adapter->dev_id);
 }
 
-static gboolean load_ltks_timeout(gpointer user_data)
+static void load_ltks_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
 {
 	struct btd_adapter *adapter = user_data;
 
-	error("Loading LTKs timed out for hci%u", adapter->dev_id);
-
-	adapter->load_ltks_timeout = 0;
-
-	mgmt_cancel(adapter->mgmt, adapter->load_ltks_id);
 	adapter->load_ltks_id = 0;
 
-	return FALSE;
-}
-
-static void load_ltks_complete(uint8_t status, uint16_t length,
-					const void *param, void *user_data)
-{
-	struct btd_adapter *adapter = user_data;
+	if (status == MGMT_STATUS_TIMEOUT) {
+		error("Loading LTKs timed out for hci%u", adapter->dev_id);
+		return;
+	}
 
 	if (status != MGMT_STATUS_SUCCESS) {
 		error("Failed to load LTKs for hci%u: %s (0x%02x)",
 				adapter->dev_id, mgmt_errstr(status), status);
 	}
 
-	adapter->load_ltks_id = 0;
-
-	g_source_remove(adapter->load_ltks_timeout);
-	adapter->load_ltks_timeout = 0;
-
-	DBG("LTKs loaded for hci%u", adapter->dev_id);
+	DBG("LTKs loaded for hci%u in %" G_GINT64_FORMAT " ms",
+				adapter->dev_id,
+				(g_get_monotonic_time() -
+					adapter->load_ltks_start) / 1000);
 }
 
-static void load_ltks(struct btd_adapter *adapter, GSList *keys)
+static void load_ltks(struct btd_adapter *adapter)
 {
 	struct mgmt_cp_load_long_term_keys *cp;
 	struct mgmt_ltk_info *key;
 	size_t key_count, cp_size;
-	GSList *l;
+	GList *l;
 
 	/*
 	 * If the controller does not support Low Energy operation,
@@ -2403,10 +2493,23 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 	if (!(adapter->supported_settings & MGMT_SETTING_LE))
 		return;
 
-	key_count = g_slist_length(keys);
+	key_count = 0;
+	for (l = adapter->stored_queue->head; l; l = l->next) {
+		struct stored_device *stored = l->data;
+
+		if (stored->flags & STORED_LTK)
+			key_count++;
+	}
 
 	DBG("hci%u keys %zu", adapter->dev_id, key_count);
 
+	if (key_count > MAX_LTKS) {
+		error("Too many LTKs for hci%u, ignoring %zu of %zu",
+					adapter->dev_id,
+					key_count - MAX_LTKS, key_count);
+		key_count = MAX_LTKS;
+	}
+
 	cp_size = sizeof(*cp) + (key_count * sizeof(*key));
 
 	cp = g_try_malloc0(cp_size);
@@ -2422,20 +2525,27 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 	 */
 	cp->key_count = htobs(key_count);
 
-	for (l = keys, key = cp->keys; l != NULL; l = g_slist_next(l), key++) {
-		struct smp_ltk_info *info = l->data;
+	for (l = adapter->stored_queue->head, key = cp->keys;
+				l && key < cp->keys + key_count; l = l->next) {
+		struct stored_device *stored = l->data;
 
-		bacpy(&key->addr.bdaddr, &info->bdaddr);
-		key->addr.type = info->bdaddr_type;
-		memcpy(key->val, info->val, sizeof(info->val));
-		memcpy(key->rand, info->rand, sizeof(info->rand));
-		memcpy(&key->ediv, &info->ediv, sizeof(key->ediv));
-		key->authenticated = info->authenticated;
-		key->master = info->master;
-		key->enc_size = info->enc_size;
+		if (!(stored->flags & STORED_LTK))
+			continue;
+
+		bacpy(&key->addr.bdaddr, &stored->bdaddr);
+		key->addr.type = stored->bdaddr_type;
+		memcpy(key->val, stored->ltk, sizeof(stored->ltk));
+		memcpy(key->rand, stored->rand, sizeof(stored->rand));
+		memcpy(&key->ediv, &stored->ediv, sizeof(key->ediv));
+		key->authenticated = stored->authenticated;
+		key->master = stored->master;
+		key->enc_size = stored->enc_size;
+		key++;
 	}
 
-	adapter->load_ltks_id = mgmt_send(adapter->mgmt,
+	adapter->load_ltks_start = g_get_monotonic_time();
+
+	adapter->load_ltks_id = mgmt_send_bulk(adapter->mgmt,
 					MGMT_OP_LOAD_LONG_TERM_KEYS,
 					adapter->dev_id, cp_size, cp,
 					load_ltks_complete, adapter, NULL);
@@ -2450,22 +2560,436 @@ static void load_ltks(struct btd_adapter *adapter, GSList *keys)
 	/*
 	 * This timeout handling is needed since the kernel is stupid
 	 * and forgets to send a command complete response. However in
-	 * case of failures it does send a command status.
+	 * case of failures it does send a command status. The timer
+	 * starts once the command is written, not while it is queued.
 	 */
-	adapter->load_ltks_timeout = g_timeout_add_seconds(2,
-						load_ltks_timeout, adapter);
+	mgmt_set_timeout(adapter->mgmt, adapter->load_ltks_id, 2);
 }
 
-static void load_devices(struct btd_adapter *adapter)
+static guint stored_device_hash(gconstpointer key)
+{
+	return util_bdaddr_hash(key);
+}
+
+static gboolean stored_device_equal(gconstpointer a, gconstpointer b)
+{
+	return bacmp(a, b) == 0;
+}
+
+static void stored_device_parse(struct stored_device *stored,
+					const char *peer, GKeyFile *key_file)
+{
+	struct link_key_info *key_info;
+	struct smp_ltk_info *ltk_info;
+	char *str;
+
+	memset(stored, 0, sizeof(*stored));
+
+	str2ba(peer, &stored->bdaddr);
+	stored->bdaddr_type = BDADDR_BREDR;
+
+	str = g_key_file_get_string(key_file, "General", "AddressType", NULL);
+	if (str && g_str_equal(str, "public"))
+		stored->bdaddr_type = BDADDR_LE_PUBLIC;
+	else if (str && g_str_equal(str, "static"))
+		stored->bdaddr_type = BDADDR_LE_RANDOM;
+	g_free(str);
+
+	if (g_key_file_get_boolean(key_file, "General", "Blocked", NULL))
+		stored->flags |= STORED_BLOCKED;
+
+	if (g_key_file_get_boolean(key_file, "General", "Trusted", NULL))
+		stored->flags |= STORED_TRUSTED;
+
+	key_info = get_key_info(key_file, peer);
+	if (key_info) {
+		stored->flags |= STORED_LINK_KEY;
+		memcpy(stored->key, key_info->key, sizeof(stored->key));
+		stored->key_type = key_info->type;
+		stored->pin_len = key_info->pin_len;
+		g_free(key_info);
+	}
+
+	ltk_info = get_ltk_info(key_file, peer);
+	if (ltk_info) {
+		stored->flags |= STORED_LTK;
+		stored->bdaddr_type = ltk_info->bdaddr_type;
+		memcpy(stored->ltk, ltk_info->val, sizeof(stored->ltk));
+		memcpy(stored->rand, ltk_info->rand, sizeof(stored->rand));
+		stored->ediv = ltk_info->ediv;
+		stored->enc_size = ltk_info->enc_size;
+		stored->authenticated = ltk_info->authenticated;
+		stored->master = ltk_info->master;
+		g_free(ltk_info);
+	}
+}
+
+static void add_stored_device(struct btd_adapter *adapter,
+					struct stored_device *stored)
+{
+	struct stored_device *record;
+
+	if (g_hash_table_lookup(adapter->stored_devices, &stored->bdaddr)) {
+		g_free(stored);
+		return;
+	}
+
+	g_hash_table_insert(adapter->stored_devices, &stored->bdaddr, stored);
+
+	record = g_memdup(stored, sizeof(*stored));
+	g_hash_table_replace(adapter->stored_records, &record->bdaddr, record);
+
+	/*
+	 * LE devices go first since their profiles usually want to be
+	 * added to the background connection list.
+	 */
+	if (stored->bdaddr_type != BDADDR_BREDR)
+		g_queue_push_head(adapter->stored_queue, stored);
+	else
+		g_queue_push_tail(adapter->stored_queue, stored);
+}
+
+static struct btd_device *load_stored_device(struct btd_adapter *adapter,
+					struct stored_device *stored)
+{
+	struct btd_device *device;
+	char filename[PATH_MAX + 1];
+	char srcaddr[18], dstaddr[18];
+	GKeyFile *key_file;
+	GSList *list;
+
+	g_hash_table_remove(adapter->stored_devices, &stored->bdaddr);
+
+	ba2str(&adapter->bdaddr, srcaddr);
+	ba2str(&stored->bdaddr, dstaddr);
+
+	DBG("%s", dstaddr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", srcaddr,
+								dstaddr);
+	filename[PATH_MAX] = '\0';
+
+	key_file = g_key_file_new();
+	g_key_file_load_from_file(key_file, filename, 0, NULL);
+
+	device = device_create_from_storage(adapter, dstaddr, key_file);
+	if (!device)
+		goto free;
+
+	device_set_temporary(device, FALSE);
+	adapter->devices = g_slist_prepend(adapter->devices, device);
+
+	/* TODO: register services from pre-loaded list of primaries */
+
+	list = device_get_uuids(device);
+	if (list)
+		device_probe_profiles(device, list);
+
+	if (stored->flags & (STORED_LINK_KEY | STORED_LTK)) {
+		device_set_paired(device, TRUE);
+		device_set_bonded(device, TRUE);
+	}
+
+free:
+	g_key_file_free(key_file);
+
+	return device;
+}
+
+static struct btd_device *find_stored_device_by_path(
+						struct btd_adapter *adapter,
+						const char *path)
 {
+	struct stored_device *stored;
+	size_t len = strlen(adapter->path);
+	char addr[18];
+	bdaddr_t bdaddr;
+
+	if (!adapter->stored_devices)
+		return NULL;
+
+	if (strncmp(path, adapter->path, len) ||
+					strncmp(path + len, "/dev_", 5))
+		return NULL;
+
+	path += len + 5;
+	if (strlen(path) != sizeof(addr) - 1)
+		return NULL;
+
+	strcpy(addr, path);
+	g_strdelimit(addr, "_", ':');
+
+	if (bachk(addr) < 0)
+		return NULL;
+
+	str2ba(addr, &bdaddr);
+
+	stored = g_hash_table_lookup(adapter->stored_devices, &bdaddr);
+	if (!stored)
+		return NULL;
+
+	return load_stored_device(adapter, stored);
+}
+
+static bool load_stored_devices(struct btd_adapter *adapter)
+{
+	struct stored_device *stored;
+	int count = 0;
+
+	if (!adapter->stored_queue)
+		return false;
+
+	while (count < 16) {
+		stored = g_queue_pop_head(adapter->stored_queue);
+		if (!stored)
+			return false;
+
+		/* Skip devices that have been loaded on demand already */
+		if (g_hash_table_lookup(adapter->stored_devices,
+						&stored->bdaddr) == stored) {
+			load_stored_device(adapter, stored);
+			count++;
+		}
+
+		g_free(stored);
+	}
+
+	return !g_queue_is_empty(adapter->stored_queue);
+}
+
+static gboolean load_devices_idle(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	if (load_stored_devices(adapter))
+		return TRUE;
+
+	DBG("hci%u all stored devices loaded", adapter->dev_id);
+
+	adapter->load_devices_id = 0;
+
+	return FALSE;
+}
+
+static void store_snapshot(struct btd_adapter *adapter)
+{
+	struct snapshot_hdr hdr;
 	char filename[PATH_MAX + 1];
 	char srcaddr[18];
-	struct adapter_keys keys = { adapter, NULL };
-	struct adapter_keys ltks = { adapter, NULL };
-	DIR *dir;
-	struct dirent *entry;
+	GHashTableIter iter;
+	gpointer value;
+	GByteArray *buf;
+
+	ba2str(&adapter->bdaddr, srcaddr);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.version = SNAPSHOT_VERSION;
+
+	buf = g_byte_array_new();
+	g_byte_array_append(buf, (guint8 *) &hdr, sizeof(hdr));
+
+	g_hash_table_iter_init(&iter, adapter->stored_records);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		g_byte_array_append(buf, value, sizeof(struct stored_device));
+		hdr.count++;
+	}
+
+	memcpy(buf->data, &hdr, sizeof(hdr));
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/snapshot", srcaddr);
+	filename[PATH_MAX] = '\0';
+
+	DBG("hci%u %u devices", adapter->dev_id, hdr.count);
+
+	create_file(filename, S_IRUSR | S_IWUSR);
+	g_file_set_contents(filename, (gchar *) buf->data, buf->len, NULL);
+
+	/*
+	 * Replacing the file updates the directory timestamp, make sure
+	 * the snapshot is not considered older than the directory.
+	 */
+	utimes(filename, NULL);
+
+	g_byte_array_free(buf, TRUE);
+}
+
+static gboolean snapshot_timeout(gpointer user_data)
+{
+	struct btd_adapter *adapter = user_data;
+
+	adapter->snapshot_timeout = 0;
+
+	store_snapshot(adapter);
+
+	return FALSE;
+}
+
+static void update_stored_record(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr)
+{
+	struct stored_device *record;
+	char filename[PATH_MAX + 1];
+	char srcaddr[18], dstaddr[18];
+	GKeyFile *key_file;
 
 	ba2str(&adapter->bdaddr, srcaddr);
+	ba2str(bdaddr, dstaddr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info", srcaddr,
+								dstaddr);
+	filename[PATH_MAX] = '\0';
+
+	key_file = g_key_file_new();
+
+	if (g_key_file_load_from_file(key_file, filename, 0, NULL)) {
+		record = g_new(struct stored_device, 1);
+		stored_device_parse(record, dstaddr, key_file);
+		g_hash_table_replace(adapter->stored_records,
+						&record->bdaddr, record);
+	} else {
+		g_hash_table_remove(adapter->stored_records, bdaddr);
+	}
+
+	g_key_file_free(key_file);
+}
+
+void adapter_storage_changed(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr)
+{
+	char filename[PATH_MAX + 1];
+	char srcaddr[18];
+
+	if (!adapter->stored_records)
+		return;
+
+	/* Only the changed device is parsed, snapshots use the records */
+	update_stored_record(adapter, bdaddr);
+
+	if (adapter->snapshot_timeout > 0)
+		return;
+
+	/*
+	 * Drop the snapshot right away so that a stale one is never
+	 * used, even if the daemon does not get to write a new one.
+	 */
+	ba2str(&adapter->bdaddr, srcaddr);
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/snapshot", srcaddr);
+	filename[PATH_MAX] = '\0';
+	unlink(filename);
+
+	adapter->snapshot_timeout = g_timeout_add_seconds(SNAPSHOT_DELAY,
+						snapshot_timeout, adapter);
+}
+
+static bool timespec_newer(const struct timespec *a,
+						const struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec > b->tv_sec;
+
+	return a->tv_nsec > b->tv_nsec;
+}
+
+/*
+ * Editing a device info file leaves the adapter directory untouched, so
+ * check the file of every device in the snapshot as well.
+ */
+static bool snapshot_outdated(const char *srcaddr, const struct stat *st,
+					const struct stored_device *records,
+					uint32_t count)
+{
+	char filename[PATH_MAX + 1];
+	char dstaddr[18];
+	struct stat dev_st;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		ba2str(&records[i].bdaddr, dstaddr);
+
+		snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/info",
+							srcaddr, dstaddr);
+		filename[PATH_MAX] = '\0';
+
+		if (stat(filename, &dev_st) < 0)
+			return true;
+
+		if (timespec_newer(&dev_st.st_mtim, &st->st_mtim))
+			return true;
+	}
+
+	return false;
+}
+
+static bool load_snapshot(struct btd_adapter *adapter, const char *srcaddr)
+{
+	char filename[PATH_MAX + 1];
+	struct snapshot_hdr *hdr;
+	struct stored_device *records;
+	struct stat st, dir_st;
+	gchar *data;
+	gsize len;
+	uint32_t i;
+	bool ret = false;
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s", srcaddr);
+	filename[PATH_MAX] = '\0';
+
+	if (stat(filename, &dir_st) < 0)
+		return false;
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/snapshot", srcaddr);
+	filename[PATH_MAX] = '\0';
+
+	if (stat(filename, &st) < 0)
+		return false;
+
+	/* Device directories have been added or removed behind our back */
+	if (timespec_newer(&dir_st.st_mtim, &st.st_mtim)) {
+		DBG("hci%u snapshot outdated", adapter->dev_id);
+		return false;
+	}
+
+	if (!g_file_get_contents(filename, &data, &len, NULL))
+		return false;
+
+	hdr = (struct snapshot_hdr *) data;
+
+	if (len < sizeof(*hdr) ||
+			memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) ||
+			hdr->version != SNAPSHOT_VERSION ||
+			len != sizeof(*hdr) + hdr->count *
+						sizeof(struct stored_device)) {
+		error("Invalid device snapshot for hci%u", adapter->dev_id);
+		goto done;
+	}
+
+	records = (struct stored_device *) (data + sizeof(*hdr));
+
+	if (snapshot_outdated(srcaddr, &st, records, hdr->count)) {
+		DBG("hci%u snapshot outdated", adapter->dev_id);
+		goto done;
+	}
+
+	for (i = 0; i < hdr->count; i++)
+		add_stored_device(adapter, g_memdup(&records[i],
+						sizeof(struct stored_device)));
+
+	DBG("hci%u %u devices from snapshot", adapter->dev_id, hdr->count);
+
+	ret = true;
+
+done:
+	g_free(data);
+
+	return ret;
+}
+
+static void load_storage(struct btd_adapter *adapter, const char *srcaddr)
+{
+	char filename[PATH_MAX + 1];
+	DIR *dir;
+	struct dirent *entry;
 
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s", srcaddr);
 	filename[PATH_MAX] = '\0';
@@ -2477,12 +3001,8 @@ static void load_devices(struct btd_adapter *adapter)
 	}
 
 	while ((entry = readdir(dir)) != NULL) {
-		struct btd_device *device;
-		char filename[PATH_MAX + 1];
+		struct stored_device *stored;
 		GKeyFile *key_file;
-		struct link_key_info *key_info;
-		struct smp_ltk_info *ltk_info;
-		GSList *list;
 
 		if (entry->d_type != DT_DIR || bachk(entry->d_name) < 0)
 			continue;
@@ -2493,52 +3013,57 @@ static void load_devices(struct btd_adapter *adapter)
 		key_file = g_key_file_new();
 		g_key_file_load_from_file(key_file, filename, 0, NULL);
 
-		key_info = get_key_info(key_file, entry->d_name);
-		if (key_info)
-			keys.keys = g_slist_append(keys.keys, key_info);
+		stored = g_new(struct stored_device, 1);
+		stored_device_parse(stored, entry->d_name, key_file);
+		add_stored_device(adapter, stored);
+
+		g_key_file_free(key_file);
+	}
+
+	closedir(dir);
 
-		ltk_info = get_ltk_info(key_file, entry->d_name);
-		if (ltk_info)
-			ltks.keys = g_slist_append(ltks.keys, ltk_info);
+	store_snapshot(adapter);
+}
 
-		list = g_slist_find_custom(adapter->devices, entry->d_name,
-							device_address_cmp);
-		if (list) {
-			device = list->data;
-			goto device_exist;
-		}
+static void load_devices(struct btd_adapter *adapter)
+{
+	char srcaddr[18];
+	GList *l, *next;
 
-		device = device_create_from_storage(adapter, entry->d_name,
-							key_file);
-		if (!device)
-			goto free;
+	ba2str(&adapter->bdaddr, srcaddr);
 
-		device_set_temporary(device, FALSE);
-		adapter->devices = g_slist_append(adapter->devices, device);
+	adapter->stored_devices = g_hash_table_new(stored_device_hash,
+							stored_device_equal);
+	adapter->stored_records = g_hash_table_new_full(stored_device_hash,
+					stored_device_equal, NULL, g_free);
+	adapter->stored_queue = g_queue_new();
 
-		/* TODO: register services from pre-loaded list of primaries */
+	if (!load_snapshot(adapter, srcaddr))
+		load_storage(adapter, srcaddr);
 
-		list = device_get_uuids(device);
-		if (list)
-			device_probe_profiles(device, list);
+	load_link_keys(adapter, main_opts.debug_keys);
+	load_ltks(adapter);
 
-device_exist:
-		if (key_info || ltk_info) {
-			device_set_paired(device, TRUE);
-			device_set_bonded(device, TRUE);
-		}
+	/*
+	 * Blocked devices need to be blocked in the kernel right away,
+	 * everything else is loaded on first use or in the background.
+	 */
+	for (l = adapter->stored_queue->head; l; l = next) {
+		struct stored_device *stored = l->data;
 
-free:
-		g_key_file_free(key_file);
-	}
+		next = l->next;
 
-	closedir(dir);
+		if (!(stored->flags & STORED_BLOCKED))
+			continue;
 
-	load_link_keys(adapter, keys.keys, main_opts.debug_keys);
-	g_slist_free_full(keys.keys, g_free);
+		g_queue_delete_link(adapter->stored_queue, l);
+		load_stored_device(adapter, stored);
+		g_free(stored);
+	}
 
-	load_ltks(adapter, ltks.keys);
-	g_slist_free_full(ltks.keys, g_free);
+	if (!g_queue_is_empty(adapter->stored_queue))
+		adapter->load_devices_id = g_idle_add(load_devices_idle,
+								adapter);
 }
 
 int btd_adapter_block_address(struct btd_adapter *adapter,
@@ -2901,9 +3426,6 @@ static void adapter_free(gpointer user_data)
 
 	DBG("%p", adapter);
 
-	if (adapter->load_ltks_timeout > 0)
-		g_source_remove(adapter->load_ltks_timeout);
-
 	if (adapter->confirm_name_timeout > 0)
 		g_source_remove(adapter->confirm_name_timeout);
 
@@ -2913,6 +3435,13 @@ static void adapter_free(gpointer user_data)
 	if (adapter->auth_idle_id)
 		g_source_remove(adapter->auth_idle_id);
 
+	if (adapter->auth_count > 0)
+		DBG("%u authorizations, max queued %u, wait avg %" PRId64
+				"ms max %" PRId64 "ms", adapter->auth_count,
+				adapter->auth_depth_max,
+				adapter->auth_wait_total / adapter->auth_count / 1000,
+				adapter->auth_wait_max / 1000);
+
 	g_queue_foreach(adapter->auths, free_service_auth, NULL);
 	g_queue_free(adapter->auths);
 
@@ -3950,6 +4479,32 @@ static void adapter_remove(struct btd_adapter *adapter)
 	g_slist_free(adapter->connect_list);
 	adapter->connect_list = NULL;
 
+	if (adapter->snapshot_timeout > 0) {
+		g_source_remove(adapter->snapshot_timeout);
+		adapter->snapshot_timeout = 0;
+		store_snapshot(adapter);
+	}
+
+	if (adapter->load_devices_id > 0) {
+		g_source_remove(adapter->load_devices_id);
+		adapter->load_devices_id = 0;
+	}
+
+	if (adapter->stored_queue) {
+		g_queue_free_full(adapter->stored_queue, g_free);
+		adapter->stored_queue = NULL;
+	}
+
+	if (adapter->stored_devices) {
+		g_hash_table_destroy(adapter->stored_devices);
+		adapter->stored_devices = NULL;
+	}
+
+	if (adapter->stored_records) {
+		g_hash_table_destroy(adapter->stored_records);
+		adapter->stored_records = NULL;
+	}
+
 	for (l = adapter->devices; l; l = l->next)
 		device_remove(l->data, FALSE);
 
@@ -4066,80 +4621,85 @@ static void update_found_devices(struct btd_adapter *adapter,
 					const uint8_t *data, uint8_t data_len)
 {
 	struct btd_device *dev;
-	struct eir_data eir_data;
+	struct eir_view eir_view;
 	char addr[18];
-	int err;
-	GSList *list;
-	bool name_known;
+	char *name = NULL;
+	bool name_known, eir_known;
 
-	memset(&eir_data, 0, sizeof(eir_data));
-	err = eir_parse(&eir_data, data, data_len);
-	if (err < 0) {
-		error("Error parsing EIR data: %s (%d)", strerror(-err), -err);
-		return;
-	}
+	eir_parse_view(&eir_view, data, data_len);
 
 	/* Avoid creating LE device if it's not discoverable */
 	if (bdaddr_type != BDADDR_BREDR &&
-			!(eir_data.flags & (EIR_LIM_DISC | EIR_GEN_DISC))) {
-		eir_data_free(&eir_data);
+			!(eir_view.flags & (EIR_LIM_DISC | EIR_GEN_DISC)))
 		return;
-	}
 
 	ba2str(bdaddr, addr);
 
-	list = g_slist_find_custom(adapter->devices, bdaddr, device_bdaddr_cmp);
-	if (!list) {
+	dev = adapter_find_device(adapter, bdaddr);
+	if (!dev) {
 		/*
 		 * If no client has requested discovery, then do not
 		 * create new device objects.
 		 */
-		if (!adapter->discovery_list) {
-			eir_data_free(&eir_data);
+		if (!adapter->discovery_list)
 			return;
-		}
 
 		dev = adapter_create_device(adapter, bdaddr, bdaddr_type);
-	} else
-		dev = list->data;
+	}
 
 	if (!dev) {
 		error("Unable to create object for found device %s", addr);
-		eir_data_free(&eir_data);
 		return;
 	}
 
-	if (eir_data.name != NULL && eir_data.name_complete)
-		device_store_cached_name(dev, eir_data.name);
+	/*
+	 * Reports repeating a payload that was already applied to the
+	 * device only need the RSSI to be updated.
+	 */
+	eir_known = device_eir_known(dev, data, data_len);
+
+	if (!eir_known)
+		name = eir_view_name(&eir_view);
+
+	if (name != NULL && eir_view.name_complete)
+		device_store_cached_name(dev, name);
 
 	/*
 	 * If no client has requested discovery, then only update
 	 * already paired devices (skip temporary ones).
 	 */
 	if (device_is_temporary(dev) && !adapter->discovery_list) {
-		eir_data_free(&eir_data);
+		g_free(name);
 		return;
 	}
 
 	device_set_legacy(dev, legacy);
 	device_set_rssi(dev, rssi);
 
-	if (eir_data.appearance != 0)
-		device_set_appearance(dev, eir_data.appearance);
-
 	/* Report an unknown name to the kernel even if there is a short name
 	 * known, but still update the name with the known short name. */
 	name_known = device_name_known(dev);
 
-	if (eir_data.name && (eir_data.name_complete || !name_known))
-		device_set_name(dev, eir_data.name);
+	if (!eir_known) {
+		GSList *services;
 
-	if (eir_data.class != 0)
-		device_set_class(dev, eir_data.class);
+		if (eir_view.appearance != 0)
+			device_set_appearance(dev, eir_view.appearance);
 
-	device_add_eir_uuids(dev, eir_data.services);
+		if (name && (eir_view.name_complete || !name_known))
+			device_set_name(dev, name);
 
-	eir_data_free(&eir_data);
+		if (eir_view.class != 0)
+			device_set_class(dev, eir_view.class);
+
+		services = eir_view_services(&eir_view);
+		device_add_eir_uuids(dev, services);
+		g_slist_free_full(services, g_free);
+
+		device_set_eir_known(dev, data, data_len);
+	}
+
+	g_free(name);
 
 	/*
 	 * Only if at least one client has requested discovery, maintain
@@ -4327,13 +4887,19 @@ void btd_unregister_adapter_driver(struct btd_adapter_driver *driver)
 	adapter_foreach(unload_driver, driver);
 }
 
-static void agent_auth_cb(struct agent *agent, DBusError *derr,
-							void *user_data)
+static void service_auth_complete(struct service_auth *auth,
+							DBusError *derr)
 {
-	struct btd_adapter *adapter = user_data;
-	struct service_auth *auth = adapter->auths->head->data;
+	struct btd_adapter *adapter = auth->adapter;
+	gint64 wait = g_get_monotonic_time() - auth->queued;
+
+	adapter->auth_count++;
+	adapter->auth_wait_total += wait;
+	if (wait > adapter->auth_wait_max)
+		adapter->auth_wait_max = wait;
 
-	g_queue_pop_head(adapter->auths);
+	DBG("id %u waited %" PRId64 "ms, %u queued", auth->id, wait / 1000,
+					g_queue_get_length(adapter->auths));
 
 	auth->cb(derr, auth->user_data);
 
@@ -4341,54 +4907,130 @@ static void agent_auth_cb(struct agent *agent, DBusError *derr,
 		agent_unref(auth->agent);
 
 	g_free(auth);
+}
 
-	adapter->auth_idle_id = g_idle_add(process_auth_queue, adapter);
+static struct service_auth *find_queued_auth(struct btd_adapter *adapter,
+						struct btd_device *device,
+						const char *uuid)
+{
+	GList *l;
+
+	for (l = adapter->auths->head; l != NULL; l = l->next) {
+		struct service_auth *auth = l->data;
+
+		if (auth->agent == NULL && auth->device == device &&
+					strcasecmp(auth->uuid, uuid) == 0)
+			return auth;
+	}
+
+	return NULL;
+}
+
+static void agent_auth_cb(struct agent *agent, DBusError *derr,
+							void *user_data)
+{
+	struct service_auth *auth = user_data;
+	struct btd_adapter *adapter = auth->adapter;
+	struct btd_device *device = auth->device;
+	char *uuid = g_strdup(auth->uuid);
+
+	g_queue_remove(adapter->auths, auth);
+
+	service_auth_complete(auth, derr);
+
+	/*
+	 * Requests queued meanwhile for the same service of the same device
+	 * get the same answer instead of prompting the user again.
+	 */
+	while ((auth = find_queued_auth(adapter, device, uuid))) {
+		g_queue_remove(adapter->auths, auth);
+		service_auth_complete(auth, derr);
+	}
+
+	g_free(uuid);
+
+	if (!adapter->auth_idle_id)
+		adapter->auth_idle_id = g_idle_add(process_auth_queue, adapter);
+}
+
+static bool agent_has_auth(struct btd_adapter *adapter, struct agent *agent)
+{
+	GList *l;
+
+	for (l = adapter->auths->head; l != NULL; l = l->next) {
+		struct service_auth *auth = l->data;
+
+		if (auth->agent == agent)
+			return true;
+	}
+
+	return false;
 }
 
 static gboolean process_auth_queue(gpointer user_data)
 {
 	struct btd_adapter *adapter = user_data;
 	DBusError err;
+	GList *l, *next;
 
 	adapter->auth_idle_id = 0;
 
 	dbus_error_init(&err);
 	dbus_set_error_const(&err, ERROR_INTERFACE ".Rejected", NULL);
 
-	while (!g_queue_is_empty(adapter->auths)) {
-		struct service_auth *auth = adapter->auths->head->data;
+	/*
+	 * Trusted devices are answered right away even while an agent
+	 * request for another device is outstanding. The Agent interface
+	 * can only cancel the one request in progress, so requests needing
+	 * the agent keep waiting until it is available.
+	 */
+	for (l = adapter->auths->head; l != NULL; l = next) {
+		struct service_auth *auth = l->data;
 		struct btd_device *device = auth->device;
+		struct agent *agent;
 		const char *dev_path;
+		int ret;
+
+		next = l->next;
+
+		/* Already waiting for the agent */
+		if (auth->agent)
+			continue;
 
 		if (device_is_trusted(device) == TRUE) {
-			auth->cb(NULL, auth->user_data);
-			goto next;
+			g_queue_delete_link(adapter->auths, l);
+			service_auth_complete(auth, NULL);
+			next = adapter->auths->head;
+			continue;
 		}
 
-		auth->agent = agent_get(NULL);
-		if (auth->agent == NULL) {
+		agent = agent_get(NULL);
+		if (agent == NULL) {
 			warn("Authentication attempt without agent");
-			auth->cb(&err, auth->user_data);
-			goto next;
+			g_queue_delete_link(adapter->auths, l);
+			service_auth_complete(auth, &err);
+			next = adapter->auths->head;
+			continue;
 		}
 
 		dev_path = device_get_path(device);
 
-		if (agent_authorize_service(auth->agent, dev_path, auth->uuid,
-					agent_auth_cb, adapter, NULL) < 0) {
-			auth->cb(&err, auth->user_data);
-			goto next;
+		ret = agent_authorize_service(agent, dev_path, auth->uuid,
+						agent_auth_cb, auth, NULL);
+		if (ret == -EBUSY && agent_has_auth(adapter, agent)) {
+			agent_unref(agent);
+			continue;
 		}
 
-		break;
-
-next:
-		if (auth->agent)
-			agent_unref(auth->agent);
-
-		g_free(auth);
+		if (ret < 0) {
+			agent_unref(agent);
+			g_queue_delete_link(adapter->auths, l);
+			service_auth_complete(auth, &err);
+			next = adapter->auths->head;
+			continue;
+		}
 
-		g_queue_pop_head(adapter->auths);
+		auth->agent = agent;
 	}
 
 	dbus_error_free(&err);
@@ -4422,11 +5064,12 @@ static int adapter_authorize(struct btd_adapter *adapter, const bdaddr_t *dst,
 	auth->device = device;
 	auth->adapter = adapter;
 	auth->id = ++id;
+	auth->queued = g_get_monotonic_time();
 
 	g_queue_push_tail(adapter->auths, auth);
 
-	if (adapter->auths->length != 1)
-		return auth->id;
+	if (adapter->auths->length > adapter->auth_depth_max)
+		adapter->auth_depth_max = adapter->auths->length;
 
 	if (adapter->auth_idle_id != 0)
 		return auth->id;
@@ -4485,17 +5128,25 @@ static struct service_auth *find_authorization(guint id)
 
 int btd_cancel_authorization(guint id)
 {
+	struct btd_adapter *adapter;
 	struct service_auth *auth;
 
 	auth = find_authorization(id);
 	if (auth == NULL)
 		return -EPERM;
 
-	g_queue_remove(auth->adapter->auths, auth);
+	adapter = auth->adapter;
+
+	g_queue_remove(adapter->auths, auth);
 
 	if (auth->agent) {
 		agent_cancel(auth->agent);
 		agent_unref(auth->agent);
+
+		/* Let the next request use the agent */
+		if (!adapter->auth_idle_id)
+			adapter->auth_idle_id = g_idle_add(process_auth_queue,
+								adapter);
 	}
 
 	g_free(auth);
@@ -5228,6 +5879,8 @@ static void store_link_key(struct btd_adapter *adapter,
 	g_free(str);
 
 	g_key_file_free(key_file);
+
+	adapter_storage_changed(adapter, device_get_address(device));
 }
 
 static void new_link_key_callback(uint16_t index, uint16_t length,
@@ -5365,6 +6018,8 @@ static void new_long_term_key_callback(uint16_t index, uint16_t length,
 					key->authenticated, key->enc_size,
 					key->ediv, key->rand);
 
+		adapter_storage_changed(adapter, &key->addr.bdaddr);
+
 		device_set_bonded(device, TRUE);
 
 		if (device_is_temporary(device))
@@ -5500,6 +6155,9 @@ void btd_adapter_for_each_device(struct btd_adapter *adapter,
 			void (*cb)(struct btd_device *device, void *data),
 			void *data)
 {
+	while (load_stored_devices(adapter))
+		;
+
 	g_slist_foreach(adapter->devices, (GFunc) cb, data);
 }
 
@@ -6223,6 +6881,8 @@ int adapter_init(void)
 	if (getenv("MGMT_DEBUG"))
 		mgmt_set_debug(mgmt_master, mgmt_debug, "mgmt: ", NULL);
 
+	mgmt_set_max_pending(mgmt_master, MGMT_MAX_PENDING);
+
 	DBG("sending read version command");
 
 	if (mgmt_send(mgmt_master, MGMT_OP_READ_VERSION,
@@ -6235,6 +6895,33 @@ int adapter_init(void)
 	return -EIO;
 }
 
+static void mgmt_stats(const struct mgmt_stats *stats, void *user_data)
+{
+	char buf[MGMT_STATS_BUCKETS * 20];
+	size_t len = 0;
+	unsigned int i;
+
+	buf[0] = '\0';
+
+	for (i = 0; i < MGMT_STATS_BUCKETS; i++) {
+		if (!stats->buckets[i])
+			continue;
+
+		if (i == MGMT_STATS_BUCKETS - 1)
+			len += snprintf(buf + len, sizeof(buf) - len,
+					" >=%uus:%u", 1U << (i - 1),
+					stats->buckets[i]);
+		else
+			len += snprintf(buf + len, sizeof(buf) - len,
+					" <%uus:%u", 1U << i,
+					stats->buckets[i]);
+	}
+
+	DBG("opcode 0x%04x count %u avg %" PRIu64 "us max %" PRIu64 "us%s",
+				stats->opcode, stats->count,
+				stats->total / stats->count, stats->max, buf);
+}
+
 void adapter_cleanup(void)
 {
 	g_list_free(adapter_list);
@@ -6266,6 +6953,8 @@ void adapter_cleanup(void)
 	 */
 	mgmt_cancel_index(mgmt_master, MGMT_INDEX_NONE);
 
+	mgmt_foreach_stats(mgmt_master, mgmt_stats, NULL);
+
 	mgmt_unref(mgmt_master);
 	mgmt_master = NULL;
 
@@ -201,6 +201,9 @@ void btd_adapter_gatt_server_stop(struct btd_adapter *adapter);
 
 bool btd_adapter_ssp_enabled(struct btd_adapter *adapter);
 
+void adapter_storage_changed(struct btd_adapter *adapter,
+						const bdaddr_t *bdaddr);
+
 int adapter_connect_list_add(struct btd_adapter *adapter,
 					struct btd_device *device);
 void adapter_connect_list_remove(struct btd_adapter *adapter,
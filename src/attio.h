@@ -31,3 +31,10 @@ guint btd_device_add_attio_callback(struct btd_device *device,
 						gpointer user_data);
 
 gboolean btd_device_remove_attio_callback(struct btd_device *device, guint id);
+
+guint btd_device_discover_char(struct btd_device *device, uint16_t start,
+					uint16_t end, bt_uuid_t *uuid,
+					gatt_cb_t func, gpointer user_data);
+guint btd_device_discover_desc(struct btd_device *device, uint16_t start,
+					uint16_t end, bt_uuid_t *uuid,
+					gatt_cb_t func, gpointer user_data);
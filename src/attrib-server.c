@@ -51,6 +51,8 @@
 #include "attrib/gatt.h"
 #include "attrib/att-database.h"
 #include "storage.h"
+#include "ccc.h"
+#include "notify-queue.h"
 
 #include "attrib-server.h"
 
@@ -66,6 +68,8 @@ struct gatt_server {
 	GSList *clients;
 	uint16_t name_handle;
 	uint16_t appearance_handle;
+	unsigned int notify_delivered;
+	unsigned int notify_dropped;
 };
 
 struct gatt_channel {
@@ -79,13 +83,8 @@ struct gatt_channel {
 	struct gatt_server *server;
 	guint cleanup_id;
 	struct btd_device *device;
-};
-
-struct group_elem {
-	uint16_t handle;
-	uint16_t end;
-	uint8_t *data;
-	uint16_t len;
+	GHashTable *ccc;
+	struct notify_queue *notify;
 };
 
 static bt_uuid_t prim_uuid = {
@@ -96,6 +95,10 @@ static bt_uuid_t snd_uuid = {
 			.type = BT_UUID16,
 			.value.u16 = GATT_SND_SVC_UUID
 };
+static bt_uuid_t charac_uuid = {
+			.type = BT_UUID16,
+			.value.u16 = GATT_CHARAC_UUID
+};
 static bt_uuid_t ccc_uuid = {
 			.type = BT_UUID16,
 			.value.u16 = GATT_CLIENT_CHARAC_CFG_UUID
@@ -109,8 +112,56 @@ static void attrib_free(void *data)
 	g_free(a);
 }
 
+static void notify_confirmed(guint8 status, const guint8 *pdu, guint16 len,
+							gpointer user_data)
+{
+	struct notify_sent *sent = user_data;
+
+	notify_sent_confirm(sent, status == 0);
+}
+
+static void notify_sent_destroy(gpointer user_data)
+{
+	notify_sent_done(user_data);
+}
+
+static gboolean channel_notify_send(const uint8_t *pdu, size_t len,
+						struct notify_sent *sent,
+						void *user_data)
+{
+	struct gatt_channel *channel = user_data;
+	GAttribResultFunc func;
+
+	func = pdu[0] == ATT_OP_HANDLE_IND ? notify_confirmed : NULL;
+
+	/* The destroy callback is not called on failure */
+	return g_attrib_send(channel->attrib, 0, pdu, len, func, sent,
+						notify_sent_destroy) > 0;
+}
+
 static void channel_free(struct gatt_channel *channel)
 {
+	struct notify_queue *queue = channel->notify;
+
+	if (queue != NULL) {
+		unsigned int delivered, dropped;
+
+		/* Queued and in-flight PDUs never reach the client */
+		notify_queue_get_stats(queue, &delivered, &dropped);
+		dropped += notify_queue_get_in_flight(queue) +
+					notify_queue_get_pending(queue);
+
+		channel->server->notify_delivered += delivered;
+		channel->server->notify_dropped += dropped;
+
+		DBG("notifications delivered %u dropped %u", delivered,
+								dropped);
+
+		notify_queue_destroy(queue);
+	}
+
+	if (channel->ccc)
+		g_hash_table_destroy(channel->ccc);
 
 	if (channel->cleanup_id)
 		g_source_remove(channel->cleanup_id);
@@ -138,6 +189,9 @@ static void gatt_server_free(struct gatt_server *server)
 
 	g_slist_free_full(server->clients, (GDestroyNotify) channel_free);
 
+	DBG("notifications delivered %u dropped %u", server->notify_delivered,
+						server->notify_dropped);
+
 	if (server->gatt_sdp_handle > 0)
 		remove_record_from_server(server->gatt_sdp_handle);
 
@@ -400,14 +454,12 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 						uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, size_t len)
 {
-	struct att_data_list *adl;
+	struct att_list list;
 	struct attribute *a;
-	struct group_elem *cur, *old = NULL;
-	GSList *l, *groups;
 	GList *dl, *database;
-	uint16_t length, last_handle, last_size = 0;
+	uint8_t *entry, *old = NULL;
+	uint16_t length, last_handle;
 	uint8_t status;
-	int i;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
@@ -423,9 +475,11 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, 0x0000,
 					ATT_ECODE_UNSUPP_GRP_TYPE, pdu, len);
 
+	att_list_init(&list, ATT_OP_READ_BY_GROUP_RESP, pdu, len);
+
 	last_handle = end;
 	database = channel->server->database;
-	for (dl = database, groups = NULL, cur = NULL; dl; dl = dl->next) {
+	for (dl = database, a = NULL; dl; dl = dl->next) {
 
 		a = dl->data;
 
@@ -438,7 +492,7 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 		/* The old group ends when a new one starts */
 		if (old && (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
 				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)) {
-			old->end = last_handle;
+			att_put_u16(last_handle, &old[2]);
 			old = NULL;
 		}
 
@@ -449,7 +503,8 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 			continue;
 		}
 
-		if (last_size && (last_size != a->len))
+		/* All elements must have the same length */
+		if (list.len && list.len != a->len + 4)
 			break;
 
 		status = att_check_reqs(channel, ATT_OP_READ_BY_GROUP_REQ,
@@ -459,60 +514,32 @@ static uint16_t read_by_group(struct gatt_channel *channel, uint16_t start,
 			status = a->read_cb(a, channel->device,
 							a->cb_user_data);
 
-		if (status) {
-			g_slist_free_full(groups, g_free);
+		if (status)
 			return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ,
 						a->handle, status, pdu, len);
-		}
 
-		cur = g_new0(struct group_elem, 1);
-		cur->handle = a->handle;
-		cur->data = a->data;
-		cur->len = a->len;
+		/* Attribute Grouping Type found, stop once the PDU is full */
+		entry = att_list_append(&list, a->len + 4);
+		if (entry == NULL)
+			break;
 
-		/* Attribute Grouping Type found */
-		groups = g_slist_append(groups, cur);
+		att_put_u16(a->handle, entry);
+		/* Attribute Value */
+		memcpy(&entry[4], a->data, a->len);
 
-		last_size = a->len;
-		old = cur;
-		last_handle = cur->handle;
+		old = entry;
+		last_handle = a->handle;
 	}
 
-	if (groups == NULL)
+	length = att_list_finish(&list);
+	if (length == 0)
 		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
 					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-	if (dl == NULL)
-		cur->end = a->handle;
-	else
-		cur->end = last_handle;
-
-	length = g_slist_length(groups);
-
-	adl = att_data_list_alloc(length, last_size + 4);
-	if (adl == NULL) {
-		g_slist_free_full(groups, g_free);
-		return enc_error_resp(ATT_OP_READ_BY_GROUP_REQ, start,
-					ATT_ECODE_UNLIKELY, pdu, len);
-	}
-
-	for (i = 0, l = groups; l; l = l->next, i++) {
-		uint8_t *value;
-
-		cur = l->data;
-
-		value = (void *) adl->data[i];
-
-		att_put_u16(cur->handle, value);
-		att_put_u16(cur->end, &value[2]);
-		/* Attribute Value */
-		memcpy(&value[4], cur->data, cur->len);
-	}
-
-	length = enc_read_by_grp_resp(adl, pdu, len);
-
-	att_data_list_free(adl);
-	g_slist_free_full(groups, g_free);
+	if (old && dl == NULL)
+		att_put_u16(a->handle, &old[2]);
+	else if (old)
+		att_put_u16(last_handle, &old[2]);
 
 	return length;
 }
@@ -521,20 +548,21 @@ static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 						uint16_t end, bt_uuid_t *uuid,
 						uint8_t *pdu, size_t len)
 {
-	struct att_data_list *adl;
-	GSList *l, *types;
+	struct att_list list;
 	GList *dl, *database;
 	struct attribute *a;
-	uint16_t num, length;
+	uint16_t length, vlen;
+	uint8_t *entry;
 	uint8_t status;
-	int i;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
+	att_list_init(&list, ATT_OP_READ_BY_TYPE_RESP, pdu, len);
+
 	database = channel->server->database;
-	for (dl = database, length = 0, types = NULL; dl; dl = dl->next) {
+	for (dl = database, length = 0; dl; dl = dl->next) {
 
 		a = dl->data;
 
@@ -554,11 +582,9 @@ static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 			status = a->read_cb(a, channel->device,
 							a->cb_user_data);
 
-		if (status) {
-			g_slist_free(types);
+		if (status)
 			return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ,
 						a->handle, status, pdu, len);
-		}
 
 		/* All elements must have the same length */
 		if (length == 0)
@@ -566,42 +592,26 @@ static uint16_t read_by_type(struct gatt_channel *channel, uint16_t start,
 		else if (a->len != length)
 			break;
 
-		types = g_slist_append(types, a);
-	}
-
-	if (types == NULL)
-		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
-					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
-
-	num = g_slist_length(types);
-
-	/* Handle length plus attribute value length */
-	length += 2;
-
-	adl = att_data_list_alloc(num, length);
-	if (adl == NULL) {
-		g_slist_free(types);
-		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
-					ATT_ECODE_UNLIKELY, pdu, len);
-	}
+		/* Long values are truncated to fit the response */
+		vlen = MIN(a->len, UINT8_MAX - 2);
+		if (len > 4)
+			vlen = MIN(vlen, len - 4);
 
-	for (i = 0, l = types; l; i++, l = l->next) {
-		uint8_t *value;
-
-		a = l->data;
-
-		value = (void *) adl->data[i];
+		/* Handle length plus attribute value length */
+		entry = att_list_append(&list, vlen + 2);
+		if (entry == NULL)
+			break;
 
-		att_put_u16(a->handle, value);
+		att_put_u16(a->handle, entry);
 
 		/* Attribute Value */
-		memcpy(&value[2], a->data, a->len);
+		memcpy(&entry[2], a->data, vlen);
 	}
 
-	length = enc_read_by_type_resp(adl, pdu, len);
-
-	att_data_list_free(adl);
-	g_slist_free(types);
+	length = att_list_finish(&list);
+	if (length == 0)
+		return enc_error_resp(ATT_OP_READ_BY_TYPE_REQ, start,
+					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
 	return length;
 }
@@ -610,19 +620,19 @@ static uint16_t find_info(struct gatt_channel *channel, uint16_t start,
 				uint16_t end, uint8_t *pdu, size_t len)
 {
 	struct attribute *a;
-	struct att_data_list *adl;
-	GSList *l, *info;
+	struct att_list list;
 	GList *dl, *database;
-	uint8_t format, last_type = BT_UUID_UNSPEC;
-	uint16_t length, num;
-	int i;
+	uint16_t length;
+	uint8_t *entry;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_FIND_INFO_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, pdu, len);
 
+	att_list_init(&list, ATT_OP_FIND_INFO_RESP, pdu, len);
+
 	database = channel->server->database;
-	for (dl = database, info = NULL, num = 0; dl; dl = dl->next) {
+	for (dl = database; dl; dl = dl->next) {
 		a = dl->data;
 
 		if (a->handle < start)
@@ -631,58 +641,29 @@ static uint16_t find_info(struct gatt_channel *channel, uint16_t start,
 		if (a->handle > end)
 			break;
 
-		if (last_type == BT_UUID_UNSPEC)
-			last_type = a->uuid.type;
+		if (a->uuid.type == BT_UUID16)
+			length = 2;
+		else if (a->uuid.type == BT_UUID128)
+			length = 16;
+		else
+			break;
 
-		if (a->uuid.type != last_type)
+		/* Stops when the UUID type changes or the PDU is full */
+		entry = att_list_append(&list, length + 2);
+		if (entry == NULL)
 			break;
 
-		info = g_slist_append(info, a);
-		num++;
+		att_put_u16(a->handle, entry);
 
-		last_type = a->uuid.type;
+		/* Attribute Value */
+		att_put_uuid(a->uuid, &entry[2]);
 	}
 
-	if (info == NULL)
+	length = att_list_finish(&list);
+	if (length == 0)
 		return enc_error_resp(ATT_OP_FIND_INFO_REQ, start,
 					ATT_ECODE_ATTR_NOT_FOUND, pdu, len);
 
-	if (last_type == BT_UUID16) {
-		length = 2;
-		format = 0x01;
-	} else if (last_type == BT_UUID128) {
-		length = 16;
-		format = 0x02;
-	} else {
-		g_slist_free(info);
-		return 0;
-	}
-
-	adl = att_data_list_alloc(num, length + 2);
-	if (adl == NULL) {
-		g_slist_free(info);
-		return enc_error_resp(ATT_OP_FIND_INFO_REQ, start,
-					ATT_ECODE_UNLIKELY, pdu, len);
-	}
-
-	for (i = 0, l = info; l; i++, l = l->next) {
-		uint8_t *value;
-
-		a = l->data;
-
-		value = (void *) adl->data[i];
-
-		att_put_u16(a->handle, value);
-
-		/* Attribute Value */
-		att_put_uuid(a->uuid, &value[2]);
-	}
-
-	length = enc_find_info_resp(format, adl, pdu, len);
-
-	att_data_list_free(adl);
-	g_slist_free(info);
-
 	return length;
 }
 
@@ -692,18 +673,20 @@ static uint16_t find_by_type(struct gatt_channel *channel, uint16_t start,
 				uint8_t *opdu, size_t mtu)
 {
 	struct attribute *a;
-	struct att_range *range;
-	GSList *matches;
+	struct att_list list;
 	GList *dl, *database;
+	uint8_t *range;
 	uint16_t len;
 
 	if (start > end || start == 0x0000)
 		return enc_error_resp(ATT_OP_FIND_BY_TYPE_REQ, start,
 					ATT_ECODE_INVALID_HANDLE, opdu, mtu);
 
+	att_list_init(&list, ATT_OP_FIND_BY_TYPE_RESP, opdu, mtu);
+
 	/* Searching first requested handle number */
 	database = channel->server->database;
-	for (dl = database, matches = NULL, range = NULL; dl; dl = dl->next) {
+	for (dl = database, range = NULL; dl; dl = dl->next) {
 		a = dl->data;
 
 		if (a->handle < start)
@@ -716,13 +699,14 @@ static uint16_t find_by_type(struct gatt_channel *channel, uint16_t start,
 		if ((bt_uuid_cmp(&a->uuid, uuid) == 0) && (a->len == vlen) &&
 					(memcmp(a->data, value, vlen) == 0)) {
 
-			range = g_new0(struct att_range, 1);
-			range->start = a->handle;
+			range = att_list_append(&list, sizeof(uint16_t) * 2);
+			if (range == NULL)
+				break;
+
 			/* It is allowed to have end group handle the same as
 			 * start handle, for groups with only one attribute. */
-			range->end = a->handle;
-
-			matches = g_slist_append(matches, range);
+			att_put_u16(a->handle, range);
+			att_put_u16(a->handle, &range[2]);
 		} else if (range) {
 			/* Update the last found handle or reset the pointer
 			 * to track that a new group started: Primary or
@@ -731,53 +715,41 @@ static uint16_t find_by_type(struct gatt_channel *channel, uint16_t start,
 					bt_uuid_cmp(&a->uuid, &snd_uuid) == 0)
 				range = NULL;
 			else
-				range->end = a->handle;
+				att_put_u16(a->handle, &range[2]);
 		}
 	}
 
-	if (matches == NULL)
+	len = att_list_finish(&list);
+	if (len == 0)
 		return enc_error_resp(ATT_OP_FIND_BY_TYPE_REQ, start,
 				ATT_ECODE_ATTR_NOT_FOUND, opdu, mtu);
 
-	len = enc_find_by_type_resp(matches, opdu, mtu);
-
-	g_slist_free_full(matches, g_free);
-
 	return len;
 }
 
-static int read_device_ccc(struct btd_device *device, uint16_t handle,
-				uint16_t *value)
+static GHashTable *load_device_ccc(struct btd_device *device)
 {
+	GHashTable *ccc;
 	char *filename;
 	GKeyFile *key_file;
-	char group[6];
-	char *str;
-	unsigned int config;
-	int err = 0;
+
+	ccc = ccc_new();
 
 	filename = btd_device_get_storage_path(device, "ccc");
 	if (!filename) {
 		warn("Unable to get ccc storage path for device");
-		return -ENOENT;
+		return ccc;
 	}
 
 	key_file = g_key_file_new();
 	g_key_file_load_from_file(key_file, filename, 0, NULL);
 
-	sprintf(group, "%hu", handle);
-
-	str = g_key_file_get_string(key_file, group, "Value", NULL);
-	if (!str || sscanf(str, "%04X", &config) != 1)
-		err = -ENOENT;
-	else
-		*value = config;
+	ccc_load(ccc, key_file);
 
-	g_free(str);
 	g_free(filename);
 	g_key_file_free(key_file);
 
-	return err;
+	return ccc;
 }
 
 static uint16_t read_value(struct gatt_channel *channel, uint16_t handle,
@@ -798,7 +770,7 @@ static uint16_t read_value(struct gatt_channel *channel, uint16_t handle,
 	a = l->data;
 
 	if (bt_uuid_cmp(&ccc_uuid, &a->uuid) == 0 &&
-		read_device_ccc(channel->device, handle, &cccval) == 0) {
+			ccc_get(channel->ccc, handle, &cccval)) {
 		uint8_t config[2];
 
 		att_put_u16(cccval, config);
@@ -839,7 +811,7 @@ static uint16_t read_blob(struct gatt_channel *channel, uint16_t handle,
 					ATT_ECODE_INVALID_OFFSET, pdu, len);
 
 	if (bt_uuid_cmp(&ccc_uuid, &a->uuid) == 0 &&
-		read_device_ccc(channel->device, handle, &cccval) == 0) {
+			ccc_get(channel->ccc, handle, &cccval)) {
 		uint8_t config[2];
 
 		att_put_u16(cccval, config);
@@ -897,10 +869,11 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 		uint16_t cccval = att_get_u16(value);
 		char *filename;
 		GKeyFile *key_file;
-		char group[6], value[5];
 		char *data;
 		gsize length = 0;
 
+		ccc_set(channel->ccc, handle, cccval);
+
 		filename = btd_device_get_storage_path(channel->device, "ccc");
 		if (!filename) {
 			warn("Unable to get ccc storage path for device");
@@ -912,9 +885,7 @@ static uint16_t write_value(struct gatt_channel *channel, uint16_t handle,
 		key_file = g_key_file_new();
 		g_key_file_load_from_file(key_file, filename, 0, NULL);
 
-		sprintf(group, "%hu", handle);
-		sprintf(value, "%hhX", cccval);
-		g_key_file_set_string(key_file, group, "Value", value);
+		ccc_store(key_file, handle, cccval);
 
 		data = g_key_file_to_data(key_file, &length, NULL);
 		if (length > 0) {
@@ -1170,6 +1141,9 @@ guint attrib_channel_attach(GAttrib *attrib)
 								channel);
 
 	channel->device = btd_device_ref(device);
+	channel->ccc = load_device_ccc(device);
+
+	channel->notify = notify_queue_new(channel_notify_send, channel);
 
 	server->clients = g_slist_append(server->clients, channel);
 
@@ -1546,6 +1520,141 @@ int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 	return 0;
 }
 
+static uint16_t find_ccc_handle(GList *dl)
+{
+	for (dl = dl->next; dl; dl = dl->next) {
+		struct attribute *a = dl->data;
+
+		if (bt_uuid_cmp(&a->uuid, &ccc_uuid) == 0)
+			return a->handle;
+
+		/* Descriptors end at the next declaration */
+		if (bt_uuid_cmp(&a->uuid, &prim_uuid) == 0 ||
+				bt_uuid_cmp(&a->uuid, &snd_uuid) == 0 ||
+				bt_uuid_cmp(&a->uuid, &charac_uuid) == 0)
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * Sends the value of handle to the channels that configured its CCC
+ * descriptor, or only to the channel of device if it is not NULL.
+ */
+int attrib_db_notify(struct btd_adapter *adapter, uint16_t handle,
+						struct btd_device *device)
+{
+	struct gatt_server *server;
+	struct attribute *a;
+	GHashTable *pdus;
+	uint16_t ccc;
+	GSList *l;
+	GList *dl;
+	guint h = handle;
+	int count = 0;
+
+	l = g_slist_find_custom(servers, adapter, adapter_cmp);
+	if (l == NULL)
+		return -ENOENT;
+
+	server = l->data;
+
+	dl = g_list_find_custom(server->database, GUINT_TO_POINTER(h),
+								handle_cmp);
+	if (dl == NULL)
+		return -ENOENT;
+
+	a = dl->data;
+
+	ccc = find_ccc_handle(dl);
+	if (ccc == 0)
+		return -ENOTSUP;
+
+	/*
+	 * Values longer than ATT_MTU - 3 are truncated, so each PDU is
+	 * encoded once per opcode and size and shared by every channel
+	 * with the same MTU class.
+	 */
+	pdus = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+
+	for (l = server->clients; l; l = l->next) {
+		struct gatt_channel *channel = l->data;
+		uint8_t opcode, *pdu;
+		size_t vlen, size;
+		gpointer key;
+
+		if (device != NULL && channel->device != device)
+			continue;
+
+		opcode = ccc_opcode(channel->ccc, ccc);
+		if (opcode == 0)
+			continue;
+
+		vlen = MIN(a->len, (size_t) channel->mtu - 3);
+		size = vlen + 3;
+
+		key = GUINT_TO_POINTER(size << 8 | opcode);
+
+		pdu = g_hash_table_lookup(pdus, key);
+		if (pdu == NULL) {
+			pdu = g_malloc(size);
+
+			if (opcode == ATT_OP_HANDLE_IND)
+				enc_indication(handle, a->data, vlen, pdu,
+									size);
+			else
+				enc_notification(handle, a->data, vlen, pdu,
+									size);
+
+			g_hash_table_insert(pdus, key, pdu);
+		}
+
+		notify_queue_push(channel->notify, handle, pdu, size);
+		count++;
+	}
+
+	DBG("handle=0x%04x ccc=0x%04x channels=%d pdus=%u", handle, ccc,
+					count, g_hash_table_size(pdus));
+
+	g_hash_table_destroy(pdus);
+
+	return count;
+}
+
+void attrib_db_notify_stats(struct btd_adapter *adapter,
+				unsigned int *delivered, unsigned int *dropped)
+{
+	struct gatt_server *server;
+	GSList *l;
+
+	*delivered = 0;
+	*dropped = 0;
+
+	l = g_slist_find_custom(servers, adapter, adapter_cmp);
+	if (l == NULL)
+		return;
+
+	server = l->data;
+
+	/* Totals of closed channels plus the ones still connected */
+	*delivered = server->notify_delivered;
+	*dropped = server->notify_dropped;
+
+	for (l = server->clients; l; l = l->next) {
+		struct gatt_channel *channel = l->data;
+		unsigned int d, n;
+
+		if (channel->notify == NULL)
+			continue;
+
+		notify_queue_get_stats(channel->notify, &d, &n);
+
+		*delivered += d;
+		*dropped += n;
+	}
+}
+
 int attrib_db_del(struct btd_adapter *adapter, uint16_t handle)
 {
 	struct gatt_server *server;
@@ -31,6 +31,10 @@ struct attribute *attrib_db_add(struct btd_adapter *adapter, uint16_t handle,
 int attrib_db_update(struct btd_adapter *adapter, uint16_t handle,
 					bt_uuid_t *uuid, const uint8_t *value,
 					size_t len, struct attribute **attr);
+int attrib_db_notify(struct btd_adapter *adapter, uint16_t handle,
+						struct btd_device *device);
+void attrib_db_notify_stats(struct btd_adapter *adapter,
+				unsigned int *delivered, unsigned int *dropped);
 int attrib_db_del(struct btd_adapter *adapter, uint16_t handle);
 int attrib_gap_set(struct btd_adapter *adapter, uint16_t uuid,
 					const uint8_t *value, size_t len);
@@ -0,0 +1,112 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "lib/uuid.h"
+#include "attrib/att.h"
+#include "attrib/gattrib.h"
+#include "attrib/gatt.h"
+#include "ccc.h"
+
+GHashTable *ccc_new(void)
+{
+	return g_hash_table_new(NULL, NULL);
+}
+
+void ccc_load(GHashTable *ccc, GKeyFile *key_file)
+{
+	char **groups, **group;
+
+	groups = g_key_file_get_groups(key_file, NULL);
+
+	for (group = groups; *group; group++) {
+		unsigned int handle, config;
+		char *str;
+
+		if (sscanf(*group, "%u", &handle) != 1 || handle > 0xffff)
+			continue;
+
+		str = g_key_file_get_string(key_file, *group, "Value", NULL);
+		if (str && sscanf(str, "%04X", &config) == 1)
+			ccc_set(ccc, handle, config);
+
+		g_free(str);
+	}
+
+	g_strfreev(groups);
+}
+
+void ccc_store(GKeyFile *key_file, uint16_t handle, uint16_t value)
+{
+	char group[6], str[5];
+
+	sprintf(group, "%hu", handle);
+	sprintf(str, "%hX", value);
+	g_key_file_set_string(key_file, group, "Value", str);
+}
+
+gboolean ccc_get(GHashTable *ccc, uint16_t handle, uint16_t *value)
+{
+	gpointer config;
+
+	if (!g_hash_table_lookup_extended(ccc, GUINT_TO_POINTER(handle),
+							NULL, &config))
+		return FALSE;
+
+	*value = GPOINTER_TO_UINT(config);
+
+	return TRUE;
+}
+
+void ccc_set(GHashTable *ccc, uint16_t handle, uint16_t value)
+{
+	g_hash_table_insert(ccc, GUINT_TO_POINTER(handle),
+						GUINT_TO_POINTER(value));
+}
+
+/*
+ * Returns the PDU used to send a value to a client that configured the
+ * descriptor at handle, or 0 if it asked for neither. Notifications win
+ * when both bits are set since they do not wait for a confirmation.
+ */
+uint8_t ccc_opcode(GHashTable *ccc, uint16_t handle)
+{
+	uint16_t config;
+
+	if (!ccc_get(ccc, handle, &config))
+		return 0;
+
+	if (config & GATT_CLIENT_CHARAC_CFG_NOTIF_BIT)
+		return ATT_OP_HANDLE_NOTIFY;
+
+	if (config & GATT_CLIENT_CHARAC_CFG_IND_BIT)
+		return ATT_OP_HANDLE_IND;
+
+	return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Client Characteristic Configuration values of a device, indexed by the
+ * handle of the descriptor. They are stored in the "ccc" file of the device
+ * with one group per handle.
+ */
+
+GHashTable *ccc_new(void);
+void ccc_load(GHashTable *ccc, GKeyFile *key_file);
+void ccc_store(GKeyFile *key_file, uint16_t handle, uint16_t value);
+gboolean ccc_get(GHashTable *ccc, uint16_t handle, uint16_t *value);
+void ccc_set(GHashTable *ccc, uint16_t handle, uint16_t value);
+uint8_t ccc_opcode(GHashTable *ccc, uint16_t handle);
@@ -54,6 +54,7 @@
 #include "hcid.h"
 #include "adapter.h"
 #include "attrib/gattrib.h"
+#include "attrib/gatt.h"
 #include "attio.h"
 #include "device.h"
 #include "profile.h"
@@ -62,7 +63,6 @@
 #include "error.h"
 #include "glib-helper.h"
 #include "sdp-client.h"
-#include "attrib/gatt.h"
 #include "agent.h"
 #include "sdp-xml.h"
 #include "storage.h"
@@ -73,6 +73,8 @@
 #define DISCONNECT_TIMER	2
 #define DISCOVERY_TIMER		1
 
+#define GATT_BASE_UUID		"00000000-0000-1000-8000-00805f9b34fb"
+
 static DBusConnection *dbus_conn = NULL;
 unsigned service_state_cb_id;
 
@@ -130,6 +132,14 @@ struct included_search {
 	GSList *current;
 };
 
+struct cache_req {
+	guint id;
+	struct btd_device *device;
+	GSList *list;
+	gatt_cb_t func;
+	gpointer user_data;
+};
+
 struct attio_data {
 	guint id;
 	attio_connect_cb cfunc;
@@ -176,6 +186,9 @@ struct btd_device {
 	struct btd_adapter	*adapter;
 	GSList		*uuids;
 	GSList		*primaries;		/* List of primary services */
+	GSList		*chars;			/* Cached characteristics */
+	GSList		*descs;			/* Cached descriptors */
+	GSList		*cache_reqs;		/* Pending cache lookups */
 	GSList		*services;		/* List of btd_service */
 	GSList		*pending;		/* Pending services */
 	GSList		*watches;		/* List of disconnect_data */
@@ -207,6 +220,7 @@ struct btd_device {
 
 	bool		legacy;
 	int8_t		rssi;
+	uint64_t	eir_hash[2];		/* Last EIR/AD payloads seen */
 
 	GIOChannel	*att_io;
 	guint		cleanup_id;
@@ -369,6 +383,8 @@ static gboolean store_device_info_cb(gpointer user_data)
 	g_key_file_free(key_file);
 	g_free(uuids);
 
+	adapter_storage_changed(device->adapter, &device->bdaddr);
+
 	return FALSE;
 }
 
@@ -447,8 +463,32 @@ static void browse_request_free(struct browse_req *req)
 	g_free(req);
 }
 
+static void cache_req_free(gpointer user_data)
+{
+	struct cache_req *req = user_data;
+
+	g_slist_free_full(req->list, g_free);
+	g_free(req);
+}
+
+static void cache_req_cancel(gpointer user_data)
+{
+	struct cache_req *req = user_data;
+
+	g_source_remove(req->id);
+	cache_req_free(req);
+}
+
+static void cache_reqs_cancel(struct btd_device *device)
+{
+	g_slist_free_full(device->cache_reqs, cache_req_cancel);
+	device->cache_reqs = NULL;
+}
+
 static void attio_cleanup(struct btd_device *device)
 {
+	cache_reqs_cancel(device);
+
 	if (device->attachid) {
 		attrib_channel_detach(device->attrib, device->attachid);
 		device->attachid = 0;
@@ -503,6 +543,8 @@ static void device_free(gpointer user_data)
 
 	g_slist_free_full(device->uuids, g_free);
 	g_slist_free_full(device->primaries, g_free);
+	g_slist_free_full(device->chars, g_free);
+	g_slist_free_full(device->descs, g_free);
 	g_slist_free_full(device->attios, g_free);
 	g_slist_free_full(device->attios_offline, g_free);
 	g_slist_free_full(device->svc_callbacks, svc_dev_remove);
@@ -1094,6 +1136,8 @@ void device_request_disconnect(struct btd_device *device, DBusMessage *msg)
 	g_slist_free(device->pending);
 	device->pending = NULL;
 
+	cache_reqs_cancel(device);
+
 	while (device->watches) {
 		struct btd_disconnect_data *data = device->watches->data;
 
@@ -1797,6 +1841,8 @@ void device_remove_connection(struct btd_device *device)
 	device->connected = FALSE;
 	device->general_connect = FALSE;
 
+	cache_reqs_cancel(device);
+
 	if (device->disconn_timer > 0) {
 		g_source_remove(device->disconn_timer);
 		device->disconn_timer = 0;
@@ -2018,12 +2064,89 @@ next:
 		store_device_info(device);
 }
 
+static int char_handle_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct gatt_char *chr1 = a;
+	const struct gatt_char *chr2 = b;
+
+	return chr1->handle - chr2->handle;
+}
+
+static int desc_handle_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct gatt_desc *desc1 = a;
+	const struct gatt_desc *desc2 = b;
+
+	return desc1->handle - desc2->handle;
+}
+
+static void load_att_char(struct btd_device *device, GKeyFile *key_file,
+							const char *group)
+{
+	struct gatt_char *chr;
+	char *str;
+
+	str = g_key_file_get_string(key_file, group, "Value", NULL);
+	if (!str)
+		return;
+
+	chr = g_new0(struct gatt_char, 1);
+	chr->handle = atoi(group);
+	chr->properties = g_key_file_get_integer(key_file, group,
+							"Properties", NULL);
+	chr->value_handle = g_key_file_get_integer(key_file, group,
+							"ValueHandle", NULL);
+	g_strlcpy(chr->uuid, str, sizeof(chr->uuid));
+	g_free(str);
+
+	if (chr->handle == 0 || chr->value_handle <= chr->handle) {
+		g_free(chr);
+		return;
+	}
+
+	device->chars = g_slist_prepend(device->chars, chr);
+}
+
+static void load_att_desc(struct btd_device *device, GKeyFile *key_file,
+					const char *group, const char *type)
+{
+	struct gatt_desc *desc;
+	bt_uuid_t uuid;
+	char uuid16[5];
+
+	/* Descriptors are stored only with their type, no value */
+	if (g_key_file_has_key(key_file, group, "Value", NULL))
+		return;
+
+	if (bt_string_to_uuid(&uuid, type) < 0 || uuid.type != BT_UUID128)
+		return;
+
+	desc = g_new0(struct gatt_desc, 1);
+	desc->handle = atoi(group);
+	bt_uuid_to_string(&uuid, desc->uuid, sizeof(desc->uuid));
+
+	/* Short form, as reported by Find Information, for Bluetooth UUIDs */
+	if (strncmp(desc->uuid, "0000", 4) == 0 &&
+			strcasecmp(&desc->uuid[8], &GATT_BASE_UUID[8]) == 0) {
+		memcpy(uuid16, &desc->uuid[4], 4);
+		uuid16[4] = '\0';
+		desc->uuid16 = strtol(uuid16, NULL, 16);
+	}
+
+	if (desc->handle == 0) {
+		g_free(desc);
+		return;
+	}
+
+	device->descs = g_slist_prepend(device->descs, desc);
+}
+
 static void load_att_info(struct btd_device *device, const char *local,
 				const char *peer)
 {
 	char filename[PATH_MAX + 1];
 	GKeyFile *key_file;
-	char *prim_uuid, *str;
+	char *prim_uuid, *char_uuid, *str;
 	char **groups, **handle, *service_uuid;
 	struct gatt_primary *prim;
 	uuid_t uuid;
@@ -2033,6 +2156,9 @@ static void load_att_info(struct btd_device *device, const char *local,
 	sdp_uuid16_create(&uuid, GATT_PRIM_SVC_UUID);
 	prim_uuid = bt_uuid2string(&uuid);
 
+	sdp_uuid16_create(&uuid, GATT_CHARAC_UUID);
+	char_uuid = bt_uuid2string(&uuid);
+
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s/attributes", local,
 			peer);
 	filename[PATH_MAX] = '\0';
@@ -2049,11 +2175,21 @@ static void load_att_info(struct btd_device *device, const char *local,
 		if (!str)
 			continue;
 
+		if (g_str_equal(str, char_uuid)) {
+			load_att_char(device, key_file, *handle);
+			g_free(str);
+			continue;
+		}
+
 		uuid_ok = g_str_equal(str, prim_uuid);
-		g_free(str);
 
-		if (!uuid_ok)
+		if (!uuid_ok) {
+			load_att_desc(device, key_file, *handle, str);
+			g_free(str);
 			continue;
+		}
+
+		g_free(str);
 
 		str = g_key_file_get_string(key_file, *handle, "Value", NULL);
 		if (!str)
@@ -2105,6 +2241,10 @@ static void load_att_info(struct btd_device *device, const char *local,
 	g_strfreev(groups);
 	g_key_file_free(key_file);
 	g_free(prim_uuid);
+	g_free(char_uuid);
+
+	device->chars = g_slist_sort(device->chars, char_handle_cmp);
+	device->descs = g_slist_sort(device->descs, desc_handle_cmp);
 }
 
 static struct btd_device *device_new(struct btd_adapter *adapter,
@@ -2342,6 +2482,8 @@ static void device_remove_stored(struct btd_device *device)
 	filename[PATH_MAX] = '\0';
 	delete_folder_tree(filename);
 
+	adapter_storage_changed(device->adapter, &device->bdaddr);
+
 	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", adapter_addr,
 			device_addr);
 	filename[PATH_MAX] = '\0';
@@ -2349,6 +2491,9 @@ static void device_remove_stored(struct btd_device *device)
 	key_file = g_key_file_new();
 	g_key_file_load_from_file(key_file, filename, 0, NULL);
 	g_key_file_remove_group(key_file, "ServiceRecords", NULL);
+	g_key_file_remove_group(key_file, "ServiceDatabase", NULL);
+
+	bt_clear_cached_records(src, &device->bdaddr);
 
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
@@ -2384,6 +2529,8 @@ void device_remove(struct btd_device *device, gboolean remove_stored)
 	g_slist_free(device->pending);
 	device->pending = NULL;
 
+	cache_reqs_cancel(device);
+
 	if (device->connected)
 		do_disconnect(device);
 
@@ -3020,7 +3167,7 @@ static void store_services(struct btd_device *device)
 	char filename[PATH_MAX + 1];
 	char src_addr[18], dst_addr[18];
 	uuid_t uuid;
-	char *prim_uuid;
+	char *prim_uuid, *char_uuid;
 	GKeyFile *key_file;
 	GSList *l;
 	char *data;
@@ -3037,6 +3184,13 @@ static void store_services(struct btd_device *device)
 	if (prim_uuid == NULL)
 		return;
 
+	sdp_uuid16_create(&uuid, GATT_CHARAC_UUID);
+	char_uuid = bt_uuid2string(&uuid);
+	if (char_uuid == NULL) {
+		g_free(prim_uuid);
+		return;
+	}
+
 	ba2str(adapter_get_address(adapter), src_addr);
 	ba2str(&device->bdaddr, dst_addr);
 
@@ -3078,6 +3232,29 @@ static void store_services(struct btd_device *device)
 					primary->range.end);
 	}
 
+	for (l = device->chars; l; l = l->next) {
+		struct gatt_char *chr = l->data;
+		char handle[6];
+
+		sprintf(handle, "%hu", chr->handle);
+
+		g_key_file_set_string(key_file, handle, "UUID", char_uuid);
+		g_key_file_set_string(key_file, handle, "Value", chr->uuid);
+		g_key_file_set_integer(key_file, handle, "Properties",
+							chr->properties);
+		g_key_file_set_integer(key_file, handle, "ValueHandle",
+							chr->value_handle);
+	}
+
+	for (l = device->descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
+		char handle[6];
+
+		sprintf(handle, "%hu", desc->handle);
+
+		g_key_file_set_string(key_file, handle, "UUID", desc->uuid);
+	}
+
 	data = g_key_file_to_data(key_file, &length, NULL);
 	if (length > 0) {
 		create_file(filename, S_IRUSR | S_IWUSR);
@@ -3085,6 +3262,7 @@ static void store_services(struct btd_device *device)
 	}
 
 	g_free(prim_uuid);
+	g_free(char_uuid);
 	g_free(data);
 	g_key_file_free(key_file);
 }
@@ -3178,6 +3356,15 @@ static void register_all_services(struct browse_req *req, GSList *services)
 	browse_request_free(req);
 }
 
+static void gatt_cache_clear(struct btd_device *device)
+{
+	g_slist_free_full(device->chars, g_free);
+	device->chars = NULL;
+
+	g_slist_free_full(device->descs, g_free);
+	device->descs = NULL;
+}
+
 static int service_by_range_cmp(gconstpointer a, gconstpointer b)
 {
 	const struct gatt_primary *prim = a;
@@ -3186,6 +3373,109 @@ static int service_by_range_cmp(gconstpointer a, gconstpointer b)
 	return memcmp(&prim->range, range, sizeof(*range));
 }
 
+static void included_search_complete(struct included_search *search)
+{
+	register_all_services(search->req, search->services);
+	g_slist_free(search->services);
+	g_free(search);
+}
+
+static void discover_desc_cb(GSList *descs, uint8_t status,
+							gpointer user_data)
+{
+	struct included_search *search = user_data;
+	struct btd_device *device = search->req->device;
+	GSList *l, *c = device->chars;
+
+	if (device->attrib == NULL) {
+		error("Disconnected while doing descriptor discovery");
+		g_slist_free(search->services);
+		g_free(search);
+		return;
+	}
+
+	/* Attribute Not Found only means the database has no descriptors */
+	if (status != 0 && status != ATT_ECODE_ATTR_NOT_FOUND) {
+		error("Discover descriptors failed: %s (%d)",
+					att_ecode2str(status), status);
+		/* A partial cache would hide descriptors from profiles */
+		gatt_cache_clear(device);
+		goto done;
+	}
+
+	/*
+	 * Find Information over the whole database also returns service
+	 * and characteristic declarations and characteristic values, keep
+	 * only the descriptors. Both lists are sorted by handle.
+	 */
+	for (l = descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
+
+		if (desc->uuid16 >= GATT_PRIM_SVC_UUID &&
+					desc->uuid16 <= GATT_CHARAC_UUID)
+			continue;
+
+		while (c && ((struct gatt_char *) c->data)->value_handle <
+								desc->handle)
+			c = c->next;
+
+		if (c && ((struct gatt_char *) c->data)->value_handle ==
+								desc->handle)
+			continue;
+
+		device->descs = g_slist_append(device->descs,
+					g_memdup(desc, sizeof(*desc)));
+	}
+
+done:
+	included_search_complete(search);
+}
+
+static void discover_char_cb(GSList *chars, uint8_t status,
+							gpointer user_data)
+{
+	struct included_search *search = user_data;
+	struct btd_device *device = search->req->device;
+	GSList *l;
+
+	if (device->attrib == NULL) {
+		error("Disconnected while doing characteristic discovery");
+		g_slist_free(search->services);
+		g_free(search);
+		return;
+	}
+
+	if (status != 0) {
+		error("Discover characteristics failed: %s (%d)",
+					att_ecode2str(status), status);
+		included_search_complete(search);
+		return;
+	}
+
+	for (l = chars; l; l = l->next)
+		device->chars = g_slist_append(device->chars,
+				g_memdup(l->data, sizeof(struct gatt_char)));
+
+	if (gatt_discover_desc(device->attrib, 0x0001, 0xffff, NULL,
+					discover_desc_cb, search) == 0)
+		included_search_complete(search);
+}
+
+/*
+ * Populate the characteristic and descriptor cache with one sweep over the
+ * whole database, rather than per service ranges from each profile.
+ */
+static void discover_attributes(struct included_search *search)
+{
+	struct btd_device *device = search->req->device;
+
+	gatt_cache_clear(device);
+
+	if (gatt_discover_char(device->attrib, 0x0001, 0xffff, NULL,
+					discover_char_cb, search) == 0)
+		included_search_complete(search);
+}
+
 static void find_included_cb(GSList *includes, uint8_t status,
 						gpointer user_data)
 {
@@ -3227,9 +3517,7 @@ static void find_included_cb(GSList *includes, uint8_t status,
 done:
 	search->current = search->current->next;
 	if (search->current == NULL) {
-		register_all_services(search->req, search->services);
-		g_slist_free(search->services);
-		g_free(search);
+		discover_attributes(search);
 		return;
 	}
 
@@ -3279,6 +3567,61 @@ static void primary_cb(GSList *services, guint8 status, gpointer user_data)
 	find_included_services(req, services);
 }
 
+static void exchange_mtu_cb(guint8 status, const guint8 *pdu, guint16 plen,
+							gpointer user_data)
+{
+	struct btd_device *device = user_data;
+	uint16_t rmtu;
+	size_t mtu;
+	char addr[18];
+
+	ba2str(&device->bdaddr, addr);
+
+	if (status) {
+		DBG("%s MTU exchange: %s", addr, att_ecode2str(status));
+		return;
+	}
+
+	if (!dec_mtu_resp(pdu, plen, &rmtu)) {
+		error("%s MTU exchange: protocol error", addr);
+		return;
+	}
+
+	g_attrib_get_buffer(device->attrib, &mtu);
+	mtu = MIN(rmtu, mtu);
+
+	if (g_attrib_set_mtu(device->attrib, mtu))
+		DBG("%s ATT MTU %zu", addr, mtu);
+	else
+		DBG("%s MTU exchange failed", addr);
+}
+
+/*
+ * Negotiate the ATT MTU once per LE connection, before any profile gets the
+ * GAttrib. The request is queued first so every discovery or profile request
+ * that follows is answered using the new MTU.
+ */
+static void attrib_exchange_mtu(struct btd_device *device, GIOChannel *io)
+{
+	GError *gerr = NULL;
+	uint16_t cid, imtu;
+
+	if (!bt_io_get(io, &gerr, BT_IO_OPT_IMTU, &imtu,
+				BT_IO_OPT_CID, &cid, BT_IO_OPT_INVALID)) {
+		error("%s", gerr->message);
+		g_error_free(gerr);
+		return;
+	}
+
+	if (cid != ATT_CID || imtu <= ATT_DEFAULT_LE_MTU)
+		return;
+
+	/* The MTU grows only once the server agrees to it */
+	if (gatt_exchange_mtu(device->attrib, imtu, exchange_mtu_cb,
+								device) > 0)
+		DBG("MTU Exchange: Requesting %d", imtu);
+}
+
 static void att_connect_cb(GIOChannel *io, GError *gerr, gpointer user_data)
 {
 	struct att_callbacks *attcb = user_data;
@@ -3310,6 +3653,8 @@ static void att_connect_cb(GIOChannel *io, GError *gerr, gpointer user_data)
 	device->cleanup_id = g_io_add_watch(io, G_IO_HUP,
 					attrib_disconnected_cb, device);
 
+	attrib_exchange_mtu(device, io);
+
 	if (attcb->success)
 		attcb->success(user_data);
 
@@ -3690,6 +4035,54 @@ void device_set_rssi(struct btd_device *device, int8_t rssi)
 						DEVICE_INTERFACE, "RSSI");
 }
 
+/* FNV-1a, only used to recognize repeated EIR/AD payloads */
+static uint64_t eir_hash(const uint8_t *eir, uint8_t eir_len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint8_t i;
+
+	hash = (hash ^ eir_len) * 0x100000001b3ULL;
+
+	for (i = 0; i < eir_len; i++)
+		hash = (hash ^ eir[i]) * 0x100000001b3ULL;
+
+	return hash;
+}
+
+bool device_eir_known(struct btd_device *device, const uint8_t *eir,
+							uint8_t eir_len)
+{
+	uint64_t hash;
+
+	if (!device || !eir)
+		return false;
+
+	hash = eir_hash(eir, eir_len);
+
+	return device->eir_hash[0] == hash || device->eir_hash[1] == hash;
+}
+
+void device_set_eir_known(struct btd_device *device, const uint8_t *eir,
+							uint8_t eir_len)
+{
+	uint64_t hash;
+
+	if (!device || !eir)
+		return;
+
+	hash = eir_hash(eir, eir_len);
+
+	if (device->eir_hash[0] == hash || device->eir_hash[1] == hash)
+		return;
+
+	/*
+	 * Keep two payloads since LE devices alternate between advertising
+	 * data and scan response data.
+	 */
+	device->eir_hash[1] = device->eir_hash[0];
+	device->eir_hash[0] = hash;
+}
+
 static void device_set_auto_connect(struct btd_device *device, gboolean enable)
 {
 	char addr[18];
@@ -4284,9 +4677,125 @@ void btd_device_gatt_set_service_changed(struct btd_device *device,
 			prim->changed = TRUE;
 	}
 
+	/* Handles may have moved, the whole cache is rebuilt when browsing */
+	gatt_cache_clear(device);
+	store_services(device);
+
 	device_browse_primary(device, NULL, FALSE);
 }
 
+static gboolean cache_req_deliver(gpointer user_data)
+{
+	struct cache_req *req = user_data;
+	struct btd_device *device = req->device;
+
+	device->cache_reqs = g_slist_remove(device->cache_reqs, req);
+
+	req->func(req->list, req->list ? 0 : ATT_ECODE_ATTR_NOT_FOUND,
+							req->user_data);
+
+	cache_req_free(req);
+
+	return FALSE;
+}
+
+static guint cache_req_new(struct btd_device *device, GSList *list,
+					gatt_cb_t func, gpointer user_data)
+{
+	struct cache_req *req;
+
+	req = g_new0(struct cache_req, 1);
+	req->device = device;
+	req->list = list;
+	req->func = func;
+	req->user_data = user_data;
+
+	/* Keep the asynchronous semantics of the ATT based discovery */
+	req->id = g_idle_add(cache_req_deliver, req);
+
+	device->cache_reqs = g_slist_prepend(device->cache_reqs, req);
+
+	return req->id;
+}
+
+static bool cache_uuid_match(bt_uuid_t *uuid, const char *str)
+{
+	bt_uuid_t cached;
+
+	if (uuid == NULL)
+		return true;
+
+	if (bt_string_to_uuid(&cached, str) < 0)
+		return false;
+
+	return bt_uuid_cmp(uuid, &cached) == 0;
+}
+
+guint btd_device_discover_char(struct btd_device *device, uint16_t start,
+					uint16_t end, bt_uuid_t *uuid,
+					gatt_cb_t func, gpointer user_data)
+{
+	GSList *l, *list = NULL;
+
+	if (device->chars == NULL) {
+		if (device->attrib == NULL)
+			return 0;
+
+		return gatt_discover_char(device->attrib, start, end, uuid,
+							func, user_data);
+	}
+
+	for (l = device->chars; l; l = l->next) {
+		struct gatt_char *chr = l->data;
+
+		if (chr->handle < start)
+			continue;
+
+		if (chr->handle > end)
+			break;
+
+		if (!cache_uuid_match(uuid, chr->uuid))
+			continue;
+
+		list = g_slist_prepend(list, g_memdup(chr, sizeof(*chr)));
+	}
+
+	return cache_req_new(device, g_slist_reverse(list), func, user_data);
+}
+
+guint btd_device_discover_desc(struct btd_device *device, uint16_t start,
+					uint16_t end, bt_uuid_t *uuid,
+					gatt_cb_t func, gpointer user_data)
+{
+	GSList *l, *list = NULL;
+
+	/* Descriptors are only trusted if the characteristics are cached */
+	if (device->chars == NULL) {
+		if (device->attrib == NULL)
+			return 0;
+
+		return gatt_discover_desc(device->attrib, start, end, uuid,
+							func, user_data);
+	}
+
+	for (l = device->descs; l; l = l->next) {
+		struct gatt_desc *desc = l->data;
+
+		if (desc->handle < start)
+			continue;
+
+		if (desc->handle > end)
+			break;
+
+		if (!cache_uuid_match(uuid, desc->uuid))
+			continue;
+
+		list = g_slist_prepend(list, g_memdup(desc, sizeof(*desc)));
+	}
+
+	return cache_req_new(device, g_slist_reverse(list), func, user_data);
+}
+
 void btd_device_add_uuid(struct btd_device *device, const char *uuid)
 {
 	GSList *uuid_list;
@@ -74,6 +74,10 @@ void device_set_trusted(struct btd_device *device, gboolean trusted);
 void device_set_bonded(struct btd_device *device, gboolean bonded);
 void device_set_legacy(struct btd_device *device, bool legacy);
 void device_set_rssi(struct btd_device *device, int8_t rssi);
+bool device_eir_known(struct btd_device *device, const uint8_t *eir,
+							uint8_t eir_len);
+void device_set_eir_known(struct btd_device *device, const uint8_t *eir,
+							uint8_t eir_len);
 gboolean device_is_connected(struct btd_device *device);
 bool device_is_retrying(struct btd_device *device);
 void device_bonding_complete(struct btd_device *device, uint8_t status);
@@ -53,7 +53,41 @@ void eir_data_free(struct eir_data *eir)
 	eir->randomizer = NULL;
 }
 
-static void eir_parse_uuid16(struct eir_data *eir, const void *data,
+struct eir_field {
+	uint8_t type;
+	const uint8_t *data;
+	uint8_t len;
+};
+
+static gboolean eir_next_field(const uint8_t **eir, const uint8_t *end,
+						struct eir_field *field)
+{
+	const uint8_t *ptr = *eir;
+	uint8_t field_len;
+
+	if (ptr == NULL || end - ptr < 2)
+		return FALSE;
+
+	field_len = ptr[0];
+
+	/* Check for the end of EIR */
+	if (field_len == 0)
+		return FALSE;
+
+	/* Do not continue EIR Data parsing if got incorrect length */
+	if (field_len + 1 > end - ptr)
+		return FALSE;
+
+	field->type = ptr[1];
+	field->data = &ptr[2];
+	field->len = field_len - 1;
+
+	*eir = ptr + field_len + 1;
+
+	return TRUE;
+}
+
+static void eir_parse_uuid16(GSList **services, const void *data,
 								uint8_t len)
 {
 	const uint16_t *uuid16 = data;
@@ -66,11 +100,11 @@ static void eir_parse_uuid16(struct eir_data *eir, const void *data,
 		service.value.uuid16 = bt_get_le16(uuid16);
 
 		uuid_str = bt_uuid2string(&service);
-		eir->services = g_slist_append(eir->services, uuid_str);
+		*services = g_slist_append(*services, uuid_str);
 	}
 }
 
-static void eir_parse_uuid32(struct eir_data *eir, const void *data,
+static void eir_parse_uuid32(GSList **services, const void *data,
 								uint8_t len)
 {
 	const uint32_t *uuid32 = data;
@@ -83,11 +117,11 @@ static void eir_parse_uuid32(struct eir_data *eir, const void *data,
 		service.value.uuid32 = bt_get_le32(uuid32);
 
 		uuid_str = bt_uuid2string(&service);
-		eir->services = g_slist_append(eir->services, uuid_str);
+		*services = g_slist_append(*services, uuid_str);
 	}
 }
 
-static void eir_parse_uuid128(struct eir_data *eir, const uint8_t *data,
+static void eir_parse_uuid128(GSList **services, const uint8_t *data,
 								uint8_t len)
 {
 	const uint8_t *uuid_ptr = data;
@@ -101,7 +135,7 @@ static void eir_parse_uuid128(struct eir_data *eir, const uint8_t *data,
 		for (k = 0; k < 16; k++)
 			service.value.uuid128.data[k] = uuid_ptr[16 - k - 1];
 		uuid_str = bt_uuid2string(&service);
-		eir->services = g_slist_append(eir->services, uuid_str);
+		*services = g_slist_append(*services, uuid_str);
 		uuid_ptr += 16;
 	}
 }
@@ -129,54 +163,26 @@ static char *name2utf8(const uint8_t *name, uint8_t len)
 	return g_strdup(utf8_name);
 }
 
-int eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+void eir_parse_view(struct eir_view *view, const uint8_t *eir_data,
+							uint8_t eir_len)
 {
-	uint16_t len = 0;
-
-	eir->flags = -1;
-	eir->tx_power = 127;
+	const uint8_t *ptr = eir_data;
+	struct eir_field field;
 
-	/* No EIR data to parse */
-	if (eir_data == NULL)
-		return 0;
+	memset(view, 0, sizeof(*view));
+	view->flags = -1;
+	view->tx_power = 127;
+	view->eir = eir_data;
+	view->eir_len = eir_data ? eir_len : 0;
 
-	while (len < eir_len - 1) {
-		uint8_t field_len = eir_data[0];
-		const uint8_t *data;
-		uint8_t data_len;
-
-		/* Check for the end of EIR */
-		if (field_len == 0)
-			break;
-
-		len += field_len + 1;
-
-		/* Do not continue EIR Data parsing if got incorrect length */
-		if (len > eir_len)
-			break;
-
-		data = &eir_data[2];
-		data_len = field_len - 1;
-
-		switch (eir_data[1]) {
-		case EIR_UUID16_SOME:
-		case EIR_UUID16_ALL:
-			eir_parse_uuid16(eir, data, data_len);
-			break;
-
-		case EIR_UUID32_SOME:
-		case EIR_UUID32_ALL:
-			eir_parse_uuid32(eir, data, data_len);
-			break;
-
-		case EIR_UUID128_SOME:
-		case EIR_UUID128_ALL:
-			eir_parse_uuid128(eir, data, data_len);
-			break;
+	while (eir_next_field(&ptr, eir_data + view->eir_len, &field)) {
+		const uint8_t *data = field.data;
+		uint8_t data_len = field.len;
 
+		switch (field.type) {
 		case EIR_FLAGS:
 			if (data_len > 0)
-				eir->flags = *data;
+				view->flags = *data;
 			break;
 
 		case EIR_NAME_SHORT:
@@ -186,45 +192,117 @@ int eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
 			while (data_len > 0 && data[data_len - 1] == '\0')
 				data_len--;
 
-			g_free(eir->name);
-
-			eir->name = name2utf8(data, data_len);
-			eir->name_complete = eir_data[1] == EIR_NAME_COMPLETE;
+			view->name = data;
+			view->name_len = data_len;
+			view->name_complete = field.type == EIR_NAME_COMPLETE;
 			break;
 
 		case EIR_TX_POWER:
 			if (data_len < 1)
 				break;
-			eir->tx_power = (int8_t) data[0];
+			view->tx_power = (int8_t) data[0];
 			break;
 
 		case EIR_CLASS_OF_DEV:
 			if (data_len < 3)
 				break;
-			eir->class = data[0] | (data[1] << 8) |
+			view->class = data[0] | (data[1] << 8) |
 							(data[2] << 16);
 			break;
 
 		case EIR_GAP_APPEARANCE:
 			if (data_len < 2)
 				break;
-			eir->appearance = bt_get_le16(data);
+			view->appearance = bt_get_le16(data);
 			break;
 
 		case EIR_SSP_HASH:
 			if (data_len < 16)
 				break;
-			eir->hash = g_memdup(data, 16);
+			view->hash = data;
 			break;
 
 		case EIR_SSP_RANDOMIZER:
 			if (data_len < 16)
 				break;
-			eir->randomizer = g_memdup(data, 16);
+			view->randomizer = data;
+			break;
+		}
+	}
+}
+
+char *eir_view_name(const struct eir_view *view)
+{
+	if (view->name == NULL)
+		return NULL;
+
+	return name2utf8(view->name, view->name_len);
+}
+
+GSList *eir_view_services(const struct eir_view *view)
+{
+	const uint8_t *ptr = view->eir;
+	struct eir_field field;
+	GSList *services = NULL;
+
+	while (eir_next_field(&ptr, view->eir + view->eir_len, &field)) {
+		switch (field.type) {
+		case EIR_UUID16_SOME:
+		case EIR_UUID16_ALL:
+			eir_parse_uuid16(&services, field.data, field.len);
+			break;
+
+		case EIR_UUID32_SOME:
+		case EIR_UUID32_ALL:
+			eir_parse_uuid32(&services, field.data, field.len);
+			break;
+
+		case EIR_UUID128_SOME:
+		case EIR_UUID128_ALL:
+			eir_parse_uuid128(&services, field.data, field.len);
 			break;
 		}
+	}
+
+	return services;
+}
+
+int eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len)
+{
+	struct eir_view view;
+
+	eir_parse_view(&view, eir_data, eir_len);
+
+	eir->flags = view.flags;
+	eir->tx_power = view.tx_power;
+
+	/* No EIR data to parse */
+	if (eir_data == NULL)
+		return 0;
+
+	eir->services = g_slist_concat(eir->services,
+						eir_view_services(&view));
+
+	if (view.name != NULL) {
+		g_free(eir->name);
+		eir->name = eir_view_name(&view);
+		eir->name_complete = view.name_complete;
+	}
+
+	if (view.class != 0)
+		eir->class = view.class;
+
+	if (view.appearance != 0)
+		eir->appearance = view.appearance;
+
+	if (view.hash != NULL) {
+		g_free(eir->hash);
+		eir->hash = g_memdup(view.hash, 16);
+	}
 
-		eir_data += field_len + 1;
+	if (view.randomizer != NULL) {
+		g_free(eir->randomizer);
+		eir->randomizer = g_memdup(view.randomizer, 16);
 	}
 
 	return 0;
@@ -51,8 +51,30 @@ struct eir_data {
 	bdaddr_t addr;
 };
 
+/*
+ * Parsed EIR or advertising data without any allocations, the pointers
+ * refer to the buffer that was parsed.
+ */
+struct eir_view {
+	int flags;
+	const uint8_t *name;
+	uint8_t name_len;
+	gboolean name_complete;
+	uint32_t class;
+	uint16_t appearance;
+	int8_t tx_power;
+	const uint8_t *hash;
+	const uint8_t *randomizer;
+	const uint8_t *eir;
+	uint8_t eir_len;
+};
+
 void eir_data_free(struct eir_data *eir);
 int eir_parse(struct eir_data *eir, const uint8_t *eir_data, uint8_t eir_len);
+void eir_parse_view(struct eir_view *view, const uint8_t *eir_data,
+							uint8_t eir_len);
+char *eir_view_name(const struct eir_view *view);
+GSList *eir_view_services(const struct eir_view *view);
 int eir_parse_oob(struct eir_data *eir, uint8_t *eir_data, uint16_t eir_len);
 int eir_create_oob(const bdaddr_t *addr, const char *name, uint32_t cod,
 			const uint8_t *hash, const uint8_t *randomizer,
@@ -0,0 +1,141 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "log.h"
+#include "adapter.h"
+#include "device.h"
+#include "measurement-stream.h"
+
+struct measurement_stream {
+	int fd;
+	guint watch;
+	unsigned int dropped;
+	measurement_stream_destroy_t destroy;
+	gpointer user_data;
+};
+
+static gboolean stream_closed(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct measurement_stream *stream = user_data;
+
+	DBG("stream %p closed, %u records dropped", stream, stream->dropped);
+
+	stream->watch = 0;
+
+	if (stream->destroy)
+		stream->destroy(stream, stream->user_data);
+
+	measurement_stream_free(stream);
+
+	return FALSE;
+}
+
+struct measurement_stream *measurement_stream_new(
+				measurement_stream_destroy_t destroy,
+				gpointer user_data, int *fd)
+{
+	struct measurement_stream *stream;
+	GIOChannel *io;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK,
+								0, sv) < 0)
+		return NULL;
+
+	/* The daemon only writes, so the remote end does not need to */
+	shutdown(sv[1], SHUT_WR);
+
+	stream = g_new0(struct measurement_stream, 1);
+	stream->fd = sv[0];
+	stream->destroy = destroy;
+	stream->user_data = user_data;
+
+	io = g_io_channel_unix_new(stream->fd);
+	stream->watch = g_io_add_watch(io, G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+							stream_closed, stream);
+	g_io_channel_unref(io);
+
+	*fd = sv[1];
+
+	DBG("stream %p", stream);
+
+	return stream;
+}
+
+void measurement_stream_free(struct measurement_stream *stream)
+{
+	if (stream->watch > 0)
+		g_source_remove(stream->watch);
+
+	close(stream->fd);
+	g_free(stream);
+}
+
+void measurement_stream_send(struct measurement_stream *stream,
+				struct btd_device *device, uint16_t uuid,
+				const uint8_t *value, size_t len)
+{
+	uint8_t buf[sizeof(struct measurement_record) + UINT8_MAX];
+	struct measurement_record *rec = (void *) buf;
+
+	if (len > UINT8_MAX)
+		return;
+
+	bt_put_le16(uuid, &rec->uuid);
+	bacpy(&rec->bdaddr, device_get_address(device));
+	rec->len = len;
+	bt_put_le64(g_get_monotonic_time(), &rec->timestamp);
+	memcpy(rec->value, value, len);
+
+	/*
+	 * Never block the daemon on a slow reader, records that do not
+	 * fit into the socket buffer are dropped.
+	 */
+	if (send(stream->fd, buf, sizeof(*rec) + len,
+					MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			stream->dropped++;
+	}
+}
+
+void measurement_stream_send_all(GSList *streams, struct btd_device *device,
+				uint16_t uuid, const uint8_t *value,
+				size_t len)
+{
+	GSList *l;
+
+	for (l = streams; l; l = l->next)
+		measurement_stream_send(l->data, device, uuid, value, len);
+}
@@ -0,0 +1,47 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Little endian record header, followed by the raw characteristic value */
+struct measurement_record {
+	uint16_t uuid;		/* 16-bit characteristic UUID */
+	bdaddr_t bdaddr;	/* remote device address */
+	uint8_t len;		/* length of the value */
+	uint64_t timestamp;	/* CLOCK_MONOTONIC in usec */
+	uint8_t value[0];
+} __attribute__ ((packed));
+
+struct measurement_stream;
+
+typedef void (*measurement_stream_destroy_t) (
+					struct measurement_stream *stream,
+					gpointer user_data);
+
+struct measurement_stream *measurement_stream_new(
+				measurement_stream_destroy_t destroy,
+				gpointer user_data, int *fd);
+void measurement_stream_free(struct measurement_stream *stream);
+
+void measurement_stream_send(struct measurement_stream *stream,
+				struct btd_device *device, uint16_t uuid,
+				const uint8_t *value, size_t len);
+void measurement_stream_send_all(GSList *streams, struct btd_device *device,
+				uint16_t uuid, const uint8_t *value,
+				size_t len);
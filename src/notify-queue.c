@@ -0,0 +1,235 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "lib/uuid.h"
+#include "attrib/att.h"
+#include "notify-queue.h"
+
+/*
+ * The queue is reference counted since the transport may release the
+ * in-flight PDUs after the channel itself is gone, in which case send is
+ * set to NULL.
+ */
+struct notify_queue {
+	int ref_count;
+	notify_send_func_t send;
+	void *user_data;
+	GQueue *pending;
+	unsigned int in_flight;
+	unsigned int delivered;
+	unsigned int dropped;
+};
+
+struct notify_pdu {
+	uint16_t handle;
+	uint8_t *pdu;
+	size_t len;
+};
+
+struct notify_sent {
+	struct notify_queue *queue;
+	uint8_t opcode;
+	gboolean confirmed;
+};
+
+static void notify_pdu_free(void *data)
+{
+	struct notify_pdu *np = data;
+
+	g_free(np->pdu);
+	g_free(np);
+}
+
+static struct notify_queue *notify_queue_ref(struct notify_queue *queue)
+{
+	queue->ref_count++;
+
+	return queue;
+}
+
+static void notify_queue_unref(struct notify_queue *queue)
+{
+	if (--queue->ref_count > 0)
+		return;
+
+	g_queue_free_full(queue->pending, notify_pdu_free);
+	g_free(queue);
+}
+
+struct notify_queue *notify_queue_new(notify_send_func_t send,
+							void *user_data)
+{
+	struct notify_queue *queue;
+
+	queue = g_new0(struct notify_queue, 1);
+	queue->send = send;
+	queue->user_data = user_data;
+	queue->pending = g_queue_new();
+
+	return notify_queue_ref(queue);
+}
+
+/* PDUs that are still queued or in flight are accounted as dropped */
+void notify_queue_destroy(struct notify_queue *queue)
+{
+	struct notify_pdu *np;
+
+	queue->dropped += queue->in_flight +
+					g_queue_get_length(queue->pending);
+
+	while ((np = g_queue_pop_head(queue->pending)))
+		notify_pdu_free(np);
+
+	queue->send = NULL;
+	queue->user_data = NULL;
+
+	notify_queue_unref(queue);
+}
+
+static void notify_queue_send(struct notify_queue *queue, const uint8_t *pdu,
+								size_t len)
+{
+	struct notify_sent *sent;
+
+	sent = g_new0(struct notify_sent, 1);
+	sent->queue = notify_queue_ref(queue);
+	sent->opcode = pdu[0];
+
+	queue->in_flight++;
+
+	if (queue->send(pdu, len, sent, queue->user_data))
+		return;
+
+	queue->in_flight--;
+	queue->dropped++;
+	notify_queue_unref(queue);
+	g_free(sent);
+}
+
+static void notify_queue_process(struct notify_queue *queue)
+{
+	struct notify_pdu *np;
+
+	while (queue->in_flight < NOTIFY_MAX_IN_FLIGHT) {
+		np = g_queue_pop_head(queue->pending);
+		if (np == NULL)
+			break;
+
+		notify_queue_send(queue, np->pdu, np->len);
+		notify_pdu_free(np);
+	}
+}
+
+static int notify_pdu_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct notify_pdu *np = a;
+	uint16_t handle = GPOINTER_TO_UINT(b);
+
+	return np->handle - handle;
+}
+
+void notify_queue_push(struct notify_queue *queue, uint16_t handle,
+					const uint8_t *pdu, size_t len)
+{
+	struct notify_pdu *np;
+	GList *l;
+
+	if (queue->in_flight < NOTIFY_MAX_IN_FLIGHT &&
+				g_queue_is_empty(queue->pending)) {
+		notify_queue_send(queue, pdu, len);
+		return;
+	}
+
+	/*
+	 * The link is not keeping up: only the most recent value of each
+	 * attribute is kept, and the oldest pending value is dropped once
+	 * the queue is full.
+	 */
+	l = g_queue_find_custom(queue->pending, GUINT_TO_POINTER(handle),
+								notify_pdu_cmp);
+	if (l != NULL) {
+		np = l->data;
+		g_queue_delete_link(queue->pending, l);
+		notify_pdu_free(np);
+		queue->dropped++;
+	} else if (g_queue_get_length(queue->pending) >= NOTIFY_MAX_PENDING) {
+		notify_pdu_free(g_queue_pop_head(queue->pending));
+		queue->dropped++;
+	}
+
+	np = g_new0(struct notify_pdu, 1);
+	np->handle = handle;
+	np->pdu = g_memdup(pdu, len);
+	np->len = len;
+
+	g_queue_push_tail(queue->pending, np);
+}
+
+unsigned int notify_queue_get_pending(struct notify_queue *queue)
+{
+	return g_queue_get_length(queue->pending);
+}
+
+unsigned int notify_queue_get_in_flight(struct notify_queue *queue)
+{
+	return queue->in_flight;
+}
+
+void notify_queue_get_stats(struct notify_queue *queue,
+				unsigned int *delivered, unsigned int *dropped)
+{
+	*delivered = queue->delivered;
+	*dropped = queue->dropped;
+}
+
+void notify_sent_confirm(struct notify_sent *sent, gboolean confirmed)
+{
+	sent->confirmed = confirmed;
+}
+
+/* Indications only count as delivered once the client confirmed them */
+void notify_sent_done(struct notify_sent *sent)
+{
+	struct notify_queue *queue = sent->queue;
+
+	queue->in_flight--;
+
+	/* In-flight PDUs were already accounted for by notify_queue_destroy */
+	if (queue->send != NULL) {
+		if (sent->opcode == ATT_OP_HANDLE_IND && !sent->confirmed)
+			queue->dropped++;
+		else
+			queue->delivered++;
+
+		notify_queue_process(queue);
+	}
+
+	notify_queue_unref(queue);
+	g_free(sent);
+}
@@ -0,0 +1,56 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Outgoing notifications and indications of a channel. At most
+ * NOTIFY_MAX_IN_FLIGHT PDUs are handed to the transport at a time, the
+ * rest wait in the queue where only the latest value of each handle is
+ * kept and the oldest one is dropped once NOTIFY_MAX_PENDING are queued.
+ */
+
+/* Maximum number of PDUs handed to the transport per channel */
+#define NOTIFY_MAX_IN_FLIGHT	4
+/* Maximum number of PDUs waiting for an in-flight slot */
+#define NOTIFY_MAX_PENDING	32
+
+struct notify_queue;
+struct notify_sent;
+
+/*
+ * Hands pdu to the transport. On success it must call notify_sent_done()
+ * once for sent when the transport is done with the PDU.
+ */
+typedef gboolean (*notify_send_func_t) (const uint8_t *pdu, size_t len,
+						struct notify_sent *sent,
+						void *user_data);
+
+struct notify_queue *notify_queue_new(notify_send_func_t send,
+							void *user_data);
+void notify_queue_destroy(struct notify_queue *queue);
+void notify_queue_push(struct notify_queue *queue, uint16_t handle,
+					const uint8_t *pdu, size_t len);
+unsigned int notify_queue_get_pending(struct notify_queue *queue);
+unsigned int notify_queue_get_in_flight(struct notify_queue *queue);
+void notify_queue_get_stats(struct notify_queue *queue,
+				unsigned int *delivered, unsigned int *dropped);
+
+void notify_sent_confirm(struct notify_sent *sent, gboolean confirmed);
+void notify_sent_done(struct notify_sent *sent);
@@ -26,6 +26,11 @@
 #endif
 
 #include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <sys/stat.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/sdp.h>
@@ -34,11 +39,16 @@
 #include <glib.h>
 
 #include <btio/btio.h>
+#include "log.h"
+#include "storage.h"
 #include "sdp-client.h"
 
 /* Number of seconds to keep a sdp_session_t in the cache */
 #define CACHE_TIMEOUT 2
 
+/* Number of seconds to trust cached records without revalidating them */
+#define RECORDS_TIMEOUT 2
+
 struct cached_sdp_session {
 	bdaddr_t src;
 	bdaddr_t dst;
@@ -115,6 +125,303 @@ static void cache_sdp_session(bdaddr_t *src, bdaddr_t *dst,
 						cached);
 }
 
+/*
+ * Remote records are cached per device after a search that returns the
+ * whole database (L2CAP or public browse group). The cache is only kept
+ * if the remote SDP server record provides a ServiceDatabaseState, so
+ * later searches can be answered from it after a single attribute
+ * request confirmed the state did not change.
+ */
+struct cached_records {
+	bdaddr_t src;
+	bdaddr_t dst;
+	sdp_list_t *recs;
+	uint32_t state;
+	gint64 validated;
+};
+
+static GSList *cached_records = NULL;
+
+static void cached_records_free(struct cached_records *cached)
+{
+	sdp_list_free(cached->recs, (sdp_free_func_t) sdp_record_free);
+	g_free(cached);
+}
+
+static bool get_database_state(sdp_list_t *recs, uint32_t *state)
+{
+	for (; recs; recs = recs->next) {
+		sdp_record_t *rec = recs->data;
+		sdp_data_t *d;
+
+		if (rec->handle != 0x00000000)
+			continue;
+
+		d = sdp_data_get(rec, SDP_ATTR_SVCDB_STATE);
+		if (!d || d->dtd != SDP_UINT32)
+			return false;
+
+		*state = d->val.uint32;
+		return true;
+	}
+
+	return false;
+}
+
+static char *record_to_string(sdp_record_t *rec)
+{
+	sdp_buf_t buf;
+	char *str;
+	uint32_t i;
+
+	if (sdp_gen_record_pdu(rec, &buf) < 0)
+		return NULL;
+
+	str = g_malloc0(buf.data_size * 2 + 1);
+
+	for (i = 0; i < buf.data_size; i++)
+		sprintf(str + (i * 2), "%02X", buf.data[i]);
+
+	free(buf.data);
+
+	return str;
+}
+
+static void store_cached_records(struct cached_records *cached)
+{
+	char srcaddr[18], dstaddr[18];
+	char filename[PATH_MAX + 1];
+	char handle[11], *str;
+	struct stat st;
+	GKeyFile *key_file;
+	sdp_list_t *l;
+	char *data;
+	gsize length = 0;
+
+	ba2str(&cached->src, srcaddr);
+	ba2str(&cached->dst, dstaddr);
+
+	/* Only persist records of devices which are stored themselves */
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/%s", srcaddr, dstaddr);
+	filename[PATH_MAX] = '\0';
+
+	if (stat(filename, &st) < 0 || !S_ISDIR(st.st_mode))
+		return;
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", srcaddr,
+								dstaddr);
+	filename[PATH_MAX] = '\0';
+
+	key_file = g_key_file_new();
+	g_key_file_load_from_file(key_file, filename, 0, NULL);
+	g_key_file_remove_group(key_file, "ServiceDatabase", NULL);
+
+	sprintf(handle, "0x%8.8X", cached->state);
+	g_key_file_set_string(key_file, "ServiceDatabase", "State", handle);
+
+	for (l = cached->recs; l; l = l->next) {
+		sdp_record_t *rec = l->data;
+
+		str = record_to_string(rec);
+		if (!str)
+			continue;
+
+		sprintf(handle, "0x%8.8X", rec->handle);
+		g_key_file_set_string(key_file, "ServiceDatabase", handle, str);
+		g_free(str);
+	}
+
+	data = g_key_file_to_data(key_file, &length, NULL);
+	if (length > 0) {
+		create_file(filename, S_IRUSR | S_IWUSR);
+		g_file_set_contents(filename, data, length, NULL);
+	}
+
+	g_free(data);
+	g_key_file_free(key_file);
+}
+
+static struct cached_records *load_cached_records(const bdaddr_t *src,
+							const bdaddr_t *dst)
+{
+	struct cached_records *cached = NULL;
+	char srcaddr[18], dstaddr[18];
+	char filename[PATH_MAX + 1];
+	GKeyFile *key_file;
+	char **keys = NULL, **key;
+	char *state, *str;
+	sdp_record_t *rec;
+
+	ba2str(src, srcaddr);
+	ba2str(dst, dstaddr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", srcaddr,
+								dstaddr);
+	filename[PATH_MAX] = '\0';
+
+	key_file = g_key_file_new();
+	g_key_file_load_from_file(key_file, filename, 0, NULL);
+
+	state = g_key_file_get_string(key_file, "ServiceDatabase", "State",
+									NULL);
+	if (!state)
+		goto done;
+
+	cached = g_new0(struct cached_records, 1);
+	bacpy(&cached->src, src);
+	bacpy(&cached->dst, dst);
+	cached->state = strtoul(state, NULL, 16);
+	g_free(state);
+
+	keys = g_key_file_get_keys(key_file, "ServiceDatabase", NULL, NULL);
+
+	for (key = keys; key && *key; key++) {
+		if (g_str_equal(*key, "State"))
+			continue;
+
+		str = g_key_file_get_string(key_file, "ServiceDatabase", *key,
+									NULL);
+		if (!str)
+			continue;
+
+		rec = record_from_string(str);
+		if (rec)
+			cached->recs = sdp_list_append(cached->recs, rec);
+
+		g_free(str);
+	}
+
+	g_strfreev(keys);
+
+	cached_records = g_slist_prepend(cached_records, cached);
+
+done:
+	g_key_file_free(key_file);
+
+	return cached;
+}
+
+static struct cached_records *find_cached_records(const bdaddr_t *src,
+							const bdaddr_t *dst)
+{
+	GSList *l;
+
+	for (l = cached_records; l; l = l->next) {
+		struct cached_records *cached = l->data;
+
+		if (!bacmp(&cached->src, src) && !bacmp(&cached->dst, dst))
+			return cached;
+	}
+
+	return load_cached_records(src, dst);
+}
+
+static void remove_stored_records(const bdaddr_t *src, const bdaddr_t *dst)
+{
+	char srcaddr[18], dstaddr[18];
+	char filename[PATH_MAX + 1];
+	GKeyFile *key_file;
+	char *data;
+	gsize length = 0;
+
+	ba2str(src, srcaddr);
+	ba2str(dst, dstaddr);
+
+	snprintf(filename, PATH_MAX, STORAGEDIR "/%s/cache/%s", srcaddr,
+								dstaddr);
+	filename[PATH_MAX] = '\0';
+
+	key_file = g_key_file_new();
+
+	/* Only rewrite the file if it had records stored */
+	if (!g_key_file_load_from_file(key_file, filename, 0, NULL) ||
+			!g_key_file_remove_group(key_file, "ServiceDatabase",
+									NULL))
+		goto done;
+
+	data = g_key_file_to_data(key_file, &length, NULL);
+	g_file_set_contents(filename, data, length, NULL);
+	g_free(data);
+
+done:
+	g_key_file_free(key_file);
+}
+
+static void remove_cached_records(const bdaddr_t *src, const bdaddr_t *dst)
+{
+	GSList *l;
+
+	remove_stored_records(src, dst);
+
+	for (l = cached_records; l; l = l->next) {
+		struct cached_records *cached = l->data;
+
+		if (bacmp(&cached->src, src) || bacmp(&cached->dst, dst))
+			continue;
+
+		cached_records = g_slist_delete_link(cached_records, l);
+		cached_records_free(cached);
+		return;
+	}
+}
+
+static void update_cached_records(const bdaddr_t *src, const bdaddr_t *dst,
+							sdp_list_t *recs)
+{
+	struct cached_records *cached;
+	uint32_t state;
+
+	remove_cached_records(src, dst);
+
+	if (!get_database_state(recs, &state))
+		return;
+
+	cached = g_new0(struct cached_records, 1);
+	bacpy(&cached->src, src);
+	bacpy(&cached->dst, dst);
+	cached->state = state;
+	cached->validated = g_get_monotonic_time();
+
+	for (; recs; recs = recs->next)
+		cached->recs = sdp_list_append(cached->recs,
+						sdp_copy_record(recs->data));
+
+	cached_records = g_slist_prepend(cached_records, cached);
+
+	store_cached_records(cached);
+}
+
+static sdp_list_t *find_cached_uuid(struct cached_records *cached,
+								uuid_t *uuid)
+{
+	sdp_list_t *l, *recs = NULL;
+	uuid_t *uuid128;
+
+	uuid128 = sdp_uuid_to_uuid128(uuid);
+	if (!uuid128)
+		return NULL;
+
+	for (l = cached->recs; l; l = l->next) {
+		sdp_record_t *rec = l->data;
+
+		if (sdp_list_find(rec->pattern, uuid128, sdp_uuid128_cmp))
+			recs = sdp_list_append(recs, sdp_copy_record(rec));
+	}
+
+	bt_free(uuid128);
+
+	return recs;
+}
+
+static bool is_full_search(uuid_t *uuid)
+{
+	if (uuid->type != SDP_UUID16)
+		return false;
+
+	return uuid->value.uuid16 == L2CAP_UUID ||
+				uuid->value.uuid16 == PUBLIC_BROWSE_GROUP;
+}
+
 struct search_context {
 	bdaddr_t		src;
 	bdaddr_t		dst;
@@ -124,6 +431,7 @@ struct search_context {
 	gpointer		user_data;
 	uuid_t			uuid;
 	guint			io_id;
+	bool			validate;
 };
 
 static GSList *context_list = NULL;
@@ -179,6 +487,9 @@ static void search_completed_cb(uint8_t type, uint16_t status,
 		recs = sdp_list_append(recs, rec);
 	} while (scanned < (ssize_t) size && bytesleft > 0);
 
+	if (recs && is_full_search(&ctxt->uuid))
+		update_cached_records(&ctxt->src, &ctxt->dst, recs);
+
 done:
 	cache_sdp_session(&ctxt->src, &ctxt->dst, ctxt->session);
 
@@ -221,12 +532,138 @@ failed:
 	return FALSE;
 }
 
+static void validate_completed_cb(uint8_t type, uint16_t status,
+			uint8_t *rsp, size_t size, void *user_data);
+
+static int send_request(struct search_context *ctxt)
+{
+	sdp_list_t *search, *attrids;
+	uint32_t range = 0x0000ffff;
+	uint16_t attr = SDP_ATTR_SVCDB_STATE;
+	GIOChannel *chan;
+	int err;
+
+	if (ctxt->validate) {
+		/* Ask the SDP server record for the database state only */
+		if (sdp_set_notify(ctxt->session, validate_completed_cb,
+								ctxt) < 0)
+			return -EIO;
+
+		attrids = sdp_list_append(NULL, &attr);
+		err = sdp_service_attr_async(ctxt->session, 0x00000000,
+					SDP_ATTR_REQ_INDIVIDUAL, attrids);
+		sdp_list_free(attrids, NULL);
+	} else {
+		if (sdp_set_notify(ctxt->session, search_completed_cb,
+								ctxt) < 0)
+			return -EIO;
+
+		search = sdp_list_append(NULL, &ctxt->uuid);
+		attrids = sdp_list_append(NULL, &range);
+		err = sdp_service_search_attr_async(ctxt->session, search,
+						SDP_ATTR_REQ_RANGE, attrids);
+		sdp_list_free(attrids, NULL);
+		sdp_list_free(search, NULL);
+	}
+
+	if (err < 0)
+		return -EIO;
+
+	/* Set callback responsible for update the internal SDP transaction */
+	chan = g_io_channel_unix_new(sdp_get_socket(ctxt->session));
+	ctxt->io_id = g_io_add_watch(chan,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				search_process_cb, ctxt);
+	g_io_channel_unref(chan);
+
+	return 0;
+}
+
+static void validate_completed_cb(uint8_t type, uint16_t status,
+			uint8_t *rsp, size_t size, void *user_data)
+{
+	struct search_context *ctxt = user_data;
+	struct cached_records *cached;
+	sdp_record_t *rec = NULL;
+	sdp_list_t *recs;
+	sdp_data_t *d;
+	bool valid = false;
+	int scanned, err;
+
+	cached = find_cached_records(&ctxt->src, &ctxt->dst);
+
+	if (!status && type == SDP_SVC_ATTR_RSP)
+		rec = sdp_extract_pdu(rsp, size, &scanned);
+
+	if (rec) {
+		d = sdp_data_get(rec, SDP_ATTR_SVCDB_STATE);
+		valid = cached && d && d->dtd == SDP_UINT32 &&
+					d->val.uint32 == cached->state;
+		sdp_record_free(rec);
+	}
+
+	if (valid) {
+		cached->validated = g_get_monotonic_time();
+		recs = find_cached_uuid(cached, &ctxt->uuid);
+
+		cache_sdp_session(&ctxt->src, &ctxt->dst, ctxt->session);
+
+		if (ctxt->cb)
+			ctxt->cb(recs, 0, ctxt->user_data);
+
+		if (recs)
+			sdp_list_free(recs, (sdp_free_func_t) sdp_record_free);
+
+		search_context_cleanup(ctxt);
+		return;
+	}
+
+	DBG("Service database changed, dropping cached records");
+
+	remove_cached_records(&ctxt->src, &ctxt->dst);
+
+	/* Continue with a full search on the same connection */
+	ctxt->validate = false;
+
+	err = send_request(ctxt);
+	if (err < 0) {
+		sdp_close(ctxt->session);
+		ctxt->session = NULL;
+
+		if (ctxt->cb)
+			ctxt->cb(NULL, err, ctxt->user_data);
+
+		search_context_cleanup(ctxt);
+	}
+}
+
+static gboolean cached_search_cb(gpointer user_data)
+{
+	struct search_context *ctxt = user_data;
+	struct cached_records *cached;
+	sdp_list_t *recs = NULL;
+
+	ctxt->io_id = 0;
+
+	cached = find_cached_records(&ctxt->src, &ctxt->dst);
+	if (cached)
+		recs = find_cached_uuid(cached, &ctxt->uuid);
+
+	if (ctxt->cb)
+		ctxt->cb(recs, 0, ctxt->user_data);
+
+	if (recs)
+		sdp_list_free(recs, (sdp_free_func_t) sdp_record_free);
+
+	search_context_cleanup(ctxt);
+
+	return FALSE;
+}
+
 static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
 							gpointer user_data)
 {
 	struct search_context *ctxt = user_data;
-	sdp_list_t *search, *attrids;
-	uint32_t range = 0x0000ffff;
 	socklen_t len;
 	int sk, err, sk_err = 0;
 
@@ -242,28 +679,10 @@ static gboolean connect_watch(GIOChannel *chan, GIOCondition cond,
 	if (err != 0)
 		goto failed;
 
-	if (sdp_set_notify(ctxt->session, search_completed_cb, ctxt) < 0) {
-		err = -EIO;
-		goto failed;
-	}
-
-	search = sdp_list_append(NULL, &ctxt->uuid);
-	attrids = sdp_list_append(NULL, &range);
-	if (sdp_service_search_attr_async(ctxt->session,
-				search, SDP_ATTR_REQ_RANGE, attrids) < 0) {
-		sdp_list_free(attrids, NULL);
-		sdp_list_free(search, NULL);
-		err = -EIO;
+	err = send_request(ctxt);
+	if (err < 0)
 		goto failed;
-	}
-
-	sdp_list_free(attrids, NULL);
-	sdp_list_free(search, NULL);
 
-	/* Set callback responsible for update the internal SDP transaction */
-	ctxt->io_id = g_io_add_watch(chan,
-				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				search_process_cb, ctxt);
 	return FALSE;
 
 failed:
@@ -318,14 +737,29 @@ int bt_search_service(const bdaddr_t *src, const bdaddr_t *dst,
 			bt_destroy_t destroy)
 {
 	struct search_context *ctxt = NULL;
+	struct cached_records *cached;
 	int err;
 
 	if (!cb)
 		return -EINVAL;
 
-	err = create_search_context(&ctxt, src, dst, uuid);
-	if (err < 0)
-		return err;
+	cached = find_cached_records(src, dst);
+
+	/* Recently validated records are used without asking the remote */
+	if (cached && g_get_monotonic_time() - cached->validated <
+					RECORDS_TIMEOUT * G_USEC_PER_SEC) {
+		ctxt = g_new0(struct search_context, 1);
+		bacpy(&ctxt->src, src);
+		bacpy(&ctxt->dst, dst);
+		ctxt->uuid = *uuid;
+		ctxt->io_id = g_idle_add(cached_search_cb, ctxt);
+	} else {
+		err = create_search_context(&ctxt, src, dst, uuid);
+		if (err < 0)
+			return err;
+
+		ctxt->validate = cached != NULL;
+	}
 
 	ctxt->cb	= cb;
 	ctxt->destroy	= destroy;
@@ -364,7 +798,8 @@ int bt_cancel_discovery(const bdaddr_t *src, const bdaddr_t *dst)
 
 	ctxt = l->data;
 
-	if (!ctxt->session)
+	/* Searches answered from the cache have no session */
+	if (!ctxt->session && !ctxt->io_id)
 		return -ENOTCONN;
 
 	if (ctxt->io_id)
@@ -386,3 +821,8 @@ void bt_clear_cached_session(const bdaddr_t *src, const bdaddr_t *dst)
 	if (session)
 		sdp_close(session);
 }
+
+void bt_clear_cached_records(const bdaddr_t *src, const bdaddr_t *dst)
+{
+	remove_cached_records(src, dst);
+}
@@ -47,8 +47,13 @@ struct mgmt {
 	guint read_watch;
 	guint write_watch;
 	GQueue *request_queue;
+	GQueue *bulk_queue;
 	GQueue *reply_queue;
-	GList *pending_list;
+	GHashTable *pending_table;
+	unsigned int pending_count;
+	unsigned int pending_bulk;
+	unsigned int max_pending;
+	GHashTable *stats_table;
 	GList *notify_list;
 	GList *notify_destroyed;
 	unsigned int next_request_id;
@@ -67,7 +72,12 @@ struct mgmt_request {
 	uint16_t opcode;
 	uint16_t index;
 	void *buf;
-	uint16_t len;
+	size_t len;
+	bool bulk;
+	gint64 start;
+	struct mgmt *mgmt;
+	unsigned int timeout;
+	guint timeout_id;
 	mgmt_request_func_t callback;
 	mgmt_destroy_func_t destroy;
 	void *user_data;
@@ -87,6 +97,9 @@ static void destroy_request(gpointer data, gpointer user_data)
 {
 	struct mgmt_request *request = data;
 
+	if (request->timeout_id > 0)
+		g_source_remove(request->timeout_id);
+
 	if (request->destroy)
 		request->destroy(request->user_data);
 
@@ -127,6 +140,162 @@ static void write_watch_destroy(gpointer user_data)
 	mgmt->write_watch = 0;
 }
 
+static GQueue *lookup_pending_queue(struct mgmt *mgmt, uint16_t index)
+{
+	return g_hash_table_lookup(mgmt->pending_table,
+						GUINT_TO_POINTER(index));
+}
+
+static void add_pending(struct mgmt *mgmt, struct mgmt_request *request)
+{
+	GQueue *queue;
+
+	queue = lookup_pending_queue(mgmt, request->index);
+	if (!queue) {
+		queue = g_queue_new();
+		g_hash_table_insert(mgmt->pending_table,
+				GUINT_TO_POINTER(request->index), queue);
+	}
+
+	g_queue_push_tail(queue, request);
+
+	mgmt->pending_count++;
+	if (request->bulk)
+		mgmt->pending_bulk++;
+}
+
+static void remove_pending(struct mgmt *mgmt, GQueue *queue, GList *list)
+{
+	struct mgmt_request *request = list->data;
+
+	g_queue_delete_link(queue, list);
+
+	mgmt->pending_count--;
+	if (request->bulk)
+		mgmt->pending_bulk--;
+}
+
+static bool index_busy(struct mgmt *mgmt, uint16_t index)
+{
+	GQueue *queue;
+
+	queue = lookup_pending_queue(mgmt, index);
+	if (!queue)
+		return false;
+
+	return !g_queue_is_empty(queue);
+}
+
+/*
+ * Bulk requests such as loading keys must reach the controller before
+ * anything that was queued for the same index after them.
+ */
+static bool bulk_queued_before(struct mgmt *mgmt,
+					struct mgmt_request *request)
+{
+	GList *list;
+
+	for (list = g_queue_peek_head_link(mgmt->bulk_queue); list;
+						list = g_list_next(list)) {
+		struct mgmt_request *bulk = list->data;
+
+		if (bulk->id > request->id)
+			break;
+
+		if (bulk->index == request->index)
+			return true;
+	}
+
+	return false;
+}
+
+static GList *next_request(struct mgmt *mgmt, GQueue **queue)
+{
+	struct mgmt_request *request;
+	GList *list;
+
+	if (mgmt->pending_count >= mgmt->max_pending)
+		return NULL;
+
+	/*
+	 * The kernel rejects many commands while another one for the
+	 * same controller is still pending, so only different indexes
+	 * get pipelined. Requests for the same index stay in order.
+	 */
+	for (list = g_queue_peek_head_link(mgmt->request_queue); list;
+						list = g_list_next(list)) {
+		request = list->data;
+
+		if (index_busy(mgmt, request->index))
+			continue;
+
+		if (bulk_queued_before(mgmt, request))
+			continue;
+
+		*queue = mgmt->request_queue;
+		return list;
+	}
+
+	/*
+	 * Bulk requests go one at a time and leave at least one slot
+	 * available for interactive requests.
+	 */
+	if (mgmt->pending_bulk > 0)
+		return NULL;
+
+	if (mgmt->max_pending > 1 &&
+				mgmt->pending_count + 1 >= mgmt->max_pending)
+		return NULL;
+
+	for (list = g_queue_peek_head_link(mgmt->bulk_queue); list;
+						list = g_list_next(list)) {
+		request = list->data;
+
+		if (index_busy(mgmt, request->index))
+			continue;
+
+		*queue = mgmt->bulk_queue;
+		return list;
+	}
+
+	return NULL;
+}
+
+static void wakeup_writer(struct mgmt *mgmt);
+
+static gboolean request_timeout(gpointer user_data)
+{
+	struct mgmt_request *request = user_data;
+	struct mgmt *mgmt = request->mgmt;
+	GQueue *queue;
+	GList *list;
+
+	request->timeout_id = 0;
+
+	util_debug(mgmt->debug_callback, mgmt->debug_data,
+				"[0x%04x] command 0x%04x timed out",
+				request->index, request->opcode);
+
+	queue = lookup_pending_queue(mgmt, request->index);
+	list = g_queue_find(queue, request);
+	if (list)
+		remove_pending(mgmt, queue, list);
+
+	mgmt_ref(mgmt);
+
+	if (request->callback)
+		request->callback(MGMT_STATUS_TIMEOUT, 0, NULL,
+							request->user_data);
+
+	destroy_request(request, NULL);
+
+	wakeup_writer(mgmt);
+
+	mgmt_unref(mgmt);
+
+	return FALSE;
+}
+
 static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 							gpointer user_data)
 {
@@ -137,15 +306,18 @@ static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
 		return FALSE;
 
+	/* only reply commands can jump the queue */
 	request = g_queue_pop_head(mgmt->reply_queue);
 	if (!request) {
-		/* only reply commands can jump the queue */
-		if (mgmt->pending_list)
-			return FALSE;
+		GQueue *queue;
+		GList *list;
 
-		request = g_queue_pop_head(mgmt->request_queue);
-		if (!request)
+		list = next_request(mgmt, &queue);
+		if (!list)
 			return FALSE;
+
+		request = list->data;
+		g_queue_delete_link(queue, list);
 	}
 
 	bytes_written = write(mgmt->fd, request->buf, request->len);
@@ -166,40 +338,64 @@ static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 	util_hexdump('<', request->buf, bytes_written,
 				mgmt->debug_callback, mgmt->debug_data);
 
-	mgmt->pending_list = g_list_append(mgmt->pending_list, request);
+	request->start = g_get_monotonic_time();
 
-	return FALSE;
+	/* Time only the controller, not the wait in the queues */
+	if (request->timeout > 0)
+		request->timeout_id = g_timeout_add_seconds(request->timeout,
+						request_timeout, request);
+
+	add_pending(mgmt, request);
+
+	/* Keep writing as long as more requests can be in flight */
+	return TRUE;
 }
 
 static void wakeup_writer(struct mgmt *mgmt)
 {
-	if (mgmt->pending_list) {
-		/* only queued reply commands trigger wakeup */
-		if (g_queue_get_length(mgmt->reply_queue) == 0)
-			return;
-	}
-
 	if (mgmt->write_watch > 0)
 		return;
 
+	if (g_queue_get_length(mgmt->reply_queue) == 0) {
+		GQueue *queue;
+
+		if (!next_request(mgmt, &queue))
+			return;
+	}
+
 	mgmt->write_watch = g_io_add_watch_full(mgmt->io, G_PRIORITY_HIGH,
 				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
 				can_write_data, mgmt, write_watch_destroy);
 }
 
-static GList *lookup_pending(struct mgmt *mgmt, uint16_t opcode, uint16_t index)
+static void update_stats(struct mgmt *mgmt, struct mgmt_request *request)
 {
-	GList *list;
+	struct mgmt_stats *stats;
+	uint64_t latency;
+	unsigned int bucket;
+
+	stats = g_hash_table_lookup(mgmt->stats_table,
+					GUINT_TO_POINTER(request->opcode));
+	if (!stats) {
+		stats = g_new0(struct mgmt_stats, 1);
+		stats->opcode = request->opcode;
+		g_hash_table_insert(mgmt->stats_table,
+				GUINT_TO_POINTER(request->opcode), stats);
+	}
 
-	for (list = g_list_first(mgmt->pending_list); list;
-						list = g_list_next(list)) {
-		struct mgmt_request *request = list->data;
+	latency = g_get_monotonic_time() - request->start;
 
-		if (request->opcode == opcode && request->index == index)
-			return list;
+	for (bucket = 0; bucket < MGMT_STATS_BUCKETS - 1; bucket++) {
+		if (latency < (1ULL << bucket))
+			break;
 	}
 
-	return NULL;
+	stats->count++;
+	stats->total += latency;
+	stats->buckets[bucket]++;
+
+	if (latency > stats->max)
+		stats->max = latency;
 }
 
 static void request_complete(struct mgmt *mgmt, uint8_t status,
@@ -207,15 +403,27 @@ static void request_complete(struct mgmt *mgmt, uint8_t status,
 					uint16_t length, const void *param)
 {
 	struct mgmt_request *request;
+	GQueue *queue;
 	GList *list;
 
-	list = lookup_pending(mgmt, opcode, index);
+	queue = lookup_pending_queue(mgmt, index);
+	if (!queue)
+		return;
+
+	for (list = g_queue_peek_head_link(queue); list;
+						list = g_list_next(list)) {
+		request = list->data;
+
+		if (request->opcode == opcode)
+			break;
+	}
+
 	if (!list)
 		return;
 
-	request = list->data;
+	remove_pending(mgmt, queue, list);
 
-	mgmt->pending_list = g_list_delete_link(mgmt->pending_list, list);
+	update_stats(mgmt, request);
 
 	if (request->callback)
 		request->callback(status, length, param, request->user_data);
@@ -371,8 +579,17 @@ struct mgmt *mgmt_new(int fd)
 	g_io_channel_set_buffered(mgmt->io, FALSE);
 
 	mgmt->request_queue = g_queue_new();
+	mgmt->bulk_queue = g_queue_new();
 	mgmt->reply_queue = g_queue_new();
 
+	mgmt->pending_table = g_hash_table_new_full(g_direct_hash,
+					g_direct_equal, NULL,
+					(GDestroyNotify) g_queue_free);
+	mgmt->max_pending = 1;
+
+	mgmt->stats_table = g_hash_table_new_full(g_direct_hash,
+					g_direct_equal, NULL, g_free);
+
 	mgmt->read_watch = g_io_add_watch_full(mgmt->io, G_PRIORITY_DEFAULT,
 				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
 				received_data, mgmt, read_watch_destroy);
@@ -434,8 +651,12 @@ void mgmt_unref(struct mgmt *mgmt)
 	mgmt_cancel_all(mgmt);
 
 	g_queue_free(mgmt->reply_queue);
+	g_queue_free(mgmt->bulk_queue);
 	g_queue_free(mgmt->request_queue);
 
+	g_hash_table_destroy(mgmt->pending_table);
+	g_hash_table_destroy(mgmt->stats_table);
+
 	if (mgmt->write_watch > 0)
 		g_source_remove(mgmt->write_watch);
 
@@ -488,6 +709,18 @@ bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close)
 	return true;
 }
 
+bool mgmt_set_max_pending(struct mgmt *mgmt, unsigned int max_pending)
+{
+	if (!mgmt || !max_pending)
+		return false;
+
+	mgmt->max_pending = max_pending;
+
+	wakeup_writer(mgmt);
+
+	return true;
+}
+
 static struct mgmt_request *create_request(uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
@@ -531,7 +764,8 @@ static struct mgmt_request *create_request(uint16_t opcode, uint16_t index,
 	return request;
 }
 
-unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
+static unsigned int queue_request(struct mgmt *mgmt, GQueue *queue,
+				uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy)
@@ -550,14 +784,40 @@ unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 		mgmt->next_request_id = 1;
 
 	request->id = mgmt->next_request_id++;
+	request->bulk = (queue == mgmt->bulk_queue);
 
-	g_queue_push_tail(mgmt->request_queue, request);
+	g_queue_push_tail(queue, request);
 
 	wakeup_writer(mgmt);
 
 	return request->id;
 }
 
+unsigned int mgmt_send(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
+				uint16_t length, const void *param,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	if (!mgmt)
+		return 0;
+
+	return queue_request(mgmt, mgmt->request_queue, opcode, index,
+				length, param, callback, user_data, destroy);
+}
+
+unsigned int mgmt_send_bulk(struct mgmt *mgmt, uint16_t opcode,
+				uint16_t index, uint16_t length,
+				const void *param,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy)
+{
+	if (!mgmt)
+		return 0;
+
+	return queue_request(mgmt, mgmt->bulk_queue, opcode, index,
+				length, param, callback, user_data, destroy);
+}
+
 unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
@@ -585,70 +845,102 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 	return request->id;
 }
 
-bool mgmt_cancel(struct mgmt *mgmt, unsigned int id)
+static bool cancel_pending(struct mgmt *mgmt, unsigned int id)
 {
-	struct mgmt_request *request;
-	GList *list;
+	GHashTableIter iter;
+	gpointer value;
 
-	if (!mgmt || !id)
-		return false;
+	g_hash_table_iter_init(&iter, mgmt->pending_table);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		GQueue *queue = value;
+		struct mgmt_request *request;
+		GList *list;
 
-	list = g_queue_find_custom(mgmt->request_queue, GUINT_TO_POINTER(id),
+		list = g_queue_find_custom(queue, GUINT_TO_POINTER(id),
 							compare_request_id);
-	if (list) {
-		request = list->data;
-		g_queue_delete_link(mgmt->request_queue, list);
-		goto done;
-	}
+		if (!list)
+			continue;
 
-	list = g_queue_find_custom(mgmt->reply_queue, GUINT_TO_POINTER(id),
-							compare_request_id);
-	if (list) {
 		request = list->data;
-		g_queue_delete_link(mgmt->reply_queue, list);
-		goto done;
+		remove_pending(mgmt, queue, list);
+		destroy_request(request, NULL);
+
+		return true;
 	}
 
-	list = g_list_find_custom(mgmt->pending_list, GUINT_TO_POINTER(id),
+	return false;
+}
+
+static bool cancel_queued(GQueue *queue, unsigned int id)
+{
+	struct mgmt_request *request;
+	GList *list;
+
+	list = g_queue_find_custom(queue, GUINT_TO_POINTER(id),
 							compare_request_id);
 	if (!list)
 		return false;
 
 	request = list->data;
+	g_queue_delete_link(queue, list);
+	destroy_request(request, NULL);
 
-	mgmt->pending_list = g_list_delete_link(mgmt->pending_list, list);
+	return true;
+}
 
-done:
-	destroy_request(request, NULL);
+bool mgmt_cancel(struct mgmt *mgmt, unsigned int id)
+{
+	if (!mgmt || !id)
+		return false;
+
+	if (!cancel_queued(mgmt->request_queue, id) &&
+				!cancel_queued(mgmt->bulk_queue, id) &&
+				!cancel_queued(mgmt->reply_queue, id) &&
+				!cancel_pending(mgmt, id))
+		return false;
 
 	wakeup_writer(mgmt);
 
 	return true;
 }
 
-bool mgmt_cancel_index(struct mgmt *mgmt, uint16_t index)
+static struct mgmt_request *find_queued(GQueue *queue, unsigned int id)
 {
-	GList *list, *next;
+	GList *list;
 
-	if (!mgmt)
-		return false;
+	list = g_queue_find_custom(queue, GUINT_TO_POINTER(id),
+							compare_request_id);
 
-	for (list = g_queue_peek_head_link(mgmt->request_queue); list;
-								list = next) {
-		struct mgmt_request *request = list->data;
+	return list ? list->data : NULL;
+}
 
-		next = g_list_next(list);
+bool mgmt_set_timeout(struct mgmt *mgmt, unsigned int id,
+							unsigned int seconds)
+{
+	struct mgmt_request *request;
 
-		if (request->index != index)
-			continue;
+	if (!mgmt || !id)
+		return false;
 
-		g_queue_delete_link(mgmt->request_queue, list);
+	request = find_queued(mgmt->request_queue, id);
+	if (!request)
+		request = find_queued(mgmt->bulk_queue, id);
+	if (!request)
+		request = find_queued(mgmt->reply_queue, id);
+	if (!request)
+		return false;
 
-		destroy_request(request, NULL);
-	}
+	request->mgmt = mgmt;
+	request->timeout = seconds;
 
-	for (list = g_queue_peek_head_link(mgmt->reply_queue); list;
-								list = next) {
+	return true;
+}
+
+static void cancel_queued_index(GQueue *queue, uint16_t index)
+{
+	GList *list, *next;
+
+	for (list = g_queue_peek_head_link(queue); list; list = next) {
 		struct mgmt_request *request = list->data;
 
 		next = g_list_next(list);
@@ -656,36 +948,55 @@ bool mgmt_cancel_index(struct mgmt *mgmt, uint16_t index)
 		if (request->index != index)
 			continue;
 
-		g_queue_delete_link(mgmt->reply_queue, list);
+		g_queue_delete_link(queue, list);
 
 		destroy_request(request, NULL);
 	}
+}
 
-	for (list = g_list_first(mgmt->pending_list); list; list = next) {
-		struct mgmt_request *request = list->data;
+bool mgmt_cancel_index(struct mgmt *mgmt, uint16_t index)
+{
+	GQueue *queue;
 
-		next = g_list_next(list);
+	if (!mgmt)
+		return false;
 
-		if (request->index != index)
-			continue;
+	cancel_queued_index(mgmt->request_queue, index);
+	cancel_queued_index(mgmt->bulk_queue, index);
+	cancel_queued_index(mgmt->reply_queue, index);
 
-		mgmt->pending_list = g_list_delete_link(mgmt->pending_list,
-									list);
+	queue = lookup_pending_queue(mgmt, index);
+	if (queue) {
+		struct mgmt_request *request;
 
-		destroy_request(request, NULL);
+		while ((request = g_queue_peek_head(queue))) {
+			remove_pending(mgmt, queue,
+					g_queue_peek_head_link(queue));
+			destroy_request(request, NULL);
+		}
 	}
 
+	wakeup_writer(mgmt);
+
 	return true;
 }
 
+static void destroy_pending(gpointer key, gpointer value, gpointer user_data)
+{
+	GQueue *queue = value;
+
+	g_queue_foreach(queue, destroy_request, NULL);
+	g_queue_clear(queue);
+}
+
 bool mgmt_cancel_all(struct mgmt *mgmt)
 {
 	if (!mgmt)
 		return false;
 
-	g_list_foreach(mgmt->pending_list, destroy_request, NULL);
-	g_list_free(mgmt->pending_list);
-	mgmt->pending_list = NULL;
+	g_hash_table_foreach(mgmt->pending_table, destroy_pending, NULL);
+	mgmt->pending_count = 0;
+	mgmt->pending_bulk = 0;
 
 	g_queue_foreach(mgmt->reply_queue, destroy_request, NULL);
 	g_queue_clear(mgmt->reply_queue);
@@ -693,6 +1004,9 @@ bool mgmt_cancel_all(struct mgmt *mgmt)
 	g_queue_foreach(mgmt->request_queue, destroy_request, NULL);
 	g_queue_clear(mgmt->request_queue);
 
+	g_queue_foreach(mgmt->bulk_queue, destroy_request, NULL);
+	g_queue_clear(mgmt->bulk_queue);
+
 	return true;
 }
 
@@ -813,3 +1127,26 @@ bool mgmt_unregister_all(struct mgmt *mgmt)
 
 	return true;
 }
+
+struct stats_data {
+	mgmt_stats_func_t func;
+	void *user_data;
+};
+
+static void call_stats(gpointer key, gpointer value, gpointer user_data)
+{
+	struct stats_data *data = user_data;
+
+	data->func(value, data->user_data);
+}
+
+void mgmt_foreach_stats(struct mgmt *mgmt, mgmt_stats_func_t func,
+							void *user_data)
+{
+	struct stats_data data = { func, user_data };
+
+	if (!mgmt || !func)
+		return;
+
+	g_hash_table_foreach(mgmt->stats_table, call_stats, &data);
+}
@@ -40,6 +40,7 @@ bool mgmt_set_debug(struct mgmt *mgmt, mgmt_debug_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy);
 
 bool mgmt_set_close_on_unref(struct mgmt *mgmt, bool do_close);
+bool mgmt_set_max_pending(struct mgmt *mgmt, unsigned int max_pending);
 
 typedef void (*mgmt_request_func_t)(uint8_t status, uint16_t length,
 					const void *param, void *user_data);
@@ -52,6 +53,13 @@ unsigned int mgmt_reply(struct mgmt *mgmt, uint16_t opcode, uint16_t index,
 				uint16_t length, const void *param,
 				mgmt_request_func_t callback,
 				void *user_data, mgmt_destroy_func_t destroy);
+unsigned int mgmt_send_bulk(struct mgmt *mgmt, uint16_t opcode,
+				uint16_t index, uint16_t length,
+				const void *param,
+				mgmt_request_func_t callback,
+				void *user_data, mgmt_destroy_func_t destroy);
+bool mgmt_set_timeout(struct mgmt *mgmt, unsigned int id,
+							unsigned int seconds);
 bool mgmt_cancel(struct mgmt *mgmt, unsigned int id);
 bool mgmt_cancel_index(struct mgmt *mgmt, uint16_t index);
 bool mgmt_cancel_all(struct mgmt *mgmt);
@@ -65,3 +73,20 @@ unsigned int mgmt_register(struct mgmt *mgmt, uint16_t event, uint16_t index,
 bool mgmt_unregister(struct mgmt *mgmt, unsigned int id);
 bool mgmt_unregister_index(struct mgmt *mgmt, uint16_t index);
 bool mgmt_unregister_all(struct mgmt *mgmt);
+
+#define MGMT_STATS_BUCKETS	20
+
+struct mgmt_stats {
+	uint16_t opcode;
+	unsigned int count;
+	uint64_t total;
+	uint64_t max;
+	/* Bucket n counts latencies below 2^n usec, the last one the rest */
+	unsigned int buckets[MGMT_STATS_BUCKETS];
+};
+
+typedef void (*mgmt_stats_func_t)(const struct mgmt_stats *stats,
+							void *user_data);
+
+void mgmt_foreach_stats(struct mgmt *mgmt, mgmt_stats_func_t func,
+							void *user_data);
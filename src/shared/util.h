@@ -21,6 +21,8 @@
  *
  */
 
+#include <stdint.h>
+
 typedef void (*util_debug_func_t)(const char *str, void *user_data);
 
 void util_debug(util_debug_func_t function, void *user_data,
@@ -29,3 +31,13 @@ void util_debug(util_debug_func_t function, void *user_data,
 
 void util_hexdump(const char dir, const unsigned char *buf, size_t len,
 				util_debug_func_t function, void *user_data);
+
+/* Hash for tables keyed by a Bluetooth address stored as 6 bytes */
+static inline uint32_t util_bdaddr_hash(const void *key)
+{
+	const uint8_t *b = key;
+
+	return (uint32_t) b[0] | (uint32_t) b[1] << 8 |
+			(uint32_t) b[2] << 16 |
+			(uint32_t) (b[3] ^ b[4] ^ b[5]) << 24;
+}
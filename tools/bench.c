@@ -0,0 +1,262 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "bench.h"
+
+struct bench_stats {
+	uint32_t expected;
+	uint32_t frames;
+	uint32_t lost;
+	uint64_t bytes;
+	uint64_t first;
+	uint64_t last;
+	int64_t *lat;
+	size_t lat_size;
+};
+
+static enum bench_format output_format;
+static unsigned int output_rows;
+
+uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+void bench_put_header(uint8_t *frame, uint32_t seq, uint16_t len,
+								uint64_t ts)
+{
+	bt_put_le32(seq, frame);
+	bt_put_le16(len, frame + 4);
+	bt_put_le64(ts, frame + 6);
+}
+
+int bench_parse_list(const char *str, int *values, int max)
+{
+	char *end;
+	int n = 0;
+
+	while (*str && n < max) {
+		values[n] = strtol(str, &end, 0);
+		if (end == str || values[n] <= 0)
+			return -1;
+
+		n++;
+
+		if (*end == '\0')
+			break;
+
+		if (*end != ',')
+			return -1;
+
+		str = end + 1;
+	}
+
+	return n;
+}
+
+struct bench_stats *bench_stats_new(void)
+{
+	return calloc(1, sizeof(struct bench_stats));
+}
+
+void bench_stats_free(struct bench_stats *stats)
+{
+	free(stats->lat);
+	free(stats);
+}
+
+bool bench_stats_add(struct bench_stats *stats, const uint8_t *frame,
+						size_t len, uint64_t now)
+{
+	uint32_t seq;
+	int64_t *lat;
+
+	if (len < BENCH_HDR_SIZE)
+		return false;
+
+	seq = bt_get_le32(frame);
+	if (seq == BENCH_END_SEQ)
+		return true;
+
+	if (seq > stats->expected)
+		stats->lost += seq - stats->expected;
+
+	stats->expected = seq + 1;
+
+	if (stats->frames == stats->lat_size) {
+		stats->lat_size = stats->lat_size ? stats->lat_size * 2 : 1024;
+		lat = realloc(stats->lat, stats->lat_size * sizeof(*lat));
+		if (!lat) {
+			perror("Can't allocate latency buffer");
+			exit(1);
+		}
+
+		stats->lat = lat;
+	}
+
+	stats->lat[stats->frames++] = now - bt_get_le64(frame + 6);
+	stats->bytes += len;
+
+	if (!stats->first)
+		stats->first = now;
+
+	stats->last = now;
+
+	return false;
+}
+
+static int cmp_lat(const void *a, const void *b)
+{
+	int64_t l = *(const int64_t *) a;
+	int64_t r = *(const int64_t *) b;
+
+	return l < r ? -1 : l > r;
+}
+
+void bench_stats_result(struct bench_stats *stats, struct bench_result *res)
+{
+	uint32_t n = stats->frames;
+
+	memset(res, 0, sizeof(*res));
+
+	res->frames = n;
+	res->lost = stats->lost;
+	res->bytes = stats->bytes;
+	res->elapsed = stats->last - stats->first;
+
+	if (n == 0)
+		return;
+
+	qsort(stats->lat, n, sizeof(*stats->lat), cmp_lat);
+
+	res->lat_min = stats->lat[0];
+	res->lat_p50 = stats->lat[(n - 1) * 50 / 100];
+	res->lat_p90 = stats->lat[(n - 1) * 90 / 100];
+	res->lat_p99 = stats->lat[(n - 1) * 99 / 100];
+	res->lat_max = stats->lat[n - 1];
+}
+
+void bench_result_encode(const struct bench_result *res, uint8_t *buf)
+{
+	bt_put_le32(res->frames, buf);
+	bt_put_le32(res->lost, buf + 4);
+	bt_put_le64(res->bytes, buf + 8);
+	bt_put_le64(res->elapsed, buf + 16);
+	bt_put_le64(res->lat_min, buf + 24);
+	bt_put_le64(res->lat_p50, buf + 32);
+	bt_put_le64(res->lat_p90, buf + 40);
+	bt_put_le64(res->lat_p99, buf + 48);
+	bt_put_le64(res->lat_max, buf + 56);
+}
+
+void bench_result_decode(struct bench_result *res, const uint8_t *buf)
+{
+	res->frames = bt_get_le32(buf);
+	res->lost = bt_get_le32(buf + 4);
+	res->bytes = bt_get_le64(buf + 8);
+	res->elapsed = bt_get_le64(buf + 16);
+	res->lat_min = bt_get_le64(buf + 24);
+	res->lat_p50 = bt_get_le64(buf + 32);
+	res->lat_p90 = bt_get_le64(buf + 40);
+	res->lat_p99 = bt_get_le64(buf + 48);
+	res->lat_max = bt_get_le64(buf + 56);
+}
+
+void bench_output_start(enum bench_format format)
+{
+	output_format = format;
+	output_rows = 0;
+
+	if (format == BENCH_FORMAT_JSON)
+		printf("[\n");
+	else
+		printf("mode,mtu,flushable,frames,lost,bytes,seconds,MBps,"
+			"lat_min_us,lat_p50_us,lat_p90_us,lat_p99_us,"
+			"lat_max_us\n");
+
+	fflush(stdout);
+}
+
+void bench_output_row(const char *mode, int mtu, int flushable,
+					const struct bench_result *res)
+{
+	double secs = res->elapsed / 1e6;
+	double mbps = secs > 0 ? res->bytes / secs / 1e6 : 0;
+	char flush[6];
+
+	if (output_format == BENCH_FORMAT_JSON) {
+		if (flushable < 0)
+			strcpy(flush, "null");
+		else
+			strcpy(flush, flushable ? "true" : "false");
+
+		printf("%s  { \"mode\": \"%s\", \"mtu\": %d, "
+			"\"flushable\": %s, \"frames\": %u, \"lost\": %u, "
+			"\"bytes\": %llu, \"seconds\": %.6f, \"MBps\": %.3f, "
+			"\"lat_min_us\": %lld, \"lat_p50_us\": %lld, "
+			"\"lat_p90_us\": %lld, \"lat_p99_us\": %lld, "
+			"\"lat_max_us\": %lld }",
+			output_rows ? ",\n" : "", mode, mtu, flush,
+			res->frames, res->lost,
+			(unsigned long long) res->bytes, secs, mbps,
+			(long long) res->lat_min, (long long) res->lat_p50,
+			(long long) res->lat_p90, (long long) res->lat_p99,
+			(long long) res->lat_max);
+	} else {
+		if (flushable < 0)
+			flush[0] = '\0';
+		else
+			strcpy(flush, flushable ? "on" : "off");
+
+		printf("%s,%d,%s,%u,%u,%llu,%.6f,%.3f,%lld,%lld,%lld,%lld,"
+			"%lld\n", mode, mtu, flush, res->frames, res->lost,
+			(unsigned long long) res->bytes, secs, mbps,
+			(long long) res->lat_min, (long long) res->lat_p50,
+			(long long) res->lat_p90, (long long) res->lat_p99,
+			(long long) res->lat_max);
+	}
+
+	output_rows++;
+	fflush(stdout);
+}
+
+void bench_output_end(void)
+{
+	if (output_format == BENCH_FORMAT_JSON)
+		printf("%s]\n", output_rows ? "\n" : "");
+
+	fflush(stdout);
+}
@@ -0,0 +1,78 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Benchmark frames start with a little endian header made of a 32-bit
+ * sequence number, the 16-bit frame length and the 64-bit send time in
+ * microseconds (CLOCK_REALTIME, so both ends need synchronized clocks
+ * unless they run on the same host, e.g. with btvirt). The rest of the
+ * frame is filled with 0x7f. A frame with BENCH_END_SEQ ends a run and
+ * the receiver answers with an encoded struct bench_result.
+ */
+#define BENCH_HDR_SIZE		14
+#define BENCH_END_SEQ		0xffffffff
+#define BENCH_BATCH		16
+#define BENCH_FRAMES		1000
+#define BENCH_TIMEOUT		10000	/* msec to wait for the result */
+#define BENCH_MAX_RUNS		16
+
+struct bench_result {
+	uint32_t frames;
+	uint32_t lost;
+	uint64_t bytes;
+	uint64_t elapsed;	/* usec from first to last frame */
+	int64_t lat_min;	/* one-way latency in usec */
+	int64_t lat_p50;
+	int64_t lat_p90;
+	int64_t lat_p99;
+	int64_t lat_max;
+};
+
+#define BENCH_RESULT_SIZE	64
+
+enum bench_format {
+	BENCH_FORMAT_CSV,
+	BENCH_FORMAT_JSON,
+};
+
+struct bench_stats;
+
+uint64_t bench_now(void);
+void bench_put_header(uint8_t *frame, uint32_t seq, uint16_t len,
+								uint64_t ts);
+int bench_parse_list(const char *str, int *values, int max);
+
+struct bench_stats *bench_stats_new(void);
+void bench_stats_free(struct bench_stats *stats);
+bool bench_stats_add(struct bench_stats *stats, const uint8_t *frame,
+						size_t len, uint64_t now);
+void bench_stats_result(struct bench_stats *stats, struct bench_result *res);
+
+void bench_result_encode(const struct bench_result *res, uint8_t *buf);
+void bench_result_decode(struct bench_result *res, const uint8_t *buf);
+
+void bench_output_start(enum bench_format format);
+void bench_output_row(const char *mode, int mtu, int flushable,
+					const struct bench_result *res);
+void bench_output_end(void);
@@ -37,8 +37,13 @@
 #include <getopt.h>
 #include <sys/param.h>
 #include <sys/ioctl.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <endian.h>
+#include <arpa/inet.h>
 
 #include <glib.h>
 
@@ -49,6 +54,8 @@
 #include "textfile.h"
 #include "oui.h"
 
+#include "src/shared/util.h"
+
 /* Unofficial value, might still change */
 #define LE_LINK		0x03
 
@@ -2506,6 +2513,333 @@ done:
 	return 0;
 }
 
+#define RECORD_BATCH		32
+
+struct scan_entry {
+	bdaddr_t bdaddr;
+	uint8_t bdaddr_type;
+	unsigned long reports;
+	int8_t rssi_min;
+	int8_t rssi_max;
+	long rssi_sum;
+	uint32_t ad_hash;
+	unsigned int ad_changes;
+	char name[30];
+};
+
+struct scan_record {
+	GHashTable *entries;
+	uint8_t filter_type;
+	FILE *log;
+	unsigned long events;
+	unsigned long reports;
+	unsigned long interval_reports;
+};
+
+static guint scan_entry_hash(gconstpointer key)
+{
+	return util_bdaddr_hash(key);
+}
+
+static gboolean scan_entry_equal(gconstpointer a, gconstpointer b)
+{
+	return bacmp(a, b) == 0;
+}
+
+static uint32_t ad_hash(const uint8_t *data, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= data[i];
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+static void btsnoop_write_header(FILE *log)
+{
+	struct {
+		uint8_t id[8];
+		uint32_t version;
+		uint32_t type;
+	} __attribute__ ((packed)) hdr = {
+		.id = { 'b', 't', 's', 'n', 'o', 'o', 'p', '\0' },
+		.version = htonl(1),
+		.type = htonl(1002),
+	};
+
+	fwrite(&hdr, sizeof(hdr), 1, log);
+}
+
+static void btsnoop_write_event(FILE *log, const struct timeval *tv,
+					const unsigned char *buf, int len)
+{
+	struct {
+		uint32_t size;
+		uint32_t len;
+		uint32_t flags;
+		uint32_t drops;
+		uint64_t ts;
+	} __attribute__ ((packed)) pkt;
+	uint64_t ts;
+
+	/* Microseconds since 0 AD as used by btsnoop */
+	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
+	ts += 0x00E03AB44A676000ll;
+
+	pkt.size = htonl(len);
+	pkt.len = htonl(len);
+	pkt.flags = htonl(0x03);
+	pkt.drops = 0;
+	pkt.ts = htobe64(ts);
+
+	fwrite(&pkt, sizeof(pkt), 1, log);
+	fwrite(buf, len, 1, log);
+}
+
+static void record_report(struct scan_record *rec, le_advertising_info *info,
+								int8_t rssi)
+{
+	struct scan_entry *entry;
+	uint32_t hash;
+
+	rec->reports++;
+	rec->interval_reports++;
+
+	if (!check_report_filter(rec->filter_type, info))
+		return;
+
+	hash = ad_hash(info->data, info->length);
+
+	entry = g_hash_table_lookup(rec->entries, &info->bdaddr);
+	if (!entry) {
+		entry = g_new0(struct scan_entry, 1);
+		bacpy(&entry->bdaddr, &info->bdaddr);
+		entry->bdaddr_type = info->bdaddr_type;
+		entry->rssi_min = rssi;
+		entry->rssi_max = rssi;
+		entry->ad_hash = hash;
+		eir_parse_name(info->data, info->length, entry->name,
+						sizeof(entry->name) - 1);
+		g_hash_table_insert(rec->entries, &entry->bdaddr, entry);
+	} else if (entry->ad_hash != hash) {
+		entry->ad_hash = hash;
+		entry->ad_changes++;
+
+		/* Scan responses often carry the name, keep the best one */
+		if (!strcmp(entry->name, "(unknown)"))
+			eir_parse_name(info->data, info->length, entry->name,
+						sizeof(entry->name) - 1);
+	}
+
+	entry->reports++;
+	entry->rssi_sum += rssi;
+
+	if (rssi < entry->rssi_min)
+		entry->rssi_min = rssi;
+
+	if (rssi > entry->rssi_max)
+		entry->rssi_max = rssi;
+}
+
+static void record_event(struct scan_record *rec, unsigned char *buf, int len)
+{
+	evt_le_meta_event *meta;
+	le_advertising_info *info;
+	uint8_t num_reports;
+	unsigned char *ptr, *end;
+
+	if (len < 1 + HCI_EVENT_HDR_SIZE + 2 || buf[0] != HCI_EVENT_PKT)
+		return;
+
+	meta = (void *) (buf + 1 + HCI_EVENT_HDR_SIZE);
+	if (meta->subevent != EVT_LE_ADVERTISING_REPORT)
+		return;
+
+	rec->events++;
+
+	end = buf + len;
+	num_reports = meta->data[0];
+	ptr = meta->data + 1;
+
+	while (num_reports--) {
+		info = (void *) ptr;
+
+		if (ptr + LE_ADVERTISING_INFO_SIZE > end ||
+				info->data + info->length + 1 > end)
+			break;
+
+		record_report(rec, info, info->data[info->length]);
+
+		ptr = info->data + info->length + 1;
+	}
+}
+
+static gint scan_entry_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct scan_entry *e1 = a, *e2 = b;
+
+	if (e1->reports == e2->reports)
+		return 0;
+
+	return e1->reports < e2->reports ? 1 : -1;
+}
+
+static void record_summary(struct scan_record *rec, int interval)
+{
+	GList *list, *l;
+
+	list = g_list_sort(g_hash_table_get_values(rec->entries),
+							scan_entry_cmp);
+
+	printf("--- %u devices, %lu events, %lu reports (%lu/s)\n",
+				g_hash_table_size(rec->entries), rec->events,
+				rec->reports, rec->interval_reports / interval);
+
+	for (l = list; l; l = l->next) {
+		struct scan_entry *entry = l->data;
+		char addr[18];
+
+		ba2str(&entry->bdaddr, addr);
+
+		printf("%s %c %8lu %4d/%4ld/%4d %5u %s\n", addr,
+				entry->bdaddr_type ? 'R' : 'P', entry->reports,
+				entry->rssi_min,
+				entry->rssi_sum / (long) entry->reports,
+				entry->rssi_max, entry->ad_changes, entry->name);
+	}
+
+	fflush(stdout);
+
+	g_list_free(list);
+
+	rec->interval_reports = 0;
+}
+
+static int record_advertising_devices(int dd, uint8_t filter_type,
+					int interval, const char *logfile)
+{
+	unsigned char buf[RECORD_BATCH][HCI_MAX_EVENT_SIZE];
+	struct mmsghdr msgs[RECORD_BATCH];
+	struct iovec iov[RECORD_BATCH];
+	struct hci_filter nf, of;
+	struct scan_record rec;
+	struct sigaction sa;
+	struct timeval tv;
+	struct pollfd p;
+	time_t next;
+	socklen_t olen;
+	int i, n, opt, err = 0;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.filter_type = filter_type;
+
+	if (logfile) {
+		rec.log = fopen(logfile, "wb");
+		if (!rec.log) {
+			perror("Could not open log file");
+			return -1;
+		}
+
+		btsnoop_write_header(rec.log);
+	}
+
+	olen = sizeof(of);
+	if (getsockopt(dd, SOL_HCI, HCI_FILTER, &of, &olen) < 0) {
+		printf("Could not get socket options\n");
+		err = -1;
+		goto close;
+	}
+
+	hci_filter_clear(&nf);
+	hci_filter_set_ptype(HCI_EVENT_PKT, &nf);
+	hci_filter_set_event(EVT_LE_META_EVENT, &nf);
+
+	if (setsockopt(dd, SOL_HCI, HCI_FILTER, &nf, sizeof(nf)) < 0) {
+		printf("Could not set socket options\n");
+		err = -1;
+		goto close;
+	}
+
+	/* Give bursts of reports some room while the summary is printed */
+	opt = 1024 * 1024;
+	setsockopt(dd, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(opt));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_flags = SA_NOCLDSTOP;
+	sa.sa_handler = sigint_handler;
+	sigaction(SIGINT, &sa, NULL);
+
+	rec.entries = g_hash_table_new_full(scan_entry_hash, scan_entry_equal,
+								NULL, g_free);
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < RECORD_BATCH; i++) {
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = sizeof(buf[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	next = time(NULL) + interval;
+
+	while (!signal_received) {
+		time_t now = time(NULL);
+
+		if (now >= next) {
+			record_summary(&rec, interval);
+			next = now + interval;
+		}
+
+		p.fd = dd;
+		p.events = POLLIN;
+		n = poll(&p, 1, (next - now) * 1000);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -1;
+			break;
+		}
+
+		if (n == 0)
+			continue;
+
+		n = recvmmsg(dd, msgs, RECORD_BATCH, MSG_DONTWAIT, NULL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			err = -1;
+			break;
+		}
+
+		if (rec.log)
+			gettimeofday(&tv, NULL);
+
+		for (i = 0; i < n; i++) {
+			if (rec.log)
+				btsnoop_write_event(rec.log, &tv, buf[i],
+							msgs[i].msg_len);
+
+			record_event(&rec, buf[i], msgs[i].msg_len);
+		}
+	}
+
+	record_summary(&rec, interval);
+
+	g_hash_table_destroy(rec.entries);
+
+	setsockopt(dd, SOL_HCI, HCI_FILTER, &of, sizeof(of));
+
+close:
+	if (rec.log)
+		fclose(rec.log);
+
+	return err;
+}
+
 static struct option lescan_options[] = {
 	{ "help",	0, 0, 'h' },
 	{ "privacy",	0, 0, 'p' },
@@ -2513,6 +2847,8 @@ static struct option lescan_options[] = {
 	{ "whitelist",	0, 0, 'w' },
 	{ "discovery",	1, 0, 'd' },
 	{ "duplicates",	0, 0, 'D' },
+	{ "record",	2, 0, 'R' },
+	{ "log",	1, 0, 'L' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -2523,7 +2859,10 @@ static const char *lescan_help =
 	"\tlescan [--whitelist] scan for address in the whitelist only\n"
 	"\tlescan [--discovery=g|l] enable general or limited discovery"
 		"procedure\n"
-	"\tlescan [--duplicates] don't filter duplicates\n";
+	"\tlescan [--duplicates] don't filter duplicates\n"
+	"\tlescan [--record[=seconds]] aggregate reports per device and\n"
+	"\t\tprint a summary periodically (default every 10 seconds)\n"
+	"\tlescan [--log=<file>] write advertising events to a btsnoop file\n";
 
 static void cmd_lescan(int dev_id, int argc, char **argv)
 {
@@ -2535,6 +2874,8 @@ static void cmd_lescan(int dev_id, int argc, char **argv)
 	uint16_t interval = htobs(0x0010);
 	uint16_t window = htobs(0x0010);
 	uint8_t filter_dup = 1;
+	int record = 0;
+	const char *logfile = NULL;
 
 	for_each_opt(opt, lescan_options, NULL) {
 		switch (opt) {
@@ -2560,6 +2901,18 @@ static void cmd_lescan(int dev_id, int argc, char **argv)
 		case 'D':
 			filter_dup = 0x00;
 			break;
+		case 'R':
+			record = optarg ? atoi(optarg) : 10;
+			if (record <= 0) {
+				fprintf(stderr, "Invalid record interval\n");
+				exit(1);
+			}
+			break;
+		case 'L':
+			logfile = optarg;
+			if (!record)
+				record = 10;
+			break;
 		default:
 			printf("%s", lescan_help);
 			return;
@@ -2591,7 +2944,11 @@ static void cmd_lescan(int dev_id, int argc, char **argv)
 
 	printf("LE Scan ...\n");
 
-	err = print_advertising_devices(dd, filter_type);
+	if (record)
+		err = record_advertising_devices(dd, filter_type, record,
+								logfile);
+	else
+		err = print_advertising_devices(dd, filter_type);
 	if (err < 0) {
 		perror("Could not receive advertising events");
 		exit(1);
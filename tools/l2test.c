@@ -40,12 +40,15 @@
 #include <sys/poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
 #include <bluetooth/l2cap.h>
 
+#include "bench.h"
+
 #define NIBBLE_TO_ASCII(c)  ((c) < 0x0a ? (c) + 0x30 : (c) + 0x57)
 
 /* Test modes */
@@ -64,6 +67,8 @@ enum {
 	CSENDRECV,
 	INFOREQ,
 	PAIRING,
+	BENCH,
+	LBENCH,
 };
 
 static unsigned char *buf;
@@ -119,6 +124,18 @@ static int rcvbuf = 0;
 static int chan_policy = -1;
 static int bdaddr_type = 0;
 
+/* Largest L2CAP MTU, accepted by the benchmark receiver without a sweep */
+#define BENCH_MAX_MTU	65535
+
+/* Benchmark sweep */
+static int bench_mtus[BENCH_MAX_RUNS];
+static int bench_num_mtus = 0;
+static int bench_modes[BENCH_MAX_RUNS];
+static int bench_num_modes = 0;
+static int bench_flush[BENCH_MAX_RUNS];
+static int bench_num_flush = 0;
+static int bench_format = BENCH_FORMAT_CSV;
+
 struct lookup_table {
 	char	*name;
 	int	flag;
@@ -149,6 +166,18 @@ static struct lookup_table bdaddr_types[] = {
 	{ NULL,		0			},
 };
 
+static struct lookup_table flush_settings[] = {
+	{ "on",		BT_FLUSHABLE_ON		},
+	{ "off",	BT_FLUSHABLE_OFF	},
+	{ NULL,		0			},
+};
+
+static struct lookup_table bench_formats[] = {
+	{ "csv",	BENCH_FORMAT_CSV	},
+	{ "json",	BENCH_FORMAT_JSON	},
+	{ NULL,		0			},
+};
+
 static int get_lookup_flag(struct lookup_table *table, char *name)
 {
 	int i;
@@ -160,6 +189,35 @@ static int get_lookup_flag(struct lookup_table *table, char *name)
 	return -1;
 }
 
+static const char *get_lookup_name(struct lookup_table *table, int flag)
+{
+	int i;
+
+	for (i = 0; table[i].name; i++)
+		if (table[i].flag == flag)
+			return table[i].name;
+
+	return "unknown";
+}
+
+static int get_lookup_list(struct lookup_table *table, char *names,
+							int *flags, int max)
+{
+	char *name;
+	int n = 0;
+
+	for (name = strtok(names, ","); name && n < max;
+					name = strtok(NULL, ",")) {
+		flags[n] = get_lookup_flag(table, name);
+		if (flags[n] < 0)
+			return -1;
+
+		n++;
+	}
+
+	return n;
+}
+
 static void print_lookup_values(struct lookup_table *table, char *header)
 {
 	int i;
@@ -950,6 +1008,283 @@ static void send_and_recv_mode(int sk)
 	return;
 }
 
+/*
+ * The benchmark receiver listens with one socket per L2CAP mode, since
+ * the mode of a connection is fixed by the listening socket.
+ */
+static int bench_psm_offset(int mode)
+{
+	switch (mode) {
+	case L2CAP_MODE_BASIC:
+		return 0;
+	case L2CAP_MODE_ERTM:
+		return 2;
+	case L2CAP_MODE_STREAMING:
+		return 4;
+	default:
+		return -1;
+	}
+}
+
+static int bench_get_options(int sk, struct l2cap_options *opts)
+{
+	socklen_t optlen;
+
+	memset(opts, 0, sizeof(*opts));
+	optlen = sizeof(*opts);
+
+	if (getsockopt(sk, SOL_L2CAP, L2CAP_OPTIONS, opts, &optlen) < 0) {
+		syslog(LOG_ERR, "Can't get L2CAP options: %s (%d)",
+							strerror(errno), errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void bench_recv_mode(int sk)
+{
+	struct mmsghdr msgs[BENCH_BATCH];
+	struct iovec iov[BENCH_BATCH];
+	struct l2cap_options opts;
+	struct bench_stats *stats;
+	struct bench_result res;
+	uint8_t reply[BENCH_RESULT_SIZE];
+	uint8_t *frames;
+	uint64_t now;
+	int i, n;
+
+	/* The global imtu is capped by buffer_size, size by the channel */
+	if (bench_get_options(sk, &opts) < 0)
+		exit(1);
+
+	imtu = opts.imtu;
+
+	frames = malloc(imtu * BENCH_BATCH);
+	stats = bench_stats_new();
+	if (!frames || !stats) {
+		syslog(LOG_ERR, "Can't allocate benchmark buffers");
+		exit(1);
+	}
+
+	syslog(LOG_INFO, "Receiving benchmark ...");
+
+	while (1) {
+		memset(msgs, 0, sizeof(msgs));
+
+		for (i = 0; i < BENCH_BATCH; i++) {
+			iov[i].iov_base = frames + i * imtu;
+			iov[i].iov_len = imtu;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		n = recvmmsg(sk, msgs, BENCH_BATCH, MSG_WAITFORONE, NULL);
+		if (n <= 0) {
+			syslog(LOG_ERR, "Read failed: %s (%d)",
+							strerror(errno), errno);
+			goto done;
+		}
+
+		now = bench_now();
+
+		for (i = 0; i < n; i++) {
+			if (bench_stats_add(stats, iov[i].iov_base,
+						msgs[i].msg_len, now))
+				goto reply;
+		}
+	}
+
+reply:
+	bench_stats_result(stats, &res);
+	bench_result_encode(&res, reply);
+
+	if (send(sk, reply, sizeof(reply), 0) < 0)
+		syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+
+	syslog(LOG_INFO, "%u frames, %u lost, %llu bytes in %.3f sec",
+				res.frames, res.lost,
+				(unsigned long long) res.bytes,
+				res.elapsed / 1e6);
+
+	/* Wait for the sender to disconnect */
+	while (recv(sk, frames, imtu, 0) > 0);
+
+done:
+	bench_stats_free(stats);
+	free(frames);
+}
+
+static void bench_listen_mode(void)
+{
+	static const int modes[] = { L2CAP_MODE_BASIC, L2CAP_MODE_ERTM,
+							L2CAP_MODE_STREAMING };
+	unsigned int i;
+	int j;
+
+	/* Accept the largest frame the sender may sweep through */
+	if (bench_num_mtus) {
+		imtu = 0;
+		for (j = 0; j < bench_num_mtus; j++)
+			if (bench_mtus[j] > imtu)
+				imtu = bench_mtus[j];
+	} else
+		imtu = BENCH_MAX_MTU;
+
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		if (fork())
+			continue;
+
+		rfcmode = modes[i];
+		psm += bench_psm_offset(rfcmode);
+		do_listen(bench_recv_mode);
+		exit(0);
+	}
+
+	/* Children are reaped automatically, this returns once all exit */
+	while (wait(NULL) > 0);
+}
+
+static int bench_send(int sk, uint8_t *frames, int len)
+{
+	struct mmsghdr msgs[BENCH_BATCH];
+	struct iovec iov[BENCH_BATCH];
+	uint32_t seq = 0;
+	uint64_t now;
+	int i, n, sent, left;
+
+	memset(frames, 0x7f, len * BENCH_BATCH);
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < BENCH_BATCH; i++) {
+		iov[i].iov_base = frames + i * len;
+		iov[i].iov_len = len;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	left = num_frames < 0 ? BENCH_FRAMES : num_frames;
+
+	while (left > 0) {
+		n = left < BENCH_BATCH ? left : BENCH_BATCH;
+		now = bench_now();
+
+		for (i = 0; i < n; i++)
+			bench_put_header(iov[i].iov_base, seq++, len, now);
+
+		for (i = 0; i < n; i += sent) {
+			sent = sendmmsg(sk, msgs + i, n - i, 0);
+			if (sent <= 0) {
+				syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+				return -1;
+			}
+		}
+
+		left -= n;
+	}
+
+	bench_put_header(frames, BENCH_END_SEQ, BENCH_HDR_SIZE, bench_now());
+
+	if (send(sk, frames, BENCH_HDR_SIZE, 0) < 0) {
+		syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void bench_run(char *svr, int mode, int mtu, int flushable)
+{
+	struct bench_result res;
+	struct l2cap_options opts;
+	uint8_t reply[BENCH_RESULT_SIZE];
+	struct pollfd p;
+	uint8_t *frames = NULL;
+	unsigned short base = psm;
+	int sk, len;
+
+	rfcmode = mode;
+	imtu = omtu = mtu;
+	psm = base + bench_psm_offset(mode);
+
+	sk = do_connect(svr);
+	psm = base;
+	if (sk < 0)
+		return;
+
+	if (flushable >= 0 && setsockopt(sk, SOL_BLUETOOTH, BT_FLUSHABLE,
+					&flushable, sizeof(flushable)) < 0) {
+		syslog(LOG_ERR, "Can't set flushable: %s (%d)",
+							strerror(errno), errno);
+		goto done;
+	}
+
+	/* The peer may accept less than requested, or more */
+	if (bench_get_options(sk, &opts) < 0)
+		goto done;
+
+	len = opts.omtu < mtu ? opts.omtu : mtu;
+
+	if (len < BENCH_HDR_SIZE) {
+		syslog(LOG_ERR, "MTU %d too small for benchmark", len);
+		goto done;
+	}
+
+	frames = malloc(len * BENCH_BATCH);
+	if (!frames) {
+		syslog(LOG_ERR, "Can't allocate benchmark buffers");
+		goto done;
+	}
+
+	if (bench_send(sk, frames, len) < 0)
+		goto done;
+
+	p.fd = sk;
+	p.events = POLLIN;
+
+	if (poll(&p, 1, BENCH_TIMEOUT) <= 0 ||
+			recv(sk, reply, sizeof(reply), 0) != sizeof(reply)) {
+		syslog(LOG_ERR, "No benchmark result for %s mtu %d",
+				get_lookup_name(l2cap_modes, mode), len);
+		goto done;
+	}
+
+	bench_result_decode(&res, reply);
+	bench_output_row(get_lookup_name(l2cap_modes, mode), len, flushable,
+									&res);
+
+done:
+	free(frames);
+	close(sk);
+}
+
+static void bench_mode(char *svr)
+{
+	int i, j, k;
+
+	if (!bench_num_modes)
+		bench_modes[bench_num_modes++] = rfcmode;
+
+	if (!bench_num_mtus)
+		bench_mtus[bench_num_mtus++] = imtu;
+
+	if (!bench_num_flush)
+		bench_flush[bench_num_flush++] = -1;
+
+	bench_output_start(bench_format);
+
+	for (i = 0; i < bench_num_modes; i++)
+		for (j = 0; j < bench_num_mtus; j++)
+			for (k = 0; k < bench_num_flush; k++)
+				bench_run(svr, bench_modes[i], bench_mtus[j],
+								bench_flush[k]);
+
+	bench_output_end();
+}
+
 static void reconnect_mode(char *svr)
 {
 	while (1) {
@@ -1212,7 +1547,10 @@ static void usage(void)
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
 		"\t-p trigger dedicated bonding\n"
-		"\t-z information request\n");
+		"\t-z information request\n"
+		"\t-e connect and run benchmark\n"
+		"\t-g listen and answer benchmark (basic on psm, ertm on\n"
+		"\t   psm + 2, streaming on psm + 4)\n");
 
 	printf("Options:\n"
 		"\t[-b bytes] [-i device] [-P psm] [-J cid]\n"
@@ -1239,17 +1577,21 @@ static void usage(void)
 		"\t[-S] secure connection\n"
 		"\t[-M] become master\n"
 		"\t[-T] enable timestamps\n"
-		"\t[-V type] address type (help for list, default = bredr)\n");
+		"\t[-V type] address type (help for list, default = bredr)\n"
+		"\t[-l mtu,...] benchmark MTUs (default = imtu)\n"
+		"\t[-o mode,...] benchmark l2cap modes (default = -X mode)\n"
+		"\t[-f on|off,...] benchmark flushable settings\n"
+		"\t[-k csv|json] benchmark output format (default = csv)\n");
 }
 
 int main(int argc, char *argv[])
 {
 	struct sigaction sa;
-	int opt, sk, mode = RECV, need_addr = 0;
+	int opt, sk, i, mode = RECV, need_addr = 0;
 
 	bacpy(&bdaddr, BDADDR_ANY);
 
-	while ((opt = getopt(argc, argv, "rdscuwmntqxyzpb:a:"
+	while ((opt = getopt(argc, argv, "rdscuwmntqxyzpegb:a:l:o:f:k:"
 		"i:P:I:O:J:B:N:L:W:C:D:X:F:Q:Z:Y:H:K:V:RUGAESMT")) != EOF) {
 		switch (opt) {
 		case 'r':
@@ -1316,10 +1658,57 @@ int main(int argc, char *argv[])
 			need_addr = 1;
 			break;
 
+		case 'e':
+			mode = BENCH;
+			need_addr = 1;
+			break;
+
+		case 'g':
+			mode = LBENCH;
+			break;
+
 		case 'b':
 			data_size = atoi(optarg);
 			break;
 
+		case 'l':
+			bench_num_mtus = bench_parse_list(optarg, bench_mtus,
+							BENCH_MAX_RUNS);
+			if (bench_num_mtus < 0) {
+				usage();
+				exit(1);
+			}
+			break;
+
+		case 'o':
+			bench_num_modes = get_lookup_list(l2cap_modes, optarg,
+						bench_modes, BENCH_MAX_RUNS);
+			if (bench_num_modes < 0) {
+				print_lookup_values(l2cap_modes,
+						"List L2CAP modes:");
+				exit(1);
+			}
+			break;
+
+		case 'f':
+			bench_num_flush = get_lookup_list(flush_settings,
+					optarg, bench_flush, BENCH_MAX_RUNS);
+			if (bench_num_flush < 0) {
+				print_lookup_values(flush_settings,
+						"List flushable settings:");
+				exit(1);
+			}
+			break;
+
+		case 'k':
+			bench_format = get_lookup_flag(bench_formats, optarg);
+			if (bench_format < 0) {
+				print_lookup_values(bench_formats,
+						"List output formats:");
+				exit(1);
+			}
+			break;
+
 		case 'i':
 			if (!strncasecmp(optarg, "hci", 3))
 				hci_devba(atoi(optarg + 3), &bdaddr);
@@ -1472,6 +1861,10 @@ int main(int argc, char *argv[])
 	else
 		buffer_size = data_size;
 
+	for (i = 0; i < bench_num_mtus; i++)
+		if (bench_mtus[i] > buffer_size)
+			buffer_size = bench_mtus[i];
+
 	if (!(buf = malloc(buffer_size))) {
 		perror("Can't allocate data buffer");
 		exit(1);
@@ -1553,6 +1946,14 @@ int main(int argc, char *argv[])
 		case PAIRING:
 			do_pairing(argv[optind]);
 			exit(0);
+
+		case BENCH:
+			bench_mode(argv[optind]);
+			break;
+
+		case LBENCH:
+			bench_listen_mode();
+			break;
 	}
 
 	syslog(LOG_INFO, "Exit");
@@ -54,18 +54,46 @@ void init_parser(unsigned long flags, unsigned long filter,
 	parser.audio_fd   = audio_fd;
 }
 
-#define PROTO_TABLE_SIZE 20
+/*
+ * Protocol and reassembly state is kept in small chained hash tables,
+ * so the number of concurrent connections and channels is not capped.
+ */
+#define HASH_SIZE 64
 
-static struct {
+struct proto_entry {
 	uint16_t handle;
 	uint16_t psm;
 	uint8_t  channel;
 	uint32_t proto;
-} proto_table[PROTO_TABLE_SIZE];
+	struct proto_entry *next;
+};
+
+static struct proto_entry *proto_table[HASH_SIZE];
+
+static unsigned int proto_hash(uint16_t handle, uint16_t psm, uint8_t channel)
+{
+	return (handle * 31 + psm * 7 + channel) % HASH_SIZE;
+}
+
+static struct proto_entry *find_proto(uint16_t handle, uint16_t psm,
+							uint8_t channel)
+{
+	struct proto_entry *p;
+
+	p = proto_table[proto_hash(handle, psm, channel)];
+
+	for (; p; p = p->next)
+		if (p->handle == handle && p->psm == psm &&
+							p->channel == channel)
+			return p;
+
+	return NULL;
+}
 
 void set_proto(uint16_t handle, uint16_t psm, uint8_t channel, uint32_t proto)
 {
-	int i, pos = -1;
+	struct proto_entry *p;
+	unsigned int h;
 
 	if (psm > 0 && psm < 0x1000 && !channel)
 		return;
@@ -73,117 +101,164 @@ void set_proto(uint16_t handle, uint16_t psm, uint8_t channel, uint32_t proto)
 	if (!psm && channel)
 		psm = RFCOMM_PSM; 
 
-	for (i = 0; i < PROTO_TABLE_SIZE; i++) {
-		if (proto_table[i].handle == handle && proto_table[i].psm == psm && proto_table[i].channel == channel) {
-			pos = i;
-			break;
-		}
-
-		if (pos < 0 && !proto_table[i].handle && !proto_table[i].psm && !proto_table[i].channel)
-			pos = i;
+	p = find_proto(handle, psm, channel);
+	if (p) {
+		p->proto = proto;
+		return;
 	}
 
-	if (pos < 0)
+	p = malloc(sizeof(*p));
+	if (!p) {
+		perror("Can't allocate protocol entry");
 		return;
+	}
+
+	h = proto_hash(handle, psm, channel);
 
-	proto_table[pos].handle  = handle;
-	proto_table[pos].psm     = psm;
-	proto_table[pos].channel = channel;
-	proto_table[pos].proto   = proto;
+	p->handle  = handle;
+	p->psm     = psm;
+	p->channel = channel;
+	p->proto   = proto;
+	p->next    = proto_table[h];
+	proto_table[h] = p;
 }
 
 uint32_t get_proto(uint16_t handle, uint16_t psm, uint8_t channel)
 {
-	int i, pos = -1;
+	struct proto_entry *p;
 
 	if (!psm && channel)
 		psm = RFCOMM_PSM;
 
-	for (i = 0; i < PROTO_TABLE_SIZE; i++) {
-		if (proto_table[i].handle == handle && proto_table[i].psm == psm && proto_table[i].channel == channel)
-			return proto_table[i].proto;
+	p = find_proto(handle, psm, channel);
+	if (p)
+		return p->proto;
 
-		if (!proto_table[i].handle) {
-			if (proto_table[i].psm == psm && proto_table[i].channel == channel)
-				pos = i;
-		}
-	}
+	/* Fall back to the defaults given on the command line */
+	p = find_proto(0, psm, channel);
 
-	return (pos < 0) ? 0 : proto_table[pos].proto;
+	return p ? p->proto : 0;
 }
 
-#define FRAME_TABLE_SIZE 20
-
-static struct {
+struct frame_entry {
 	uint16_t handle;
 	uint8_t dlci;
 	uint8_t opcode;
 	uint8_t status;
 	struct frame frm;
-} frame_table[FRAME_TABLE_SIZE];
+	uint32_t size;		/* allocated size of frm.data */
+	struct frame_entry *next;
+};
+
+static struct frame_entry *frame_table[HASH_SIZE];
+
+static unsigned int frame_hash(uint16_t handle, uint8_t dlci)
+{
+	return (handle * 31 + dlci) % HASH_SIZE;
+}
+
+static struct frame_entry *find_frame(uint16_t handle, uint8_t dlci)
+{
+	struct frame_entry *f;
+
+	for (f = frame_table[frame_hash(handle, dlci)]; f; f = f->next)
+		if (f->handle == handle && f->dlci == dlci)
+			return f;
+
+	return NULL;
+}
 
 void del_frame(uint16_t handle, uint8_t dlci)
 {
-	int i;
-
-	for (i = 0; i < FRAME_TABLE_SIZE; i++)
-		if (frame_table[i].handle == handle &&
-					frame_table[i].dlci == dlci) {
-			frame_table[i].handle = 0;
-			frame_table[i].dlci   = 0;
-			frame_table[i].opcode = 0;
-			frame_table[i].status = 0;
-			if (frame_table[i].frm.data)
-				free(frame_table[i].frm.data);
-			memset(&frame_table[i].frm, 0, sizeof(struct frame));
-			break;
-		}
+	struct frame_entry **f, *entry;
+
+	for (f = &frame_table[frame_hash(handle, dlci)]; *f; f = &(*f)->next) {
+		if ((*f)->handle != handle || (*f)->dlci != dlci)
+			continue;
+
+		entry = *f;
+		*f = entry->next;
+
+		free(entry->frm.data);
+		free(entry);
+		break;
+	}
 }
 
-struct frame *add_frame(struct frame *frm)
+/*
+ * Make room for len more bytes after the pending data of fr. Already
+ * consumed data at the head of the buffer is only reclaimed and the
+ * buffer is only grown when the tail runs out, so appending fragments
+ * is amortized linear in the size of the reassembled SDU.
+ */
+static int reserve_frame(struct frame_entry *entry, uint32_t len)
 {
-	struct frame *fr;
+	struct frame *fr = &entry->frm;
+	uint32_t offset = fr->ptr ? fr->ptr - fr->data : 0;
+	uint32_t size;
 	void *data;
-	int i, pos = -1;
 
-	for (i = 0; i < FRAME_TABLE_SIZE; i++) {
-		if (frame_table[i].handle == frm->handle &&
-					frame_table[i].dlci == frm->dlci) {
-			pos = i;
-			break;
-		}
+	if (offset + fr->len + len <= entry->size)
+		return 0;
 
-		if (pos < 0 && !frame_table[i].handle && !frame_table[i].dlci)
-			pos = i;
+	if (offset > 0) {
+		memmove(fr->data, fr->ptr, fr->len);
+		fr->ptr = fr->data;
+
+		if (fr->len + len <= entry->size)
+			return 0;
 	}
 
-	if (pos < 0)
-		return frm;
+	size = entry->size ? entry->size : 256;
+	while (size < fr->len + len)
+		size *= 2;
+
+	data = realloc(fr->data, size);
+	if (!data)
+		return -ENOMEM;
+
+	fr->data = data;
+	fr->ptr = data;
+	entry->size = size;
+
+	return 0;
+}
+
+struct frame *add_frame(struct frame *frm)
+{
+	struct frame_entry *entry;
+	struct frame *fr;
+	unsigned int h;
+
+	entry = find_frame(frm->handle, frm->dlci);
+	if (!entry) {
+		entry = calloc(1, sizeof(*entry));
+		if (!entry) {
+			perror("Can't allocate frame stream");
+			return frm;
+		}
 
-	frame_table[pos].handle = frm->handle;
-	frame_table[pos].dlci   = frm->dlci;
-	fr = &frame_table[pos].frm;
+		h = frame_hash(frm->handle, frm->dlci);
+
+		entry->handle = frm->handle;
+		entry->dlci   = frm->dlci;
+		entry->next   = frame_table[h];
+		frame_table[h] = entry;
+	}
 
-	data = malloc(fr->len + frm->len);
-	if (!data) {
+	fr = &entry->frm;
+
+	if (reserve_frame(entry, frm->len) < 0) {
 		perror("Can't allocate frame stream buffer");
 		del_frame(frm->handle, frm->dlci);
 		return frm;
 	}
 
-	if (fr->len > 0)
-		memcpy(data, fr->ptr, fr->len);
-
 	if (frm->len > 0)
-		memcpy(data + fr->len, frm->ptr, frm->len);
+		memcpy(fr->ptr + fr->len, frm->ptr, frm->len);
 
-	if (fr->data)
-		free(fr->data);
-
-	fr->data       = data;
-	fr->data_len   = fr->len + frm->len;
-	fr->len        = fr->data_len;
-	fr->ptr        = fr->data;
+	fr->len       += frm->len;
+	fr->data_len   = fr->ptr - fr->data + fr->len;
 	fr->dev_id     = frm->dev_id;
 	fr->in         = frm->in;
 	fr->ts         = frm->ts;
@@ -200,50 +275,32 @@ struct frame *add_frame(struct frame *frm)
 
 uint8_t get_opcode(uint16_t handle, uint8_t dlci)
 {
-	int i;
-
-	for (i = 0; i < FRAME_TABLE_SIZE; i++)
-		if (frame_table[i].handle == handle &&
-					frame_table[i].dlci == dlci)
-			return frame_table[i].opcode;
+	struct frame_entry *entry = find_frame(handle, dlci);
 
-	return 0x00;
+	return entry ? entry->opcode : 0x00;
 }
 
 void set_opcode(uint16_t handle, uint8_t dlci, uint8_t opcode)
 {
-	int i;
+	struct frame_entry *entry = find_frame(handle, dlci);
 
-	for (i = 0; i < FRAME_TABLE_SIZE; i++)
-		if (frame_table[i].handle == handle && 
-					frame_table[i].dlci == dlci) {
-			frame_table[i].opcode = opcode;
-			break;
-		}
+	if (entry)
+		entry->opcode = opcode;
 }
 
 uint8_t get_status(uint16_t handle, uint8_t dlci)
 {
-	int i;
-
-	for (i = 0; i < FRAME_TABLE_SIZE; i++)
-		if (frame_table[i].handle == handle &&
-					frame_table[i].dlci == dlci)
-			return frame_table[i].status;
+	struct frame_entry *entry = find_frame(handle, dlci);
 
-	return 0x00;
+	return entry ? entry->status : 0x00;
 }
 
 void set_status(uint16_t handle, uint8_t dlci, uint8_t status)
 {
-	int i;
+	struct frame_entry *entry = find_frame(handle, dlci);
 
-	for (i = 0; i < FRAME_TABLE_SIZE; i++)
-		if (frame_table[i].handle == handle &&
-					frame_table[i].dlci == dlci) {
-			frame_table[i].status = status;
-			break;
-		}
+	if (entry)
+		entry->status = status;
 }
 
 void ascii_dump(int level, struct frame *frm, int num)
@@ -36,6 +36,7 @@
 #include <syslog.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <sys/poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -47,6 +48,8 @@
 #include <bluetooth/sdp.h>
 #include <bluetooth/sdp_lib.h>
 
+#include "bench.h"
+
 /* Test modes */
 enum {
 	SEND,
@@ -58,6 +61,8 @@ enum {
 	CRECV,
 	LSEND,
 	AUTO,
+	BENCH,
+	LBENCH,
 };
 
 static unsigned char *buf;
@@ -92,6 +97,11 @@ static int timestamp = 0;
 static int defer_setup = 0;
 static int priority = -1;
 
+/* Benchmark sweep */
+static int bench_sizes[BENCH_MAX_RUNS];
+static int bench_num_sizes = 0;
+static int bench_format = BENCH_FORMAT_CSV;
+
 static float tv2fl(struct timeval tv)
 {
 	return (float)tv.tv_sec + (float)(tv.tv_usec/1000000.0);
@@ -591,6 +601,177 @@ static void send_mode(int sk)
 		syslog(LOG_INFO, "Done");
 }
 
+/*
+ * RFCOMM is a stream, so frames are batched into a single send and the
+ * receiver splits them again using the length from each frame header.
+ */
+static void bench_recv_mode(int sk)
+{
+	static uint8_t data[65536];
+	struct bench_stats *stats;
+	struct bench_result res;
+	uint8_t reply[BENCH_RESULT_SIZE];
+	uint64_t now;
+	size_t used = 0, off;
+	uint16_t len;
+	ssize_t n;
+
+	stats = bench_stats_new();
+	if (!stats) {
+		syslog(LOG_ERR, "Can't allocate benchmark buffers");
+		exit(1);
+	}
+
+	syslog(LOG_INFO, "Receiving benchmark ...");
+
+	while (1) {
+		n = recv(sk, data + used, sizeof(data) - used, 0);
+		if (n <= 0) {
+			syslog(LOG_ERR, "Read failed: %s (%d)",
+							strerror(errno), errno);
+			goto done;
+		}
+
+		now = bench_now();
+		used += n;
+
+		for (off = 0; used - off >= BENCH_HDR_SIZE; off += len) {
+			len = bt_get_le16(data + off + 4);
+			if (len < BENCH_HDR_SIZE) {
+				syslog(LOG_ERR, "Invalid frame length %u", len);
+				goto done;
+			}
+
+			if (used - off < len)
+				break;
+
+			if (bench_stats_add(stats, data + off, len, now))
+				goto reply;
+		}
+
+		memmove(data, data + off, used - off);
+		used -= off;
+	}
+
+reply:
+	bench_stats_result(stats, &res);
+	bench_result_encode(&res, reply);
+
+	if (send(sk, reply, sizeof(reply), 0) < 0)
+		syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+
+	syslog(LOG_INFO, "%u frames, %u lost, %llu bytes in %.3f sec",
+				res.frames, res.lost,
+				(unsigned long long) res.bytes,
+				res.elapsed / 1e6);
+
+	/* Wait for the sender to disconnect */
+	while (recv(sk, data, sizeof(data), 0) > 0);
+
+done:
+	bench_stats_free(stats);
+}
+
+static int bench_send(int sk, uint8_t *frames, int len)
+{
+	uint32_t seq = 0;
+	uint64_t now;
+	int i, n, left;
+	ssize_t sent, size;
+
+	memset(frames, 0x7f, len * BENCH_BATCH);
+
+	left = num_frames < 0 ? BENCH_FRAMES : num_frames;
+
+	while (left > 0) {
+		n = left < BENCH_BATCH ? left : BENCH_BATCH;
+		now = bench_now();
+
+		for (i = 0; i < n; i++)
+			bench_put_header(frames + i * len, seq++, len, now);
+
+		for (size = 0; size < n * len; size += sent) {
+			sent = send(sk, frames + size, n * len - size, 0);
+			if (sent <= 0) {
+				syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+				return -1;
+			}
+		}
+
+		left -= n;
+	}
+
+	bench_put_header(frames, BENCH_END_SEQ, BENCH_HDR_SIZE, bench_now());
+
+	if (send(sk, frames, BENCH_HDR_SIZE, 0) != BENCH_HDR_SIZE) {
+		syslog(LOG_ERR, "Send failed: %s (%d)",
+							strerror(errno), errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void bench_run(char *svr, int size)
+{
+	struct bench_result res;
+	uint8_t reply[BENCH_RESULT_SIZE];
+	struct pollfd p;
+	uint8_t *frames = NULL;
+	int sk;
+
+	if (size < BENCH_HDR_SIZE || size > UINT16_MAX) {
+		syslog(LOG_ERR, "Invalid benchmark frame size %d", size);
+		return;
+	}
+
+	sk = do_connect(svr);
+	if (sk < 0)
+		return;
+
+	frames = malloc(size * BENCH_BATCH);
+	if (!frames) {
+		syslog(LOG_ERR, "Can't allocate benchmark buffers");
+		goto done;
+	}
+
+	if (bench_send(sk, frames, size) < 0)
+		goto done;
+
+	p.fd = sk;
+	p.events = POLLIN;
+
+	if (poll(&p, 1, BENCH_TIMEOUT) <= 0 || recv(sk, reply, sizeof(reply),
+					MSG_WAITALL) != sizeof(reply)) {
+		syslog(LOG_ERR, "No benchmark result for size %d", size);
+		goto done;
+	}
+
+	bench_result_decode(&res, reply);
+	bench_output_row("rfcomm", size, -1, &res);
+
+done:
+	free(frames);
+	close(sk);
+}
+
+static void bench_mode(char *svr)
+{
+	int i;
+
+	if (!bench_num_sizes)
+		bench_sizes[bench_num_sizes++] = data_size;
+
+	bench_output_start(bench_format);
+
+	for (i = 0; i < bench_num_sizes; i++)
+		bench_run(svr, bench_sizes[i]);
+
+	bench_output_end();
+}
+
 static void reconnect_mode(char *svr)
 {
 	while(1) {
@@ -672,7 +853,9 @@ static void usage(void)
 		"\t-n connect and be silent\n"
 		"\t-c connect, disconnect, connect, ...\n"
 		"\t-m multiple connects\n"
-		"\t-a automated test (receive hcix as parameter)\n");
+		"\t-a automated test (receive hcix as parameter)\n"
+		"\t-e connect and run benchmark\n"
+		"\t-g listen and answer benchmark\n");
 
 	printf("Options:\n"
 		"\t[-b bytes] [-i device] [-P channel] [-U uuid]\n"
@@ -688,7 +871,9 @@ static void usage(void)
 		"\t[-E] request encryption\n"
 		"\t[-S] secure connection\n"
 		"\t[-M] become master\n"
-		"\t[-T] enable timestamps\n");
+		"\t[-T] enable timestamps\n"
+		"\t[-l bytes,...] benchmark frame sizes (default = -b bytes)\n"
+		"\t[-k csv|json] benchmark output format (default = csv)\n");
 }
 
 int main(int argc, char *argv[])
@@ -699,7 +884,7 @@ int main(int argc, char *argv[])
 	bacpy(&bdaddr, BDADDR_ANY);
 	bacpy(&auto_bdaddr, BDADDR_ANY);
 
-	while ((opt=getopt(argc,argv,"rdscuwmna:b:i:P:U:B:O:N:MAESL:W:C:D:Y:T")) != EOF) {
+	while ((opt=getopt(argc,argv,"rdscuwmnega:b:i:P:U:B:O:N:MAESL:W:C:D:Y:Tl:k:")) != EOF) {
 		switch (opt) {
 		case 'r':
 			mode = RECV;
@@ -747,10 +932,41 @@ int main(int argc, char *argv[])
 				str2ba(optarg, &auto_bdaddr);
 			break;
 
+		case 'e':
+			mode = BENCH;
+			need_addr = 1;
+			break;
+
+		case 'g':
+			mode = LBENCH;
+			break;
+
 		case 'b':
 			data_size = atoi(optarg);
 			break;
 
+		case 'l':
+			bench_num_sizes = bench_parse_list(optarg, bench_sizes,
+							BENCH_MAX_RUNS);
+			if (bench_num_sizes < 0) {
+				usage();
+				exit(1);
+			}
+			break;
+
+		case 'k':
+			if (!strcasecmp(optarg, "csv"))
+				bench_format = BENCH_FORMAT_CSV;
+			else if (!strcasecmp(optarg, "json"))
+				bench_format = BENCH_FORMAT_JSON;
+			else {
+				fprintf(stderr, "Unknown output format: %s\n",
+									optarg);
+				usage();
+				exit(1);
+			}
+			break;
+
 		case 'i':
 			if (!strncasecmp(optarg, "hci", 3))
 				hci_devba(atoi(optarg + 3), &bdaddr);
@@ -894,6 +1110,14 @@ int main(int argc, char *argv[])
 		case AUTO:
 			automated_send_recv();
 			break;
+
+		case BENCH:
+			bench_mode(argv[optind]);
+			break;
+
+		case LBENCH:
+			do_listen(bench_recv_mode);
+			break;
 	}
 
 	syslog(LOG_INFO, "Exit");
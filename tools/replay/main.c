@@ -34,10 +34,13 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 
 #include "main.h"
 #include "time.h"
@@ -55,6 +58,10 @@
 
 #define TIMING_NONE 0
 #define TIMING_DELTA 1
+#define TIMING_MAX 2
+
+/* Delay before the first packet when replaying traces in parallel */
+#define PARALLEL_START_DELAY 100000
 
 static struct hciseq_list dumpseq;
 static struct hciseq_type_cfg type_cfg;
@@ -62,7 +69,19 @@ static struct hciseq_type_cfg type_cfg;
 static int fd;
 static int pos = 1;
 static int skipped = 0;
-static struct timeval start;
+static struct timespec start;
+static struct timespec deadline;
+
+static struct {
+	unsigned int frames;
+	unsigned long long bytes;
+	unsigned int paced;
+	long long lat_min;
+	long long lat_max;
+	long long lat_sum;
+	long long jitter_sum;
+	long long lat_last;
+} stats;
 
 static int epoll_fd;
 static struct epoll_event epoll_event;
@@ -166,6 +185,7 @@ static int parse_dump(int fd, struct hciseq_list *seq)
 		if (n <= 0) {
 			free(frm->data);
 			free(frm);
+			seq->current = last;
 			return n;
 		}
 
@@ -223,9 +243,116 @@ static void dump_frame(struct frame *frm)
 	}
 }
 
+static long long timespec_to_usec(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000LL + ts->tv_nsec / 1000;
+}
+
+static void timespec_add_usec(struct timespec *ts, long long usec)
+{
+	ts->tv_sec += usec / 1000000;
+	ts->tv_nsec += (usec % 1000000) * 1000;
+
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
 static int send_frm(struct frame *frm)
 {
-	return write(fd, frm->data, frm->data_len);
+	struct pollfd p;
+	int n;
+
+	/* wait for the host stack instead of dropping the packet */
+	while ((n = write(fd, frm->data, frm->data_len)) < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			break;
+
+		p.fd = fd;
+		p.events = POLLOUT;
+		poll(&p, 1, -1);
+	}
+
+	return n;
+}
+
+/*
+ * Deadlines are absolute and advance by the recorded delta of each
+ * packet, so processing time and oversleeping do not accumulate over
+ * the whole replay.
+ */
+static void wait_deadline(const struct timeval *diff)
+{
+	struct timespec now;
+	long long delay;
+
+	delay = (diff->tv_sec * 1000000LL + diff->tv_usec) * factor;
+	timespec_add_usec(&deadline, delay);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (timespec_to_usec(&now) > timespec_to_usec(&deadline)) {
+		/* exec time was longer than delay */
+		printf("Packet delay - processing previous packet took longer than recorded time difference\n");
+		return;
+	}
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+						&deadline, NULL) == EINTR);
+}
+
+static void update_stats(struct frame *frm)
+{
+	struct timespec now;
+	long long lat;
+
+	stats.frames++;
+	stats.bytes += frm->data_len;
+
+	if (timing != TIMING_DELTA)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	lat = timespec_to_usec(&now) - timespec_to_usec(&deadline);
+
+	if (stats.paced == 0 || lat < stats.lat_min)
+		stats.lat_min = lat;
+
+	if (stats.paced == 0 || lat > stats.lat_max)
+		stats.lat_max = lat;
+
+	if (stats.paced > 0)
+		stats.jitter_sum += llabs(lat - stats.lat_last);
+
+	stats.lat_last = lat;
+	stats.lat_sum += lat;
+	stats.paced++;
+}
+
+static void print_stats(const char *name)
+{
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (timespec_to_usec(&now) - timespec_to_usec(&start)) / 1e6;
+	if (elapsed <= 0)
+		elapsed = 1e-6;
+
+	printf("%s: sent %u packets (%llu bytes) in %.3f s, "
+				"%.1f packets/s, %.1f kB/s\n", name,
+				stats.frames, stats.bytes, elapsed,
+				stats.frames / elapsed,
+				stats.bytes / elapsed / 1000);
+
+	if (stats.paced == 0)
+		return;
+
+	printf("%s: deadline lateness min %lld avg %lld max %lld usec, "
+				"jitter %lld usec\n", name,
+				stats.lat_min, stats.lat_sum / stats.paced,
+				stats.lat_max, stats.paced > 1 ?
+				stats.jitter_sum / (stats.paced - 1) : 0);
 }
 
 static int recv_frm(int fd, struct frame *frm)
@@ -464,9 +591,13 @@ static bool process_out()
 	switch (pkt_type) {
 	case BT_H4_EVT_PKT:
 	case BT_H4_ACL_PKT:
-		printf("[%4d/%4d] ", pos, dumpseq.len);
-		dump_frame(dumpseq.current->frame);
-		send_frm(dumpseq.current->frame);
+		/* decoding dominates the cost of a max speed replay */
+		if (timing != TIMING_MAX || verbose) {
+			printf("[%4d/%4d] ", pos, dumpseq.len);
+			dump_frame(dumpseq.current->frame);
+		}
+		if (send_frm(dumpseq.current->frame) > 0)
+			update_stats(dumpseq.current->frame);
 		break;
 	default:
 		printf("Unsupported packet 0x%2.2x\n", pkt_type);
@@ -476,13 +607,13 @@ static bool process_out()
 	return true;
 }
 
-static void process()
+static void process(const char *name)
 {
-	struct timeval last, last_diff;
-	__useconds_t delay;
 	bool processed;
 
-	gettimeofday(&last, NULL);
+	deadline = start;
+	memset(&stats, 0, sizeof(stats));
+
 	do {
 		if (dumpseq.current->attr->action == HCISEQ_ACTION_SKIP) {
 			printf("[%4d/%4d] SKIPPING\n            ", pos,
@@ -494,22 +625,8 @@ static void process()
 		}
 
 		/* delay */
-		if (timing == TIMING_DELTA) {
-			/* consider exec time of process_out()/process_in() */
-			get_timeval_passed(&last, &last_diff);
-			if (timeval_cmp(&dumpseq.current->attr->ts_diff,
-					&last_diff) >= 0) {
-				delay = timeval_diff(&dumpseq.current->attr
-						->ts_diff, &last_diff, NULL);
-				delay *= factor;
-				if (usleep(delay) == -1)
-					printf("Delay failed\n");
-			} else {
-				/* exec time was longer than delay */
-				printf("Packet delay - processing previous packet took longer than recorded time difference\n");
-			}
-			gettimeofday(&last, NULL);
-		}
+		if (timing == TIMING_DELTA)
+			wait_deadline(&dumpseq.current->attr->ts_diff);
 
 		if (dumpseq.current->frame->in == 1)
 			processed = process_out();
@@ -525,6 +642,7 @@ static void process()
 	printf("Done\n");
 	printf("Processed %d out of %d\n", dumpseq.len - skipped,
 							dumpseq.len);
+	print_stats(name);
 }
 
 static int vhci_open()
@@ -585,10 +703,11 @@ static void usage(void)
 	printf("hcireplay - Bluetooth replayer\n"
 	       "Usage:\thcireplay-client [options] file...\n"
 	       "options:\n"
-	       "\t-d, --delay-mode={none|delta}    Specify delay mode (default is none)\n"
+	       "\t-d, --delay-mode={none|delta|max} Specify delay mode (default is none)\n"
 	       "\t-m, --delay-modifier=N           Set delay modifier to N (default is 1)\n"
 	       "\t-t, --timeout=N                  Set timeout to N milliseconds when receiving packets from host\n"
 	       "\t-e, --btdev-type=TYPE            Set emulator device type\n"
+	       "\t-p, --parallel                   Replay each file on its own controller\n"
 	       "\t-v, --verbose                    Enable verbose output\n"
 	       "\t    --version                    Give version information\n"
 	       "\t    --help                       Give a short usage message\n");
@@ -599,22 +718,137 @@ static const struct option main_options[] = {
 	{"delay-modifier", required_argument, NULL, 'm'},
 	{"timeout", required_argument, NULL, 't'},
 	{"btdev-type", required_argument, NULL, 'e'},
+	{"parallel", no_argument, NULL, 'p'},
 	{"verbose", no_argument, NULL, 'v'},
 	{"version", no_argument, NULL, 'V'},
 	{"help", no_argument, NULL, 'H'},
 	{}
 };
 
+static int replay(const char *name, enum btdev_type btdev_type)
+{
+	dumpseq.current = dumpseq.frames;
+	calc_rel_ts(&dumpseq);
+
+	/* init emulator */
+	btdev = btdev_create(btdev_type, 0);
+	btdev_set_send_handler(btdev, btdev_send, NULL);
+
+	/*
+	 * make sure we open the interface after parsing
+	 * through all files so we can start without delay
+	 */
+	fd = vhci_open();
+	if (fd < 0) {
+		perror("Failed to open VHCI interface");
+		btdev_destroy(btdev);
+		return EXIT_FAILURE;
+	}
+
+	printf("Running\n");
+
+	process(name);
+
+	vhci_close();
+	btdev_destroy(btdev);
+
+	return EXIT_SUCCESS;
+}
+
+static int parse_file(const char *path, struct hciseq_list *seq)
+{
+	int dumpfd, err;
+
+	dumpfd = open(path, O_RDONLY);
+	if (dumpfd < 0) {
+		perror("Failed to open dump file");
+		return -1;
+	}
+
+	err = parse_dump(dumpfd, seq);
+	close(dumpfd);
+
+	if (err < 0) {
+		fprintf(stderr, "Error parsing dump file\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Replay every file on its own virtual controller. Each replay runs in
+ * a child process so the per controller state stays untouched, and all
+ * of them share the same start time.
+ */
+static int replay_parallel(int count, char *files[],
+						enum btdev_type btdev_type)
+{
+	struct hciseq_list *seqs;
+	pid_t *pids;
+	int i, status, result = EXIT_SUCCESS;
+
+	seqs = calloc(count, sizeof(*seqs));
+	pids = calloc(count, sizeof(*pids));
+
+	for (i = 0; i < count; i++) {
+		if (parse_file(files[i], &seqs[i]) < 0 ||
+						seqs[i].frames == NULL) {
+			result = EXIT_FAILURE;
+			goto done;
+		}
+	}
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	timespec_add_usec(&start, PARALLEL_START_DELAY);
+
+	for (i = 0; i < count; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			perror("Failed to start replay");
+			result = EXIT_FAILURE;
+			break;
+		}
+
+		if (pids[i] == 0) {
+			dumpseq = seqs[i];
+			exit(replay(files[i], btdev_type));
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (pids[i] <= 0)
+			continue;
+
+		if (waitpid(pids[i], &status, 0) < 0 ||
+				!WIFEXITED(status) || WEXITSTATUS(status))
+			result = EXIT_FAILURE;
+	}
+
+done:
+	for (i = 0; i < count; i++) {
+		dumpseq = seqs[i];
+		delete_list();
+	}
+
+	free(pids);
+	free(seqs);
+
+	return result;
+}
+
 int main(int argc, char *argv[])
 {
-	int dumpfd;
-	int i;
+	int i, result;
+	bool parallel = false;
 	enum btdev_type btdev_type = BTDEV_TYPE_BREDRLE;
 
 	while (1) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "d:m:t:ev",
+		opt = getopt_long(argc, argv, "d:m:t:e:pv",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -625,6 +859,8 @@ int main(int argc, char *argv[])
 				timing = TIMING_NONE;
 			else if (!strcmp(optarg, "delta"))
 				timing = TIMING_DELTA;
+			else if (!strcmp(optarg, "max"))
+				timing = TIMING_MAX;
 
 			break;
 		case 'm':
@@ -643,6 +879,9 @@ int main(int argc, char *argv[])
 			else if (!strcmp(optarg, "AMP"))
 				btdev_type = BTDEV_TYPE_AMP;
 
+			break;
+		case 'p':
+			parallel = true;
 			break;
 		case 'v':
 			verbose = true;
@@ -663,49 +902,33 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (parallel) {
+		result = replay_parallel(argc - optind, argv + optind,
+								btdev_type);
+		delete_type_cfg();
+		printf("Terminating\n");
+		return result;
+	}
+
 	dumpseq.current = NULL;
 	dumpseq.frames = NULL;
 	for (i = optind; i < argc; i++) {
-		dumpfd = open(argv[i], O_RDONLY);
-		if (dumpfd < 0) {
-			perror("Failed to open dump file");
-			return EXIT_FAILURE;
-		}
-
-		if (parse_dump(dumpfd, &dumpseq) < 0) {
-			fprintf(stderr, "Error parsing dump file\n");
-			vhci_close();
+		if (parse_file(argv[i], &dumpseq) < 0)
 			return EXIT_FAILURE;
-		}
 	}
-	dumpseq.current = dumpseq.frames;
-	calc_rel_ts(&dumpseq);
 
-	/* init emulator */
-	btdev = btdev_create(btdev_type, 0);
-	btdev_set_send_handler(btdev, btdev_send, NULL);
-
-	gettimeofday(&start, NULL);
-
-	/*
-	 * make sure we open the interface after parsing
-	 * through all files so we can start without delay
-	 */
-	fd = vhci_open();
-	if (fd < 0) {
-		perror("Failed to open VHCI interface");
+	if (dumpseq.frames == NULL) {
+		fprintf(stderr, "No packets to replay\n");
 		return EXIT_FAILURE;
 	}
 
-	printf("Running\n");
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	process();
+	result = replay("replay", btdev_type);
 
-	vhci_close();
-	btdev_destroy(btdev);
 	delete_list();
 	delete_type_cfg();
 	printf("Terminating\n");
 
-	return EXIT_SUCCESS;
+	return result;
 }
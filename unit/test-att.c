@@ -0,0 +1,588 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <glib.h>
+
+#include "lib/uuid.h"
+#include "attrib/att.h"
+#include "attrib/gattrib.h"
+#include "attrib/gatt.h"
+
+static const uint8_t read_by_type_pdu[] = {
+	ATT_OP_READ_BY_TYPE_RESP, 0x07,
+	0x02, 0x00, 0x02, 0x03, 0x00, 0x00, 0x2a,
+	0x04, 0x00, 0x02, 0x05, 0x00, 0x01, 0x2a,
+	0x06,				/* Incomplete entry */
+};
+
+static const uint8_t read_by_group_pdu[] = {
+	ATT_OP_READ_BY_GROUP_RESP, 0x06,
+	0x01, 0x00, 0x07, 0x00, 0x00, 0x18,
+	0x08, 0x00, 0x0b, 0x00, 0x01, 0x18,
+};
+
+static const uint8_t find_info_pdu[] = {
+	ATT_OP_FIND_INFO_RESP, ATT_FIND_INFO_RESP_FMT_16BIT,
+	0x01, 0x00, 0x00, 0x28,
+	0x02, 0x00, 0x03, 0x28,
+	0x03, 0x00, 0x00, 0x2a,
+};
+
+static const uint8_t find_by_type_pdu[] = {
+	ATT_OP_FIND_BY_TYPE_RESP,
+	0x01, 0x00, 0x07, 0x00,
+	0x10, 0x00, 0xff, 0xff,
+};
+
+struct iter_data {
+	const uint8_t *pdu;
+	size_t len;
+	uint16_t elen;
+	int num;
+};
+
+static const struct iter_data read_by_type_test = {
+	.pdu = read_by_type_pdu,
+	.len = sizeof(read_by_type_pdu),
+	.elen = 7,
+	.num = 2,
+};
+
+static const struct iter_data read_by_group_test = {
+	.pdu = read_by_group_pdu,
+	.len = sizeof(read_by_group_pdu),
+	.elen = 6,
+	.num = 2,
+};
+
+static const struct iter_data find_info_test = {
+	.pdu = find_info_pdu,
+	.len = sizeof(find_info_pdu),
+	.elen = 4,
+	.num = 3,
+};
+
+static const struct iter_data find_by_type_test = {
+	.pdu = find_by_type_pdu,
+	.len = sizeof(find_by_type_pdu),
+	.elen = 4,
+	.num = 2,
+};
+
+static void test_iter(gconstpointer data)
+{
+	const struct iter_data *test = data;
+	const uint8_t *entry, *expected;
+	struct att_iter iter;
+	struct att_list list;
+	uint8_t pdu[ATT_DEFAULT_LE_MTU];
+	uint8_t *out;
+	int num = 0;
+
+	g_assert(att_iter_init(&iter, test->pdu, test->len) == test->elen);
+
+	/* Entries start after the opcode and the length or format byte */
+	if (test->pdu[0] != ATT_OP_FIND_BY_TYPE_RESP)
+		expected = test->pdu + 2;
+	else
+		expected = test->pdu + 1;
+
+	att_list_init(&list, test->pdu[0], pdu, sizeof(pdu));
+
+	while ((entry = att_iter_next(&iter)) != NULL) {
+		g_assert(entry == expected);
+		expected += test->elen;
+
+		out = att_list_append(&list, test->elen);
+		g_assert(out != NULL);
+		memcpy(out, entry, test->elen);
+
+		num++;
+	}
+
+	g_assert_cmpint(num, ==, test->num);
+
+	/* Re-encoding the entries gives back the complete original PDU */
+	g_assert(att_list_finish(&list) == expected - test->pdu);
+	g_assert(memcmp(pdu, test->pdu, expected - test->pdu) == 0);
+}
+
+static void test_iter_invalid(void)
+{
+	const uint8_t zero_len[] = { ATT_OP_READ_BY_TYPE_RESP, 0x00, 0x01 };
+	const uint8_t short_group[] = { ATT_OP_READ_BY_GROUP_RESP, 0x03,
+							0x01, 0x00, 0x02 };
+	const uint8_t bad_format[] = { ATT_OP_FIND_INFO_RESP, 0x03,
+						0x01, 0x00, 0x00, 0x28 };
+	const uint8_t read_resp[] = { ATT_OP_READ_RESP, 0x01, 0x02 };
+	struct att_iter iter;
+
+	g_assert(att_iter_init(&iter, NULL, 0) == 0);
+	g_assert(att_iter_init(&iter, read_by_type_pdu, 1) == 0);
+	g_assert(att_iter_init(&iter, zero_len, sizeof(zero_len)) == 0);
+	g_assert(att_iter_init(&iter, short_group, sizeof(short_group)) == 0);
+	g_assert(att_iter_init(&iter, bad_format, sizeof(bad_format)) == 0);
+	g_assert(att_iter_init(&iter, read_resp, sizeof(read_resp)) == 0);
+
+	/* Valid header without any complete entry */
+	g_assert(att_iter_init(&iter, read_by_type_pdu, 8) == 7);
+	g_assert(att_iter_next(&iter) == NULL);
+}
+
+static void test_list_limits(void)
+{
+	struct att_list list;
+	uint8_t pdu[ATT_DEFAULT_LE_MTU];
+	int i;
+
+	/* Nothing appended */
+	att_list_init(&list, ATT_OP_READ_BY_TYPE_RESP, pdu, sizeof(pdu));
+	g_assert(att_list_finish(&list) == 0);
+
+	/* All entries must have the same length */
+	g_assert(att_list_append(&list, 4) != NULL);
+	g_assert(att_list_append(&list, 5) == NULL);
+	g_assert(pdu[1] == 4);
+
+	/* Stops once the PDU is full: (23 - 2) / 4 entries fit */
+	for (i = 1; att_list_append(&list, 4) != NULL; i++);
+	g_assert_cmpint(i, ==, 5);
+	g_assert(att_list_finish(&list) == 22);
+
+	/* Find Information format follows from the entry length */
+	att_list_init(&list, ATT_OP_FIND_INFO_RESP, pdu, sizeof(pdu));
+	g_assert(att_list_append(&list, 6) == NULL);
+	g_assert(att_list_append(&list, 18) != NULL);
+	g_assert(pdu[1] == ATT_FIND_INFO_RESP_FMT_128BIT);
+	g_assert(att_list_finish(&list) == 20);
+
+	/* Other opcodes do not carry a list */
+	att_list_init(&list, ATT_OP_READ_RESP, pdu, sizeof(pdu));
+	g_assert(att_list_append(&list, 2) == NULL);
+}
+
+/*
+ * Benchmark: every case encodes one PDU for the given MTU and decodes
+ * it again, returning the PDU length or 0 on failure.
+ */
+
+static uint8_t value[ATT_MAX_VALUE_LEN];
+
+/* Longest value fitting a PDU with the given header length */
+#define value_len(mtu, hdr) MIN((mtu) - (hdr), sizeof(value))
+
+typedef uint16_t (*bench_func_t) (uint8_t *pdu, size_t mtu);
+
+static uint16_t bench_error_resp(uint8_t *pdu, size_t mtu)
+{
+	return enc_error_resp(ATT_OP_READ_REQ, 0x0001,
+				ATT_ECODE_INVALID_HANDLE, pdu, mtu);
+}
+
+static uint16_t bench_mtu(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, client, server;
+
+	len = enc_mtu_req(mtu, pdu, mtu);
+	if (dec_mtu_req(pdu, len, &client) == 0)
+		return 0;
+
+	len = enc_mtu_resp(client, pdu, mtu);
+	if (dec_mtu_resp(pdu, len, &server) == 0)
+		return 0;
+
+	return len;
+}
+
+static uint16_t bench_find_info_req(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, start, end;
+
+	len = enc_find_info_req(0x0001, 0xffff, pdu, mtu);
+
+	return dec_find_info_req(pdu, len, &start, &end);
+}
+
+static uint16_t bench_find_info_resp(uint8_t *pdu, size_t mtu)
+{
+	struct att_list list;
+	struct att_iter iter;
+	const uint8_t *entry;
+	bt_uuid_t uuid;
+	uint16_t handle, len;
+	uint8_t *out;
+
+	bt_uuid16_create(&uuid, 0x2a00);
+
+	att_list_init(&list, ATT_OP_FIND_INFO_RESP, pdu, mtu);
+
+	for (handle = 1; (out = att_list_append(&list, 4)) != NULL; handle++) {
+		att_put_u16(handle, out);
+		att_put_uuid(uuid, &out[2]);
+	}
+
+	len = att_list_finish(&list);
+
+	if (att_iter_init(&iter, pdu, len) == 0)
+		return 0;
+
+	while ((entry = att_iter_next(&iter)) != NULL)
+		uuid = att_get_uuid16(&entry[2]);
+
+	return len;
+}
+
+static uint16_t bench_find_by_type_req(uint8_t *pdu, size_t mtu)
+{
+	uint8_t svc[2] = { 0x00, 0x18 }, out[2];
+	uint16_t len, start, end;
+	bt_uuid_t uuid;
+	size_t vlen;
+
+	bt_uuid16_create(&uuid, GATT_PRIM_SVC_UUID);
+
+	len = enc_find_by_type_req(0x0001, 0xffff, &uuid, svc, sizeof(svc),
+								pdu, mtu);
+
+	return dec_find_by_type_req(pdu, len, &start, &end, &uuid, out, &vlen);
+}
+
+static uint16_t bench_find_by_type_resp(uint8_t *pdu, size_t mtu)
+{
+	struct att_list list;
+	struct att_iter iter;
+	const uint8_t *entry;
+	uint16_t handle, len;
+	uint8_t *out;
+
+	att_list_init(&list, ATT_OP_FIND_BY_TYPE_RESP, pdu, mtu);
+
+	for (handle = 1; (out = att_list_append(&list, 4)) != NULL;
+								handle += 8) {
+		att_put_u16(handle, out);
+		att_put_u16(handle + 7, &out[2]);
+	}
+
+	len = att_list_finish(&list);
+
+	if (att_iter_init(&iter, pdu, len) == 0)
+		return 0;
+
+	while ((entry = att_iter_next(&iter)) != NULL)
+		handle = att_get_u16(&entry[2]);
+
+	return len;
+}
+
+static uint16_t bench_read_by_type_req(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, start, end;
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, GATT_CHARAC_UUID);
+
+	len = enc_read_by_type_req(0x0001, 0xffff, &uuid, pdu, mtu);
+
+	return dec_read_by_type_req(pdu, len, &start, &end, &uuid);
+}
+
+static uint16_t bench_read_by_type_resp(uint8_t *pdu, size_t mtu)
+{
+	struct att_list list;
+	struct att_iter iter;
+	const uint8_t *entry;
+	uint16_t handle, len;
+	uint8_t *out;
+
+	att_list_init(&list, ATT_OP_READ_BY_TYPE_RESP, pdu, mtu);
+
+	for (handle = 2; (out = att_list_append(&list, 7)) != NULL;
+								handle += 2) {
+		att_put_u16(handle, out);
+		out[2] = 0x02;
+		att_put_u16(handle + 1, &out[3]);
+		att_put_u16(0x2a00, &out[5]);
+	}
+
+	len = att_list_finish(&list);
+
+	if (att_iter_init(&iter, pdu, len) == 0)
+		return 0;
+
+	while ((entry = att_iter_next(&iter)) != NULL)
+		handle = att_get_u16(&entry[3]);
+
+	return len;
+}
+
+static uint16_t bench_read_by_type_resp_alloc(uint8_t *pdu, size_t mtu)
+{
+	struct att_data_list *list;
+	uint16_t handle, len;
+	int i;
+
+	list = att_data_list_alloc((mtu - 2) / 7, 7);
+
+	for (i = 0, handle = 2; i < list->num; i++, handle += 2) {
+		att_put_u16(handle, list->data[i]);
+		list->data[i][2] = 0x02;
+		att_put_u16(handle + 1, &list->data[i][3]);
+		att_put_u16(0x2a00, &list->data[i][5]);
+	}
+
+	len = enc_read_by_type_resp(list, pdu, mtu);
+	att_data_list_free(list);
+
+	list = dec_read_by_type_resp(pdu, len);
+	if (list == NULL)
+		return 0;
+
+	for (i = 0; i < list->num; i++)
+		handle = att_get_u16(&list->data[i][3]);
+
+	att_data_list_free(list);
+
+	return len;
+}
+
+static uint16_t bench_read_by_group_req(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, start, end;
+	bt_uuid_t uuid;
+
+	bt_uuid16_create(&uuid, GATT_PRIM_SVC_UUID);
+
+	len = enc_read_by_grp_req(0x0001, 0xffff, &uuid, pdu, mtu);
+
+	return dec_read_by_grp_req(pdu, len, &start, &end, &uuid);
+}
+
+static uint16_t bench_read_by_group_resp(uint8_t *pdu, size_t mtu)
+{
+	struct att_list list;
+	struct att_iter iter;
+	const uint8_t *entry;
+	bt_uuid_t uuid;
+	uint16_t handle, len;
+	uint8_t *out;
+
+	att_list_init(&list, ATT_OP_READ_BY_GROUP_RESP, pdu, mtu);
+
+	for (handle = 1; (out = att_list_append(&list, 20)) != NULL;
+								handle += 8) {
+		att_put_u16(handle, out);
+		att_put_u16(handle + 7, &out[2]);
+		memset(&out[4], handle, 16);
+	}
+
+	len = att_list_finish(&list);
+
+	if (att_iter_init(&iter, pdu, len) == 0)
+		return 0;
+
+	while ((entry = att_iter_next(&iter)) != NULL) {
+		uuid = att_get_uuid128(&entry[4]);
+		if (uuid.type != BT_UUID128)
+			return 0;
+	}
+
+	return len;
+}
+
+static uint16_t bench_read(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, handle;
+
+	len = enc_read_req(0x0003, pdu, mtu);
+	if (dec_read_req(pdu, len, &handle) == 0)
+		return 0;
+
+	len = enc_read_resp(value, value_len(mtu, 1), pdu, mtu);
+	if (dec_read_resp(pdu, len, value, sizeof(value)) < 0)
+		return 0;
+
+	return len;
+}
+
+static uint16_t bench_read_blob(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, handle, offset;
+
+	len = enc_read_blob_req(0x0003, ATT_DEFAULT_LE_MTU - 1, pdu, mtu);
+	if (dec_read_blob_req(pdu, len, &handle, &offset) == 0)
+		return 0;
+
+	/* Read Blob Response has no decoder, the value follows the opcode */
+	return enc_read_blob_resp(value, sizeof(value), offset, pdu, mtu);
+}
+
+static uint16_t bench_write(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, handle;
+	size_t vlen;
+
+	len = enc_write_req(0x0003, value, value_len(mtu, 3), pdu, mtu);
+	if (dec_write_req(pdu, len, &handle, value, &vlen) == 0)
+		return 0;
+
+	len = enc_write_resp(pdu, mtu);
+
+	return dec_write_resp(pdu, len);
+}
+
+static uint16_t bench_write_cmd(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, handle;
+	size_t vlen;
+
+	len = enc_write_cmd(0x0003, value, value_len(mtu, 3), pdu, mtu);
+
+	return dec_write_cmd(pdu, len, &handle, value, &vlen);
+}
+
+static uint16_t bench_prep_write(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, handle, offset;
+	size_t vlen;
+
+	len = enc_prep_write_req(0x0003, 0, value, value_len(mtu, 5), pdu, mtu);
+
+	/* The response echoes the request */
+	pdu[0] = ATT_OP_PREP_WRITE_RESP;
+
+	return dec_prep_write_resp(pdu, len, &handle, &offset, value, &vlen);
+}
+
+static uint16_t bench_exec_write(uint8_t *pdu, size_t mtu)
+{
+	enc_exec_write_req(ATT_WRITE_ALL_PREP_WRITES, pdu, mtu);
+
+	pdu[0] = ATT_OP_EXEC_WRITE_RESP;
+
+	return dec_exec_write_resp(pdu, 1);
+}
+
+static uint16_t bench_notification(uint8_t *pdu, size_t mtu)
+{
+	return enc_notification(0x0003, value, value_len(mtu, 3), pdu, mtu);
+}
+
+static uint16_t bench_indication(uint8_t *pdu, size_t mtu)
+{
+	uint16_t len, handle;
+
+	len = enc_indication(0x0003, value, value_len(mtu, 3), pdu, mtu);
+	if (dec_indication(pdu, len, &handle, value, sizeof(value)) == 0)
+		return 0;
+
+	return enc_confirmation(pdu, mtu);
+}
+
+static const struct {
+	const char *name;
+	bench_func_t func;
+} bench_cases[] = {
+	{ "Error Response", bench_error_resp },
+	{ "Exchange MTU", bench_mtu },
+	{ "Find Information Request", bench_find_info_req },
+	{ "Find Information Response", bench_find_info_resp },
+	{ "Find By Type Value Request", bench_find_by_type_req },
+	{ "Find By Type Value Response", bench_find_by_type_resp },
+	{ "Read By Type Request", bench_read_by_type_req },
+	{ "Read By Type Response", bench_read_by_type_resp },
+	{ "Read By Type Response (list)", bench_read_by_type_resp_alloc },
+	{ "Read By Group Type Request", bench_read_by_group_req },
+	{ "Read By Group Type Response", bench_read_by_group_resp },
+	{ "Read", bench_read },
+	{ "Read Blob", bench_read_blob },
+	{ "Write", bench_write },
+	{ "Write Command", bench_write_cmd },
+	{ "Prepare Write", bench_prep_write },
+	{ "Execute Write", bench_exec_write },
+	{ "Notification", bench_notification },
+	{ "Indication", bench_indication },
+	{ }
+};
+
+static void test_benchmark(gconstpointer data)
+{
+	size_t mtu = GPOINTER_TO_UINT(data);
+	unsigned int i, iterations;
+	uint8_t *pdu;
+	GTimer *timer;
+
+	iterations = g_test_perf() ? 1000000 : 100;
+
+	pdu = g_malloc0(mtu);
+	timer = g_timer_new();
+
+	for (i = 0; bench_cases[i].name; i++) {
+		unsigned int n;
+		double elapsed;
+
+		g_timer_start(timer);
+
+		for (n = 0; n < iterations; n++)
+			g_assert(bench_cases[i].func(pdu, mtu) > 0);
+
+		elapsed = g_timer_elapsed(timer, NULL);
+
+		if (g_test_perf())
+			g_test_minimized_result(elapsed * 1e9 / iterations,
+					"%s (MTU %zu): %.1f ns per PDU",
+					bench_cases[i].name, mtu,
+					elapsed * 1e9 / iterations);
+	}
+
+	g_timer_destroy(timer);
+	g_free(pdu);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_data_func("/att/iter/read_by_type", &read_by_type_test,
+								test_iter);
+	g_test_add_data_func("/att/iter/read_by_group", &read_by_group_test,
+								test_iter);
+	g_test_add_data_func("/att/iter/find_info", &find_info_test,
+								test_iter);
+	g_test_add_data_func("/att/iter/find_by_type", &find_by_type_test,
+								test_iter);
+	g_test_add_func("/att/iter/invalid", test_iter_invalid);
+	g_test_add_func("/att/list/limits", test_list_limits);
+
+	g_test_add_data_func("/att/benchmark/23",
+				GUINT_TO_POINTER(ATT_DEFAULT_LE_MTU),
+				test_benchmark);
+	g_test_add_data_func("/att/benchmark/185", GUINT_TO_POINTER(185),
+							test_benchmark);
+	g_test_add_data_func("/att/benchmark/517", GUINT_TO_POINTER(517),
+							test_benchmark);
+
+	return g_test_run();
+}
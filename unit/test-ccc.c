@@ -0,0 +1,166 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "lib/uuid.h"
+#include "attrib/att.h"
+#include "attrib/gattrib.h"
+#include "attrib/gatt.h"
+#include "src/ccc.h"
+
+static const char ccc_data[] =
+	"[18]\n"
+	"Value=1\n"
+	"[21]\n"
+	"Value=2\n"
+	"[24]\n"
+	"Value=3\n"
+	"[27]\n"
+	"Value=0\n"
+	"[30]\n"
+	"Other=1\n"
+	"[handle]\n"
+	"Value=1\n"
+	"[70000]\n"
+	"Value=1\n";
+
+static GHashTable *load_data(const char *data)
+{
+	GKeyFile *key_file;
+	GHashTable *ccc;
+
+	key_file = g_key_file_new();
+	g_assert(g_key_file_load_from_data(key_file, data, -1, 0, NULL));
+
+	ccc = ccc_new();
+	ccc_load(ccc, key_file);
+
+	g_key_file_free(key_file);
+
+	return ccc;
+}
+
+static void test_load(void)
+{
+	GHashTable *ccc = load_data(ccc_data);
+	uint16_t value;
+
+	g_assert(ccc_get(ccc, 18, &value));
+	g_assert_cmpuint(value, ==, GATT_CLIENT_CHARAC_CFG_NOTIF_BIT);
+
+	g_assert(ccc_get(ccc, 21, &value));
+	g_assert_cmpuint(value, ==, GATT_CLIENT_CHARAC_CFG_IND_BIT);
+
+	g_assert(ccc_get(ccc, 27, &value));
+	g_assert_cmpuint(value, ==, 0);
+
+	/* Groups without a value or a valid handle are ignored */
+	g_assert(!ccc_get(ccc, 30, &value));
+	g_assert_cmpuint(g_hash_table_size(ccc), ==, 4);
+
+	g_hash_table_destroy(ccc);
+}
+
+static void test_opcode(void)
+{
+	GHashTable *ccc = load_data(ccc_data);
+
+	g_assert_cmpuint(ccc_opcode(ccc, 18), ==, ATT_OP_HANDLE_NOTIFY);
+	g_assert_cmpuint(ccc_opcode(ccc, 21), ==, ATT_OP_HANDLE_IND);
+	g_assert_cmpuint(ccc_opcode(ccc, 24), ==, ATT_OP_HANDLE_NOTIFY);
+	g_assert_cmpuint(ccc_opcode(ccc, 27), ==, 0);
+	g_assert_cmpuint(ccc_opcode(ccc, 30), ==, 0);
+
+	g_hash_table_destroy(ccc);
+}
+
+static void test_set(void)
+{
+	GHashTable *ccc = load_data(ccc_data);
+	uint16_t value;
+
+	/* Writes from the client replace the stored configuration */
+	ccc_set(ccc, 18, 0);
+	g_assert_cmpuint(ccc_opcode(ccc, 18), ==, 0);
+
+	ccc_set(ccc, 27, GATT_CLIENT_CHARAC_CFG_IND_BIT);
+	g_assert_cmpuint(ccc_opcode(ccc, 27), ==, ATT_OP_HANDLE_IND);
+
+	ccc_set(ccc, 33, GATT_CLIENT_CHARAC_CFG_NOTIF_BIT);
+	g_assert(ccc_get(ccc, 33, &value));
+	g_assert_cmpuint(value, ==, GATT_CLIENT_CHARAC_CFG_NOTIF_BIT);
+
+	g_hash_table_destroy(ccc);
+}
+
+static void test_store(void)
+{
+	GKeyFile *key_file;
+	GHashTable *ccc;
+	uint16_t value;
+	char *data;
+
+	key_file = g_key_file_new();
+
+	ccc_store(key_file, 18, GATT_CLIENT_CHARAC_CFG_NOTIF_BIT);
+	ccc_store(key_file, 21, 0x0102);
+	ccc_store(key_file, 0xffff, GATT_CLIENT_CHARAC_CFG_IND_BIT);
+	ccc_store(key_file, 18, 0);
+
+	data = g_key_file_to_data(key_file, NULL, NULL);
+	g_key_file_free(key_file);
+
+	ccc = load_data(data);
+	g_free(data);
+
+	g_assert_cmpuint(g_hash_table_size(ccc), ==, 3);
+
+	g_assert(ccc_get(ccc, 18, &value));
+	g_assert_cmpuint(value, ==, 0);
+
+	/* The whole 16-bit value is kept */
+	g_assert(ccc_get(ccc, 21, &value));
+	g_assert_cmpuint(value, ==, 0x0102);
+
+	g_assert(ccc_get(ccc, 0xffff, &value));
+	g_assert_cmpuint(value, ==, GATT_CLIENT_CHARAC_CFG_IND_BIT);
+
+	g_hash_table_destroy(ccc);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/ccc/load", test_load);
+	g_test_add_func("/ccc/opcode", test_opcode);
+	g_test_add_func("/ccc/set", test_set);
+	g_test_add_func("/ccc/store", test_store);
+
+	return g_test_run();
+}
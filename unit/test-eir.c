@@ -601,6 +601,51 @@ static void test_parsing(gconstpointer data)
 	eir_data_free(&eir);
 }
 
+static void test_view(gconstpointer data)
+{
+	const struct test_data *test = data;
+	const uint8_t *start = test->eir_data;
+	struct eir_view view;
+
+	eir_parse_view(&view, test->eir_data, test->eir_size);
+
+	g_assert(view.flags == test->flags);
+	g_assert(view.tx_power == test->tx_power);
+
+	if (test->name) {
+		char *name;
+
+		/* The name refers to the parsed buffer */
+		g_assert(view.name > start);
+		g_assert(view.name + view.name_len <= start + test->eir_size);
+		g_assert(view.name_complete == test->name_complete);
+
+		name = eir_view_name(&view);
+		g_assert_cmpstr(name, ==, test->name);
+		g_free(name);
+	} else {
+		g_assert(view.name == NULL);
+		g_assert(eir_view_name(&view) == NULL);
+	}
+
+	if (test->uuid) {
+		GSList *services, *list;
+		int n = 0;
+
+		services = eir_view_services(&view);
+
+		for (list = services; list; list = list->next, n++) {
+			char *uuid_str = list->data;
+			g_assert(test->uuid[n]);
+			g_assert_cmpstr(test->uuid[n], ==, uuid_str);
+		}
+
+		g_slist_free_full(services, g_free);
+	} else {
+		g_assert(eir_view_services(&view) == NULL);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -621,5 +666,13 @@ int main(int argc, char *argv[])
 	g_test_add_data_func("/ad/citizen1", &citizen_adv_test, test_parsing);
 	g_test_add_data_func("/ad/citizen2", &citizen_scan_test, test_parsing);
 
+	g_test_add_data_func("/eir/view/macbookair", &macbookair_test,
+								test_view);
+	g_test_add_data_func("/eir/view/iphone5", &iphone5_test, test_view);
+	g_test_add_data_func("/ad/view/wahooscale", &wahoo_scale_test,
+								test_view);
+	g_test_add_data_func("/ad/view/citizen2", &citizen_scan_test,
+								test_view);
+
 	return g_test_run();
 }
@@ -25,11 +25,18 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <glib.h>
 #include <gdbus.h>
 
 #define SERVICE_NAME "org.bluez.unit.test-gdbus-client"
 #define SERVICE_PATH "/org/bluez/unit/test_gdbus_client"
+#define DISPATCH_INTERFACE "org.bluez.unit.Dispatch"
+#define FILTER_INTERFACE "org.bluez.unit.Filtered"
+#define OTHER_INTERFACE "org.bluez.unit.Other"
+#define OBJECT_FILTER_INTERFACE "org.bluez.ObjectFilter1"
+#define BATCH_INTERFACE "org.bluez.unit.Batch"
 
 struct context {
 	GMainLoop *main_loop;
@@ -779,6 +786,879 @@ static void client_string_changed(void)
 	destroy_context(context);
 }
 
+#define ECHO_VALUE 0x12345678
+
+struct dispatch_data {
+	GTimer *timer;
+	unsigned int iterations;
+	unsigned int replies;
+};
+
+static DBusMessage *echo_method(DBusConnection *conn, DBusMessage *msg,
+							void *user_data)
+{
+	dbus_uint32_t value;
+
+	if (!dbus_message_get_args(msg, NULL, DBUS_TYPE_UINT32, &value,
+							DBUS_TYPE_INVALID))
+		return g_dbus_create_error(msg, DBUS_ERROR_INVALID_ARGS, NULL);
+
+	return g_dbus_create_reply(msg, DBUS_TYPE_UINT32, &value,
+							DBUS_TYPE_INVALID);
+}
+
+static DBusMessage *unused_method(DBusConnection *conn, DBusMessage *msg,
+							void *user_data)
+{
+	g_assert_not_reached();
+
+	return NULL;
+}
+
+#define UNUSED_METHOD(name) \
+	{ GDBUS_METHOD(name, GDBUS_ARGS({ "value", "s" }), NULL, \
+							unused_method) }
+
+static const GDBusMethodTable dispatch_methods[] = {
+	UNUSED_METHOD("Method00"), UNUSED_METHOD("Method01"),
+	UNUSED_METHOD("Method02"), UNUSED_METHOD("Method03"),
+	UNUSED_METHOD("Method04"), UNUSED_METHOD("Method05"),
+	UNUSED_METHOD("Method06"), UNUSED_METHOD("Method07"),
+	UNUSED_METHOD("Method08"), UNUSED_METHOD("Method09"),
+	UNUSED_METHOD("Method10"), UNUSED_METHOD("Method11"),
+	UNUSED_METHOD("Method12"), UNUSED_METHOD("Method13"),
+	UNUSED_METHOD("Method14"), UNUSED_METHOD("Method15"),
+	/* Overloaded name, only the second signature matches */
+	UNUSED_METHOD("Echo"),
+	{ GDBUS_METHOD("Echo", GDBUS_ARGS({ "value", "u" }),
+			GDBUS_ARGS({ "value", "u" }), echo_method) },
+	{ }
+};
+
+static void echo_setup(DBusMessageIter *iter, void *user_data)
+{
+	dbus_uint32_t value = ECHO_VALUE;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_UINT32, &value);
+}
+
+static void echo_reply(DBusMessage *message, void *user_data)
+{
+	struct context *context = user_data;
+	struct dispatch_data *dispatch = context->data;
+	dbus_uint32_t value;
+	double elapsed;
+
+	g_assert(dbus_message_get_args(message, NULL,
+						DBUS_TYPE_UINT32, &value,
+						DBUS_TYPE_INVALID));
+	g_assert_cmpuint(value, ==, ECHO_VALUE);
+
+	if (++dispatch->replies < dispatch->iterations)
+		return;
+
+	elapsed = g_timer_elapsed(dispatch->timer, NULL);
+
+	if (g_test_perf())
+		g_test_minimized_result(elapsed * 1000000 / dispatch->replies,
+					"%.1f usec per method call",
+					elapsed * 1000000 / dispatch->replies);
+
+	g_dbus_client_unref(context->dbus_client);
+}
+
+static void proxy_dispatch(GDBusProxy *proxy, void *user_data)
+{
+	struct context *context = user_data;
+	struct dispatch_data *dispatch = context->data;
+	unsigned int i;
+
+	if (g_test_verbose())
+		g_print("proxy %s found\n",
+					g_dbus_proxy_get_interface(proxy));
+
+	g_timer_start(dispatch->timer);
+
+	for (i = 0; i < dispatch->iterations; i++)
+		g_assert(g_dbus_proxy_method_call(proxy, "Echo", echo_setup,
+						echo_reply, context, NULL));
+}
+
+static void client_method_dispatch(void)
+{
+	struct context *context = create_context();
+	struct dispatch_data *dispatch;
+
+	if (context == NULL)
+		return;
+
+	dispatch = g_new0(struct dispatch_data, 1);
+	dispatch->timer = g_timer_new();
+	dispatch->iterations = g_test_perf() ? 10000 : 100;
+	context->data = dispatch;
+
+	g_dbus_register_interface(context->dbus_conn,
+				SERVICE_PATH, DISPATCH_INTERFACE,
+				dispatch_methods, signals, properties,
+				context, NULL);
+
+	context->dbus_client = g_dbus_client_new(context->dbus_conn,
+						SERVICE_NAME, SERVICE_PATH);
+
+	g_dbus_client_set_disconnect_watch(context->dbus_client,
+						disconnect_handler, context);
+	g_dbus_client_set_proxy_handlers(context->dbus_client, proxy_dispatch,
+						NULL, NULL, context);
+
+	g_main_loop_run(context->main_loop);
+
+	g_assert_cmpuint(dispatch->replies, ==, dispatch->iterations);
+
+	g_dbus_unregister_interface(context->dbus_conn,
+					SERVICE_PATH, DISPATCH_INTERFACE);
+
+	g_timer_destroy(dispatch->timer);
+	g_free(dispatch);
+	context->data = NULL;
+
+	destroy_context(context);
+}
+
+static gboolean get_string_value(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *data)
+{
+	const char *string = "value";
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &string);
+
+	return TRUE;
+}
+
+static const GDBusPropertyTable string_properties[] = {
+	{ "String", "s", get_string_value },
+	{ }
+};
+
+struct filter_step {
+	const char *path;
+	const char *after;
+	dbus_uint32_t count;
+	const char *interface;
+	const char *remove;
+	unsigned int objects;
+	const char *next;
+};
+
+/*
+ * The object removed before the second page sorts before the cursor, it
+ * must neither shift the page nor make it repeat an object.
+ */
+static const struct filter_step filter_steps[] = {
+	{ NULL, NULL, 2, FILTER_INTERFACE, NULL, 2, SERVICE_PATH "/obj1" },
+	{ NULL, SERVICE_PATH "/obj1", 0, FILTER_INTERFACE,
+					SERVICE_PATH "/obj0", 1, "/" },
+	{ SERVICE_PATH "/other", NULL, 0, NULL, NULL, 1, "/" },
+	{ SERVICE_PATH "/none", NULL, 0, NULL, NULL, 0, "/" },
+	{ }
+};
+
+static void append_interfaces(DBusMessageIter *dict, const char *interface)
+{
+	DBusMessageIter entry, value, array;
+	const char *key = "Interfaces";
+
+	dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY,
+							NULL, &entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+	dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT,
+					DBUS_TYPE_ARRAY_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING, &value);
+	dbus_message_iter_open_container(&value, DBUS_TYPE_ARRAY,
+					DBUS_TYPE_STRING_AS_STRING, &array);
+	dbus_message_iter_append_basic(&array, DBUS_TYPE_STRING, &interface);
+	dbus_message_iter_close_container(&value, &array);
+	dbus_message_iter_close_container(&entry, &value);
+	dbus_message_iter_close_container(dict, &entry);
+}
+
+static void get_filtered_objects(struct context *context);
+
+static void filtered_objects_reply(DBusPendingCall *call, void *user_data)
+{
+	struct context *context = user_data;
+	const struct filter_step *step = context->data;
+	DBusMessage *reply = dbus_pending_call_steal_reply(call);
+	DBusMessageIter iter, objects;
+	const char *next, *last = NULL;
+	unsigned int count = 0;
+
+	g_assert(dbus_message_get_type(reply) ==
+					DBUS_MESSAGE_TYPE_METHOD_RETURN);
+
+	dbus_message_iter_init(reply, &iter);
+	dbus_message_iter_recurse(&iter, &objects);
+
+	while (dbus_message_iter_get_arg_type(&objects) ==
+						DBUS_TYPE_DICT_ENTRY) {
+		DBusMessageIter entry, interfaces, iface;
+		const char *path, *name;
+
+		dbus_message_iter_recurse(&objects, &entry);
+		dbus_message_iter_get_basic(&entry, &path);
+		dbus_message_iter_next(&entry);
+
+		if (g_test_verbose())
+			g_print("object %s\n", path);
+
+		/* Objects are sorted by path and follow the cursor */
+		if (step->after)
+			g_assert_cmpstr(path, >, step->after);
+		if (last)
+			g_assert_cmpstr(path, >, last);
+		last = path;
+
+		/* Only the requested interface is returned */
+		if (step->interface) {
+			dbus_message_iter_recurse(&entry, &interfaces);
+			dbus_message_iter_recurse(&interfaces, &iface);
+			dbus_message_iter_get_basic(&iface, &name);
+			g_assert_cmpstr(name, ==, step->interface);
+
+			g_assert(!dbus_message_iter_next(&interfaces));
+		} else
+			g_assert(g_str_has_prefix(path, step->path));
+
+		count++;
+		dbus_message_iter_next(&objects);
+	}
+
+	dbus_message_iter_next(&iter);
+	dbus_message_iter_get_basic(&iter, &next);
+
+	g_assert_cmpuint(count, ==, step->objects);
+	g_assert_cmpstr(next, ==, step->next);
+
+	dbus_message_unref(reply);
+
+	context->data = (void *) (step + 1);
+	if (step[1].next)
+		get_filtered_objects(context);
+	else
+		g_main_loop_quit(context->main_loop);
+}
+
+static void get_filtered_objects(struct context *context)
+{
+	const struct filter_step *step = context->data;
+	DBusMessage *msg;
+	DBusMessageIter iter, dict;
+	DBusPendingCall *call;
+
+	if (step->remove)
+		g_dbus_unregister_interface(context->dbus_conn, step->remove,
+							FILTER_INTERFACE);
+
+	msg = dbus_message_new_method_call(SERVICE_NAME, "/",
+					OBJECT_FILTER_INTERFACE,
+					"GetFilteredObjects");
+	g_assert(msg != NULL);
+
+	dbus_message_iter_init_append(msg, &iter);
+	dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY,
+			DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+			DBUS_TYPE_STRING_AS_STRING DBUS_TYPE_VARIANT_AS_STRING
+			DBUS_DICT_ENTRY_END_CHAR_AS_STRING, &dict);
+
+	if (step->path)
+		dict_append_entry(&dict, "Path", DBUS_TYPE_OBJECT_PATH,
+						(void *) &step->path);
+	if (step->interface)
+		append_interfaces(&dict, step->interface);
+	if (step->after)
+		dict_append_entry(&dict, "After", DBUS_TYPE_OBJECT_PATH,
+						(void *) &step->after);
+	if (step->count)
+		dict_append_entry(&dict, "Count", DBUS_TYPE_UINT32,
+							(void *) &step->count);
+
+	dbus_message_iter_close_container(&iter, &dict);
+
+	if (!dbus_connection_send_with_reply(context->dbus_conn, msg,
+								&call, -1))
+		g_assert_not_reached();
+	dbus_pending_call_set_notify(call, filtered_objects_reply, context,
+									NULL);
+	dbus_pending_call_unref(call);
+	dbus_message_unref(msg);
+}
+
+static gboolean start_filtered_objects(gpointer user_data)
+{
+	get_filtered_objects(user_data);
+
+	return FALSE;
+}
+
+static void register_filter_objects(struct context *context,
+							gboolean register_)
+{
+	static const char *filtered[] = {
+		SERVICE_PATH "/obj0", SERVICE_PATH "/obj1",
+		SERVICE_PATH "/obj2", NULL
+	};
+	static const char *other[] = {
+		SERVICE_PATH "/obj1", SERVICE_PATH "/other", NULL
+	};
+	int i;
+
+	for (i = 0; filtered[i]; i++) {
+		if (register_)
+			g_dbus_register_interface(context->dbus_conn,
+						filtered[i], FILTER_INTERFACE,
+						methods, signals,
+						string_properties, context,
+						NULL);
+		else
+			g_dbus_unregister_interface(context->dbus_conn,
+						filtered[i], FILTER_INTERFACE);
+	}
+
+	for (i = 0; other[i]; i++) {
+		if (register_)
+			g_dbus_register_interface(context->dbus_conn,
+						other[i], OTHER_INTERFACE,
+						methods, signals,
+						string_properties, context,
+						NULL);
+		else
+			g_dbus_unregister_interface(context->dbus_conn,
+						other[i], OTHER_INTERFACE);
+	}
+}
+
+static void filtered_objects(void)
+{
+	struct context *context = create_context();
+
+	if (context == NULL)
+		return;
+
+	g_dbus_set_flags(G_DBUS_FLAG_ENABLE_EXPERIMENTAL);
+
+	register_filter_objects(context, TRUE);
+
+	/* Objects are only reported once their interfaces got announced */
+	context->data = (void *) filter_steps;
+	g_idle_add(start_filtered_objects, context);
+
+	g_main_loop_run(context->main_loop);
+
+	register_filter_objects(context, FALSE);
+
+	g_dbus_set_flags(0);
+
+	context->data = NULL;
+	destroy_context(context);
+}
+
+struct signal_count {
+	unsigned int unicast[2];
+	unsigned int broadcast[2];
+};
+
+struct subscribe_data {
+	DBusConnection *listener;
+	struct signal_count subscriber_count;
+	struct signal_count listener_count;
+};
+
+static void count_signal(struct signal_count *count, DBusMessage *msg,
+							const char *interface)
+{
+	int other;
+
+	if (g_strcmp0(interface, FILTER_INTERFACE) == 0)
+		other = 0;
+	else if (g_strcmp0(interface, OTHER_INTERFACE) == 0)
+		other = 1;
+	else
+		return;
+
+	if (dbus_message_get_destination(msg))
+		count->unicast[other]++;
+	else
+		count->broadcast[other]++;
+}
+
+static DBusHandlerResult subscribe_filter(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct signal_count *count = user_data;
+	DBusMessageIter iter, array, entry;
+	const char *interface;
+
+	if (dbus_message_is_signal(msg, DBUS_INTERFACE_PROPERTIES,
+						"PropertiesChanged")) {
+		if (dbus_message_get_args(msg, NULL,
+					DBUS_TYPE_STRING, &interface,
+					DBUS_TYPE_INVALID))
+			count_signal(count, msg, interface);
+
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+	}
+
+	if (!dbus_message_is_signal(msg, "org.freedesktop.DBus.ObjectManager",
+							"InterfacesAdded"))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	/* The standard interfaces of a new object come along */
+	dbus_message_iter_init(msg, &iter);
+	dbus_message_iter_next(&iter);
+	dbus_message_iter_recurse(&iter, &array);
+
+	while (dbus_message_iter_get_arg_type(&array) ==
+						DBUS_TYPE_DICT_ENTRY) {
+		dbus_message_iter_recurse(&array, &entry);
+		dbus_message_iter_get_basic(&entry, &interface);
+		count_signal(count, msg, interface);
+		dbus_message_iter_next(&array);
+	}
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+static gboolean subscribe_done(gpointer user_data)
+{
+	struct context *context = user_data;
+
+	context->timeout_source = 0;
+
+	g_main_loop_quit(context->main_loop);
+
+	return FALSE;
+}
+
+static void listen_broadcasts(DBusConnection *conn)
+{
+	DBusError err;
+
+	dbus_error_init(&err);
+
+	/* Blocking, so signals sent from now on are received */
+	dbus_bus_add_match(conn, "type='signal',"
+				"interface='" DBUS_INTERFACE_PROPERTIES "'",
+				&err);
+	g_assert(!dbus_error_is_set(&err));
+
+	dbus_bus_add_match(conn, "type='signal',"
+			"interface='org.freedesktop.DBus.ObjectManager'",
+			&err);
+	g_assert(!dbus_error_is_set(&err));
+}
+
+static void subscribe_reply(DBusPendingCall *call, void *user_data)
+{
+	struct context *context = user_data;
+	struct subscribe_data *data = context->data;
+	DBusMessage *reply = dbus_pending_call_steal_reply(call);
+
+	g_assert(dbus_message_get_type(reply) ==
+					DBUS_MESSAGE_TYPE_METHOD_RETURN);
+	dbus_message_unref(reply);
+
+	/*
+	 * The subscriber has no match rule and only gets its unicast
+	 * copies, the other connection relies on the broadcast.
+	 */
+	dbus_connection_add_filter(context->dbus_conn, subscribe_filter,
+						&data->subscriber_count, NULL);
+
+	listen_broadcasts(data->listener);
+	dbus_connection_add_filter(data->listener, subscribe_filter,
+						&data->listener_count, NULL);
+
+	g_dbus_emit_property_changed(context->dbus_conn, SERVICE_PATH,
+						FILTER_INTERFACE, "String");
+	g_dbus_emit_property_changed(context->dbus_conn, SERVICE_PATH,
+						OTHER_INTERFACE, "String");
+
+	g_dbus_register_interface(context->dbus_conn, SERVICE_PATH "/obj0",
+					FILTER_INTERFACE, methods, signals,
+					string_properties, context, NULL);
+	g_dbus_register_interface(context->dbus_conn, SERVICE_PATH "/other",
+					OTHER_INTERFACE, methods, signals,
+					string_properties, context, NULL);
+
+	/* Give any duplicated signal the chance to show up */
+	context->timeout_source = g_timeout_add(200, subscribe_done, context);
+}
+
+static gboolean start_subscribe(gpointer user_data)
+{
+	struct context *context = user_data;
+	const char *interface = FILTER_INTERFACE;
+	const char **interfaces = &interface;
+	DBusMessage *msg;
+	DBusPendingCall *call;
+
+	msg = dbus_message_new_method_call(SERVICE_NAME, "/",
+					OBJECT_FILTER_INTERFACE, "Subscribe");
+	g_assert(msg != NULL);
+
+	dbus_message_append_args(msg, DBUS_TYPE_ARRAY, DBUS_TYPE_STRING,
+					&interfaces, 1, DBUS_TYPE_INVALID);
+
+	if (!dbus_connection_send_with_reply(context->dbus_conn, msg,
+								&call, -1))
+		g_assert_not_reached();
+	dbus_pending_call_set_notify(call, subscribe_reply, context, NULL);
+	dbus_pending_call_unref(call);
+	dbus_message_unref(msg);
+
+	return FALSE;
+}
+
+static void subscribe_signals(void)
+{
+	struct context *context = create_context();
+	struct subscribe_data data;
+	struct signal_count *count;
+
+	if (context == NULL)
+		return;
+
+	memset(&data, 0, sizeof(data));
+	context->data = &data;
+
+	data.listener = g_dbus_setup_private(DBUS_BUS_SESSION, NULL, NULL);
+	g_assert(data.listener != NULL);
+
+	g_dbus_set_flags(G_DBUS_FLAG_ENABLE_EXPERIMENTAL);
+
+	g_dbus_register_interface(context->dbus_conn, SERVICE_PATH,
+					FILTER_INTERFACE, methods, signals,
+					string_properties, context, NULL);
+	g_dbus_register_interface(context->dbus_conn, SERVICE_PATH,
+					OTHER_INTERFACE, methods, signals,
+					string_properties, context, NULL);
+
+	g_idle_add(start_subscribe, context);
+
+	g_main_loop_run(context->main_loop);
+
+	/* One PropertiesChanged and one InterfacesAdded per interface */
+	count = &data.subscriber_count;
+	g_assert_cmpuint(count->unicast[0], ==, 2);
+	g_assert_cmpuint(count->broadcast[0], ==, 0);
+	g_assert_cmpuint(count->unicast[1], ==, 0);
+	g_assert_cmpuint(count->broadcast[1], ==, 0);
+
+	/* Clients that did not subscribe still get every broadcast */
+	count = &data.listener_count;
+	g_assert_cmpuint(count->unicast[0], ==, 0);
+	g_assert_cmpuint(count->broadcast[0], ==, 2);
+	g_assert_cmpuint(count->unicast[1], ==, 0);
+	g_assert_cmpuint(count->broadcast[1], ==, 2);
+
+	dbus_connection_remove_filter(context->dbus_conn, subscribe_filter,
+						&data.subscriber_count);
+	dbus_connection_remove_filter(data.listener, subscribe_filter,
+						&data.listener_count);
+
+	dbus_connection_close(data.listener);
+	dbus_connection_unref(data.listener);
+
+	g_dbus_unregister_interface(context->dbus_conn, SERVICE_PATH "/obj0",
+							FILTER_INTERFACE);
+	g_dbus_unregister_interface(context->dbus_conn, SERVICE_PATH "/other",
+							OTHER_INTERFACE);
+	g_dbus_unregister_interface(context->dbus_conn, SERVICE_PATH,
+							FILTER_INTERFACE);
+	g_dbus_unregister_interface(context->dbus_conn, SERVICE_PATH,
+							OTHER_INTERFACE);
+
+	g_dbus_set_flags(0);
+
+	context->data = NULL;
+	destroy_context(context);
+}
+
+static const char *introspect_children[] = {
+	SERVICE_PATH "/c", SERVICE_PATH "/a", SERVICE_PATH "/b",
+	SERVICE_PATH "/a/x", NULL
+};
+
+static void introspect_reply(DBusPendingCall *call, void *user_data)
+{
+	struct context *context = user_data;
+	DBusMessage *reply = dbus_pending_call_steal_reply(call);
+	const char *xml;
+
+	g_assert(dbus_message_get_args(reply, NULL, DBUS_TYPE_STRING, &xml,
+							DBUS_TYPE_INVALID));
+
+	if (g_test_verbose())
+		g_print("%s\n", xml);
+
+	/* Children are listed once and always in the same order */
+	g_assert(strstr(xml, "<node name=\"a\"/><node name=\"b\"/>"
+					"<node name=\"c\"/></node>") != NULL);
+
+	dbus_message_unref(reply);
+
+	g_main_loop_quit(context->main_loop);
+}
+
+static gboolean start_introspect(gpointer user_data)
+{
+	struct context *context = user_data;
+	DBusMessage *msg;
+	DBusPendingCall *call;
+
+	msg = dbus_message_new_method_call(SERVICE_NAME, SERVICE_PATH,
+					DBUS_INTERFACE_INTROSPECTABLE,
+					"Introspect");
+	g_assert(msg != NULL);
+
+	if (!dbus_connection_send_with_reply(context->dbus_conn, msg,
+								&call, -1))
+		g_assert_not_reached();
+
+	dbus_pending_call_set_notify(call, introspect_reply, context, NULL);
+	dbus_pending_call_unref(call);
+	dbus_message_unref(msg);
+
+	return FALSE;
+}
+
+static void introspect_child_nodes(void)
+{
+	struct context *context = create_context();
+	int i;
+
+	if (context == NULL)
+		return;
+
+	g_dbus_register_interface(context->dbus_conn, SERVICE_PATH,
+					OTHER_INTERFACE, methods, signals,
+					string_properties, context, NULL);
+
+	for (i = 0; introspect_children[i]; i++)
+		g_dbus_register_interface(context->dbus_conn,
+					introspect_children[i], OTHER_INTERFACE,
+					methods, signals,
+					string_properties, context, NULL);
+
+	g_idle_add(start_introspect, context);
+
+	g_main_loop_run(context->main_loop);
+
+	for (i = 0; introspect_children[i]; i++)
+		g_dbus_unregister_interface(context->dbus_conn,
+					introspect_children[i],
+					OTHER_INTERFACE);
+
+	g_dbus_unregister_interface(context->dbus_conn, SERVICE_PATH,
+							OTHER_INTERFACE);
+
+	destroy_context(context);
+}
+
+static const char *batch_paths[] = {
+	SERVICE_PATH "/batch0", SERVICE_PATH "/batch1", NULL
+};
+
+struct batch_data {
+	const char *string;
+	dbus_uint32_t number;
+	unsigned int proxies;
+	unsigned int changed;
+	unsigned int batches[2];
+};
+
+static gboolean get_batch_string(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *data)
+{
+	struct context *context = data;
+	struct batch_data *batch = context->data;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING,
+							&batch->string);
+
+	return TRUE;
+}
+
+static gboolean get_batch_number(const GDBusPropertyTable *property,
+					DBusMessageIter *iter, void *data)
+{
+	struct context *context = data;
+	struct batch_data *batch = context->data;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_UINT32,
+							&batch->number);
+
+	return TRUE;
+}
+
+static const GDBusPropertyTable batch_properties[] = {
+	{ "String", "s", get_batch_string },
+	{ "Number", "u", get_batch_number },
+	{ }
+};
+
+static int batch_index(GDBusProxy *proxy)
+{
+	int i;
+
+	for (i = 0; batch_paths[i]; i++) {
+		if (g_str_equal(g_dbus_proxy_get_path(proxy), batch_paths[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+static gboolean names_contain(const char **names, const char *name)
+{
+	for (; *names; names++) {
+		if (g_str_equal(*names, name))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean emit_batch_changes(gpointer user_data)
+{
+	struct context *context = user_data;
+	struct batch_data *batch = context->data;
+
+	batch->string = "changed";
+	batch->number = 2;
+
+	/* Both properties of batch0 change within one iteration */
+	g_dbus_emit_property_changed(context->dbus_conn, batch_paths[0],
+						BATCH_INTERFACE, "String");
+	g_dbus_emit_property_changed(context->dbus_conn, batch_paths[0],
+						BATCH_INTERFACE, "Number");
+	g_dbus_emit_property_changed(context->dbus_conn, batch_paths[1],
+						BATCH_INTERFACE, "Number");
+
+	context->timeout_source = g_timeout_add_seconds(2, timeout_test,
+								context);
+
+	return FALSE;
+}
+
+static gboolean batch_done(gpointer user_data)
+{
+	struct context *context = user_data;
+	struct batch_data *batch = context->data;
+
+	/* No further batches arrived for the same changes */
+	g_assert_cmpuint(batch->batches[0], ==, 1);
+	g_assert_cmpuint(batch->batches[1], ==, 1);
+	g_assert_cmpuint(batch->changed, ==, 3);
+
+	g_source_remove(context->timeout_source);
+	context->timeout_source = 0;
+
+	g_dbus_client_unref(context->dbus_client);
+
+	return FALSE;
+}
+
+static void batch_proxy_added(GDBusProxy *proxy, void *user_data)
+{
+	struct context *context = user_data;
+	struct batch_data *batch = context->data;
+
+	if (!g_str_equal(g_dbus_proxy_get_interface(proxy), BATCH_INTERFACE))
+		return;
+
+	if (++batch->proxies == 2)
+		g_idle_add(emit_batch_changes, context);
+}
+
+static void batch_property_changed(GDBusProxy *proxy, const char *name,
+					DBusMessageIter *iter, void *user_data)
+{
+	struct context *context = user_data;
+	struct batch_data *batch = context->data;
+
+	if (g_str_equal(g_dbus_proxy_get_interface(proxy), BATCH_INTERFACE))
+		batch->changed++;
+}
+
+static void batch_properties_changed(GDBusProxy *proxy, const char **names,
+							void *user_data)
+{
+	struct context *context = user_data;
+	struct batch_data *batch = context->data;
+	int i;
+
+	g_assert_cmpstr(g_dbus_proxy_get_interface(proxy), ==,
+							BATCH_INTERFACE);
+
+	i = batch_index(proxy);
+	g_assert(i >= 0);
+
+	batch->batches[i]++;
+
+	/* The per property callbacks already ran for the whole batch */
+	if (i == 0) {
+		g_assert_cmpuint(g_strv_length((char **) names), ==, 2);
+		g_assert(names_contain(names, "String"));
+		g_assert(names_contain(names, "Number"));
+	} else {
+		g_assert_cmpuint(g_strv_length((char **) names), ==, 1);
+		g_assert_cmpstr(names[0], ==, "Number");
+	}
+
+	if (batch->batches[0] > 0 && batch->batches[1] > 0)
+		g_timeout_add(100, batch_done, context);
+}
+
+static void client_properties_watch(void)
+{
+	struct context *context = create_context();
+	struct batch_data *batch;
+	int i;
+
+	if (context == NULL)
+		return;
+
+	batch = g_new0(struct batch_data, 1);
+	batch->string = "initial";
+	batch->number = 1;
+	context->data = batch;
+
+	for (i = 0; batch_paths[i]; i++)
+		g_dbus_register_interface(context->dbus_conn, batch_paths[i],
+					BATCH_INTERFACE, methods, signals,
+					batch_properties, context, NULL);
+
+	context->dbus_client = g_dbus_client_new(context->dbus_conn,
+						SERVICE_NAME, SERVICE_PATH);
+
+	g_dbus_client_set_disconnect_watch(context->dbus_client,
+						disconnect_handler, context);
+	g_dbus_client_set_properties_watch(context->dbus_client,
+					batch_properties_changed, context);
+	g_dbus_client_set_proxy_handlers(context->dbus_client,
+						batch_proxy_added, NULL,
+						batch_property_changed,
+						context);
+
+	g_main_loop_run(context->main_loop);
+
+	for (i = 0; batch_paths[i]; i++)
+		g_dbus_unregister_interface(context->dbus_conn,
+					batch_paths[i], BATCH_INTERFACE);
+
+	destroy_context(context);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -806,8 +1686,21 @@ int main(int argc, char *argv[])
 	g_test_add_func("/gdbus/client_set_string_property",
 						client_set_string_property);
 
+	g_test_add_func("/gdbus/client_properties_watch",
+						client_properties_watch);
+
 	g_test_add_func("/gdbus/client_string_changed",
 						client_string_changed);
 
+	g_test_add_func("/gdbus/filtered_objects", filtered_objects);
+
+	g_test_add_func("/gdbus/subscribe_signals", subscribe_signals);
+
+	g_test_add_func("/gdbus/introspect_child_nodes",
+						introspect_child_nodes);
+
+	g_test_add_func("/gdbus/client_method_dispatch",
+						client_method_dispatch);
+
 	return g_test_run();
 }
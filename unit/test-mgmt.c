@@ -232,6 +232,140 @@ static void test_command(gconstpointer data)
 	execute_context(context);
 }
 
+static void test_pipeline(gconstpointer data)
+{
+	struct context *context = create_context();
+
+	/* Only the second command completes the test */
+	add_action(context, read_version_command,
+					sizeof(read_version_command),
+					false, ACTION_IGNORE);
+	add_action(context, read_info_command, sizeof(read_info_command),
+					false, ACTION_PASSED);
+
+	mgmt_set_max_pending(context->mgmt_client, 2);
+
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_VERSION,
+					MGMT_INDEX_NONE, 0, NULL,
+						NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_INFO, 512, 0, NULL,
+						NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+static void test_priority(gconstpointer data)
+{
+	struct context *context = create_context();
+
+	/* Bulk command must not be written before the interactive one */
+	add_action(context, read_version_command,
+					sizeof(read_version_command),
+					false, ACTION_PASSED);
+
+	mgmt_send_bulk(context->mgmt_client, MGMT_OP_READ_INFO, 512, 0, NULL,
+						NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_VERSION,
+					MGMT_INDEX_NONE, 0, NULL,
+						NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+static void test_index_order(gconstpointer data)
+{
+	struct context *context = create_context();
+	uint8_t powered = 0x01;
+
+	/*
+	 * The bulk command is left pending, so the interactive command
+	 * for the same index must wait while the one for another index
+	 * gets written.
+	 */
+	add_action(context, read_info_command, sizeof(read_info_command),
+					false, ACTION_IGNORE);
+	add_action(context, read_version_command,
+					sizeof(read_version_command),
+					false, ACTION_PASSED);
+
+	mgmt_set_max_pending(context->mgmt_client, 3);
+
+	mgmt_send_bulk(context->mgmt_client, MGMT_OP_READ_INFO, 512, 0, NULL,
+						NULL, NULL, NULL);
+
+	while (g_main_context_iteration(NULL, FALSE));
+
+	mgmt_send(context->mgmt_client, MGMT_OP_SET_POWERED, 512, 1,
+					&powered, NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_READ_VERSION,
+					MGMT_INDEX_NONE, 0, NULL,
+						NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+static const unsigned char set_powered_command[] =
+				{ 0x05, 0x00, 0x00, 0x02, 0x01, 0x00, 0x01 };
+
+static void test_bulk_order(gconstpointer data)
+{
+	struct context *context = create_context();
+	uint8_t powered = 0x01;
+
+	/*
+	 * The interactive command was queued after the bulk one for
+	 * the same index, so it must not be written first.
+	 */
+	add_action(context, read_info_command, sizeof(read_info_command),
+					false, ACTION_PASSED);
+
+	mgmt_set_max_pending(context->mgmt_client, 3);
+
+	mgmt_send_bulk(context->mgmt_client, MGMT_OP_READ_INFO, 512, 0, NULL,
+						NULL, NULL, NULL);
+	mgmt_send(context->mgmt_client, MGMT_OP_SET_POWERED, 512, 1,
+					&powered, NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
+static void timeout_complete(uint8_t status, uint16_t length,
+					const void *param, void *user_data)
+{
+	struct context *context = user_data;
+
+	g_assert_cmpuint(status, ==, MGMT_STATUS_TIMEOUT);
+
+	context_quit(context);
+}
+
+static void test_timeout(gconstpointer data)
+{
+	struct context *context = create_context();
+	unsigned int id;
+	uint8_t powered = 0x01;
+
+	/*
+	 * The timer only starts once the command is written, and the
+	 * command for the same index is written after the timeout.
+	 */
+	add_action(context, read_info_command, sizeof(read_info_command),
+					false, ACTION_IGNORE);
+	add_action(context, set_powered_command, sizeof(set_powered_command),
+					false, ACTION_IGNORE);
+
+	id = mgmt_send_bulk(context->mgmt_client, MGMT_OP_READ_INFO, 512,
+					0, NULL, timeout_complete, context, NULL);
+	g_assert(id > 0);
+
+	g_assert(mgmt_set_timeout(context->mgmt_client, id, 1));
+
+	mgmt_send(context->mgmt_client, MGMT_OP_SET_POWERED, 512, 1,
+					&powered, NULL, NULL, NULL);
+
+	execute_context(context);
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -239,5 +373,11 @@ int main(int argc, char *argv[])
 	g_test_add_data_func("/mgmt/command/1", &command_test_1, test_command);
 	g_test_add_data_func("/mgmt/command/2", &command_test_2, test_command);
 
+	g_test_add_data_func("/mgmt/pipeline", NULL, test_pipeline);
+	g_test_add_data_func("/mgmt/priority", NULL, test_priority);
+	g_test_add_data_func("/mgmt/index-order", NULL, test_index_order);
+	g_test_add_data_func("/mgmt/bulk-order", NULL, test_bulk_order);
+	g_test_add_data_func("/mgmt/timeout", NULL, test_timeout);
+
 	return g_test_run();
 }
@@ -0,0 +1,280 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "lib/uuid.h"
+#include "attrib/att.h"
+#include "src/notify-queue.h"
+
+struct context {
+	struct notify_queue *queue;
+	GQueue *sent;
+	GQueue *handles;
+	gboolean fail;
+};
+
+static gboolean send_pdu(const uint8_t *pdu, size_t len,
+					struct notify_sent *sent, void *user_data)
+{
+	struct context *context = user_data;
+
+	if (context->fail)
+		return FALSE;
+
+	g_queue_push_tail(context->sent, sent);
+	g_queue_push_tail(context->handles,
+				GUINT_TO_POINTER(att_get_u16(&pdu[1])));
+
+	return TRUE;
+}
+
+static struct context *create_context(void)
+{
+	struct context *context = g_new0(struct context, 1);
+
+	context->queue = notify_queue_new(send_pdu, context);
+	context->sent = g_queue_new();
+	context->handles = g_queue_new();
+
+	return context;
+}
+
+static void destroy_context(struct context *context)
+{
+	struct notify_sent *sent;
+
+	unsigned int sent_count;
+
+	notify_queue_destroy(context->queue);
+
+	sent_count = g_queue_get_length(context->handles);
+
+	/* The transport may release PDUs after the queue is destroyed */
+	while ((sent = g_queue_pop_head(context->sent)))
+		notify_sent_done(sent);
+
+	g_assert_cmpuint(g_queue_get_length(context->handles), ==,
+								sent_count);
+
+	g_queue_free(context->sent);
+	g_queue_free(context->handles);
+	g_free(context);
+}
+
+static void push(struct context *context, uint8_t opcode, uint16_t handle)
+{
+	uint8_t pdu[4];
+
+	pdu[0] = opcode;
+	att_put_u16(handle, &pdu[1]);
+	pdu[3] = handle & 0xff;
+
+	notify_queue_push(context->queue, handle, pdu, sizeof(pdu));
+}
+
+static void complete(struct context *context)
+{
+	notify_sent_done(g_queue_pop_head(context->sent));
+}
+
+static void check_stats(struct context *context, unsigned int delivered,
+							unsigned int dropped)
+{
+	unsigned int d, n;
+
+	notify_queue_get_stats(context->queue, &d, &n);
+
+	g_assert_cmpuint(d, ==, delivered);
+	g_assert_cmpuint(n, ==, dropped);
+}
+
+static void test_push_pop(void)
+{
+	struct context *context = create_context();
+	unsigned int i;
+
+	for (i = 0; i < NOTIFY_MAX_IN_FLIGHT + 2; i++)
+		push(context, ATT_OP_HANDLE_NOTIFY, 0x0010 + i);
+
+	g_assert_cmpuint(notify_queue_get_in_flight(context->queue), ==,
+							NOTIFY_MAX_IN_FLIGHT);
+	g_assert_cmpuint(notify_queue_get_pending(context->queue), ==, 2);
+
+	/* Each completion sends the next pending PDU in order */
+	complete(context);
+	g_assert_cmpuint(notify_queue_get_pending(context->queue), ==, 1);
+	g_assert_cmpuint(GPOINTER_TO_UINT(g_queue_peek_tail(context->handles)),
+				==, 0x0010 + NOTIFY_MAX_IN_FLIGHT);
+
+	complete(context);
+	g_assert_cmpuint(notify_queue_get_pending(context->queue), ==, 0);
+	g_assert_cmpuint(GPOINTER_TO_UINT(g_queue_peek_tail(context->handles)),
+				==, 0x0010 + NOTIFY_MAX_IN_FLIGHT + 1);
+
+	while (!g_queue_is_empty(context->sent))
+		complete(context);
+
+	g_assert_cmpuint(notify_queue_get_in_flight(context->queue), ==, 0);
+	check_stats(context, NOTIFY_MAX_IN_FLIGHT + 2, 0);
+
+	destroy_context(context);
+}
+
+static void test_coalesce(void)
+{
+	struct context *context = create_context();
+	unsigned int i;
+
+	for (i = 0; i < NOTIFY_MAX_IN_FLIGHT; i++)
+		push(context, ATT_OP_HANDLE_NOTIFY, 0x0001);
+
+	/* Only the latest value of each pending handle is kept */
+	push(context, ATT_OP_HANDLE_NOTIFY, 0x0020);
+	push(context, ATT_OP_HANDLE_NOTIFY, 0x0021);
+	push(context, ATT_OP_HANDLE_NOTIFY, 0x0020);
+	push(context, ATT_OP_HANDLE_NOTIFY, 0x0020);
+
+	g_assert_cmpuint(notify_queue_get_pending(context->queue), ==, 2);
+	check_stats(context, 0, 2);
+
+	while (!g_queue_is_empty(context->sent))
+		complete(context);
+
+	g_assert_cmpuint(g_queue_get_length(context->handles), ==,
+						NOTIFY_MAX_IN_FLIGHT + 2);
+	g_assert_cmpuint(GPOINTER_TO_UINT(g_queue_pop_tail(context->handles)),
+								==, 0x0020);
+	g_assert_cmpuint(GPOINTER_TO_UINT(g_queue_pop_tail(context->handles)),
+								==, 0x0021);
+	check_stats(context, NOTIFY_MAX_IN_FLIGHT + 2, 2);
+
+	destroy_context(context);
+}
+
+static void test_drop_oldest(void)
+{
+	struct context *context = create_context();
+	unsigned int i;
+
+	for (i = 0; i < NOTIFY_MAX_IN_FLIGHT + NOTIFY_MAX_PENDING + 1; i++)
+		push(context, ATT_OP_HANDLE_NOTIFY, 0x0100 + i);
+
+	g_assert_cmpuint(notify_queue_get_pending(context->queue), ==,
+							NOTIFY_MAX_PENDING);
+	check_stats(context, 0, 1);
+
+	/* The oldest pending value was dropped to make room */
+	complete(context);
+	g_assert_cmpuint(GPOINTER_TO_UINT(g_queue_peek_tail(context->handles)),
+				==, 0x0100 + NOTIFY_MAX_IN_FLIGHT + 1);
+
+	destroy_context(context);
+}
+
+static void test_in_flight(void)
+{
+	struct context *context = create_context();
+	unsigned int i;
+
+	for (i = 0; i < NOTIFY_MAX_IN_FLIGHT; i++) {
+		push(context, ATT_OP_HANDLE_NOTIFY, 0x0001 + i);
+		g_assert_cmpuint(notify_queue_get_pending(context->queue),
+								==, 0);
+	}
+
+	push(context, ATT_OP_HANDLE_NOTIFY, 0x0010);
+
+	g_assert_cmpuint(g_queue_get_length(context->sent), ==,
+							NOTIFY_MAX_IN_FLIGHT);
+	g_assert_cmpuint(notify_queue_get_in_flight(context->queue), ==,
+							NOTIFY_MAX_IN_FLIGHT);
+	g_assert_cmpuint(notify_queue_get_pending(context->queue), ==, 1);
+
+	destroy_context(context);
+}
+
+static void test_accounting(void)
+{
+	struct context *context = create_context();
+	struct notify_sent *sent;
+
+	/* Indications count only once confirmed */
+	push(context, ATT_OP_HANDLE_IND, 0x0001);
+	push(context, ATT_OP_HANDLE_IND, 0x0002);
+	push(context, ATT_OP_HANDLE_NOTIFY, 0x0003);
+
+	sent = g_queue_pop_head(context->sent);
+	notify_sent_confirm(sent, TRUE);
+	notify_sent_done(sent);
+
+	complete(context);
+	complete(context);
+
+	check_stats(context, 2, 1);
+
+	/* Failing to send is a drop */
+	context->fail = TRUE;
+	push(context, ATT_OP_HANDLE_NOTIFY, 0x0004);
+	context->fail = FALSE;
+
+	check_stats(context, 2, 2);
+	g_assert_cmpuint(notify_queue_get_in_flight(context->queue), ==, 0);
+
+	destroy_context(context);
+}
+
+static void test_destroy(void)
+{
+	struct context *context = create_context();
+	unsigned int i;
+
+	for (i = 0; i < NOTIFY_MAX_IN_FLIGHT + 3; i++)
+		push(context, ATT_OP_HANDLE_NOTIFY, 0x0001 + i);
+
+	check_stats(context, 0, 0);
+
+	/*
+	 * In-flight PDUs complete after the owner destroyed the queue,
+	 * the pending ones must not be sent anymore.
+	 */
+	destroy_context(context);
+}
+
+int main(int argc, char *argv[])
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/notify-queue/push-pop", test_push_pop);
+	g_test_add_func("/notify-queue/coalesce", test_coalesce);
+	g_test_add_func("/notify-queue/drop-oldest", test_drop_oldest);
+	g_test_add_func("/notify-queue/in-flight", test_in_flight);
+	g_test_add_func("/notify-queue/accounting", test_accounting);
+	g_test_add_func("/notify-queue/destroy", test_destroy);
+
+	return g_test_run();
+}
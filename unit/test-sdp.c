@@ -822,6 +822,64 @@ static void test_sdp_de_attr(gconstpointer data)
 	sdp_data_free(d);
 }
 
+static void test_sdp_codec(gconstpointer data)
+{
+	unsigned int i, iterations, records = 0;
+	sdp_list_t *list;
+	GTimer *timer;
+	double elapsed;
+
+	set_fixed_db_timestamp(0x496f0654);
+
+	register_public_browse_group();
+	register_server_service();
+
+	register_serial_port();
+	register_object_push();
+	register_hid_keyboard();
+	register_file_transfer();
+
+	iterations = g_test_perf() ? 10000 : 10;
+
+	timer = g_timer_new();
+
+	for (i = 0; i < iterations; i++) {
+		for (list = sdp_get_record_list(); list; list = list->next) {
+			sdp_record_t *rec;
+			sdp_buf_t pdu, copy;
+			int scanned = 0;
+
+			g_assert(sdp_gen_record_pdu(list->data, &pdu) == 0);
+
+			rec = sdp_extract_pdu(pdu.data, pdu.data_size,
+								&scanned);
+			g_assert(rec != NULL);
+			g_assert_cmpint(scanned, ==, pdu.data_size);
+
+			/* Decoding and encoding again must be lossless */
+			g_assert(sdp_gen_record_pdu(rec, &copy) == 0);
+			g_assert_cmpuint(copy.data_size, ==, pdu.data_size);
+			g_assert(memcmp(copy.data, pdu.data,
+							pdu.data_size) == 0);
+
+			sdp_record_free(rec);
+			free(copy.data);
+			free(pdu.data);
+
+			records++;
+		}
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	if (g_test_perf())
+		g_test_maximized_result(records / elapsed,
+					"%.0f records/s", records / elapsed);
+
+	sdp_svcdb_reset();
+}
+
 int main(int argc, char *argv[])
 {
 	g_test_init(&argc, &argv, NULL);
@@ -2853,5 +2911,11 @@ int main(int argc, char *argv[])
 						0x00, 0x00, 0x00, 0x00, 0x00,
 						0x00, 0x00, 0x00, 0x00, 0x00)));
 
+	/*
+	 * Record codec round trip, run with -m perf to measure the
+	 * encoding and decoding throughput.
+	 */
+	g_test_add_data_func("/sdp/codec/records", NULL, test_sdp_codec);
+
 	return g_test_run();
 }